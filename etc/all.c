@@ -5,12 +5,15 @@
 #define luaall_c
 
 #include "lapi.c"
+#include "lclone.c"
 #include "lcode.c"
 #include "ldebug.c"
 #include "ldo.c"
 #include "ldump.c"
+#include "lfrozen.c"
 #include "lfunc.c"
 #include "lgc.c"
+#include "ljit.c"
 #include "llex.c"
 #include "lmem.c"
 #include "lobject.c"
@@ -26,12 +29,14 @@
 
 #include "lauxlib.c"
 #include "lbaselib.c"
+#include "lchanlib.c"
 #include "ldblib.c"
 #include "liolib.c"
 #include "linit.c"
 #include "lmathlib.c"
 #include "loadlib.c"
 #include "loslib.c"
+#include "lschedlib.c"
 #include "lstrlib.c"
 #include "ltablib.c"
 
@@ -0,0 +1,124 @@
+/*
+* channel.c -- messages between states in two threads
+* one thread sends numbers, tables or long strings through a channel
+* and another thread receives them, and prints how many go per second.
+* needs a Lua library built with LUA_USE_CHANNEL (see luaconf.h).
+* usage: channel [messages]
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+static const char *sender=
+ "local kind,n=...\n"
+ "local ch=channel.open(kind)\n"
+ "if kind=='number' then\n"
+ " for i=1,n do ch:send(i) end\n"
+ "elseif kind=='table' then\n"
+ " for i=1,n do\n"
+ "  ch:send({id=i,name='item'..i%10,tags={'a','b','c'},ok=true})\n"
+ " end\n"
+ "else\n"
+ " local s=string.rep('x',4096)\n"
+ " for i=1,n do ch:send(s,i) end\n"
+ "end\n"
+ "ch:close()\n";
+
+static const char *receiver=
+ "local kind,n=...\n"
+ "local ch=channel.open(kind)\n"
+ "local sum=0\n"
+ "for i=1,n do\n"
+ " local v,j=ch:receive()\n"
+ " if kind=='number' then sum=sum+v\n"
+ " elseif kind=='table' then\n"
+ "  assert(v.ok and v.name=='item'..i%10)\n"
+ "  sum=sum+v.id+#v.tags\n"
+ " else assert(j==i) sum=sum+#v end\n"
+ "end\n"
+ "ch:close()\n"
+ "return sum\n";
+
+typedef struct Worker
+{
+ pthread_t thread;
+ const char *code,*kind;
+ int n;
+ lua_Number result;
+ const char *error;
+} Worker;
+
+static double now(void)
+{
+ struct timespec t;
+ clock_gettime(CLOCK_MONOTONIC,&t);
+ return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+static void *run(void *arg)
+{
+ Worker *w=arg;
+ lua_State *L=luaL_newstate();
+ luaL_openlibs(L);
+ if (luaL_loadstring(L,w->code)!=0 ||
+     (lua_pushstring(L,w->kind),lua_pushinteger(L,w->n),lua_pcall(L,2,1,0))!=0)
+ {
+  fprintf(stderr,"%s\n",lua_tostring(L,-1));
+  w->error="failed";
+ }
+ else
+  w->result=lua_tonumber(L,-1);
+ lua_close(L);
+ return NULL;
+}
+
+static int bench(const char *kind, int n, lua_Number expected)
+{
+ Worker w[2];
+ double t=now();
+ int i;
+ w[0].code=sender;
+ w[1].code=receiver;
+ for (i=0; i<2; i++)
+ {
+  w[i].kind=kind;
+  w[i].n=n;
+  w[i].error=NULL;
+  if (pthread_create(&w[i].thread,NULL,run,&w[i])!=0)
+  {
+   fprintf(stderr,"cannot create thread\n");
+   return 0;
+  }
+ }
+ for (i=0; i<2; i++) pthread_join(w[i].thread,NULL);
+ t=now()-t;
+ printf("%-8s %8d messages %12.0f messages/s\n",kind,n,n/t);
+ return w[0].error==NULL && w[1].error==NULL && w[1].result==expected;
+}
+
+int main(int argc, char *argv[])
+{
+ int n=(argc>1) ? atoi(argv[1]) : 200000;
+ lua_Number m=n;
+ int ok=1;
+ lua_State *L=luaL_newstate();
+ luaL_openlibs(L);
+ lua_getglobal(L,"channel");
+ if (lua_isnil(L,-1))
+ {
+  fprintf(stderr,"no channels: build Lua with LUA_USE_CHANNEL\n");
+  return EXIT_FAILURE;
+ }
+ lua_close(L);
+ if (!bench("number",n,m*(m+1)/2)) ok=0;
+ if (!bench("table",n,m*(m+1)/2+3*m)) ok=0;
+ if (!bench("string",n/10,4096*(n/10))) ok=0;
+ printf("%s\n",ok ? "OK" : "FAILED");
+ return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,111 @@
+/*
+* clone.c -- copies of a state that took long to load
+* loads many generated modules into one state, then makes copies of it
+* with lua_clonestate and checks that each copy works on its own.
+* the io library is left out: its files are userdata with a metatable,
+* which lua_clonestate refuses to copy.
+* usage: clone [modules [copies]]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+static const char *setup=
+ "local n=...\n"
+ "for m=1,n do\n"
+ " local code={'local M={} local count=0'}\n"
+ " for f=1,50 do\n"
+ "  code[#code+1]=string.format('function M.f%d(x) count=count+1 "
+ "return x*%d+#M.names[%d] end',f,f,f)\n"
+ " end\n"
+ " code[#code+1]='M.names={} for i=1,50 do M.names[i]=\"name\"..i end'\n"
+ " code[#code+1]='function M.count() return count end return M'\n"
+ " local f=assert(loadstring(table.concat(code,'\\n'),'m'..m))\n"
+ " package.loaded['m'..m]=f()\n"
+ "end\n"
+ "function work()\n"
+ " local s=0\n"
+ " for m=1,n do s=s+require('m'..m).f7(m) end\n"
+ " return s,require('m1').count()\n"
+ "end\n";
+
+static const luaL_Reg libs[] = {
+ {"", luaopen_base},
+ {LUA_LOADLIBNAME, luaopen_package},
+ {LUA_TABLIBNAME, luaopen_table},
+ {LUA_OSLIBNAME, luaopen_os},
+ {LUA_STRLIBNAME, luaopen_string},
+ {LUA_MATHLIBNAME, luaopen_math},
+ {LUA_DBLIBNAME, luaopen_debug},
+ {NULL, NULL}
+};
+
+static void openlibs(lua_State *L)
+{
+ const luaL_Reg *lib;
+ for (lib=libs; lib->func; lib++)
+ {
+  lua_pushcfunction(L,lib->func);
+  lua_pushstring(L,lib->name);
+  lua_call(L,1,0);
+ }
+}
+
+static double seconds(void)
+{
+ return (double)clock()/CLOCKS_PER_SEC;
+}
+
+static int check(lua_State *L, int n)
+{
+ lua_getglobal(L,"work");
+ if (lua_pcall(L,0,2,0)!=0)
+ {
+  fprintf(stderr,"%s\n",lua_tostring(L,-1));
+  return 0;
+ }
+ return lua_tointeger(L,-2)==7*n*(n+1)/2+5*n && lua_tointeger(L,-1)==1;
+}
+
+int main(int argc, char *argv[])
+{
+ int n=(argc>1) ? atoi(argv[1]) : 200;
+ int copies=(argc>2) ? atoi(argv[2]) : 10;
+ int i,ok=1;
+ double t=seconds(),total=0;
+ void *ud;
+ lua_State *L=luaL_newstate();
+ openlibs(L);
+ if (luaL_loadstring(L,setup)!=0 ||
+     (lua_pushinteger(L,n),lua_pcall(L,1,0,0))!=0)
+ {
+  fprintf(stderr,"%s\n",lua_tostring(L,-1));
+  return EXIT_FAILURE;
+ }
+ printf("loaded %d modules (%d KB) in %.1f ms\n",
+        n,lua_gc(L,LUA_GCCOUNT,0),1e3*(seconds()-t));
+ for (i=0; i<copies; i++)
+ {
+  lua_State *C;
+  t=seconds();
+  C=lua_clonestate(L,lua_getallocf(L,&ud),ud);
+  total+=seconds()-t;
+  if (C==NULL || !check(C,n)) ok=0;
+  if (C!=NULL) lua_close(C);
+ }
+ printf("made %d copies in %.1f ms each\n",copies,1e3*total/copies);
+ if (!check(L,n)) ok=0;		/* copies did not change it */
+ luaL_openlibs(L);			/* open files cannot be copied */
+ {
+  lua_State *C=lua_clonestate(L,lua_getallocf(L,&ud),ud);
+  if (C!=NULL) { lua_close(C); ok=0; }
+ }
+ lua_close(L);
+ printf("%s\n",ok ? "OK" : "FAILED");
+ return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
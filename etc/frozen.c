@@ -0,0 +1,145 @@
+/*
+* frozen.c -- one table shared by states in several threads
+* freezes a table of routes with lua_freeze and gives it to a new state
+* in each thread, which reads it at will and fails to change it.
+* needs a Lua library built with LUA_USE_FROZEN (see luaconf.h).
+* usage: frozen [threads [rounds]]
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+static const char *setup=
+ "config={name='routes',version=3,hosts={},routes={}}\n"
+ "for i=1,16 do config.hosts[i]='h'..(i-1) end\n"
+ "for i=1,2000 do\n"
+ " config.routes['/api/v1/item'..i]={id=i,host='h'..(i%16),weight=i/2,\n"
+ "  tags={'a','b',i}}\n"
+ "end\n"
+ "setmetatable(config.routes,{__index={default=true}})\n"
+ "config.self=config\n";
+
+static const char *work=
+ "local c,rounds=config,...\n"
+ "local sum=0\n"
+ "for r=1,rounds do\n"
+ " for i=1,2000 do\n"
+ "  local route=c.routes['/api/v1/item'..i]\n"
+ "  sum=sum+route.id+route.weight+#route.tags\n"
+ "  if c.hosts[route.id%16+1]==route.host then sum=sum+1 end\n"
+ " end\n"
+ "end\n"
+ "return sum\n";
+
+static const char *check=
+ "local c=config\n"
+ "assert(c.self==c and c.routes.default==true)\n"
+ "assert(c.name=='routes' and c.name..'!'=='routes!' and #c.hosts==16)\n"
+ "local t={} t[c.name]=1 t[c.hosts[1]]=2\n"
+ "assert(t.routes==1 and t.h0==2)\n"
+ "local n=0 for k,v in pairs(c.routes) do n=n+1 end\n"
+ "assert(n==2000)\n"
+ "local function fill(t) for i=1,#t do t[i]=i end end\n"
+ "local plain={} for i=1,16 do plain[i]=0 end\n"
+ "for i=1,200 do fill(plain) end\n"
+ "for i=1,100 do assert(not pcall(fill,c.hosts)) end\n"
+ "assert(not pcall(function() c.version=4 end))\n"
+ "assert(not pcall(rawset,c,'x',1))\n"
+ "assert(not pcall(table.insert,c.hosts,'x'))\n"
+ "assert(not pcall(setmetatable,c.routes,nil))\n"
+ "collectgarbage()\n"
+ "assert(c.version==3 and c.hosts[1]=='h0' and c.x==nil)\n";
+
+typedef struct Worker
+{
+ pthread_t thread;
+ lua_Frozen *config;
+ int rounds;
+ lua_Number result;
+ const char *error;
+} Worker;
+
+static void *l_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+ (void)ud; (void)osize;
+ if (nsize==0)
+ {
+  free(ptr);
+  return NULL;
+ }
+ return realloc(ptr,nsize);
+}
+
+static void *run(void *arg)
+{
+ Worker *w=arg;
+ lua_State *L=luaL_newstate();
+ luaL_openlibs(L);
+ lua_pushfrozen(L,w->config);
+ lua_setglobal(L,"config");
+ if (luaL_dostring(L,check)!=0 || luaL_loadstring(L,work)!=0 ||
+     (lua_pushinteger(L,w->rounds),lua_pcall(L,1,1,0))!=0)
+ {
+  fprintf(stderr,"%s\n",lua_tostring(L,-1));
+  w->error="failed";
+ }
+ else
+  w->result=lua_tonumber(L,-1);
+ lua_close(L);
+ return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+ int n=(argc>1) ? atoi(argv[1]) : 8;
+ int rounds=(argc>2) ? atoi(argv[2]) : 50;
+ int i,failed=0;
+ lua_Number expected;
+ lua_Frozen *config;
+ Worker *w=malloc(n*sizeof(Worker));
+ lua_State *L=luaL_newstate();
+ luaL_openlibs(L);
+ if (w==NULL || luaL_dostring(L,setup)!=0)
+ {
+  fprintf(stderr,"%s\n",w ? lua_tostring(L,-1) : "not enough memory");
+  return EXIT_FAILURE;
+ }
+ lua_getglobal(L,"config");
+ config=lua_freeze(L,l_alloc,NULL);
+ lua_pop(L,1);
+ if (config==NULL)
+ {
+  fprintf(stderr,"no frozen regions: build Lua with LUA_USE_FROZEN\n");
+  return EXIT_FAILURE;
+ }
+ luaL_loadstring(L,work);		/* expected result, from the original */
+ lua_pushinteger(L,rounds);
+ lua_call(L,1,1);
+ expected=lua_tonumber(L,-1);
+ lua_close(L);				/* the region outlives its maker */
+ for (i=0; i<n; i++)
+ {
+  w[i].config=config;
+  w[i].rounds=rounds;
+  w[i].error=NULL;
+  if (pthread_create(&w[i].thread,NULL,run,&w[i])!=0)
+  {
+   fprintf(stderr,"cannot create thread %d\n",i+1);
+   return EXIT_FAILURE;
+  }
+ }
+ for (i=0; i<n; i++)
+ {
+  pthread_join(w[i].thread,NULL);
+  if (w[i].error!=NULL || w[i].result!=expected) failed=1;
+ }
+ lua_freefrozen(config);
+ free(w);
+ if (!failed) printf("%d threads, %d rounds each: OK\n",n,rounds);
+ return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+/*
+* threads.c -- several threads running coroutines in one Lua state
+* needs a Lua library built with LUA_USE_LOCK (see luaconf.h), or else
+* the threads corrupt the state.
+* usage: threads [threads [rounds]]
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+static const char *code=
+ "shared={}\n"
+ "for i=1,1000 do shared[i]=i; shared['k'..i]=-i end\n"
+ "finalized=0\n"
+ "local proto=newproxy(true)\n"
+ "getmetatable(proto).__gc=function() finalized=finalized+1 end\n"
+ "local function fib(n)\n"
+ " if n<2 then return n else return fib(n-1)+fib(n-2) end\n"
+ "end\n"
+ "function work(id,rounds)\n"
+ " local sum=0\n"
+ " for r=1,rounds do\n"
+ "  local t={}\n"
+ "  for i=1,100 do\n"
+ "   local k=(id*r+i)%1000+1\n"
+ "   t[i]=shared[k]+shared['k'..k]+#tostring(k)\n"
+ "   sum=sum+t[i]\n"
+ "  end\n"
+ "  sum=sum+fib(id%8+8)\n"
+ "  newproxy(proto)\n"
+ "  if coroutine.running() then coroutine.yield(r) end\n"
+ " end\n"
+ " return sum\n"
+ "end\n";
+
+typedef struct Worker
+{
+ pthread_t thread;
+ lua_State *co;
+ int id,rounds;
+ lua_Number result;
+ int yields;
+ const char *error;
+} Worker;
+
+static void *run(void *arg)
+{
+ Worker *w=arg;
+ int status,nargs=2;
+ lua_getglobal(w->co,"work");
+ lua_pushinteger(w->co,w->id);
+ lua_pushinteger(w->co,w->rounds);
+ while ((status=lua_resume(w->co,nargs))==LUA_YIELD)
+ {
+  if (lua_tointeger(w->co,-1)!=w->yields+1) w->error="bad yield";
+  w->yields++;
+  lua_settop(w->co,0);
+  nargs=0;
+ }
+ if (status!=0) w->error=lua_tostring(w->co,-1);
+ else w->result=lua_tonumber(w->co,-1);
+ return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+ int n=(argc>1) ? atoi(argv[1]) : 8;
+ int rounds=(argc>2) ? atoi(argv[2]) : 500;
+ int i,failed=0;
+ Worker *w=malloc(n*sizeof(Worker));
+ lua_State *L=luaL_newstate();
+ luaL_openlibs(L);
+ if (w==NULL || luaL_dostring(L,code)!=0)
+ {
+  fprintf(stderr,"%s\n",w ? lua_tostring(L,-1) : "not enough memory");
+  return EXIT_FAILURE;
+ }
+ for (i=0; i<n; i++)
+ {
+  w[i].co=lua_newthread(L);		/* kept in the stack of L */
+  w[i].id=i+1;
+  w[i].rounds=rounds;
+  w[i].yields=0;
+  w[i].error=NULL;
+ }
+ for (i=0; i<n; i++)
+  if (pthread_create(&w[i].thread,NULL,run,&w[i])!=0)
+  {
+   fprintf(stderr,"cannot create thread %d\n",i+1);
+   return EXIT_FAILURE;
+  }
+ for (i=0; i<n; i++)
+  pthread_join(w[i].thread,NULL);
+ for (i=0; i<n; i++)			/* check against a run with no threads */
+ {
+  lua_getglobal(L,"work");
+  lua_pushinteger(L,w[i].id);
+  lua_pushinteger(L,rounds);
+  lua_call(L,2,1);
+  if (w[i].error==NULL &&
+      (w[i].yields!=rounds || lua_tonumber(L,-1)!=w[i].result))
+   w[i].error="wrong result";
+  if (w[i].error!=NULL)
+  {
+   fprintf(stderr,"thread %d: %s\n",i+1,w[i].error);
+   failed=1;
+  }
+  lua_pop(L,1);
+ }
+ lua_settop(L,0);
+ lua_gc(L,LUA_GCCOLLECT,0);
+ lua_getglobal(L,"finalized");
+ if (lua_tointeger(L,-1)!=2*n*rounds)
+ {
+  fprintf(stderr,"%d proxies finalized, expected %d\n",
+          (int)lua_tointeger(L,-1),2*n*rounds);
+  failed=1;
+ }
+ lua_close(L);
+ free(w);
+ if (!failed) printf("%d threads, %d rounds each: OK\n",n,rounds);
+ return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
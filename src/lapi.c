@@ -259,8 +259,13 @@ LUA_API int lua_iscfunction (lua_State *L, int idx) {
 
 LUA_API int lua_isnumber (lua_State *L, int idx) {
   TValue n;
-  const TValue *o = index2adr(L, idx);
-  return tonumber(o, &n);
+  const TValue *o;
+  int res;
+  lua_lock(L);  /* `luaV_tonumber' may flatten a rope */
+  o = index2adr(L, idx);
+  res = tonumber(L, o, &n);
+  lua_unlock(L);
+  return res;
 }
 
 
@@ -313,24 +318,30 @@ LUA_API int lua_lessthan (lua_State *L, int index1, int index2) {
 LUA_API lua_Number lua_tonumber (lua_State *L, int idx) {
   TValue n;
   const TValue *o = index2adr(L, idx);
-  if (tonumber(o, &n))
+  if (ttisnumber(o))
     return nvalue(o);
-  else
-    return 0;
+  lua_lock(L);  /* `luaV_tonumber' may flatten a rope */
+  o = luaV_tonumber(L, o, &n);
+  lua_unlock(L);
+  return (o != NULL) ? nvalue(o) : 0;
 }
 
 
 LUA_API lua_Integer lua_tointeger (lua_State *L, int idx) {
   TValue n;
   const TValue *o = index2adr(L, idx);
-  if (tonumber(o, &n)) {
-    lua_Integer res;
-    lua_Number num = nvalue(o);
-    lua_number2integer(res, num);
+  if (ttisint(o))
+    return ivalue(o);
+  else {
+    lua_Integer res = 0;
+    lua_lock(L);  /* `luaV_tonumber' may flatten a rope */
+    if (tonumber(L, o, &n)) {
+      lua_Number num = nvalue(o);
+      lua_number2integer(res, num);
+    }
+    lua_unlock(L);
     return res;
   }
-  else
-    return 0;
 }
 
 
@@ -361,7 +372,7 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
 LUA_API size_t lua_objlen (lua_State *L, int idx) {
   StkId o = index2adr(L, idx);
   switch (ttype(o)) {
-    case LUA_TSTRING: return tsvalue(o)->len;
+    case LUA_TSTRING: return luaS_len(o);
     case LUA_TUSERDATA: return uvalue(o)->len;
     case LUA_TTABLE: return luaH_getn(hvalue(o));
     case LUA_TNUMBER: {
@@ -436,7 +447,10 @@ LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
 
 LUA_API void lua_pushinteger (lua_State *L, lua_Integer n) {
   lua_lock(L);
-  setnvalue(L->top, cast_num(n));
+  if (isexactint(n))
+    setivalue(L->top, n)
+  else
+    setnvalue(L->top, cast_num(n));
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -451,6 +465,45 @@ LUA_API void lua_pushlstring (lua_State *L, const char *s, size_t len) {
 }
 
 
+/*
+** a block of `f' with room for a long string of length `len', which
+** belongs to no state; returns where its characters go, or NULL if
+** there is no memory
+*/
+LUA_API char *lua_newstrblock (lua_Alloc f, void *ud, size_t len) {
+  TString *ts;
+  if (len > (MAX_SIZET - sizeof(TString))/sizeof(char) - 1)
+    return NULL;
+  ts = cast(TString *, (*f)(ud, NULL, 0, sizeof(TString) + len + 1));
+  if (ts == NULL)
+    return NULL;
+  ts->tsv.len = len;
+  cast(char *, ts + 1)[len] = '\0';
+  return cast(char *, ts + 1);
+}
+
+
+/*
+** pushes the string of block `s', which must come from the allocator of
+** `L'; the state takes over the block, with no copy
+*/
+LUA_API void lua_pushstrblock (lua_State *L, char *s) {
+  TString *ts = cast(TString *, s) - 1;
+  lua_lock(L);
+  api_check(L, ts->tsv.len > LUAI_MAXSHORTLEN);
+  luaC_checkGC(L);
+  setsvalue2s(L, L->top, luaS_adopt(L, ts));
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_freestrblock (lua_Alloc f, void *ud, char *s) {
+  TString *ts = cast(TString *, s) - 1;
+  (*f)(ud, ts, sizestring(&ts->tsv), 0);
+}
+
+
 LUA_API void lua_pushstring (lua_State *L, const char *s) {
   if (s == NULL)
     lua_pushnil(L);
@@ -559,6 +612,7 @@ LUA_API void lua_rawget (lua_State *L, int idx) {
   lua_lock(L);
   t = index2adr(L, idx);
   api_check(L, ttistable(t));
+  flatkey(L, L->top - 1);
   setobj2s(L, L->top - 1, luaH_get(hvalue(t), L->top - 1));
   lua_unlock(L);
 }
@@ -674,6 +728,7 @@ LUA_API void lua_rawset (lua_State *L, int idx) {
   api_checknelems(L, 2);
   t = index2adr(L, idx);
   api_check(L, ttistable(t));
+  flatkey(L, L->top - 2);
   setobj2t(L, luaH_set(L, hvalue(t), L->top-2), L->top-1);
   luaC_barriert(L, hvalue(t), L->top-1);
   L->top -= 2;
@@ -709,6 +764,7 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   }
   switch (ttype(obj)) {
     case LUA_TTABLE: {
+      luaH_checkfrozen(L, hvalue(obj));
       hvalue(obj)->metatable = mt;
       if (mt)
         luaC_objbarriert(L, hvalue(obj), mt);
@@ -760,6 +816,17 @@ LUA_API int lua_setfenv (lua_State *L, int idx) {
 }
 
 
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId t;
+  lua_lock(L);
+  t = index2adr(L, idx);
+  api_check(L, ttistable(t));
+  luaH_checkfrozen(L, hvalue(t));
+  luaH_clear(hvalue(t));
+  lua_unlock(L);
+}
+
+
 /*
 ** `load' and `call' functions (run Lua code)
 */
@@ -931,7 +998,8 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         g->GCthreshold = 0;
       while (g->GCthreshold <= g->totalbytes) {
         luaC_step(L);
-        if (g->gcstate == GCSpause) {  /* end of cycle? */
+        if (g->gcstate == GCSpause ||  /* end of cycle? */
+            g->gckind == KGC_GEN) {  /* (generational steps are whole cycles) */
           res = 1;  /* signal it */
           break;
         }
@@ -948,6 +1016,44 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCGEN: {
+      if (data != 0) g->gcminor = data;
+      res = (luaC_changemode(L, KGC_GEN) == KGC_GEN) ? LUA_GCGEN : LUA_GCINC;
+      break;
+    }
+    case LUA_GCINC: {
+      res = (luaC_changemode(L, KGC_NORMAL) == KGC_GEN) ? LUA_GCGEN : LUA_GCINC;
+      break;
+    }
+    case LUA_GCSETWORKERS: {
+      res = luaC_setworkers(L, data);
+      break;
+    }
+    case LUA_GCBGSWEEP: {
+      res = luaC_bgsweep(L, data);
+      break;
+    }
+    case LUA_GCPROFILE: {
+#if defined(LUA_USE_MEMSTATS)
+      res = luaM_profile(L, data);
+#else
+      res = -1;
+#endif
+      break;
+    }
+    case LUA_GCSTRINGS: {
+      res = luaS_stats(L, data);
+      break;
+    }
+    case LUA_GCJIT: {  /* set threshold of the JIT compiler */
+#if defined(LUA_USE_JIT)
+      res = g->jithot;
+      if (data >= 0) g->jithot = data;
+#else
+      res = -1;
+#endif
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -955,6 +1061,71 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+/*
+** statistics of worker `n' of the parallel marker during the last
+** full collection
+*/
+LUA_API int lua_gcworker (lua_State *L, int n, size_t *marked,
+                          size_t *bytes, size_t *steals) {
+  int res;
+  lua_lock(L);
+  res = luaC_getworker(L, n, marked, bytes, steals);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** allocation statistics for blocks of kind `kind' (see lmem.h); returns
+** the name of the kind, or NULL if there are no statistics
+*/
+LUA_API const char *lua_memstats (lua_State *L, int kind, size_t *count,
+                                  size_t *bytes, size_t *allocs,
+                                  size_t *total) {
+  const char *name = NULL;
+#if defined(LUA_USE_MEMSTATS)
+  lua_lock(L);
+  name = luaM_kindname(kind);
+  if (name != NULL) {
+    MemStats *s = &G(L)->memstats;
+    luaC_finishsweep(L);  /* count the blocks being freed */
+    *count = cast(size_t, s->count[kind]);
+    *bytes = cast(size_t, s->bytes[kind]);
+    *allocs = cast(size_t, s->allocs[kind]);
+    *total = cast(size_t, s->total[kind]);
+  }
+  lua_unlock(L);
+#else
+  UNUSED(L); UNUSED(kind); UNUSED(count);
+  UNUSED(bytes); UNUSED(allocs); UNUSED(total);
+#endif
+  return name;
+}
+
+
+/*
+** allocation site `n' sampled by the heap profiler; returns its source,
+** or NULL if there is no such site
+*/
+LUA_API const char *lua_memsample (lua_State *L, int n, int *line,
+                                   const char **kind, size_t *count,
+                                   size_t *bytes) {
+  const char *source = NULL;
+#if defined(LUA_USE_MEMSTATS)
+  int k;
+  lua_lock(L);
+  source = luaM_getsample(L, n, line, &k, count, bytes);
+  if (source != NULL)
+    *kind = luaM_kindname(k);
+  lua_unlock(L);
+#else
+  UNUSED(L); UNUSED(n); UNUSED(line);
+  UNUSED(kind); UNUSED(count); UNUSED(bytes);
+#endif
+  return source;
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -976,6 +1147,7 @@ LUA_API int lua_next (lua_State *L, int idx) {
   lua_lock(L);
   t = index2adr(L, idx);
   api_check(L, ttistable(t));
+  flatkey(L, L->top - 1);
   more = luaH_next(L, hvalue(t), L->top - 1);
   if (more) {
     api_incr_top(L);
@@ -992,7 +1164,7 @@ LUA_API void lua_concat (lua_State *L, int n) {
   api_checknelems(L, n);
   if (n >= 2) {
     luaC_checkGC(L);
-    luaV_concat(L, n, cast_int(L->top - L->base) - 1);
+    luaV_concat(L, n, cast_int(L->top - L->base) - 1, 0);
     L->top -= (n-1);
   }
   else if (n == 0) {  /* push empty string */
@@ -1016,12 +1188,24 @@ LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
 
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  luaC_finishsweep(L);  /* sweeper may be using the old allocator */
   G(L)->ud = ud;
   G(L)->frealloc = f;
   lua_unlock(L);
 }
 
 
+LUA_API void lua_setfreebatch (lua_State *L, lua_FreeBatch f) {
+  lua_lock(L);
+  if (f == NULL)
+    luaC_bgsweep(L, 0);  /* cannot sweep in the background without it */
+  else
+    luaC_finishsweep(L);
+  G(L)->freebatch = f;
+  lua_unlock(L);
+}
+
+
 LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
   Udata *u;
   lua_lock(L);
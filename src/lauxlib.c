@@ -624,7 +624,9 @@ LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s) {
 /* }====================================================== */
 
 
-static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+/* allocator of `luaL_newstate': any thread may free its blocks */
+LUALIB_API void *luaL_alloc (void *ud, void *ptr, size_t osize,
+                             size_t nsize) {
   (void)ud;
   (void)osize;
   if (nsize == 0) {
@@ -644,9 +646,291 @@ static int panic (lua_State *L) {
 }
 
 
+/* `free' is thread safe, so the background sweeper may use it */
+static void l_freebatch (void *ud, void **blocks, size_t *sizes, int n) {
+  int i;
+  (void)ud;
+  (void)sizes;
+  for (i = 0; i < n; i++)
+    free(blocks[i]);
+}
+
+
 LUALIB_API lua_State *luaL_newstate (void) {
-  lua_State *L = lua_newstate(l_alloc, NULL);
-  if (L) lua_atpanic(L, &panic);
+  lua_State *L = lua_newstate(luaL_alloc, NULL);
+  if (L) {
+    lua_atpanic(L, &panic);
+    lua_setfreebatch(L, l_freebatch);
+  }
+  return L;
+}
+
+
+
+/*
+** {======================================================
+** Pool allocator
+** =======================================================
+*/
+
+/*
+** Small blocks are grouped in size classes, each one with a free list
+** of blocks carved from page-sized chunks. Lua always tells the size of
+** the block being freed, so blocks need no headers. Larger blocks go
+** straight to `realloc'. All pages are released when the last block of
+** the state (the state itself) is freed.
+*/
+
+#define POOL_PAGESIZE	4096
+#define POOL_GRAIN	8	/* size classes are multiples of this */
+#define POOL_MAXSMALL	256	/* larger blocks are not pooled */
+#define POOL_NCLASSES	(POOL_MAXSMALL/POOL_GRAIN)
+
+#define sizeclass(s)	(((s) + POOL_GRAIN - 1)/POOL_GRAIN - 1)
+#define classsize(c)	(((c) + 1)*POOL_GRAIN)
+
+
+typedef union PoolBlock {
+  union PoolBlock *next;  /* next free block of the same class */
+  LUAI_USER_ALIGNMENT_T dummy;
+} PoolBlock;
+
+
+typedef union PoolPage {
+  union PoolPage *next;  /* list of all pages */
+  LUAI_USER_ALIGNMENT_T dummy;
+} PoolPage;
+
+
+typedef struct Pool {
+  PoolBlock *freelist[POOL_NCLASSES];
+  PoolPage *pages;
+  int ready;  /* may the pool itself be freed with its last block? */
+  size_t nblocks;  /* live blocks, not counting `remote' frees */
+  size_t allocs;
+  size_t frees;
+  size_t reallocs;
+  size_t npages;
+  size_t smallbytes;  /* bytes asked for in live small blocks */
+  size_t classbytes;  /* size of live small blocks */
+  size_t nlarge;  /* live large blocks */
+  size_t largebytes;
+#if defined(LUA_USE_BGSWEEP)
+  /* blocks freed by the background sweeper, and their statistics */
+  PoolBlock *remote[POOL_NCLASSES];
+  size_t rfrees;
+  size_t rsmallbytes;
+  size_t rclassbytes;
+  size_t rnlarge;
+  size_t rlargebytes;
+#endif
+} Pool;
+
+
+#if defined(LUA_USE_BGSWEEP)
+
+#define rstat(p,f)	__atomic_load_n(&(p)->f, __ATOMIC_RELAXED)
+
+/* take the blocks of class `c' freed by other threads, if any */
+static PoolBlock *pool_remote (Pool *p, int c) {
+  if (__atomic_load_n(&p->remote[c], __ATOMIC_RELAXED) == NULL)
+    return NULL;
+  return __atomic_exchange_n(&p->remote[c], NULL, __ATOMIC_ACQUIRE);
+}
+
+
+/* `lua_FreeBatch' for the pool: may run in the sweeper's thread */
+static void pool_freebatch (void *ud, void **blocks, size_t *sizes, int n) {
+  Pool *p = (Pool *)ud;
+  size_t smallbytes = 0, classbytes = 0, nlarge = 0, largebytes = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    if (sizes[i] > POOL_MAXSMALL) {
+      free(blocks[i]);
+      nlarge++;
+      largebytes += sizes[i];
+    }
+    else {
+      int c = sizeclass(sizes[i]);
+      PoolBlock *b = (PoolBlock *)blocks[i];
+      b->next = __atomic_load_n(&p->remote[c], __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n(&p->remote[c], &b->next, b, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+      smallbytes += sizes[i];
+      classbytes += classsize(c);
+    }
+  }
+  __atomic_add_fetch(&p->rsmallbytes, smallbytes, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&p->rclassbytes, classbytes, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&p->rnlarge, nlarge, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&p->rlargebytes, largebytes, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&p->rfrees, (size_t)n, __ATOMIC_RELEASE);
+}
+
+#else
+
+#define rstat(p,f)	0
+#define pool_remote(p,c)	NULL
+
+#endif
+
+
+static void pool_release (Pool *p) {
+  while (p->pages) {
+    PoolPage *pg = p->pages;
+    p->pages = pg->next;
+    free(pg);
+  }
+  if (p->ready) free(p);
+}
+
+
+/* carve a new page into free blocks of class `c' */
+static PoolBlock *pool_newpage (Pool *p, int c) {
+  size_t sz = classsize(c);
+  PoolPage *pg = (PoolPage *)malloc(POOL_PAGESIZE);
+  char *b, *limit;
+  PoolBlock *list = NULL;
+  if (pg == NULL) return NULL;
+  pg->next = p->pages;
+  p->pages = pg;
+  p->npages++;
+  limit = (char *)pg + POOL_PAGESIZE - sz;
+  for (b = (char *)(pg + 1); b <= limit; b += sz) {
+    ((PoolBlock *)b)->next = list;
+    list = (PoolBlock *)b;
+  }
+  return list;
+}
+
+
+static void *pool_malloc (Pool *p, size_t size) {
+  p->allocs++;
+  p->nblocks++;
+  if (size > POOL_MAXSMALL) {
+    void *block = malloc(size);
+    if (block == NULL) { p->allocs--; p->nblocks--; return NULL; }
+    p->nlarge++;
+    p->largebytes += size;
+    return block;
+  }
+  else {
+    int c = sizeclass(size);
+    PoolBlock *b = p->freelist[c];
+    if (b == NULL && (b = pool_remote(p, c)) == NULL &&
+                     (b = pool_newpage(p, c)) == NULL) {
+      p->allocs--; p->nblocks--;
+      return NULL;
+    }
+    p->freelist[c] = b->next;
+    p->smallbytes += size;
+    p->classbytes += classsize(c);
+    return b;
+  }
+}
+
+
+static void pool_free (Pool *p, void *block, size_t size) {
+  p->frees++;
+  if (size > POOL_MAXSMALL) {
+    free(block);
+    p->nlarge--;
+    p->largebytes -= size;
+  }
+  else {
+    int c = sizeclass(size);
+    PoolBlock *b = (PoolBlock *)block;
+    b->next = p->freelist[c];
+    p->freelist[c] = b;
+    p->smallbytes -= size;
+    p->classbytes -= classsize(c);
+  }
+  if (--p->nblocks == rstat(p, rfrees))  /* was it the last block? */
+    pool_release(p);
+}
+
+
+static void *pool_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  void *block;
+  if (ptr == NULL)
+    return (nsize == 0) ? NULL : pool_malloc(p, nsize);
+  if (nsize == 0) {
+    pool_free(p, ptr, osize);
+    return NULL;
+  }
+  p->reallocs++;
+  if (osize > POOL_MAXSMALL && nsize > POOL_MAXSMALL) {  /* both large? */
+    block = realloc(ptr, nsize);
+    if (block != NULL)
+      p->largebytes = p->largebytes - osize + nsize;
+    return block;
+  }
+  if (osize <= POOL_MAXSMALL && nsize <= POOL_MAXSMALL &&
+      sizeclass(osize) == sizeclass(nsize)) {  /* block still fits? */
+    p->smallbytes = p->smallbytes - osize + nsize;
+    return ptr;
+  }
+  block = pool_malloc(p, nsize);
+  if (block != NULL) {
+    memcpy(block, ptr, (osize < nsize) ? osize : nsize);
+    pool_free(p, ptr, osize);
+  }
+  return block;
+}
+
+
+/* a state whose memory comes from a new pool allocator */
+LUALIB_API lua_State *luaL_newpoolstate (void) {
+  Pool *p = (Pool *)malloc(sizeof(Pool));
+  lua_State *L;
+  if (p == NULL) return NULL;
+  memset(p, 0, sizeof(Pool));  /* empty lists and statistics */
+  L = lua_newstate(pool_alloc, p);
+  if (L == NULL) {  /* pages (if any) were already released */
+    free(p);
+    return NULL;
+  }
+  p->ready = 1;
+  lua_atpanic(L, &panic);
+#if defined(LUA_USE_BGSWEEP)
+  lua_setfreebatch(L, pool_freebatch);
+#endif
   return L;
 }
 
+
+static void setstat (lua_State *L, const char *name, size_t n) {
+  lua_pushnumber(L, (lua_Number)n);
+  lua_setfield(L, -2, name);
+}
+
+
+/*
+** push a table with statistics of the pool allocator of `L' and return
+** 1; return 0 (pushing nothing) if `L' does not use it
+*/
+LUALIB_API int luaL_poolstats (lua_State *L) {
+  void *ud;
+  Pool *p;
+  size_t classbytes;
+  if (lua_getallocf(L, &ud) != pool_alloc) return 0;
+  p = (Pool *)ud;
+  classbytes = p->classbytes - rstat(p, rclassbytes);
+  lua_createtable(L, 0, 10);
+  setstat(L, "allocs", p->allocs);
+  setstat(L, "frees", p->frees + rstat(p, rfrees));
+  setstat(L, "reallocs", p->reallocs);
+  setstat(L, "pages", p->npages);
+  setstat(L, "inuse", p->smallbytes - rstat(p, rsmallbytes));
+  /* fragmentation: bytes lost to rounding and bytes in free blocks */
+  setstat(L, "slack", classbytes - (p->smallbytes - rstat(p, rsmallbytes)));
+  setstat(L, "idle", p->npages * (POOL_PAGESIZE - sizeof(PoolPage)) - classbytes);
+  setstat(L, "large", p->nlarge - rstat(p, rnlarge));
+  setstat(L, "largebytes", p->largebytes - rstat(p, rlargebytes));
+  return 1;
+}
+
+/* }====================================================== */
+
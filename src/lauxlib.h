@@ -80,6 +80,10 @@ LUALIB_API int (luaL_loadbuffer) (lua_State *L, const char *buff, size_t sz,
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
+LUALIB_API void *(luaL_alloc) (void *ud, void *ptr, size_t osize,
+                               size_t nsize);
+LUALIB_API lua_State *(luaL_newpoolstate) (void);
+LUALIB_API int (luaL_poolstats) (lua_State *L);
 
 
 LUALIB_API const char *(luaL_gsub) (lua_State *L, const char *s, const char *p,
@@ -190,14 +190,102 @@ static int luaB_gcinfo (lua_State *L) {
 }
 
 
+/* statistics of each worker of the parallel marker */
+static int gcworkers (lua_State *L) {
+  size_t marked, bytes, steals;
+  int i;
+  lua_newtable(L);
+  for (i = 0; lua_gcworker(L, i, &marked, &bytes, &steals); i++) {
+    lua_createtable(L, 0, 3);
+    lua_pushnumber(L, (lua_Number)marked);
+    lua_setfield(L, -2, "marked");
+    lua_pushnumber(L, (lua_Number)bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, (lua_Number)steals);
+    lua_setfield(L, -2, "steals");
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+
+/* allocation statistics per kind of block and heap profiler samples */
+static int gcstats (lua_State *L) {
+  size_t count, bytes, allocs, total;
+  const char *name, *source;
+  int i, line;
+  if (lua_memstats(L, 0, &count, &bytes, &allocs, &total) == NULL) {
+    lua_pushnil(L);  /* no statistics in this build */
+    return 1;
+  }
+  lua_newtable(L);
+  for (i = 0; (name = lua_memstats(L, i, &count, &bytes, &allocs, &total));
+       i++) {
+    lua_createtable(L, 0, 4);
+    lua_pushnumber(L, (lua_Number)count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, (lua_Number)bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, (lua_Number)allocs);
+    lua_setfield(L, -2, "allocs");
+    lua_pushnumber(L, (lua_Number)total);
+    lua_setfield(L, -2, "total");
+    lua_setfield(L, -2, name);
+  }
+  lua_newtable(L);
+  for (i = 0; (source = lua_memsample(L, i, &line, &name, &count, &bytes));
+       i++) {
+    lua_createtable(L, 0, 5);
+    lua_pushstring(L, source);
+    lua_setfield(L, -2, "source");
+    lua_pushinteger(L, line);
+    lua_setfield(L, -2, "line");
+    lua_pushstring(L, name);
+    lua_setfield(L, -2, "kind");
+    lua_pushnumber(L, (lua_Number)count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, (lua_Number)bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "samples");
+  return 1;
+}
+
+
+/* size and load of the string table */
+static int gcstrings (lua_State *L) {
+  static const char *const names[] = {"size", "nuse", "longest", "empty",
+                                      "pending"};
+  int i;
+  lua_createtable(L, 0, 5);
+  for (i = 0; i < 5; i++) {
+    lua_pushinteger(L, lua_gc(L, LUA_GCSTRINGS, LUA_STRSIZE + i));
+    lua_setfield(L, -2, names[i]);
+  }
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
-    "count", "step", "setpause", "setstepmul", NULL};
+    "count", "step", "setpause", "setstepmul", "generational", "incremental",
+    "setworkers", "workers", "bgsweep", "stats", "profile", "strings", "jit",
+    NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
-    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL};
+    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL, LUA_GCGEN,
+    LUA_GCINC, LUA_GCSETWORKERS, -1, LUA_GCBGSWEEP, -2, LUA_GCPROFILE, -3,
+    LUA_GCJIT};
   int o = luaL_checkoption(L, 1, "collect", opts);
-  int ex = luaL_optint(L, 2, 0);
-  int res = lua_gc(L, optsnum[o], ex);
+  int ex = luaL_optint(L, 2, (optsnum[o] == LUA_GCJIT) ? -1 : 0);
+  int res;
+  if (optsnum[o] == -1)  /* "workers" */
+    return gcworkers(L);
+  if (optsnum[o] == -2)  /* "stats" */
+    return gcstats(L);
+  if (optsnum[o] == -3)  /* "strings" */
+    return gcstrings(L);
+  res = lua_gc(L, optsnum[o], ex);
   switch (optsnum[o]) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
@@ -208,6 +296,10 @@ static int luaB_collectgarbage (lua_State *L) {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCGEN: case LUA_GCINC: {  /* return previous mode */
+      lua_pushstring(L, (res == LUA_GCGEN) ? "generational" : "incremental");
+      return 1;
+    }
     default: {
       lua_pushnumber(L, res);
       return 1;
@@ -0,0 +1,661 @@
+/*
+** $Id: lchanlib.c $
+** Channels between states
+** See Copyright Notice in lua.h
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#define lchanlib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+
+#if defined(LUA_USE_CHANNEL)
+
+#if defined(LUA_USE_POSIX)
+#include <sched.h>
+#endif
+
+/*
+** A channel is a ring of bytes outside any state, known by its name,
+** that carries messages from the state that sends to the state that
+** receives, which may run in different threads. Each state opens a
+** handle of its own; one handle may send and one may receive. The
+** sender only moves the `head' of the ring and the receiver only its
+** `tail', so neither ever waits for a lock. A message is an encoding
+** of the values given to `send'. Strings longer than BIGSTRING are not
+** copied into it but into blocks of their own (see `lua_newstrblock').
+** These always come from `luaL_alloc', whatever the allocator of the
+** sender, because the receiver, or whoever closes the channel last,
+** frees them in its own thread. A receiver with that allocator (any
+** state made by `luaL_newstate') takes them over as they are.
+*/
+
+
+#define LUA_CHANHANDLE	"CHANNEL*"
+
+#define DEFAULTSIZE	65536	/* default size of the ring of a channel */
+#define MINSIZE		1024
+#define MAXSIZE		(1 << 30)
+#define BIGSTRING	1024	/* longer strings go in blocks of their own */
+#define MAXDEPTH	200	/* maximum nesting of tables in a message */
+#define SPINS		100	/* tries before a waiting state yields */
+#define INTLIMIT	2147483647.0	/* numbers sent as integers */
+
+
+/* kinds of items in a message */
+#define M_NIL		0
+#define M_FALSE		1
+#define M_TRUE		2
+#define M_INT		3	/* + varint (zigzag) */
+#define M_NUM		4	/* + lua_Number */
+#define M_STR		5	/* + varint length + characters */
+#define M_BIGSTR	6	/* + BigString */
+#define M_TABLE		7	/* + varint size of its array + pairs + M_END */
+#define M_END		8
+
+#define MAXVARINT	(sizeof(size_t)*8/7 + 1)
+
+
+typedef struct BigString {
+  char *s;  /* characters (NULL once the receiver has them) */
+  size_t len;
+} BigString;
+
+
+/* a message in the ring is its length and its bytes, aligned */
+#define HEADER		sizeof(size_t)
+#define msgsize(l)	(HEADER + (((l) + HEADER - 1) & ~(HEADER - 1)))
+
+/* length of the filler at the end of the ring, when a message is after */
+#define WRAP		(~(size_t)0)
+
+#define CACHELINE	64
+
+
+typedef struct Channel {
+  size_t head;  /* bytes ever written (only the sender changes it) */
+  size_t tailseen;  /* `tail' when the sender last looked */
+  char pad1[CACHELINE - 2*sizeof(size_t)];
+  size_t tail;  /* bytes ever read (only the receiver changes it) */
+  size_t headseen;  /* `head' when the receiver last looked */
+  char pad2[CACHELINE - 2*sizeof(size_t)];
+  void *sender;  /* handles that send and receive (NULL if none yet) */
+  void *receiver;
+  struct Channel *next;  /* in list `channels' */
+  int refs;  /* open handles */
+  size_t size;  /* size of `ring' (a power of 2) */
+  char *ring;
+  char name[1];
+} Channel;
+
+
+typedef struct Handle {
+  Channel *ch;  /* NULL when closed */
+  char *buff;  /* where messages are made and taken apart */
+  size_t size;
+  size_t used;  /* bytes of `buff' in use (they may own blocks) */
+} Handle;
+
+
+static Channel *channels = NULL;  /* all open channels */
+static int channelslock = 0;
+
+
+
+static void waitabit (int *spins) {
+  if (++*spins >= SPINS) {
+    *spins = 0;
+#if defined(LUA_USE_POSIX)
+    sched_yield();
+#endif
+  }
+}
+
+
+static void lockchannels (void) {
+  int spins = 0;
+  while (__atomic_exchange_n(&channelslock, 1, __ATOMIC_ACQUIRE))
+    waitabit(&spins);
+}
+
+
+static void unlockchannels (void) {
+  __atomic_store_n(&channelslock, 0, __ATOMIC_RELEASE);
+}
+
+
+
+/*
+** {======================================================
+** Ring of a channel
+** =======================================================
+*/
+
+/* copies a message into the ring; returns 0 if there is no room yet */
+static int put (Channel *ch, const char *msg, size_t len) {
+  size_t head = ch->head;
+  size_t pos = head & (ch->size - 1);
+  size_t need = msgsize(len);
+  size_t skip = (ch->size - pos < need) ? ch->size - pos : 0;
+  if (head + skip + need - ch->tailseen > ch->size) {
+    ch->tailseen = __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE);
+    if (head + skip + need - ch->tailseen > ch->size)
+      return 0;
+  }
+  if (skip > 0) {  /* no room before the end? */
+    size_t wrap = WRAP;
+    memcpy(ch->ring + pos, &wrap, HEADER);
+    head += skip;
+    pos = 0;
+  }
+  memcpy(ch->ring + pos, &len, HEADER);
+  if (len > 0)
+    memcpy(ch->ring + pos + HEADER, msg, len);
+  __atomic_store_n(&ch->head, head + need, __ATOMIC_RELEASE);
+  return 1;
+}
+
+
+/* the next message in the ring and its length, or NULL if none */
+static char *get (Channel *ch, size_t *len) {
+  size_t tail = ch->tail;
+  size_t pos = tail & (ch->size - 1);
+  if (tail == ch->headseen) {
+    ch->headseen = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE);
+    if (tail == ch->headseen)
+      return NULL;
+  }
+  memcpy(len, ch->ring + pos, HEADER);
+  if (*len == WRAP) {  /* message is at the start */
+    __atomic_store_n(&ch->tail, tail + ch->size - pos, __ATOMIC_RELEASE);
+    pos = 0;
+    memcpy(len, ch->ring, HEADER);
+  }
+  return ch->ring + pos + HEADER;
+}
+
+
+/* lets the sender reuse the room of the message just read */
+static void advance (Channel *ch, size_t len) {
+  __atomic_store_n(&ch->tail, ch->tail + msgsize(len), __ATOMIC_RELEASE);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Messages
+** =======================================================
+*/
+
+static char *putvarint (char *p, size_t x) {
+  for (; x >= 0x80; x >>= 7)
+    *p++ = (char)(x | 0x80);
+  *p++ = (char)x;
+  return p;
+}
+
+
+static char *getvarint (char *p, size_t *x) {
+  int shift = 0;
+  *x = 0;
+  for (; *(unsigned char *)p & 0x80; p++, shift += 7)
+    *x |= (size_t)(*(unsigned char *)p & 0x7f) << shift;
+  *x |= (size_t)*(unsigned char *)p << shift;
+  return p + 1;
+}
+
+
+/* frees the blocks of the strings that message [p, end) still owns */
+static void freeblocks (char *p, char *end) {
+  while (p < end) {
+    size_t n;
+    switch (*p++) {
+      case M_INT: case M_TABLE: p = getvarint(p, &n); break;
+      case M_NUM: p += sizeof(lua_Number); break;
+      case M_STR: p = getvarint(p, &n) + n; break;
+      case M_BIGSTR: {
+        BigString b;
+        memcpy(&b, p, sizeof(b));
+        if (b.s != NULL)
+          lua_freestrblock(luaL_alloc, NULL, b.s);
+        p += sizeof(b);
+        break;
+      }
+      default: break;
+    }
+  }
+}
+
+
+/* frees what a message left half made or taken apart still owns */
+static void cleanup (Handle *h) {
+  if (h->used > 0) {
+    freeblocks(h->buff, h->buff + h->used);
+    h->used = 0;
+  }
+}
+
+
+/*
+** room for `n' more bytes in the buffer of `h'; an item is only counted
+** in `used' when it is complete, so that `cleanup' can always walk them
+*/
+static char *reserve (lua_State *L, Handle *h, size_t n) {
+  if (h->size - h->used < n || h->buff == NULL) {
+    size_t size = (h->size > 0) ? h->size : LUAL_BUFFERSIZE;
+    char *b;
+    while (size - h->used < n) {
+      if (size > MAXSIZE)
+        luaL_error(L, "message too big");
+      size *= 2;
+    }
+    b = (char *)realloc(h->buff, size);
+    if (b == NULL)
+      luaL_error(L, "not enough memory");
+    h->buff = b;
+    h->size = size;
+  }
+  return h->buff + h->used;
+}
+
+
+static void putbyte (lua_State *L, Handle *h, int c) {
+  *reserve(L, h, 1) = (char)c;
+  h->used++;
+}
+
+
+static void putnumber (lua_State *L, Handle *h, lua_Number n) {
+  char *p = reserve(L, h, 1 + MAXVARINT + sizeof(lua_Number));
+  lua_Integer i = (n >= -INTLIMIT && n <= INTLIMIT) ? (lua_Integer)n : 0;
+  lua_Number zero = 0;
+  if ((lua_Number)i == n && (i != 0 || memcmp(&n, &zero, sizeof(n)) == 0)) {
+    *p++ = M_INT;  /* zigzag, so that small negatives are short too */
+    p = putvarint(p, (i < 0) ? ((size_t)(-(i + 1)) << 1) | 1 : (size_t)i << 1);
+  }
+  else {
+    *p++ = M_NUM;
+    memcpy(p, &n, sizeof(n));
+    p += sizeof(n);
+  }
+  h->used = p - h->buff;
+}
+
+
+static void putstring (lua_State *L, Handle *h, int idx) {
+  size_t l;
+  const char *s = lua_tolstring(L, idx, &l);
+  char *p;
+  if (l <= BIGSTRING) {
+    p = reserve(L, h, 1 + MAXVARINT + l);
+    *p++ = M_STR;
+    p = putvarint(p, l);
+    memcpy(p, s, l);
+    p += l;
+  }
+  else {
+    BigString b;
+    p = reserve(L, h, 1 + sizeof(b));  /* before the block, not to lose it */
+    b.s = lua_newstrblock(luaL_alloc, NULL, l);
+    if (b.s == NULL)
+      luaL_error(L, "not enough memory");
+    memcpy(b.s, s, l);
+    b.len = l;
+    *p++ = M_BIGSTR;
+    memcpy(p, &b, sizeof(b));
+    p += sizeof(b);
+  }
+  h->used = p - h->buff;
+}
+
+
+static void putvalue (lua_State *L, Handle *h, int idx, int depth);
+
+static void puttable (lua_State *L, Handle *h, int idx, int depth) {
+  char *p;
+  int top;
+  if (depth >= MAXDEPTH)
+    luaL_error(L, "cannot send tables nested more than %d levels "
+                  "(or tables in a cycle)", MAXDEPTH);
+  luaL_checkstack(L, 4, "tables nested too deep");  /* 2 for errors */
+  p = reserve(L, h, 1 + MAXVARINT);
+  *p++ = M_TABLE;
+  h->used = putvarint(p, lua_objlen(L, idx)) - h->buff;
+  lua_pushnil(L);
+  top = lua_gettop(L);
+  while (lua_next(L, idx)) {
+    putvalue(L, h, top, depth + 1);
+    putvalue(L, h, top + 1, depth + 1);
+    lua_pop(L, 1);
+  }
+  putbyte(L, h, M_END);
+}
+
+
+static void putvalue (lua_State *L, Handle *h, int idx, int depth) {
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL: putbyte(L, h, M_NIL); break;
+    case LUA_TBOOLEAN:
+      putbyte(L, h, lua_toboolean(L, idx) ? M_TRUE : M_FALSE);
+      break;
+    case LUA_TNUMBER: putnumber(L, h, lua_tonumber(L, idx)); break;
+    case LUA_TSTRING: putstring(L, h, idx); break;
+    case LUA_TTABLE: puttable(L, h, idx, depth); break;
+    default:
+      luaL_error(L, "cannot send a %s value", luaL_typename(L, idx));
+  }
+}
+
+
+static char *getbigstring (lua_State *L, char *p) {
+  BigString b;
+  memcpy(&b, p, sizeof(b));
+  if (lua_getallocf(L, NULL) == luaL_alloc)
+    lua_pushstrblock(L, b.s);  /* the state takes over the block */
+  else {
+    lua_pushlstring(L, b.s, b.len);
+    lua_freestrblock(luaL_alloc, NULL, b.s);
+  }
+  b.s = NULL;  /* the message does not own it any more */
+  memcpy(p, &b, sizeof(b));
+  return p + sizeof(b);
+}
+
+
+static char *getvalue (lua_State *L, char *p) {
+  size_t n;
+  switch (*p++) {
+    case M_NIL: lua_pushnil(L); break;
+    case M_FALSE: lua_pushboolean(L, 0); break;
+    case M_TRUE: lua_pushboolean(L, 1); break;
+    case M_INT: {
+      p = getvarint(p, &n);
+      lua_pushinteger(L, (n & 1) ? -(lua_Integer)(n >> 1) - 1
+                                 : (lua_Integer)(n >> 1));
+      break;
+    }
+    case M_NUM: {
+      lua_Number x;
+      memcpy(&x, p, sizeof(x));
+      lua_pushnumber(L, x);
+      p += sizeof(x);
+      break;
+    }
+    case M_STR: {
+      p = getvarint(p, &n);
+      lua_pushlstring(L, p, n);
+      p += n;
+      break;
+    }
+    case M_BIGSTR: p = getbigstring(L, p); break;
+    case M_TABLE: {
+      p = getvarint(p, &n);
+      luaL_checkstack(L, 3, "tables nested too deep");
+      lua_createtable(L, (int)n, 0);
+      while (*p != M_END) {
+        p = getvalue(L, p);  /* key */
+        p = getvalue(L, p);  /* value */
+        lua_rawset(L, -3);
+      }
+      p++;  /* skip M_END */
+      break;
+    }
+    default: lua_assert(0);
+  }
+  return p;
+}
+
+/* }====================================================== */
+
+
+
+static Handle *tohandle (lua_State *L) {
+  Handle *h = (Handle *)luaL_checkudata(L, 1, LUA_CHANHANDLE);
+  if (h->ch == NULL)
+    luaL_error(L, "attempt to use a closed channel");
+  return h;
+}
+
+
+/* makes `h' the only handle at end `e' (sender or receiver) */
+static void claim (lua_State *L, Handle *h, void **e, const char *what) {
+  void *none = NULL;
+  if (__atomic_load_n(e, __ATOMIC_RELAXED) != h &&
+      !__atomic_compare_exchange_n(e, &none, h, 0, __ATOMIC_ACQ_REL,
+                                   __ATOMIC_RELAXED))
+    luaL_error(L, "channel " LUA_QS " already has a %s", h->ch->name, what);
+}
+
+
+static void unclaim (Handle *h, void **e) {
+  void *me = h;
+  __atomic_compare_exchange_n(e, &me, NULL, 0, __ATOMIC_ACQ_REL,
+                              __ATOMIC_RELAXED);
+}
+
+
+/* encodes the arguments (after the handle) in the buffer of `h' */
+static void encode (lua_State *L, Handle *h) {
+  int i, n = lua_gettop(L);
+  claim(L, h, &h->ch->sender, "sender");
+  cleanup(h);
+  for (i = 2; i <= n; i++)
+    putvalue(L, h, i, 0);
+  if (msgsize(h->used) > h->ch->size/2) {
+    cleanup(h);
+    luaL_error(L, "message too big for channel " LUA_QS, h->ch->name);
+  }
+}
+
+
+/* pushes the values of the next message; returns -1 if there is none */
+static int decode (lua_State *L, Handle *h, int wait) {
+  char *msg, *p, *end;
+  size_t len;
+  int n = 0, spins = 0;
+  claim(L, h, &h->ch->receiver, "receiver");
+  cleanup(h);
+  while ((msg = get(h->ch, &len)) == NULL) {
+    if (!wait) return -1;
+    waitabit(&spins);
+  }
+  memcpy(reserve(L, h, len), msg, len);
+  h->used = len;  /* the buffer owns its blocks now */
+  advance(h->ch, len);
+  for (p = h->buff, end = h->buff + len; p < end; n++) {
+    luaL_checkstack(L, 1, "too many values in message");
+    p = getvalue(L, p);
+  }
+  h->used = 0;
+  return n;
+}
+
+
+static int chan_send (lua_State *L) {
+  Handle *h = tohandle(L);
+  int spins = 0;
+  encode(L, h);
+  while (!put(h->ch, h->buff, h->used))  /* wait for room */
+    waitabit(&spins);
+  h->used = 0;  /* its blocks belong to the ring now */
+  return 0;
+}
+
+
+static int chan_trysend (lua_State *L) {
+  Handle *h = tohandle(L);
+  encode(L, h);
+  if (put(h->ch, h->buff, h->used)) {
+    h->used = 0;
+    lua_pushboolean(L, 1);
+  }
+  else {
+    cleanup(h);
+    lua_pushboolean(L, 0);
+  }
+  return 1;
+}
+
+
+static int chan_receive (lua_State *L) {
+  Handle *h = tohandle(L);
+  lua_settop(L, 1);
+  return decode(L, h, 1);
+}
+
+
+static int chan_tryreceive (lua_State *L) {
+  Handle *h = tohandle(L);
+  int n;
+  lua_settop(L, 1);
+  lua_pushboolean(L, 1);
+  n = decode(L, h, 0);
+  if (n < 0) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  return n + 1;
+}
+
+
+static Channel *newchannel (const char *name, size_t l, size_t size) {
+  Channel *ch = (Channel *)malloc(sizeof(Channel) + l);
+  if (ch == NULL) return NULL;
+  ch->ring = (char *)malloc(size);
+  if (ch->ring == NULL) {
+    free(ch);
+    return NULL;
+  }
+  ch->head = ch->tailseen = ch->tail = ch->headseen = 0;
+  ch->sender = ch->receiver = NULL;
+  ch->refs = 0;
+  ch->size = size;
+  memcpy(ch->name, name, l + 1);
+  return ch;
+}
+
+
+static int chan_open (lua_State *L) {
+  size_t l;
+  const char *name = luaL_checklstring(L, 1, &l);
+  lua_Integer size = luaL_optinteger(L, 2, DEFAULTSIZE);
+  size_t ringsize = MINSIZE;
+  Handle *h;
+  Channel *ch;
+  luaL_argcheck(L, 0 < size && size <= MAXSIZE, 2, "invalid size");
+  while (ringsize < (size_t)size) ringsize *= 2;
+  h = (Handle *)lua_newuserdata(L, sizeof(Handle));
+  h->ch = NULL;
+  h->buff = NULL;
+  h->size = h->used = 0;
+  luaL_getmetatable(L, LUA_CHANHANDLE);
+  lua_setmetatable(L, -2);
+  lockchannels();
+  for (ch = channels; ch != NULL; ch = ch->next)
+    if (strcmp(ch->name, name) == 0) break;
+  if (ch == NULL) {  /* a new channel? */
+    ch = newchannel(name, l, ringsize);
+    if (ch == NULL) {
+      unlockchannels();
+      return luaL_error(L, "not enough memory");
+    }
+    ch->next = channels;
+    channels = ch;
+  }
+  ch->refs++;
+  unlockchannels();
+  h->ch = ch;
+  return 1;
+}
+
+
+static int chan_close (lua_State *L) {
+  Handle *h = (Handle *)luaL_checkudata(L, 1, LUA_CHANHANDLE);
+  Channel *ch = h->ch;
+  cleanup(h);
+  free(h->buff);
+  h->buff = NULL;
+  h->size = 0;
+  if (ch == NULL) return 0;  /* closed already */
+  h->ch = NULL;
+  unclaim(h, &ch->sender);
+  unclaim(h, &ch->receiver);
+  lockchannels();
+  if (--ch->refs == 0) {  /* last handle? */
+    Channel **p = &channels;
+    while (*p != ch) p = &(*p)->next;
+    *p = ch->next;
+  }
+  else
+    ch = NULL;
+  unlockchannels();
+  if (ch != NULL) {  /* free it, with the messages nobody received */
+    char *msg;
+    size_t len;
+    while ((msg = get(ch, &len)) != NULL) {
+      freeblocks(msg, msg + len);
+      advance(ch, len);
+    }
+    free(ch->ring);
+    free(ch);
+  }
+  return 0;
+}
+
+
+static int chan_tostring (lua_State *L) {
+  Handle *h = (Handle *)luaL_checkudata(L, 1, LUA_CHANHANDLE);
+  if (h->ch == NULL)
+    lua_pushliteral(L, "channel (closed)");
+  else
+    lua_pushfstring(L, "channel (%s)", h->ch->name);
+  return 1;
+}
+
+
+static const luaL_Reg chanlib[] = {
+  {"open", chan_open},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg chanmethods[] = {
+  {"close", chan_close},
+  {"receive", chan_receive},
+  {"send", chan_send},
+  {"tryreceive", chan_tryreceive},
+  {"trysend", chan_trysend},
+  {"__gc", chan_close},
+  {"__tostring", chan_tostring},
+  {NULL, NULL}
+};
+
+
+LUALIB_API int luaopen_channel (lua_State *L) {
+  luaL_newmetatable(L, LUA_CHANHANDLE);  /* metatable for handles */
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  luaL_register(L, NULL, chanmethods);
+  luaL_register(L, LUA_CHANLIBNAME, chanlib);
+  return 1;
+}
+
+#else
+
+LUALIB_API int luaopen_channel (lua_State *L) {
+  return luaL_error(L, "no channels: build Lua with LUA_USE_CHANNEL");
+}
+
+#endif
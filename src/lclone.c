@@ -0,0 +1,479 @@
+/*
+** $Id: lclone.c $
+** Copy of a whole state into a new, independent state
+** See Copyright Notice in lua.h
+*/
+
+
+#include <string.h>
+
+#define lclone_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+
+
+
+/*
+** `lua_clonestate' copies everything reachable from the registry, the
+** table of globals and the metatables of basic types of a state into a
+** new state, so that a state that took long to load its modules can be
+** copied many times. Objects are copied in two steps: `copyobj' makes
+** an object of the right size and records it in `map' (so that shared
+** objects stay shared and cycles end) and in `todo'; `fillobj' then
+** copies its contents, which may make more objects. So deep structures
+** do not take C stack. Nothing is collected while copying, so the new
+** objects need no anchors and no barriers.
+** Open upvalues are copied with the stacks of their coroutines; those
+** of coroutines that are not copied (such as the main thread) become
+** closed upvalues with the values they had. Suspended and dead
+** coroutines are copied, but running ones cannot be (their frames are
+** in the C stack), and then `lua_clonestate' returns NULL. Full userdata
+** are copied only when they have no metatable: one with a metatable (and
+** so maybe a `__gc') may own a resource, such as an open file, that the
+** copy cannot own too, so then `lua_clonestate' returns NULL as well.
+** Copies cannot share pages with the old state, as objects point to
+** each other; processes that fork after loading share them instead.
+*/
+
+
+typedef struct Copy {
+  GCObject *from;  /* object of the old state */
+  GCObject *to;  /* its copy */
+} Copy;
+
+
+typedef struct PendingUpval {
+  Closure *cl;  /* copy of the closure */
+  int n;  /* upvalue of `cl' */
+  UpVal *uv;  /* open upvalue of the old state */
+} PendingUpval;
+
+
+typedef struct CloneState {
+  lua_State *from;  /* state being copied */
+  Copy *map;  /* open-addressing table of copies made */
+  int sizemap;
+  int nmap;
+  Copy *todo;  /* copies still to be filled */
+  int sizetodo;
+  int ntodo;
+  PendingUpval *pending;  /* open upvalues still to be found */
+  int sizepending;
+  int npending;
+} CloneState;
+
+
+
+/*
+** {======================================================
+** Map from objects of the old state to their copies
+** =======================================================
+*/
+
+static unsigned int hashptr (const void *p) {
+  size_t x = cast(size_t, p);
+  unsigned int h = cast(unsigned int, x ^ ((x >> 16) >> 16));
+  h = (h ^ (h >> 16)) * 0x45d9f3bU;
+  return h ^ (h >> 16);
+}
+
+
+static GCObject *lookup (CloneState *cs, const void *o) {
+  int i = cast_int(hashptr(o) & (cs->sizemap - 1));
+  while (cs->map[i].from != NULL) {
+    if (cs->map[i].from == o) return cs->map[i].to;
+    i = (i + 1) & (cs->sizemap - 1);
+  }
+  return NULL;
+}
+
+
+static void insert (CloneState *cs, GCObject *from, GCObject *to) {
+  int i = cast_int(hashptr(from) & (cs->sizemap - 1));
+  while (cs->map[i].from != NULL)
+    i = (i + 1) & (cs->sizemap - 1);
+  cs->map[i].from = from;
+  cs->map[i].to = to;
+}
+
+
+static void record (lua_State *L, CloneState *cs, GCObject *from,
+                    GCObject *to, int fill) {
+  if (2*(cs->nmap + 1) > cs->sizemap) {  /* keep it at most half full */
+    Copy *old = cs->map;
+    int oldsize = cs->sizemap;
+    int i;
+    int size = (oldsize == 0) ? 1024 : 2*oldsize;
+    cs->map = luaM_newvector(L, size, Copy, MEMOTHER);
+    for (i = 0; i < size; i++) cs->map[i].from = NULL;
+    cs->sizemap = size;
+    for (i = 0; i < oldsize; i++)
+      if (old[i].from != NULL) insert(cs, old[i].from, old[i].to);
+    luaM_freearray(L, old, oldsize, Copy, MEMOTHER);
+  }
+  insert(cs, from, to);
+  cs->nmap++;
+  if (fill) {
+    luaM_growvector(L, cs->todo, cs->ntodo, cs->sizetodo, Copy, MAX_INT,
+                    "objects", MEMOTHER);
+    cs->todo[cs->ntodo].from = from;
+    cs->todo[cs->ntodo].to = to;
+    cs->ntodo++;
+  }
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Copies of objects
+** =======================================================
+*/
+
+
+/* size of the hash part for the entries of `h' */
+static int hashsize (Table *h) {
+  int i, n = 0;
+  for (i = 0; i < sizenode(h); i++)
+    if (!ttisnil(gval(gnode(h, i)))) n++;
+  return n;
+}
+
+
+static GCObject *copyobj (lua_State *L, CloneState *cs, GCObject *o) {
+  GCObject *c = lookup(cs, o);
+  int fill = 1;
+  if (c != NULL) return c;
+  switch (o->gch.tt) {
+    case LUA_TLNGSTR: {
+      TString *ts = rawgco2ts(o);
+      c = obj2gco(luaS_newlstr(L, getstr(ts), ts->tsv.len));
+      fill = 0;
+      break;
+    }
+    case LUA_TROPE: {  /* copied as a plain string */
+      Rope *r = gco2rp(o);
+      c = obj2gco(luaS_newlstr(L, luaS_ropedata(r), r->len));
+      fill = 0;
+      break;
+    }
+    case LUA_TTABLE: {
+      Table *h = gco2h(o);
+      c = obj2gco(luaH_new(L, h->sizearray, hashsize(h)));
+      break;
+    }
+    case LUA_TFUNCTION: {
+      Closure *cl = gco2cl(o);
+      c = obj2gco(cl->c.isC ? luaF_newCclosure(L, cl->c.nupvalues, NULL) :
+                              luaF_newLclosure(L, cl->l.nupvalues, NULL));
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Udata *u = rawgco2u(o);
+      Udata *nu;
+      if (u->uv.metatable != NULL)  /* may own something? */
+        luaD_throw(L, LUA_ERRRUN);  /* cannot copy it safely */
+      nu = luaS_newudata(L, u->uv.len, NULL);
+      memcpy(nu + 1, u + 1, u->uv.len);
+      c = obj2gco(nu);
+      break;
+    }
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      if (th->status == 0 && th->ci != th->base_ci)  /* running? */
+        luaD_throw(L, LUA_ERRRUN);  /* cannot copy its C frames */
+      c = obj2gco(luaE_newthread(L));
+      break;
+    }
+    case LUA_TPROTO: {  /* code is copied now, for `savedpc's */
+      Proto *f = gco2p(o);
+      Proto *nf = luaF_newproto(L);
+      nf->code = luaM_newvector(L, f->sizecode, Instruction, MEMPROTO);
+      nf->sizecode = f->sizecode;
+      memcpy(nf->code, f->code, f->sizecode * sizeof(Instruction));
+      c = obj2gco(nf);
+      break;
+    }
+    case LUA_TUPVAL: {  /* closed upvalue */
+      c = obj2gco(luaF_newupval(L));
+      break;
+    }
+    default: lua_assert(0);
+  }
+  record(L, cs, o, c, fill);
+  return c;
+}
+
+
+#define copytable(L,cs,h) \
+	(((h) == NULL || isfrozen(obj2gco(h))) ? (h) : \
+	 gco2h(copyobj(L, cs, obj2gco(h))))
+#define copyproto(L,cs,f)	gco2p(copyobj(L, cs, obj2gco(f)))
+
+
+/* long strings (such as sources of chunks) stay shared */
+static TString *copystr (lua_State *L, CloneState *cs, TString *ts) {
+  if (ts->tsv.tt == LUA_TSTRING)  /* interned anyway? */
+    return luaS_newlstr(L, getstr(ts), ts->tsv.len);
+  else
+    return rawgco2ts(copyobj(L, cs, obj2gco(ts)));
+}
+
+
+static void copyvalue (lua_State *L, CloneState *cs, TValue *to,
+                       const TValue *from) {
+  if (!iscollectable(from) || isfrozen(gcvalue(from))) {
+    setobj(L, to, from);  /* (frozen regions are shared by all states) */
+  }
+  else if (ttisshrstring(from)) {
+    setsvalue(L, to, copystr(L, cs, rawtsvalue(from)));
+  }
+  else {
+    GCObject *c = copyobj(L, cs, gcvalue(from));
+    to->value.gc = c;
+    to->tt = c->gch.tt;  /* (ropes become strings) */
+  }
+}
+
+
+static void filltable (lua_State *L, CloneState *cs, Table *h, Table *nh) {
+  int i;
+  nh->metatable = copytable(L, cs, h->metatable);
+  for (i = 0; i < h->sizearray; i++)
+    copyvalue(L, cs, &nh->array[i], &h->array[i]);
+  for (i = 0; i < sizenode(h); i++) {
+    Node *n = gnode(h, i);
+    if (!ttisnil(gval(n))) {
+      TValue k;
+      copyvalue(L, cs, &k, key2tval(n));
+      copyvalue(L, cs, luaH_set(L, nh, &k), gval(n));
+    }
+  }
+  nh->flags = h->flags;
+}
+
+
+static void fillclosure (lua_State *L, CloneState *cs, Closure *cl,
+                         Closure *ncl) {
+  int i;
+  ncl->c.env = copytable(L, cs, cl->c.env);
+  if (cl->c.isC) {
+    ncl->c.f = cl->c.f;
+    for (i = 0; i < cl->c.nupvalues; i++)
+      copyvalue(L, cs, &ncl->c.upvalue[i], &cl->c.upvalue[i]);
+  }
+  else {
+    ncl->l.p = copyproto(L, cs, cl->l.p);
+    for (i = 0; i < cl->l.nupvalues; i++) {
+      UpVal *uv = cl->l.upvals[i];
+      if (uv == NULL) continue;
+      else if (uv->v == &uv->u.value)  /* closed? */
+        ncl->l.upvals[i] = gco2uv(copyobj(L, cs, obj2gco(uv)));
+      else {  /* open: wait until its coroutine is copied */
+        luaM_growvector(L, cs->pending, cs->npending, cs->sizepending,
+                        PendingUpval, MAX_INT, "upvalues", MEMOTHER);
+        cs->pending[cs->npending].cl = ncl;
+        cs->pending[cs->npending].n = i;
+        cs->pending[cs->npending].uv = uv;
+        cs->npending++;
+      }
+    }
+  }
+}
+
+
+static void fillproto (lua_State *L, CloneState *cs, Proto *f, Proto *nf) {
+  int i;
+  nf->source = (f->source) ? copystr(L, cs, f->source) : NULL;
+  nf->linedefined = f->linedefined;
+  nf->lastlinedefined = f->lastlinedefined;
+  nf->nups = f->nups;
+  nf->numparams = f->numparams;
+  nf->is_vararg = f->is_vararg;
+  nf->maxstacksize = f->maxstacksize;
+  if (f->icache) luaF_initcache(L, nf);
+  nf->k = luaM_newvector(L, f->sizek, TValue, MEMPROTO);
+  nf->sizek = f->sizek;
+  for (i = 0; i < f->sizek; i++) setnilvalue(&nf->k[i]);
+  for (i = 0; i < f->sizek; i++) copyvalue(L, cs, &nf->k[i], &f->k[i]);
+  nf->p = luaM_newvector(L, f->sizep, Proto *, MEMPROTO);
+  nf->sizep = f->sizep;
+  for (i = 0; i < f->sizep; i++) nf->p[i] = NULL;
+  for (i = 0; i < f->sizep; i++) nf->p[i] = copyproto(L, cs, f->p[i]);
+  nf->lineinfo = luaM_newvector(L, f->sizelineinfo, int, MEMPROTO);
+  nf->sizelineinfo = f->sizelineinfo;
+  memcpy(nf->lineinfo, f->lineinfo, f->sizelineinfo * sizeof(int));
+  nf->locvars = luaM_newvector(L, f->sizelocvars, LocVar, MEMPROTO);
+  nf->sizelocvars = f->sizelocvars;
+  for (i = 0; i < f->sizelocvars; i++) nf->locvars[i].varname = NULL;
+  for (i = 0; i < f->sizelocvars; i++) {
+    nf->locvars[i].varname = copystr(L, cs, f->locvars[i].varname);
+    nf->locvars[i].startpc = f->locvars[i].startpc;
+    nf->locvars[i].endpc = f->locvars[i].endpc;
+  }
+  nf->upvalues = luaM_newvector(L, f->sizeupvalues, TString *, MEMPROTO);
+  nf->sizeupvalues = f->sizeupvalues;
+  for (i = 0; i < f->sizeupvalues; i++) nf->upvalues[i] = NULL;
+  for (i = 0; i < f->sizeupvalues; i++)
+    nf->upvalues[i] = copystr(L, cs, f->upvalues[i]);
+  nf->inlines = luaM_newvector(L, f->sizeinlines, InlineCall, MEMPROTO);
+  nf->sizeinlines = f->sizeinlines;
+  for (i = 0; i < f->sizeinlines; i++) nf->inlines[i].f = NULL;
+  for (i = 0; i < f->sizeinlines; i++) {
+    nf->inlines[i] = f->inlines[i];
+    nf->inlines[i].f = copyproto(L, cs, f->inlines[i].f);
+  }
+}
+
+
+/* `savedpc' of a Lua frame: the same instruction in the copy of its code */
+static const Instruction *copypc (lua_State *L, CloneState *cs, StkId func,
+                                  const Instruction *pc) {
+  Proto *f = clvalue(func)->l.p;
+  return copyproto(L, cs, f)->code + (pc - f->code);
+}
+
+
+static void fillthread (lua_State *L, CloneState *cs, lua_State *th,
+                        lua_State *L1) {
+  CallInfo *ci;
+  StkId o;
+  GCObject *up;
+  luaD_reallocstack(L1, th->stacksize - EXTRA_STACK - 1);
+  luaD_reallocCI(L1, th->size_ci);
+  for (o = L1->stack; o < L1->stack + L1->stacksize; o++)
+    setnilvalue(o);
+  for (o = th->stack; o < th->top; o++)
+    copyvalue(L, cs, L1->stack + (o - th->stack), o);
+  for (ci = th->base_ci; ci <= th->ci; ci++) {
+    CallInfo *nci = L1->base_ci + (ci - th->base_ci);
+    nci->base = L1->stack + (ci->base - th->stack);
+    nci->func = L1->stack + (ci->func - th->stack);
+    nci->top = L1->stack + (ci->top - th->stack);
+    nci->savedpc = (ci != th->base_ci && isLua(ci)) ?
+                   copypc(L, cs, ci->func, ci->savedpc) : NULL;
+    nci->nresults = ci->nresults;
+    nci->tailcalls = ci->tailcalls;
+  }
+  L1->ci = L1->base_ci + (th->ci - th->base_ci);
+  L1->base = L1->stack + (th->base - th->stack);
+  L1->top = L1->stack + (th->top - th->stack);
+  L1->savedpc = (th->ci != th->base_ci && isLua(th->ci)) ?
+                copypc(L, cs, th->ci->func, th->savedpc) : NULL;
+  L1->status = th->status;
+  L1->nCcalls = th->nCcalls;
+  L1->baseCcalls = th->baseCcalls;
+  L1->hookmask = th->hookmask;
+  L1->allowhook = th->allowhook;
+  L1->basehookcount = th->basehookcount;
+  L1->hookcount = th->hookcount;
+  L1->hook = th->hook;
+  L1->errfunc = th->errfunc;
+  copyvalue(L, cs, gt(L1), gt(th));
+  for (up = th->openupval; up != NULL; up = up->gch.next) {
+    UpVal *uv = ngcotouv(up);
+    if (lookup(cs, uv) == NULL) {  /* not made closed already? */
+      UpVal *nuv = luaF_findupval(L1, L1->stack + (uv->v - th->stack));
+      record(L, cs, obj2gco(uv), obj2gco(nuv), 0);
+    }
+  }
+  luai_userstatethread(L, L1);
+}
+
+
+static void fillobj (lua_State *L, CloneState *cs, GCObject *o,
+                     GCObject *c) {
+  switch (o->gch.tt) {
+    case LUA_TTABLE: filltable(L, cs, gco2h(o), gco2h(c)); break;
+    case LUA_TFUNCTION: fillclosure(L, cs, gco2cl(o), gco2cl(c)); break;
+    case LUA_TUSERDATA:
+      rawgco2u(c)->uv.env = copytable(L, cs, gco2u(o)->env);
+      break;
+    case LUA_TTHREAD: fillthread(L, cs, gco2th(o), gco2th(c)); break;
+    case LUA_TPROTO: fillproto(L, cs, gco2p(o), gco2p(c)); break;
+    case LUA_TUPVAL:
+      copyvalue(L, cs, gco2uv(c)->v, gco2uv(o)->v);
+      break;
+    default: lua_assert(0);
+  }
+}
+
+/* }====================================================== */
+
+
+
+static void f_clone (lua_State *L, void *ud) {
+  CloneState *cs = cast(CloneState *, ud);
+  global_State *g = G(L);
+  global_State *og = G(cs->from);
+  lua_State *om = og->mainthread;
+  int i;
+  record(L, cs, obj2gco(om), obj2gco(L), 0);  /* main threads match */
+  copyvalue(L, cs, registry(L), registry(om));
+  copyvalue(L, cs, gt(L), gt(om));
+  for (i = 0; i < NUM_TAGS; i++)
+    g->mt[i] = copytable(L, cs, og->mt[i]);
+  while (cs->ntodo > 0) {
+    while (cs->ntodo > 0) {
+      Copy c = cs->todo[--cs->ntodo];
+      fillobj(L, cs, c.from, c.to);
+    }
+    /* all coroutines copied: other open upvalues become closed ones */
+    while (cs->npending > 0) {
+      PendingUpval *p = &cs->pending[--cs->npending];
+      UpVal *nuv = ngcotouv(lookup(cs, p->uv));
+      if (nuv == NULL) {
+        nuv = luaF_newupval(L);
+        record(L, cs, obj2gco(p->uv), obj2gco(nuv), 1);
+      }
+      p->cl->l.upvals[p->n] = nuv;
+    }
+  }
+  g->panic = og->panic;
+  g->gcpause = og->gcpause;
+  g->gcstepmul = og->gcstepmul;
+  g->gcminor = og->gcminor;
+#if defined(LUA_USE_JIT)
+  g->jithot = og->jithot;
+#endif
+  g->estimate = g->totalbytes;  /* as if just collected */
+  g->GCthreshold = (g->estimate/100) * g->gcpause;
+  if (og->gckind == KGC_GEN)
+    luaC_changemode(L, KGC_GEN);
+}
+
+
+LUA_API lua_State *lua_clonestate (lua_State *L, lua_Alloc f, void *ud) {
+  CloneState cs;
+  int status;
+  lua_State *L1 = lua_newstate(f, ud);
+  if (L1 == NULL) return NULL;
+  cs.from = L;
+  cs.map = NULL; cs.sizemap = cs.nmap = 0;
+  cs.todo = NULL; cs.sizetodo = cs.ntodo = 0;
+  cs.pending = NULL; cs.sizepending = cs.npending = 0;
+  lua_lock(L);
+  status = luaD_rawrunprotected(L1, f_clone, &cs);
+  lua_unlock(L);
+  luaM_freearray(L1, cs.map, cs.sizemap, Copy, MEMOTHER);
+  luaM_freearray(L1, cs.todo, cs.sizetodo, Copy, MEMOTHER);
+  luaM_freearray(L1, cs.pending, cs.sizepending, PendingUpval, MEMOTHER);
+  if (status != 0) {  /* not enough memory, or something not copyable? */
+    lua_close(L1);
+    L1 = NULL;
+  }
+  return L1;
+}
+
@@ -15,6 +15,7 @@
 #include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
+#include "lfunc.h"
 #include "lgc.h"
 #include "llex.h"
 #include "lmem.h"
@@ -238,7 +239,7 @@ static int addk (FuncState *fs, TValue *k, TValue *v) {
   else {  /* constant not found; create a new entry */
     setnvalue(idx, cast_num(fs->nk));
     luaM_growvector(L, f->k, fs->nk, f->sizek, TValue,
-                    MAXARG_Bx, "constant table overflow");
+                    MAXARG_Bx, "constant table overflow", MEMPROTO);
     while (oldsize < f->sizek) setnilvalue(&f->k[oldsize++]);
     setobj(L, &f->k[fs->nk], v);
     luaC_barrier(L, f, v);
@@ -256,7 +257,7 @@ int luaK_stringK (FuncState *fs, TString *s) {
 
 int luaK_numberK (FuncState *fs, lua_Number r) {
   TValue o;
-  setnvalue(&o, r);
+  luaO_setnum(&o, r);
   return addk(fs, &o, &o);
 }
 
@@ -791,11 +792,11 @@ static int luaK_code (FuncState *fs, Instruction i, int line) {
   dischargejpc(fs);  /* `pc' will change */
   /* put new instruction in code array */
   luaM_growvector(fs->L, f->code, fs->pc, f->sizecode, Instruction,
-                  MAX_INT, "code size overflow");
+                  MAX_INT, "code size overflow", MEMPROTO);
   f->code[fs->pc] = i;
   /* save corresponding line information */
   luaM_growvector(fs->L, f->lineinfo, fs->pc, f->sizelineinfo, int,
-                  MAX_INT, "code size overflow");
+                  MAX_INT, "code size overflow", MEMPROTO);
   f->lineinfo[fs->pc] = line;
   return fs->pc++;
 }
@@ -829,3 +830,1130 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+
+/*
+** {======================================================
+** Constant propagation and dead code elimination
+** =======================================================
+*/
+
+
+/* flags for each word of code */
+#define TARGET		1	/* a jump or a skip may land here */
+#define DATA		2	/* not an instruction (see `codeflags') */
+#define LIVE		4	/* may run */
+
+#define jumpby(n)	CREATE_ABx(OP_JMP, 0, (n)+MAXARG_sBx)
+
+#define setunknown(o)	((o)->tt = LUA_TNONE)
+#define isknown(o)	(rttype(o) != LUA_TNONE)
+
+/* integers below this size are exact as lua_Numbers, and so are their
+   sums, differences and products below it */
+#define EXACTINT	cast_num(4503599627370496.0)  /* 2^52 */
+#define isexact(x)	(luai_numlt(-EXACTINT, x) && luai_numlt(x, EXACTINT))
+
+
+#if defined(LUA_USE_PROPAGATE) || defined(LUA_USE_INLINE)
+
+/*
+** destination of the instruction `i' at `pc' if it is a jump (even one
+** made by `fusepairs'), -1 if not
+*/
+static int jumpto (Instruction i, int pc) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: case OP_FORLOOP: case OP_FORPREP:
+    case OP_JMPIF: case OP_JMPNOT:
+      return pc+1+GETARG_sBx(i);
+    case OP_JMPEQ: case OP_JMPNE:
+      return pc+1+GETARG_sC(i);
+    default: return -1;
+  }
+}
+
+
+/*
+** marks the words of the first `n' of the code of `f' where a jump may
+** land and those that are not instructions: the upvalue operands that
+** follow an OP_CLOSURE and the real C operand that follows an OP_SETLIST
+*/
+static lu_byte *codeflags (lua_State *L, const Proto *f, int n) {
+  lu_byte *fl = luaM_newvector(L, n+1, lu_byte, MEMPROTO);
+  int pc;
+  for (pc = 0; pc <= n; pc++) fl[pc] = 0;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    int to = jumpto(i, pc);
+    if (fl[pc] & DATA) continue;
+    if (to >= 0) {
+      fl[to] |= TARGET;
+      continue;
+    }
+    switch (op) {
+      case OP_LOADBOOL: {
+        if (GETARG_C(i)) fl[pc+2] |= TARGET;
+        break;
+      }
+      case OP_SETLIST: {
+        if (GETARG_C(i) == 0) fl[pc+1] |= DATA;
+        break;
+      }
+      case OP_CLOSURE: {
+        int j;
+        for (j = f->p[GETARG_Bx(i)]->nups; j > 0; j--)
+          fl[pc+j] |= DATA;
+        break;
+      }
+      default: {
+        if (testTMode(op)) fl[pc+2] |= TARGET;  /* where a skip lands */
+        break;
+      }
+    }
+  }
+  return fl;
+}
+
+
+/*
+** returns the first register that `i' may change (-1 if none) and puts
+** the last one in `*last'
+*/
+static int changes (Instruction i, int *last) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  *last = a;
+  switch (op) {
+    case OP_LOADNIL: *last = GETARG_B(i); break;
+    case OP_SELF: *last = a+1; break;
+    case OP_FORLOOP: case OP_FORPREP: *last = a+3; break;
+    case OP_TFORLOOP: a += 2;  /* control variable and results */
+      /* go through */
+    case OP_CALL: case OP_TAILCALL: case OP_VARARG: *last = MAXSTACK; break;
+    case OP_TEST: case OP_JMPIF: case OP_JMPNOT:
+      return -1;  /* (marked as changing `a' only for `symbexec') */
+    default: if (!testAMode(op)) return -1; break;
+  }
+  return a;
+}
+
+
+/*
+** can upvalue `u' of `p' change? (either in `p' or in a closure that it
+** passes `u' to)
+*/
+static int upvalchanged (const Proto *p, int u) {
+  int pc;
+  for (pc = 0; pc < p->sizecode; pc++) {
+    Instruction i = p->code[pc];
+    switch (GET_OPCODE(i)) {
+      case OP_SETUPVAL: {
+        if (GETARG_B(i) == u) return 1;
+        break;
+      }
+      case OP_CLOSURE: {
+        const Proto *q = p->p[GETARG_Bx(i)];
+        int j;
+        for (j = 0; j < q->nups; j++) {
+          Instruction c = p->code[++pc];
+          if (GET_OPCODE(c) == OP_GETUPVAL && GETARG_B(c) == u &&
+              upvalchanged(q, j))
+            return 1;
+        }
+        break;
+      }
+      case OP_SETLIST: {
+        if (GETARG_C(i) == 0) pc++;
+        break;
+      }
+      default: break;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** marks in `shared' the registers captured by closures that may change
+** them: a call (or a metamethod) may do so at any time
+*/
+static void sharedregs (const Proto *f, int n, const lu_byte *fl,
+                        lu_byte *shared) {
+  int pc, j;
+  for (pc = 0; pc < f->maxstacksize; pc++) shared[pc] = 0;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    if ((fl[pc] & DATA) || GET_OPCODE(i) != OP_CLOSURE) continue;
+    for (j = 0; j < f->p[GETARG_Bx(i)]->nups; j++) {
+      Instruction c = f->code[pc+1+j];
+      if (GET_OPCODE(c) == OP_MOVE &&
+          upvalchanged(f->p[GETARG_Bx(i)], j))
+        shared[GETARG_B(c)] = 1;
+    }
+  }
+}
+
+
+/* is register `r' left alone from `from' up to (not including) `to'? */
+static int unchanged (const Proto *f, const lu_byte *fl, int r,
+                      int from, int to) {
+  int pc, last;
+  for (pc = from; pc < to; pc++) {
+    int first;
+    if (fl[pc] & DATA) continue;
+    first = changes(f->code[pc], &last);
+    if (first >= 0 && first <= r && r <= last) return 0;
+  }
+  return 1;
+}
+
+
+#if defined(LUA_USE_PROPAGATE)
+
+/*
+** RK operand `x' as a constant, if it is a register that is known to
+** hold one (only a number if `numeric')
+*/
+static int rkconst (FuncState *fs, TValue *kv, int x, int numeric) {
+  TValue *o;
+  int k;
+  if (ISK(x)) return x;
+  o = &kv[x];
+  if (!isknown(o) || (numeric && !ttisnumber(o))) return x;
+  if (ttisnumber(o) && nvalue(o) == 0) return x;  /* see `foldk' */
+  k = ttisnil(o) ? nilK(fs) : addk(fs, o, o);
+  return (k <= MAXINDEXRK) ? RKASK(k) : x;
+}
+
+
+/*
+** puts in `res' the result of arithmetic `op' on numbers `o1' and `o2',
+** as the VM would compute it; returns 0 if it should not be folded
+*/
+static int foldk (OpCode op, const TValue *o1, const TValue *o2,
+                  TValue *res) {
+  lua_Number v1 = nvalue(o1), v2 = nvalue(o2), r;
+  switch (op) {
+    case OP_ADD: r = luai_numadd(v1, v2); break;
+    case OP_SUB: r = luai_numsub(v1, v2); break;
+    case OP_MUL: r = luai_nummul(v1, v2); break;
+    case OP_DIV:
+      if (v2 == 0) return 0;  /* do not attempt to divide by 0 */
+      r = luai_numdiv(v1, v2); break;
+    case OP_MOD:
+      if (v2 == 0) return 0;  /* do not attempt to divide by 0 */
+      r = luai_nummod(v1, v2); break;
+    case OP_POW: r = luai_numpow(v1, v2); break;
+    default: lua_assert(0); return 0;
+  }
+  if (luai_numisnan(r)) return 0;  /* do not attempt to produce NaN */
+  if (r == 0) return 0;  /* 0 and -0 are the same key in `fs->h' */
+  /* the VM does exact integer arithmetic on two integers */
+  if (ttisint(o1) && ttisint(o2) && op != OP_DIV && op != OP_POW &&
+      !(isexact(v1) && isexact(v2) && isexact(r)))
+    return 0;
+  luaO_setnum(res, r);
+  return 1;
+}
+
+
+/* result of comparison `op' on constants `o1' and `o2' (-1 if unknown) */
+static int comparek (OpCode op, const TValue *o1, const TValue *o2) {
+  if (op == OP_EQ)
+    return luaO_rawequalObj(o1, o2);
+  else if (!ttisnumber(o1) || !ttisnumber(o2))
+    return -1;
+  else if (ttisint(o1) && ttisint(o2))
+    return (op == OP_LT) ? ivalue(o1) < ivalue(o2) : ivalue(o1) <= ivalue(o2);
+  else
+    return (op == OP_LT) ? luai_numlt(nvalue(o1), nvalue(o2))
+                         : luai_numle(nvalue(o1), nvalue(o2));
+}
+
+
+/*
+** propagates constants through the code of `fs'. Within a basic block,
+** every register is followed from the instructions that load constants
+** into it; across blocks, only local variables that get a constant and
+** are not changed afterwards in their scope (nor by a closure) are known.
+** Known operands become constants, arithmetic on constants is folded and
+** tests with known results become jumps (see `prune'). Instructions that
+** set registers are not removed, so the debug information stays right.
+*/
+static void propagate (FuncState *fs) {
+  Proto *f = fs->f;
+  int n = fs->pc;
+  int nreg = f->maxstacksize;
+  lu_byte *fl = codeflags(fs->L, f, n);
+  TValue *kv = luaM_newvector(fs->L, 2*nreg, TValue, MEMPROTO);
+  TValue *kl = kv + nreg;  /* values of the active constant locals */
+  int *act = luaM_newvector(fs->L, fs->nlocvars+1, int, MEMPROTO);
+  int nact = 0;  /* number of active locals (the register of the next one) */
+  int v = 0;  /* next local variable to start */
+  lu_byte shared[MAXSTACK];
+  int pc, r, last;
+  sharedregs(f, n, fl, shared);
+  for (r = 0; r < 2*nreg; r++) setunknown(&kv[r]);
+  for (pc = 0; pc < n; pc++) {
+    Instruction *ip = &f->code[pc];
+    OpCode op = GET_OPCODE(*ip);
+    int a = GETARG_A(*ip);
+    int b = GETARG_B(*ip);
+    int c = GETARG_C(*ip);
+    if (fl[pc] & DATA) continue;
+    while (nact > 0 && f->locvars[act[nact-1]].endpc <= pc)
+      setunknown(&kl[--nact]);
+    if (fl[pc] & TARGET) {  /* paths join: keep only constant locals */
+      for (r = 0; r < nreg; r++) kv[r] = kl[r];
+    }
+    for (; v < fs->nlocvars && f->locvars[v].startpc <= pc; v++) {
+      r = nact;
+      act[nact++] = v;
+      if (r < nreg && isknown(&kv[r]) && !shared[r] &&
+          f->locvars[v].startpc == pc &&
+          unchanged(f, fl, r, pc, f->locvars[v].endpc))
+        kl[r] = kv[r];
+    }
+    switch (op) {
+      case OP_MOVE: {
+        kv[a] = kv[b];
+        break;
+      }
+      case OP_LOADK: {
+        kv[a] = f->k[GETARG_Bx(*ip)];
+        break;
+      }
+      case OP_LOADBOOL: {
+        if (c) setunknown(&kv[a]);
+        else setbvalue(&kv[a], b);
+        break;
+      }
+      case OP_LOADNIL: {
+        for (r = a; r <= b; r++) {
+          if (shared[r]) setunknown(&kv[r]);
+          else setnilvalue(&kv[r]);
+        }
+        break;
+      }
+      case OP_ADD: case OP_SUB: case OP_MUL:
+      case OP_DIV: case OP_MOD: case OP_POW: {
+        b = rkconst(fs, kv, b, 1);
+        c = rkconst(fs, kv, c, 1);
+        SETARG_B(*ip, b);
+        SETARG_C(*ip, c);
+        setunknown(&kv[a]);
+        if (ISK(b) && ISK(c) && fs->nk < MAXARG_Bx &&
+            ttisnumber(&f->k[INDEXK(b)]) && ttisnumber(&f->k[INDEXK(c)]) &&
+            foldk(op, &f->k[INDEXK(b)], &f->k[INDEXK(c)], &kv[a]))
+          *ip = CREATE_ABx(OP_LOADK, a, addk(fs, &kv[a], &kv[a]));
+        break;
+      }
+      case OP_UNM: {
+        if (ttisnumber(&kv[b]) && nvalue(&kv[b]) != 0 && fs->nk < MAXARG_Bx) {
+          luaO_setnum(&kv[a], luai_numunm(nvalue(&kv[b])));
+          *ip = CREATE_ABx(OP_LOADK, a, addk(fs, &kv[a], &kv[a]));
+        }
+        else setunknown(&kv[a]);
+        break;
+      }
+      case OP_NOT: {
+        if (isknown(&kv[b])) {
+          int res = l_isfalse(&kv[b]);
+          *ip = CREATE_ABC(OP_LOADBOOL, a, res, 0);
+          setbvalue(&kv[a], res);
+        }
+        else setunknown(&kv[a]);
+        break;
+      }
+      case OP_SETTABLE: {
+        SETARG_B(*ip, rkconst(fs, kv, b, 0));
+        SETARG_C(*ip, rkconst(fs, kv, c, 0));
+        break;
+      }
+      case OP_EQ: case OP_LT: case OP_LE: {
+        int res;
+        b = rkconst(fs, kv, b, op != OP_EQ);
+        c = rkconst(fs, kv, c, op != OP_EQ);
+        SETARG_B(*ip, b);
+        SETARG_C(*ip, c);
+        /* with a known result, go on to the jump that follows or skip it */
+        if (ISK(b) && ISK(c) &&
+            (res = comparek(op, &f->k[INDEXK(b)], &f->k[INDEXK(c)])) >= 0)
+          *ip = jumpby((res == a) ? 0 : 1);
+        break;
+      }
+      case OP_TEST: {
+        if (isknown(&kv[a]))  /* as above */
+          *ip = jumpby((l_isfalse(&kv[a]) != c) ? 0 : 1);
+        break;
+      }
+      case OP_GETTABLE: case OP_SELF: {
+        SETARG_C(*ip, rkconst(fs, kv, c, 0));
+        /* go through */
+      }
+      default: {
+        int first = changes(*ip, &last);
+        if (first >= 0)
+          for (r = first; r <= last && r < nreg; r++) setunknown(&kv[r]);
+        break;
+      }
+    }
+    if (a < nreg && shared[a]) setunknown(&kv[a]);  /* see `sharedregs' */
+  }
+  luaM_freearray(fs->L, act, fs->nlocvars+1, int, MEMPROTO);
+  luaM_freearray(fs->L, kv, 2*nreg, TValue, MEMPROTO);
+  luaM_freearray(fs->L, fl, n+1, lu_byte, MEMPROTO);
+}
+
+
+/*
+** removes the code of `fs' that cannot run and jumps to the next
+** instruction (not those after a test, as the test skips them); returns
+** whether it removed anything
+*/
+static int prune (FuncState *fs) {
+  Proto *f = fs->f;
+  int n = fs->pc;
+  lu_byte *fl = codeflags(fs->L, f, n);
+  int *newpc = luaM_newvector(fs->L, n+1, int, MEMPROTO);
+  int *stack = newpc;  /* used first for the positions still to visit */
+  int top = 0;
+  int pc, j, v;
+#define reach(p)  { if ((p) < n && !(fl[p] & LIVE)) \
+                      { fl[p] |= LIVE; stack[top++] = (p); } }
+  reach(0);
+  reach(n-1);  /* the final return must stay */
+  while (top > 0) {
+    Instruction i;
+    pc = stack[--top];
+    i = f->code[pc];
+    switch (GET_OPCODE(i)) {
+      case OP_JMP: case OP_FORPREP: {
+        reach(pc+1+GETARG_sBx(i));
+        break;
+      }
+      case OP_FORLOOP: {
+        reach(pc+1);
+        reach(pc+1+GETARG_sBx(i));
+        break;
+      }
+      case OP_RETURN: break;
+      case OP_LOADBOOL: {
+        reach(pc+1);  /* kept even if only skipped */
+        if (GETARG_C(i)) reach(pc+2);
+        break;
+      }
+      case OP_SETLIST: {
+        if (GETARG_C(i) == 0) fl[++pc] |= LIVE;
+        reach(pc+1);
+        break;
+      }
+      case OP_CLOSURE: {
+        int nup = f->p[GETARG_Bx(i)]->nups;
+        while (nup-- > 0) fl[++pc] |= LIVE;
+        reach(pc+1);
+        break;
+      }
+      default: {
+        reach(pc+1);
+        if (testTMode(GET_OPCODE(i))) reach(pc+2);
+        break;
+      }
+    }
+  }
+#undef reach
+  for (pc = j = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    newpc[pc] = j;
+    if (!(fl[pc] & LIVE)) continue;
+    if (!(fl[pc] & DATA) && GET_OPCODE(i) == OP_JMP && GETARG_sBx(i) == 0) {
+      Instruction p = (pc > 0) ? f->code[pc-1] : 0;
+      if (pc == 0 || (fl[pc-1] & DATA) ||
+          !(testTMode(GET_OPCODE(p)) ||
+            (GET_OPCODE(p) == OP_LOADBOOL && GETARG_C(p))))
+        continue;  /* a jump to the next instruction */
+    }
+    j++;
+  }
+  newpc[n] = j;
+  if (j < n) {
+    for (pc = 0; pc < n; pc++) {
+      Instruction i = f->code[pc];
+      OpCode op = GET_OPCODE(i);
+      if (newpc[pc+1] == newpc[pc]) continue;  /* removed */
+      if (!(fl[pc] & DATA) &&
+          (op == OP_JMP || op == OP_FORLOOP || op == OP_FORPREP))
+        SETARG_sBx(i, newpc[pc+1+GETARG_sBx(i)] - (newpc[pc]+1));
+      f->code[newpc[pc]] = i;
+      f->lineinfo[newpc[pc]] = f->lineinfo[pc];
+    }
+    for (v = 0; v < fs->nlocvars; v++) {
+      f->locvars[v].startpc = newpc[f->locvars[v].startpc];
+      f->locvars[v].endpc = newpc[f->locvars[v].endpc];
+    }
+    fs->pc = j;
+  }
+  luaM_freearray(fs->L, newpc, n+1, int, MEMPROTO);
+  luaM_freearray(fs->L, fl, n+1, lu_byte, MEMPROTO);
+  return (j < n);
+}
+
+#endif
+
+#endif
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Peephole optimizer
+** =======================================================
+*/
+
+
+/* is RK operand `x' a constant short string? */
+#define isKshrstr(f,x)	(ISK(x) && ttisshrstring(&(f)->k[INDEXK(x)]))
+
+
+/*
+** puts in `*si' the superinstruction for the instruction at `pc' and
+** returns how many instructions it stands for (0 if none). `pair' tells
+** whether the next instruction may go too (it is not a jump target).
+** Jump offsets are left for `luaK_optimize' to fix.
+*/
+static int fuse (Proto *f, int pc, int pair, Instruction *si) {
+  Instruction i = f->code[pc];
+  Instruction j = pair ? f->code[pc+1] : 0;
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  switch (GET_OPCODE(i)) {
+    case OP_ADD: {  /* increment by a constant */
+      if (ISK(b) || !ISK(c) || !ttisnumber(&f->k[INDEXK(c)])) return 0;
+      *si = CREATE_ABC(OP_ADDK, a, b, c);
+      return 1;
+    }
+    case OP_TEST: {  /* test and branch */
+      if (!pair) return 0;
+      lua_assert(GET_OPCODE(j) == OP_JMP);
+      *si = CREATE_ABx(c ? OP_JMPIF : OP_JMPNOT, a, 0);
+      return 2;
+    }
+    case OP_EQ: {  /* compare with a constant and branch */
+      if (!pair || ISK(b) == ISK(c)) return 0;
+      lua_assert(GET_OPCODE(j) == OP_JMP);
+      /* offsets never grow, so the old one tells whether the new fits */
+      if (GETARG_sBx(j) < -MAXARG_sC || GETARG_sBx(j) > MAXARG_sC) return 0;
+      if (ISK(b)) { int t = b; b = c; c = t; }  /* register in `b' */
+      *si = CREATE_ABC(a ? OP_JMPEQ : OP_JMPNE, b, c, 0);
+      return 2;
+    }
+    case OP_GETGLOBAL: {  /* get a field of a global */
+      int g = GETARG_Bx(i);
+      if (!pair || GET_OPCODE(j) != OP_GETTABLE || GETARG_A(j) != a ||
+          GETARG_B(j) != a || !isKshrstr(f, GETARG_C(j)) || g > MAXINDEXRK)
+        return 0;
+      *si = CREATE_ABC(OP_GETGFIELD, a, RKASK(g), GETARG_C(j));
+      return 2;
+    }
+    default: return 0;
+  }
+}
+
+
+/*
+** rewrites the code of `fs' with superinstructions, which take one
+** dispatch instead of two and skip some generic checks. A pair is fused
+** only if no jump goes to its second instruction and no local variable
+** starts or ends there; the code is then compacted and all jumps, line
+** information and variable ranges are moved along.
+*/
+static void fusepairs (FuncState *fs) {
+  Proto *f = fs->f;
+  int n = fs->pc;
+  int *newpc = luaM_newvector(fs->L, n+1, int, MEMPROTO);
+  int pc, j, v;
+  int data = 0;  /* is the current word the real C of an OP_SETLIST? */
+  Instruction si;
+  /* first pass: mark in `newpc' where a pair cannot end */
+  for (pc = 0; pc <= n; pc++) newpc[pc] = 0;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (op == OP_JMP || op == OP_FORLOOP || op == OP_FORPREP)
+      newpc[pc+1+GETARG_sBx(i)] = 1;
+    else if (testTMode(op) || (op == OP_LOADBOOL && GETARG_C(i)))
+      newpc[pc+2] = 1;  /* where a skip lands */
+    else if (op == OP_SETLIST && GETARG_C(i) == 0)
+      newpc[++pc] = 1;  /* not an instruction */
+  }
+  for (v = 0; v < fs->nlocvars; v++) {
+    newpc[f->locvars[v].startpc] = 1;
+    newpc[f->locvars[v].endpc] = 1;
+  }
+  /* second pass: choose the superinstructions and map old positions to
+     new ones (each mark is read before it is overwritten) */
+  for (pc = j = 0; pc < n; pc++, j++) {
+    Instruction i = f->code[pc];
+    int pair = (pc+1 < n && !newpc[pc+1]);
+    newpc[pc] = j;
+    if (fuse(f, pc, pair, &si) == 2)
+      newpc[++pc] = j;
+    else if (GET_OPCODE(i) == OP_SETLIST && GETARG_C(i) == 0)
+      newpc[++pc] = ++j;
+  }
+  newpc[n] = j;
+  /* third pass: compact the code in place (no word moves forward) */
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    int line = f->lineinfo[pc];
+    j = newpc[pc];
+    if (data)
+      data = 0;
+    else if (pc+1 < n && newpc[pc+1] == j) {  /* a pair */
+      int to = pc + 2 + GETARG_sBx(f->code[pc+1]);  /* if it jumps */
+      fuse(f, pc++, 1, &i);
+      op = GET_OPCODE(i);
+      if (op == OP_JMPIF || op == OP_JMPNOT)
+        SETARG_sBx(i, newpc[to] - (j+1));
+      else if (op == OP_JMPEQ || op == OP_JMPNE)
+        SETARG_sC(i, newpc[to] - (j+1));
+    }
+    else if (op == OP_JMP || op == OP_FORLOOP || op == OP_FORPREP)
+      SETARG_sBx(i, newpc[pc+1+GETARG_sBx(i)] - (j+1));
+    else if (op == OP_SETLIST && GETARG_C(i) == 0)
+      data = 1;
+    else
+      fuse(f, pc, 0, &i);  /* may be a single one */
+    f->code[j] = i;
+    f->lineinfo[j] = line;
+  }
+  for (v = 0; v < fs->nlocvars; v++) {
+    f->locvars[v].startpc = newpc[f->locvars[v].startpc];
+    f->locvars[v].endpc = newpc[f->locvars[v].endpc];
+  }
+  fs->pc = newpc[n];
+  luaM_freearray(fs->L, newpc, n+1, int, MEMPROTO);
+}
+
+
+/*
+** optimizes the finished code of `fs'. Removing code may turn a jump into
+** a jump to the next instruction, so pruning goes on until it finds
+** nothing else to remove.
+*/
+void luaK_optimize (FuncState *fs) {
+#if defined(LUA_USE_PROPAGATE)
+  propagate(fs);
+  while (prune(fs)) ;
+#endif
+  fusepairs(fs);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Inlining
+** =======================================================
+*/
+
+#if defined(LUA_USE_INLINE)
+
+/* a call to replace by the code of the function called */
+typedef struct Site {
+  Proto *f;  /* function called */
+  int pc;  /* position of the OP_CALL */
+  int nres;  /* results wanted (all of them for an open call) */
+  int size;  /* size of the code that replaces it */
+  int body;  /* where the code of `f' starts in that code */
+  int name;  /* register or upvalue with `f' (see `InlineCall') */
+  int upvals;  /* where the upvalues of `f' were given (-1 if none) */
+} Site;
+
+
+/*
+** can calls to `q' be replaced by its code? It must not need a frame of
+** its own: no calls, varargs or globals (it may have another
+** environment), and no upvalues to change or to close
+*/
+static int inlinable (const Proto *q) {
+  int pc;
+  if (q->is_vararg || q->sizecode > LUAI_MAXINLINE) return 0;
+  for (pc = 0; pc < q->sizecode; pc++) {
+    Instruction i = q->code[pc];
+    switch (GET_OPCODE(i)) {
+      case OP_CALL: case OP_TAILCALL: case OP_TFORLOOP: case OP_VARARG:
+      case OP_CLOSURE: case OP_CLOSE: case OP_SETUPVAL:
+      case OP_GETGLOBAL: case OP_SETGLOBAL: case OP_GETGFIELD:
+        return 0;
+      case OP_SETLIST: {
+        if (GETARG_C(i) == 0) return 0;
+        break;
+      }
+      case OP_RETURN: {
+        if (GETARG_B(i) == 0) return 0;  /* open results */
+        break;
+      }
+      default: break;
+    }
+  }
+  return 1;
+}
+
+
+/* the last return of `q' that may run */
+static int lastreturn (const Proto *q) {
+  int last = q->sizecode - 1;
+  int pc;
+  if (last > 0 && GET_OPCODE(q->code[last-1]) == OP_RETURN) {
+    for (pc = 0; pc < last && jumpto(q->code[pc], pc) != last; pc++) ;
+    if (pc == last) last--;  /* nothing gets to the final return */
+  }
+  return last;
+}
+
+
+/* how many results `q' returns, or -1 if that varies */
+static int nresults (const Proto *q) {
+  int last = lastreturn(q);
+  int nres = GETARG_B(q->code[last]) - 1;
+  int pc;
+  for (pc = 0; pc < last; pc++) {
+    Instruction i = q->code[pc];
+    if (GET_OPCODE(i) == OP_RETURN && GETARG_B(i) - 1 != nres) return -1;
+  }
+  return nres;
+}
+
+
+/*
+** the position of the OP_CLOSURE right before local `v' of `p' (in
+** register `r' and starting at `pc') if the local always holds the
+** function made there, or -1 if it may hold anything else
+*/
+static int closurelocal (const Proto *p, const lu_byte *fl,
+                         const lu_byte *shared, int r, int v, int pc) {
+  int def = pc;
+  int j;
+  if (p->locvars[v].startpc != pc || shared[r]) return -1;
+  do def--; while (def >= 0 && (fl[def] & DATA));
+  if (def < 0 || GET_OPCODE(p->code[def]) != OP_CLOSURE ||
+      GETARG_A(p->code[def]) != r)
+    return -1;
+  if (fl[pc] & TARGET) {  /* not only the start of a loop? */
+    for (j = 0; j < def; j++) {  /* `local f = a or function ...' */
+      if (!(fl[j] & DATA) && jumpto(p->code[j], j) == pc) return -1;
+    }
+  }
+  return unchanged(p, fl, r, def+1, p->locvars[v].endpc) ? def : -1;
+}
+
+
+/*
+** fills `s' for the OP_CALL at `pc' of `p' if it calls a function that
+** can be inlined there: the called register must come straight from a
+** local kept by `closurelocal' (`def' tells where each active local got
+** its closure) or from an upvalue known to hold such a function (`up')
+*/
+static int callee (const Proto *p, const lu_byte *fl, const int *act,
+                   const int *def, int nact, Proto *const *up, int pc,
+                   Site *s) {
+  Instruction i = p->code[pc];
+  int t = GETARG_A(i);
+  int w, first, last;
+  if (GETARG_B(i) == 0) return 0;  /* open arguments */
+  for (w = pc-1; w >= 0; w--) {  /* find what set the called register */
+    if (fl[w+1] & TARGET) return 0;  /* not the only way to get here */
+    if (fl[w] & DATA) continue;
+    first = changes(p->code[w], &last);
+    if (first >= 0 && first <= t && t <= last) break;
+  }
+  if (w < 0) return 0;
+  i = p->code[w];
+  s->f = NULL;
+  s->pc = pc;
+  if (GET_OPCODE(i) == OP_MOVE) {
+    int b = GETARG_B(i);
+    if (b < nact && def[b] >= 0 && p->locvars[act[b]].startpc <= w) {
+      s->f = p->p[GETARG_Bx(p->code[def[b]])];
+      s->name = b;
+      s->upvals = def[b] + 1;
+    }
+  }
+  else if (GET_OPCODE(i) == OP_GETUPVAL) {
+    s->f = up[GETARG_B(i)];
+    s->name = -1 - GETARG_B(i);
+    s->upvals = -1;
+    if (s->f != NULL && s->f->nups > 0) return 0;  /* its upvalues are lost */
+  }
+  return (s->f != NULL && inlinable(s->f));
+}
+
+
+/*
+** index of constant `v' in `p', which gets it if it has not got it yet
+** (-1 if there is no room for it)
+*/
+static int mapk (lua_State *L, Proto *p, const TValue *v) {
+  int k;
+  for (k = 0; k < p->sizek; k++) {  /* the same constant (not 0 for -0) */
+    if (rttype(&p->k[k]) == rttype(v) && luaO_rawequalObj(&p->k[k], v))
+      return k;
+  }
+  if (k >= MAXARG_Bx) return -1;
+  luaM_reallocvector(L, p->k, k, k+1, TValue, MEMPROTO);
+  setobj(L, &p->k[k], v);
+  luaC_barrier(L, p, v);
+  p->sizek = k+1;
+  return k;
+}
+
+
+/* can RK operand `x' of `q' be one of `p'? */
+static int rkfits (lua_State *L, Proto *p, const Proto *q, int x) {
+  int k;
+  if (!ISK(x)) return 1;
+  k = mapk(L, p, &q->k[INDEXK(x)]);
+  return (0 <= k && k <= MAXINDEXRK);
+}
+
+
+/*
+** can the code of `q' run in `p' with its frame from register `base'?
+** The constants of `q' go to `p' here
+*/
+static int fits (lua_State *L, Proto *p, const Proto *q, int base) {
+  int pc;
+  if (base + q->maxstacksize > MAXSTACK) return 0;
+  for (pc = 0; pc < q->sizecode; pc++) {
+    Instruction i = q->code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (getOpMode(op) == iABx) {
+      if (getBMode(op) == OpArgK && mapk(L, p, &q->k[GETARG_Bx(i)]) < 0)
+        return 0;
+    }
+    else if (getOpMode(op) == iABC) {
+      if ((getBMode(op) == OpArgK && !rkfits(L, p, q, GETARG_B(i))) ||
+          (getCMode(op) == OpArgK && !rkfits(L, p, q, GETARG_C(i))))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+/* operand `x' of `q', of kind `mode', as an operand of `p' */
+static int relocarg (lua_State *L, Proto *p, const Proto *q,
+                     enum OpArgMask mode, int x, int base) {
+  if (mode == OpArgR || (mode == OpArgK && !ISK(x)))
+    return base + x;
+  else if (mode == OpArgK)
+    return RKASK(mapk(L, p, &q->k[INDEXK(x)]));
+  else
+    return x;
+}
+
+
+/*
+** instruction `i' of the function called at site `s' of `p' moved into
+** `p', with the frame of the function from register `base'. Its jumps
+** stay as they are, as its code is copied whole.
+*/
+static Instruction reloc (lua_State *L, Proto *p, const Site *s,
+                          Instruction i, int base) {
+  const Proto *q = s->f;
+  OpCode op = GET_OPCODE(i);
+  if (op == OP_GETUPVAL) {  /* get it from where `p' gave it to `q' */
+    Instruction u = p->code[s->upvals + GETARG_B(i)];
+    SETARG_A(u, base + GETARG_A(i));
+    return u;
+  }
+  if (op != OP_JMP && op != OP_EQ && op != OP_LT && op != OP_LE)
+    SETARG_A(i, base + GETARG_A(i));
+  if (getOpMode(op) == iABC) {
+    SETARG_B(i, relocarg(L, p, q, getBMode(op), GETARG_B(i), base));
+    SETARG_C(i, relocarg(L, p, q, getCMode(op), GETARG_C(i), base));
+  }
+  else if (getOpMode(op) == iABx && getBMode(op) == OpArgK)
+    SETARG_Bx(i, mapk(L, p, &q->k[GETARG_Bx(i)]));
+  return i;
+}
+
+
+/* size of the moves of the results of `ret' to a call wanting `nres' */
+static int stubsize (Instruction ret, int nres) {
+  int nmove = GETARG_B(ret) - 1;
+  if (nmove > nres) nmove = nres;
+  return nmove + (nmove < nres);
+}
+
+
+/*
+** writes at `code' (and the lines at `lines') what replaces the call at
+** site `s' of `p', and returns its size; only measures it if `code' is
+** NULL. The frame gets cleared as a call clears it, then comes the code
+** of the function called, where each return jumps to moves of its
+** results that then jump to the end. The moves for the last return come
+** right after the code, and a final return that cannot run goes away.
+*/
+static int expand (lua_State *L, Proto *p, Site *s, Instruction *code,
+                   int *lines) {
+  const Proto *q = s->f;
+  Instruction call = p->code[s->pc];
+  int t = GETARG_A(call);
+  int nargs = GETARG_B(call) - 1;
+  int nres = s->nres;
+  int base = t+1;
+  int first = (nargs < q->numparams) ? nargs : q->numparams;
+  int last = lastreturn(q);
+  int stub[LUAI_MAXINLINE];
+  int n = 0, nstubs = 0;
+  int end, pc, k, m;
+#define emit(i,l)  { if (code) { code[n] = (i); lines[n] = (l); } n++; }
+  if (first < q->maxstacksize)
+    emit(CREATE_ABC(OP_LOADNIL, base+first, base+q->maxstacksize-1, 0),
+         p->lineinfo[s->pc]);
+  s->body = n;
+  end = n + last;
+  for (pc = 0; pc <= last; pc++) {
+    if (GET_OPCODE(q->code[pc]) == OP_RETURN) {
+      end += stubsize(q->code[pc], nres);
+      nstubs++;
+    }
+  }
+  end += nstubs - 1;  /* all but the last moves jump to the end */
+  n += last;
+  for (k = 0; k <= last; k++) {  /* the moves for each return */
+    Instruction i;
+    int line;
+    pc = (k == 0) ? last : k-1;  /* the last return first */
+    i = q->code[pc];
+    line = q->lineinfo[pc];
+    if (GET_OPCODE(i) != OP_RETURN) continue;
+    stub[pc] = n;
+    for (m = 0; m < nres && m < GETARG_B(i)-1; m++)
+      emit(CREATE_ABC(OP_MOVE, t+m, base+GETARG_A(i)+m, 0), line);
+    if (m < nres)
+      emit(CREATE_ABC(OP_LOADNIL, t+m, t+nres-1, 0), line);
+    if (--nstubs > 0)
+      emit(jumpby(end - (n+1)), line);
+  }
+  lua_assert(n == end && stub[last] == s->body + last);
+  if (code) {  /* the code itself */
+    for (pc = 0; pc < last; pc++) {
+      Instruction i = q->code[pc];
+      int j = s->body + pc;
+      if (GET_OPCODE(i) == OP_RETURN)
+        code[j] = jumpby(stub[pc] - (j+1));
+      else
+        code[j] = reloc(L, p, s, i, base);
+      lines[j] = q->lineinfo[pc];
+    }
+  }
+#undef emit
+  return n;
+}
+
+
+/*
+** maps in `newpc' the code of `p' to where it goes with the calls at
+** `sites' expanded. Returns -1 if all jumps can still reach, or else a
+** site in the way of one that cannot.
+*/
+static int place (const Proto *p, const lu_byte *fl, const Site *sites,
+                  int nsites, int *newpc) {
+  int n = p->sizecode;
+  int pc, j, k;
+  for (pc = j = k = 0; pc < n; pc++) {
+    newpc[pc] = j;
+    if (k < nsites && sites[k].pc == pc) j += sites[k++].size;
+    else j++;
+  }
+  newpc[n] = j;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = p->code[pc];
+    OpCode op = GET_OPCODE(i);
+    int to = jumpto(i, pc);
+    int off, max;
+    if ((fl[pc] & DATA) || to < 0) continue;
+    off = newpc[to] - (newpc[pc]+1);
+    max = (op == OP_JMPEQ || op == OP_JMPNE) ? MAXARG_sC : MAXARG_sBx;
+    if (-max <= off && off <= max) continue;
+    for (k = nsites-1; k >= 0; k--) {
+      if ((pc < sites[k].pc) != (to <= sites[k].pc)) return k;
+    }
+  }
+  return -1;
+}
+
+
+/*
+** replaces the calls of `p' at `sites' by the code of the functions
+** called, moving jumps, lines and variable ranges along, and records
+** them for the debug interface
+*/
+static void rebuild (lua_State *L, Proto *p, const lu_byte *fl,
+                     Site *sites, int nsites, const int *newpc) {
+  int n = p->sizecode;
+  int size = newpc[n];
+  Instruction *code = luaM_newvector(L, size, Instruction, MEMPROTO);
+  int *lines = luaM_newvector(L, size, int, MEMPROTO);
+  InlineCall *ic = luaM_newvector(L, nsites, InlineCall, MEMPROTO);
+  int pc, k, v;
+  for (pc = k = 0; pc < n; pc++) {
+    Instruction i = p->code[pc];
+    OpCode op = GET_OPCODE(i);
+    int j = newpc[pc];
+    int to = jumpto(i, pc);
+    if (k < nsites && sites[k].pc == pc) {
+      Site *s = &sites[k];
+      expand(L, p, s, code + j, lines + j);
+      ic[k].f = s->f;
+      ic[k].startpc = j;
+      ic[k].endpc = newpc[pc+1];
+      ic[k].line = p->lineinfo[pc];
+      ic[k].name = s->name;
+      ic[k].base = GETARG_A(i) + 1;
+      ic[k].bodypc = j + s->body;
+      if (ic[k].base + s->f->maxstacksize > p->maxstacksize)
+        p->maxstacksize = cast_byte(ic[k].base + s->f->maxstacksize);
+      luaC_objbarrier(L, p, s->f);
+      k++;
+      continue;
+    }
+    if (!(fl[pc] & DATA) && to >= 0) {
+      if (op == OP_JMPEQ || op == OP_JMPNE)
+        SETARG_sC(i, newpc[to] - (j+1));
+      else
+        SETARG_sBx(i, newpc[to] - (j+1));
+    }
+    else if (k > 0 && sites[k-1].pc == pc-1 && GETARG_C(p->code[pc-1]) == 0) {
+      /* it took all results of the call: now it knows how many */
+      int top = GETARG_A(p->code[pc-1]) + sites[k-1].nres;
+      lua_assert(GETARG_B(i) == 0);
+      SETARG_B(i, top - GETARG_A(i) + (op == OP_RETURN) - (op == OP_SETLIST));
+    }
+    code[j] = i;
+    lines[j] = p->lineinfo[pc];
+  }
+  for (v = 0; v < p->sizelocvars; v++) {
+    p->locvars[v].startpc = newpc[p->locvars[v].startpc];
+    p->locvars[v].endpc = newpc[p->locvars[v].endpc];
+  }
+  luaM_freearray(L, p->code, n, Instruction, MEMPROTO);
+  luaM_freearray(L, p->lineinfo, p->sizelineinfo, int, MEMPROTO);
+  luaM_freearray(L, p->icache, n, int, MEMPROTO);
+  p->code = code;
+  p->lineinfo = lines;
+  p->sizecode = p->sizelineinfo = size;
+  p->inlines = ic;
+  p->sizeinlines = nsites;
+  luaF_initcache(L, p);
+  lua_assert(luaG_checkcode(p));
+}
+
+
+/*
+** inlines the calls that it can in `p' and in the functions nested in
+** it; `up' tells which functions the upvalues of `p' hold when known.
+** `budget' is how many instructions inlining may still add.
+*/
+static void inlinecalls (lua_State *L, Proto *p, Proto *const *up,
+                         int *budget) {
+  int n = p->sizecode;
+  lu_byte *fl = codeflags(L, p, n);
+  int sizeact = p->sizelocvars + p->maxstacksize;
+  int *act = luaM_newvector(L, sizeact, int, MEMPROTO);
+  int *def = act + p->sizelocvars;  /* see `callee' */
+  int nact = 0;  /* number of active locals (the register of the next one) */
+  int *newpc;
+  Site *sites = NULL;
+  int nsites = 0, sizesites = 0;
+  int v = 0;  /* next local variable to start */
+  lu_byte shared[MAXSTACK];
+  Proto *cup[LUAI_MAXUPVALUES];
+  int pc, j;
+  Site s;
+  sharedregs(p, n, fl, shared);
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = p->code[pc];
+    if (fl[pc] & DATA) continue;
+    while (nact > 0 && p->locvars[act[nact-1]].endpc <= pc)
+      nact--;
+    for (; v < p->sizelocvars && p->locvars[v].startpc <= pc; v++) {
+      if (nact < p->maxstacksize)
+        def[nact] = closurelocal(p, fl, shared, nact, v, pc);
+      act[nact++] = v;
+    }
+    switch (GET_OPCODE(i)) {
+      case OP_CLOSURE: {  /* what it gives to the new function */
+        Proto *q = p->p[GETARG_Bx(i)];
+        for (j = 0; j < q->nups; j++) {
+          Instruction u = p->code[pc+1+j];
+          int b = GETARG_B(u);
+          if (GET_OPCODE(u) == OP_GETUPVAL)
+            cup[j] = up[b];
+          else
+            cup[j] = (b < nact && def[b] >= 0) ?
+                     p->p[GETARG_Bx(p->code[def[b]])] : NULL;
+        }
+        inlinecalls(L, q, cup, budget);
+        break;
+      }
+      case OP_CALL: {
+        if (!callee(p, fl, act, def, nact, up, pc, &s) ||
+            !fits(L, p, s.f, GETARG_A(i)+1))
+          break;
+        s.nres = GETARG_C(i) - 1;
+        if (s.nres < 0) {  /* the next instruction takes all results */
+          Instruction next = p->code[pc+1];
+          s.nres = nresults(s.f);
+          if (s.nres < 0 || (GET_OPCODE(next) == OP_SETLIST &&
+                             GETARG_A(i) + s.nres == GETARG_A(next) + 1))
+            break;  /* (an OP_SETLIST of nothing would take all) */
+        }
+        s.size = expand(L, p, &s, NULL, NULL);
+        if (s.size - 1 > *budget) break;
+        *budget -= s.size - 1;
+        luaM_growvector(L, sites, nsites, sizesites, Site, MAX_INT,
+                        "", MEMPROTO);
+        sites[nsites++] = s;
+        break;
+      }
+      default: break;
+    }
+  }
+  newpc = luaM_newvector(L, n+1, int, MEMPROTO);
+  while (nsites > 0 && (j = place(p, fl, sites, nsites, newpc)) >= 0) {
+    *budget += sites[j].size - 1;  /* a jump would not reach */
+    for (nsites--; j < nsites; j++) sites[j] = sites[j+1];
+  }
+  if (nsites > 0)
+    rebuild(L, p, fl, sites, nsites, newpc);
+  luaM_freearray(L, newpc, n+1, int, MEMPROTO);
+  luaM_freearray(L, sites, sizesites, Site, MEMPROTO);
+  luaM_freearray(L, act, sizeact, int, MEMPROTO);
+  luaM_freearray(L, fl, n+1, lu_byte, MEMPROTO);
+}
+
+
+/*
+** replaces calls to small local functions in the chunk `f' by the code
+** of the functions called, up to LUAI_INLINEBUDGET instructions in all
+*/
+void luaK_inline (lua_State *L, Proto *f) {
+  int budget = LUAI_INLINEBUDGET;
+  lua_assert(f->nups == 0);
+  inlinecalls(L, f, NULL, &budget);
+}
+
+#endif
+
+/* }====================================================== */
@@ -25,6 +25,13 @@ static int db_getregistry (lua_State *L) {
 }
 
 
+static int db_poolstats (lua_State *L) {
+  if (!luaL_poolstats(L))
+    lua_pushnil(L);  /* state does not use the pool allocator */
+  return 1;
+}
+
+
 static int db_getmetatable (lua_State *L) {
   luaL_checkany(L, 1);
   if (!lua_getmetatable(L, 1)) {
@@ -381,6 +388,7 @@ static const luaL_Reg dblib[] = {
   {"getregistry", db_getregistry},
   {"getmetatable", db_getmetatable},
   {"getupvalue", db_getupvalue},
+  {"poolstats", db_poolstats},
   {"setfenv", db_setfenv},
   {"sethook", db_sethook},
   {"setlocal", db_setlocal},
@@ -50,6 +50,42 @@ static int currentline (lua_State *L, CallInfo *ci) {
 }
 
 
+/*
+** the call that the compiler inlined (see `luaK_inline') where `ci' is
+** running, if any. It shows as a level of its own, above that of `ci',
+** with `i_ci' negative.
+*/
+static const InlineCall *getinline (lua_State *L, CallInfo *ci) {
+  Proto *p;
+  int pc, i;
+  if (!isLua(ci) || (p = ci_func(ci)->l.p)->sizeinlines == 0) return NULL;
+  pc = currentpc(L, ci);
+  for (i = 0; i < p->sizeinlines; i++) {
+    if (p->inlines[i].startpc <= pc && pc < p->inlines[i].endpc)
+      return &p->inlines[i];
+  }
+  return NULL;
+}
+
+
+/* the position in the inlined function `ic' matching `pc' */
+static int inlinedpc (const InlineCall *ic, int pc) {
+  pc -= ic->bodypc;
+  if (pc < 0) return 0;  /* still clearing its frame */
+  else if (pc >= ic->f->sizecode) return ic->f->sizecode - 1;  /* returned */
+  else return pc;
+}
+
+
+/* the inlined function `ic' running in `ci' */
+static Closure *inlinedfunc (CallInfo *ci, const InlineCall *ic) {
+  const TValue *o = (ic->name >= 0) ? ci->base + ic->name :
+                    ci_func(ci)->l.upvals[-1 - ic->name]->v;
+  lua_assert(ttisfunction(o) && clvalue(o)->l.p == ic->f);
+  return clvalue(o);
+}
+
+
 /*
 ** this function can be called asynchronous (e.g. during a signal)
 */
@@ -85,7 +121,13 @@ LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
   int status;
   CallInfo *ci;
   lua_lock(L);
-  for (ci = L->ci; level > 0 && ci > L->base_ci; ci--) {
+  for (ci = L->ci; ci > L->base_ci; ci--) {
+    if (getinline(L, ci) != NULL && level-- == 0) {  /* an inlined call? */
+      lua_unlock(L);
+      ar->i_ci = -cast_int(ci - L->base_ci);
+      return 1;
+    }
+    if (level <= 0) break;
     level--;
     if (f_isLua(ci))  /* Lua function? */
       level -= ci->tailcalls;  /* skip lost tail calls */
@@ -109,9 +151,21 @@ static Proto *getluaproto (CallInfo *ci) {
 }
 
 
-static const char *findlocal (lua_State *L, CallInfo *ci, int n) {
+static const char *findlocal (lua_State *L, const lua_Debug *ar, int n,
+                              StkId *pos) {
   const char *name;
-  Proto *fp = getluaproto(ci);
+  CallInfo *ci;
+  Proto *fp;
+  if (ar->i_ci < 0) {  /* an inlined call? */
+    const InlineCall *ic;
+    ci = L->base_ci - ar->i_ci;
+    ic = getinline(L, ci);
+    *pos = ci->base + ic->base + (n - 1);
+    return luaF_getlocalname(ic->f, n, inlinedpc(ic, currentpc(L, ci)));
+  }
+  ci = L->base_ci + ar->i_ci;
+  fp = getluaproto(ci);
+  *pos = ci->base + (n - 1);
   if (fp && (name = luaF_getlocalname(fp, n, currentpc(L, ci))) != NULL)
     return name;  /* is a local variable in a Lua function */
   else {
@@ -125,22 +179,22 @@ static const char *findlocal (lua_State *L, CallInfo *ci, int n) {
 
 
 LUA_API const char *lua_getlocal (lua_State *L, const lua_Debug *ar, int n) {
-  CallInfo *ci = L->base_ci + ar->i_ci;
-  const char *name = findlocal(L, ci, n);
+  StkId pos;
+  const char *name = findlocal(L, ar, n, &pos);
   lua_lock(L);
   if (name)
-      luaA_pushobject(L, ci->base + (n - 1));
+      luaA_pushobject(L, pos);
   lua_unlock(L);
   return name;
 }
 
 
 LUA_API const char *lua_setlocal (lua_State *L, const lua_Debug *ar, int n) {
-  CallInfo *ci = L->base_ci + ar->i_ci;
-  const char *name = findlocal(L, ci, n);
+  StkId pos;
+  const char *name = findlocal(L, ar, n, &pos);
   lua_lock(L);
   if (name)
-      setobjs2s(L, ci->base + (n - 1), L->top - 1);
+      setobjs2s(L, pos, L->top - 1);
   L->top--;  /* pop value */
   lua_unlock(L);
   return name;
@@ -190,8 +244,27 @@ static void collectvalidlines (lua_State *L, Closure *f) {
 }
 
 
+static const char *inlinedname (CallInfo *ci, const InlineCall *ic,
+                                const char **name) {
+  Proto *p = ci_func(ci)->l.p;
+  if (ic->name >= 0) {
+    *name = luaF_getlocalname(p, ic->name + 1, ic->startpc);
+    if (*name == NULL) *name = "?";
+    return "local";
+  }
+  else {
+    *name = p->upvalues ? getstr(p->upvalues[-1 - ic->name]) : "?";
+    return "upvalue";
+  }
+}
+
+
+/*
+** `ic' tells whether `f' is a function inlined in `ci' rather than the
+** one that `ci' runs
+*/
 static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
-                    Closure *f, CallInfo *ci) {
+                    Closure *f, CallInfo *ci, const InlineCall *ic) {
   int status = 1;
   if (f == NULL) {
     info_tailcall(ar);
@@ -204,7 +277,9 @@ static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
         break;
       }
       case 'l': {
-        ar->currentline = (ci) ? currentline(L, ci) : -1;
+        const InlineCall *in = (ci && !ic) ? getinline(L, ci) : NULL;
+        ar->currentline = (in) ? in->line :  /* line of the inlined call */
+                          (ci) ? currentline(L, ci) : -1;
         break;
       }
       case 'u': {
@@ -212,7 +287,8 @@ static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
         break;
       }
       case 'n': {
-        ar->namewhat = (ci) ? getfuncname(L, ci, &ar->name) : NULL;
+        ar->namewhat = (ic) ? inlinedname(ci, ic, &ar->name) :
+                       (ci) ? getfuncname(L, ci, &ar->name) : NULL;
         if (ar->namewhat == NULL) {
           ar->namewhat = "";  /* not found */
           ar->name = NULL;
@@ -233,6 +309,7 @@ LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar) {
   int status;
   Closure *f = NULL;
   CallInfo *ci = NULL;
+  const InlineCall *ic = NULL;
   lua_lock(L);
   if (*what == '>') {
     StkId func = L->top - 1;
@@ -241,12 +318,17 @@ LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar) {
     f = clvalue(func);
     L->top--;  /* pop function */
   }
+  else if (ar->i_ci < 0) {  /* an inlined call? */
+    ci = L->base_ci - ar->i_ci;
+    ic = getinline(L, ci);
+    f = inlinedfunc(ci, ic);
+  }
   else if (ar->i_ci != 0) {  /* no tail call? */
     ci = L->base_ci + ar->i_ci;
     lua_assert(ttisfunction(ci->func));
     f = clvalue(ci->func);
   }
-  status = auxgetinfo(L, what, ar, f, ci);
+  status = auxgetinfo(L, what, ar, f, ci, ic);
   if (strchr(what, 'f')) {
     if (f == NULL) setnilvalue(L->top);
     else setclvalue(L, L->top, f);
@@ -314,6 +396,27 @@ static int checkArgMode (const Proto *pt, int r, enum OpArgMask mode) {
 }
 
 
+/* check that a jump can go to `dest' */
+static int checkdest (const Proto *pt, int dest) {
+  check(0 <= dest && dest < pt->sizecode);
+  if (dest > 0) {
+    int j;
+    /* check that it does not jump to a setlist count; this
+       is tricky, because the count from a previous setlist may
+       have the same value of an invalid setlist; so, we must
+       go all the way back to the first of them (if any) */
+    for (j = 0; j < dest; j++) {
+      Instruction d = pt->code[dest-1-j];
+      if (!(GET_OPCODE(d) == OP_SETLIST && GETARG_C(d) == 0)) break;
+    }
+    /* if 'j' is even, previous value is not a setlist (even if
+       it looks like one) */
+    check((j&1) == 0);
+  }
+  return 1;
+}
+
+
 static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
   int pc;
   int last;  /* stores position of last instruction that changed `reg' */
@@ -342,24 +445,7 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
       }
       case iAsBx: {
         b = GETARG_sBx(i);
-        if (getBMode(op) == OpArgR) {
-          int dest = pc+1+b;
-          check(0 <= dest && dest < pt->sizecode);
-          if (dest > 0) {
-            int j;
-            /* check that it does not jump to a setlist count; this
-               is tricky, because the count from a previous setlist may
-               have the same value of an invalid setlist; so, we must
-               go all the way back to the first of them (if any) */
-            for (j = 0; j < dest; j++) {
-              Instruction d = pt->code[dest-1-j];
-              if (!(GET_OPCODE(d) == OP_SETLIST && GETARG_C(d) == 0)) break;
-            }
-            /* if 'j' is even, previous value is not a setlist (even if
-               it looks like one) */
-            check((j&1) == 0);
-          }
-        }
+        if (getBMode(op) == OpArgR) check(checkdest(pt, pc+1+b));
         break;
       }
     }
@@ -394,6 +480,15 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
         check(ttisstring(&pt->k[b]));
         break;
       }
+      case OP_GETGFIELD: {
+        check(ISK(b) && ttisstring(&pt->k[INDEXK(b)]));
+        check(ISK(c) && ttisshrstring(&pt->k[INDEXK(c)]));
+        break;
+      }
+      case OP_ADDK: {
+        check(ISK(c) && ttisnumber(&pt->k[INDEXK(c)]));
+        break;
+      }
       case OP_SELF: {
         checkreg(pt, a+1);
         if (reg == a+1) last = pc;
@@ -409,10 +504,22 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
         if (reg >= a+2) last = pc;  /* affect all regs above its base */
         break;
       }
+      case OP_JMPEQ:
+      case OP_JMPNE: {
+        int dest = pc+1+GETARG_sC(i);
+        check(ISK(b));
+        check(checkdest(pt, dest));
+        /* as the OP_JMP after a test (see below) */
+        if (reg != NO_REG && pc < dest && dest <= lastpc)
+          pc += GETARG_sC(i);
+        break;
+      }
       case OP_FORLOOP:
       case OP_FORPREP:
         checkreg(pt, a+3);
         /* go through */
+      case OP_JMPIF:
+      case OP_JMPNOT:
       case OP_JMP: {
         int dest = pc+1+b;
         /* not full check and jump is forward and do not skip `lastpc'? */
@@ -494,48 +601,63 @@ static const char *kname (Proto *p, int c) {
 }
 
 
+static const char *objname (Proto *p, int pc, int stackpos,
+                            const char **name) {
+  Instruction i;
+  *name = luaF_getlocalname(p, stackpos+1, pc);
+  if (*name)  /* is a local? */
+    return "local";
+  i = p->code[pc];
+  if (GET_OPCODE(i) == OP_GETGFIELD && GETARG_A(i) == stackpos) {
+    *name = kname(p, GETARG_B(i));  /* failed to index this global */
+    return "global";
+  }
+  i = symbexec(p, pc, stackpos);  /* try symbolic execution */
+  lua_assert(pc != -1);
+  switch (GET_OPCODE(i)) {
+    case OP_GETGLOBAL: {
+      int g = GETARG_Bx(i);  /* global index */
+      lua_assert(ttisstring(&p->k[g]));
+      *name = svalue(&p->k[g]);
+      return "global";
+    }
+    case OP_MOVE: {
+      int a = GETARG_A(i);
+      int b = GETARG_B(i);  /* move from `b' to `a' */
+      if (b < a)
+        return objname(p, pc, b, name);  /* get name for `b' */
+      break;
+    }
+    case OP_GETTABLE:
+    case OP_GETGFIELD: {
+      int k = GETARG_C(i);  /* key index */
+      *name = kname(p, k);
+      return "field";
+    }
+    case OP_GETUPVAL: {
+      int u = GETARG_B(i);  /* upvalue index */
+      *name = p->upvalues ? getstr(p->upvalues[u]) : "?";
+      return "upvalue";
+    }
+    case OP_SELF: {
+      int k = GETARG_C(i);  /* key index */
+      *name = kname(p, k);
+      return "method";
+    }
+    default: break;
+  }
+  return NULL;  /* no useful name found */
+}
+
+
 static const char *getobjname (lua_State *L, CallInfo *ci, int stackpos,
                                const char **name) {
   if (isLua(ci)) {  /* a Lua function? */
-    Proto *p = ci_func(ci)->l.p;
+    const InlineCall *ic = getinline(L, ci);
     int pc = currentpc(L, ci);
-    Instruction i;
-    *name = luaF_getlocalname(p, stackpos+1, pc);
-    if (*name)  /* is a local? */
-      return "local";
-    i = symbexec(p, pc, stackpos);  /* try symbolic execution */
-    lua_assert(pc != -1);
-    switch (GET_OPCODE(i)) {
-      case OP_GETGLOBAL: {
-        int g = GETARG_Bx(i);  /* global index */
-        lua_assert(ttisstring(&p->k[g]));
-        *name = svalue(&p->k[g]);
-        return "global";
-      }
-      case OP_MOVE: {
-        int a = GETARG_A(i);
-        int b = GETARG_B(i);  /* move from `b' to `a' */
-        if (b < a)
-          return getobjname(L, ci, b, name);  /* get name for `b' */
-        break;
-      }
-      case OP_GETTABLE: {
-        int k = GETARG_C(i);  /* key index */
-        *name = kname(p, k);
-        return "field";
-      }
-      case OP_GETUPVAL: {
-        int u = GETARG_B(i);  /* upvalue index */
-        *name = p->upvalues ? getstr(p->upvalues[u]) : "?";
-        return "upvalue";
-      }
-      case OP_SELF: {
-        int k = GETARG_C(i);  /* key index */
-        *name = kname(p, k);
-        return "method";
-      }
-      default: break;
-    }
+    if (ic && stackpos >= ic->base)  /* in the frame of an inlined call? */
+      return objname(ic->f, inlinedpc(ic, pc), stackpos - ic->base, name);
+    return objname(ci_func(ci)->l.p, pc, stackpos, name);
   }
   return NULL;  /* no useful name found */
 }
@@ -579,15 +701,15 @@ void luaG_typeerror (lua_State *L, const TValue *o, const char *op) {
 
 
 void luaG_concaterror (lua_State *L, StkId p1, StkId p2) {
-  if (ttisstring(p1) || ttisnumber(p1)) p1 = p2;
-  lua_assert(!ttisstring(p1) && !ttisnumber(p1));
+  if (ttype(p1) == LUA_TSTRING || ttisnumber(p1)) p1 = p2;
+  lua_assert(ttype(p1) != LUA_TSTRING && !ttisnumber(p1));
   luaG_typeerror(L, p1, "concatenate");
 }
 
 
 void luaG_aritherror (lua_State *L, const TValue *p1, const TValue *p2) {
   TValue temp;
-  if (luaV_tonumber(p1, &temp) == NULL)
+  if (luaV_tonumber(L, p1, &temp) == NULL)
     p2 = p1;  /* first operand is wrong */
   luaG_typeerror(L, p2, "perform arithmetic on");
 }
@@ -615,6 +737,24 @@ static void addinfo (lua_State *L, const char *msg) {
 }
 
 
+/*
+** source and current line of the innermost active Lua function ("[C]"
+** and -1 if there is none); must not allocate memory
+*/
+void luaG_where (lua_State *L, char *buff, int *line) {
+  CallInfo *ci;
+  for (ci = L->ci; ci != NULL && ci > L->base_ci; ci--) {
+    if (isLua(ci)) {
+      luaO_chunkid(buff, getstr(getluaproto(ci)->source), LUA_IDSIZE);
+      *line = currentline(L, ci);
+      return;
+    }
+  }
+  strcpy(buff, "[C]");
+  *line = -1;
+}
+
+
 void luaG_errormsg (lua_State *L) {
   if (L->errfunc != 0) {  /* is there an error handling function? */
     StkId errfunc = restorestack(L, L->errfunc);
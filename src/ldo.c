@@ -138,20 +138,72 @@ static void correctstack (lua_State *L, TValue *oldstack) {
 }
 
 
+#if defined(LUA_USE_STACKMAP)
+
+/*
+** A stack or CallInfo array (`bit' tells which) that grows to
+** LUAI_STACKMAPMIN bytes moves to address space reserved for its
+** largest size; from then on it grows and shrinks in place. Returns the
+** new address of vector `v', or NULL to leave it in the heap (as when
+** there is no address space left).
+*/
+static void *mapvector (lua_State *L, void *v, int bit, size_t osize,
+                        size_t nsize, size_t reserve) {
+  void *m;
+  if (L->stackmap & bit) {  /* already in reserved space? */
+    if (nsize <= reserve && luaM_commit(L, v, osize, nsize, MEMTHREAD))
+      return v;  /* resized in place */
+    m = luaM_realloc(L, NULL, 0, nsize, MEMTHREAD);  /* back to the heap */
+    memcpy(m, v, osize);  /* (it cannot fail to shrink) */
+    luaM_release(L, v, osize, reserve, MEMTHREAD);
+    L->stackmap &= ~bit;
+    return m;
+  }
+  else if (osize < nsize && LUAI_STACKMAPMIN <= nsize && nsize <= reserve &&
+           (m = luaM_reserve(L, reserve)) != NULL) {
+    if (!luaM_commit(L, m, 0, nsize, MEMTHREAD)) {
+      luaM_release(L, m, 0, reserve, MEMTHREAD);
+      return NULL;
+    }
+    memcpy(m, v, osize);
+    luaM_freemem(L, v, osize, MEMTHREAD);
+    L->stackmap |= bit;
+    return m;
+  }
+  else
+    return NULL;
+}
+
+
+#define resizevector(L,v,on,n,t,bit,r) { \
+  void *m_ = mapvector(L, v, bit, (on)*sizeof(t), (n)*sizeof(t), r); \
+  if (m_ != NULL) (v) = cast(t *, m_); \
+  else luaM_reallocvector(L, v, on, n, t, MEMTHREAD); }
+
+#else
+
+#define resizevector(L,v,on,n,t,bit,r) \
+	luaM_reallocvector(L, v, on, n, t, MEMTHREAD)
+
+#endif
+
+
 void luaD_reallocstack (lua_State *L, int newsize) {
   TValue *oldstack = L->stack;
   int realsize = newsize + 1 + EXTRA_STACK;
   lua_assert(L->stack_last - L->stack == L->stacksize - EXTRA_STACK - 1);
-  luaM_reallocvector(L, L->stack, L->stacksize, realsize, TValue);
+  resizevector(L, L->stack, L->stacksize, realsize, TValue,
+               MAPSTACK, STACKRESERVE);
   L->stacksize = realsize;
   L->stack_last = L->stack+newsize;
-  correctstack(L, oldstack);
+  if (L->stack != oldstack)  /* did it move? */
+    correctstack(L, oldstack);
 }
 
 
 void luaD_reallocCI (lua_State *L, int newsize) {
   CallInfo *oldci = L->base_ci;
-  luaM_reallocvector(L, L->base_ci, L->size_ci, newsize, CallInfo);
+  resizevector(L, L->base_ci, L->size_ci, newsize, CallInfo, MAPCI, CIRESERVE);
   L->size_ci = newsize;
   L->ci = (L->ci - oldci) + L->base_ci;
   L->end_ci = L->base_ci + L->size_ci - 1;
@@ -306,6 +358,7 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
   }
   else {  /* if is a C function, call it */
     CallInfo *ci;
+    lua_CFunction f;
     int n;
     luaD_checkstack(L, LUA_MINSTACK);  /* ensure minimum stack size */
     ci = inc_ci(L);  /* now `enter' new function */
@@ -316,8 +369,9 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
     ci->nresults = nresults;
     if (L->hookmask & LUA_MASKCALL)
       luaD_callhook(L, LUA_HOOKCALL, -1);
+    f = curr_func(L)->c.f;  /* (`L->ci' may move once unlocked) */
     lua_unlock(L);
-    n = (*curr_func(L)->c.f)(L);  /* do the actual call */
+    n = (*f)(L);  /* do the actual call */
     lua_lock(L);
     if (n < 0)  /* yielding? */
       return PCRYIELD;
@@ -28,6 +28,17 @@
 #define restoreci(L,n)		((CallInfo *)((char *)L->base_ci + (n)))
 
 
+#if defined(LUA_USE_STACKMAP)
+/* bits in `L->stackmap': which vectors are in reserved address space */
+#define MAPSTACK	1
+#define MAPCI		2
+
+/* address space reserved for a stack and for a CallInfo array */
+#define STACKRESERVE	(cast(size_t, LUAI_MAXSTACKMAP) * sizeof(TValue))
+#define CIRESERVE	(cast(size_t, 2*LUAI_MAXCALLS) * sizeof(CallInfo))
+#endif
+
+
 /* results from luaD_precall */
 #define PCRLUA		0	/* initiated a call to a Lua function */
 #define PCRC		1	/* did a call to a C function */
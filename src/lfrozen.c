@@ -0,0 +1,318 @@
+/*
+** $Id: lfrozen.c $
+** Frozen regions: read-only tables shared by all states
+** See Copyright Notice in lua.h
+*/
+
+
+#include <string.h>
+
+#define lfrozen_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "ldebug.h"
+#include "ldo.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+
+
+
+#if defined(LUA_USE_FROZEN)
+
+/*
+** `lua_freeze' copies a table, with all the tables and strings that it
+** reaches through keys, values and metatables, into a frozen region:
+** memory from a given allocator that belongs to no state. The copies
+** are ordinary objects for the rest of Lua, but they are black and
+** fixed (see `isfrozen'), so no collector ever marks, sweeps or writes
+** them, and any change to their tables raises an error. So any number
+** of states, in any threads, may read them at the same time with no
+** locks. Strings of a region are long strings, whatever their lengths:
+** they compare by contents with the strings of each state, and their
+** hashes, computed when they are frozen, use the seed that all states
+** share. Each table is first built as an ordinary table of the
+** freezing state, with the frozen keys and values, and then its parts
+** are copied into the region, so that keys are where lookups look for
+** them. A region must outlive all states that use it.
+*/
+
+
+/* memory of a region comes in chunks, filled by objects in order */
+typedef union Chunk {
+  struct {
+    union Chunk *next;
+    size_t size;
+  } c;
+  L_Umaxalign dummy;  /* ensures maximum alignment for objects */
+} Chunk;
+
+#define CHUNKSIZE	16384
+
+/* objects bigger than this get chunks of their own */
+#define BIGOBJECT	(CHUNKSIZE/4)
+
+#define alignsize(s) \
+	(((s) + sizeof(L_Umaxalign) - 1) & ~(sizeof(L_Umaxalign) - 1))
+
+
+struct lua_Frozen {
+  lua_Alloc f;
+  void *ud;
+  unsigned int seed;  /* seed of the hashes of its strings */
+  Chunk *chunks;
+  char *free;  /* free part of the current chunk */
+  size_t left;
+  Table *root;
+};
+
+
+typedef struct Freeze {
+  lua_Frozen *fz;
+  Table *map;  /* tables and strings of the state -> their frozen copies */
+  Table *todo;  /* tables still to be filled */
+  int ntodo;
+} Freeze;
+
+
+static Chunk *newchunk (lua_State *L, lua_Frozen *fz, size_t size) {
+  Chunk *c = cast(Chunk *, (*fz->f)(fz->ud, NULL, 0, sizeof(Chunk) + size));
+  if (c == NULL)
+    luaD_throw(L, LUA_ERRMEM);
+  c->c.size = sizeof(Chunk) + size;
+  return c;
+}
+
+
+static void *fzalloc (lua_State *L, lua_Frozen *fz, size_t size) {
+  void *block;
+  size = alignsize(size);
+  if (size > BIGOBJECT) {  /* put it in a chunk after the current one */
+    Chunk *c = newchunk(L, fz, size);
+    if (fz->chunks == NULL) {
+      c->c.next = NULL;
+      fz->chunks = c;
+    }
+    else {
+      c->c.next = fz->chunks->c.next;
+      fz->chunks->c.next = c;
+    }
+    return c + 1;
+  }
+  if (size > fz->left) {
+    Chunk *c = newchunk(L, fz, CHUNKSIZE);
+    c->c.next = fz->chunks;
+    fz->chunks = c;
+    fz->free = cast(char *, c + 1);
+    fz->left = CHUNKSIZE;
+  }
+  block = fz->free;
+  fz->free += size;
+  fz->left -= size;
+  return block;
+}
+
+
+/* number of entries in the hash part of `h' */
+static int hashentries (Table *h) {
+  int i, n = 0;
+  for (i = 0; i < sizenode(h); i++)
+    if (!ttisnil(gval(gnode(h, i)))) n++;
+  return n;
+}
+
+
+static TString *freezestr (lua_State *L, Freeze *fr, const TValue *o) {
+  TValue key;
+  const TValue *copy;
+  TString *ts;
+  size_t l;
+  if (ttisrope(o)) {
+    setsvalue(L, &key, luaS_flatten(L, rpvalue(o)));
+  }
+  else {
+    setobj(L, &key, o);
+  }
+  copy = luaH_get(fr->map, &key);  /* equal strings share a copy */
+  if (!ttisnil(copy))
+    return cast(TString *, pvalue(copy));
+  l = tsvalue(&key)->len;
+  ts = cast(TString *, fzalloc(L, fr->fz, sizeof(TString) + l + 1));
+  ts->tsv.next = NULL;
+  ts->tsv.tt = LUA_TLNGSTR;
+  ts->tsv.marked = FROZENBITS;
+  ts->tsv.extra = 1;  /* it has its hash already */
+  ts->tsv.hash = luaS_hash(svalue(&key), l, G(L)->seed);
+  ts->tsv.len = l;
+  memcpy(ts + 1, svalue(&key), l + 1);  /* with the ending '\0' */
+  setpvalue(luaH_set(L, fr->map, &key), ts);
+  return ts;
+}
+
+
+/* a frozen table to be filled later (its address is enough for now) */
+static Table *freezetable (lua_State *L, Freeze *fr, Table *h) {
+  TValue key;
+  const TValue *copy;
+  Table *ft;
+  sethvalue(L, &key, h);
+  copy = luaH_get(fr->map, &key);
+  if (!ttisnil(copy))
+    return cast(Table *, pvalue(copy));
+  ft = cast(Table *, fzalloc(L, fr->fz, sizeof(Table)));
+  ft->next = NULL;
+  ft->tt = LUA_TTABLE;
+  ft->marked = FROZENBITS;
+  ft->flags = 0;
+  ft->lsizenode = 0;
+  ft->metatable = NULL;
+  ft->array = NULL;
+  ft->sizearray = 0;
+  ft->node = NULL;
+  ft->gclist = NULL;
+  setpvalue(luaH_set(L, fr->map, &key), ft);
+  sethvalue(L, luaH_setnum(L, fr->todo, ++fr->ntodo), h);
+  return ft;
+}
+
+
+static void freezevalue (lua_State *L, Freeze *fr, TValue *to,
+                         const TValue *from) {
+  if (!iscollectable(from) || isfrozen(gcvalue(from))) {
+    setobj(L, to, from);
+  }
+  else if (ttype(from) == LUA_TSTRING) {  /* string or rope */
+    to->value.gc = obj2gco(freezestr(L, fr, from));
+    to->tt = LUA_TLNGSTR;
+  }
+  else if (ttistable(from)) {
+    sethvalue(L, to, freezetable(L, fr, hvalue(from)));
+  }
+  else
+    luaG_runerror(L, "cannot freeze a %s value", luaT_typenames[ttype(from)]);
+}
+
+
+static void fillfrozen (lua_State *L, Freeze *fr, Table *h) {
+  TValue key;
+  Table *t, *ft;
+  int i;
+  sethvalue(L, &key, h);
+  ft = cast(Table *, pvalue(luaH_get(fr->map, &key)));
+  t = luaH_new(L, h->sizearray, hashentries(h));
+  sethvalue(L, L->top - 1, t);  /* anchor it */
+  for (i = 0; i < h->sizearray; i++)
+    freezevalue(L, fr, &t->array[i], &h->array[i]);
+  for (i = 0; i < sizenode(h); i++) {
+    Node *n = gnode(h, i);
+    if (!ttisnil(gval(n))) {
+      TValue k, v;
+      freezevalue(L, fr, &k, key2tval(n));
+      freezevalue(L, fr, &v, gval(n));
+      setobj2t(L, luaH_set(L, t, &k), &v);
+    }
+  }
+  if (h->metatable != NULL)
+    ft->metatable = freezetable(L, fr, h->metatable);
+  luaH_copyparts(t, ft, fzalloc(L, fr->fz, luaH_partsize(t)));
+  for (i = 0; i <= TM_EQ; i++)  /* fill its cache of absent metamethods */
+    luaT_gettm(ft, cast(TMS, i), G(L)->tmname[i]);
+}
+
+
+static void f_freeze (lua_State *L, void *ud) {
+  Freeze *fr = cast(Freeze *, ud);
+  TValue root;
+  int i;
+  setobj2n(L, &root, L->top - 1);
+  fr->map = luaH_new(L, 0, 0);
+  sethvalue(L, L->top, fr->map);
+  incr_top(L);
+  fr->todo = luaH_new(L, 0, 0);
+  sethvalue(L, L->top, fr->todo);
+  incr_top(L);
+  setnilvalue(L->top);  /* for the table being filled */
+  incr_top(L);
+  fr->ntodo = 0;
+  fr->fz->root = freezetable(L, fr, hvalue(&root));
+  for (i = 1; i <= fr->ntodo; i++)  /* (`fillfrozen' may add more) */
+    fillfrozen(L, fr, hvalue(luaH_getnum(fr->todo, i)));
+}
+
+#endif
+
+
+/*
+** copies the table at the top of the stack into a new frozen region,
+** with memory from `f'; returns NULL if Lua has no frozen regions
+*/
+LUA_API lua_Frozen *lua_freeze (lua_State *L, lua_Alloc f, void *ud) {
+#if defined(LUA_USE_FROZEN)
+  Freeze fr;
+  lua_Frozen *fz;
+  ptrdiff_t top;
+  int status;
+  lua_lock(L);
+  api_check(L, L->top > L->base && ttistable(L->top - 1));
+  fz = cast(lua_Frozen *, (*f)(ud, NULL, 0, sizeof(lua_Frozen)));
+  if (fz == NULL)
+    luaD_throw(L, LUA_ERRMEM);
+  fz->f = f;
+  fz->ud = ud;
+  fz->seed = G(L)->seed;
+  fz->chunks = NULL;
+  fz->free = NULL;
+  fz->left = 0;
+  fz->root = NULL;
+  fr.fz = fz;
+  top = savestack(L, L->top);
+  status = luaD_pcall(L, f_freeze, &fr, top, 0);
+  if (status != 0) {  /* free what was made and raise the error again */
+    lua_freefrozen(fz);
+    luaD_throw(L, status);
+  }
+  L->top = restorestack(L, top);
+  lua_unlock(L);
+  return fz;
+#else
+  UNUSED(L); UNUSED(f); UNUSED(ud);
+  return NULL;
+#endif
+}
+
+
+LUA_API void lua_pushfrozen (lua_State *L, lua_Frozen *fz) {
+  TValue o;
+  lua_lock(L);
+#if defined(LUA_USE_FROZEN)
+  api_check(L, fz->seed == G(L)->seed);  /* a region of this process */
+  sethvalue(L, &o, fz->root);
+#else
+  UNUSED(fz);
+  setnilvalue(&o);
+#endif
+  luaA_pushobject(L, &o);
+  lua_unlock(L);
+}
+
+
+/* frees a region, which no state may use any more */
+LUA_API void lua_freefrozen (lua_Frozen *fz) {
+#if defined(LUA_USE_FROZEN)
+  if (fz == NULL) return;
+  while (fz->chunks != NULL) {
+    Chunk *c = fz->chunks;
+    fz->chunks = c->c.next;
+    (*fz->f)(fz->ud, c, c->c.size, 0);
+  }
+  (*fz->f)(fz->ud, fz, sizeof(lua_Frozen), 0);
+#else
+  UNUSED(fz);
+#endif
+}
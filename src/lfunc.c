@@ -14,6 +14,7 @@
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -21,7 +22,8 @@
 
 
 Closure *luaF_newCclosure (lua_State *L, int nelems, Table *e) {
-  Closure *c = cast(Closure *, luaM_malloc(L, sizeCclosure(nelems)));
+  Closure *c = cast(Closure *, luaM_malloc(L, sizeCclosure(nelems),
+                                             MEMCLOSURE));
   luaC_link(L, obj2gco(c), LUA_TFUNCTION);
   c->c.isC = 1;
   c->c.env = e;
@@ -31,7 +33,8 @@ Closure *luaF_newCclosure (lua_State *L, int nelems, Table *e) {
 
 
 Closure *luaF_newLclosure (lua_State *L, int nelems, Table *e) {
-  Closure *c = cast(Closure *, luaM_malloc(L, sizeLclosure(nelems)));
+  Closure *c = cast(Closure *, luaM_malloc(L, sizeLclosure(nelems),
+                                             MEMCLOSURE));
   luaC_link(L, obj2gco(c), LUA_TFUNCTION);
   c->l.isC = 0;
   c->l.env = e;
@@ -42,7 +45,7 @@ Closure *luaF_newLclosure (lua_State *L, int nelems, Table *e) {
 
 
 UpVal *luaF_newupval (lua_State *L) {
-  UpVal *uv = luaM_new(L, UpVal);
+  UpVal *uv = luaM_new(L, UpVal, MEMCLOSURE);
   luaC_link(L, obj2gco(uv), LUA_TUPVAL);
   uv->v = &uv->u.value;
   setnilvalue(uv->v);
@@ -64,7 +67,7 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
     }
     pp = &p->next;
   }
-  uv = luaM_new(L, UpVal);  /* not found: create a new one */
+  uv = luaM_new(L, UpVal, MEMCLOSURE);  /* not found: create a new one */
   uv->tt = LUA_TUPVAL;
   uv->marked = luaC_white(g);
   uv->v = level;  /* current value lives in the stack */
@@ -89,7 +92,7 @@ static void unlinkupval (UpVal *uv) {
 void luaF_freeupval (lua_State *L, UpVal *uv) {
   if (uv->v != &uv->u.value)  /* is it open? */
     unlinkupval(uv);  /* remove from open list */
-  luaM_free(L, uv);  /* free upvalue */
+  luaM_free(L, uv, MEMCLOSURE);  /* free upvalue */
 }
 
 
@@ -113,13 +116,14 @@ void luaF_close (lua_State *L, StkId level) {
 
 
 Proto *luaF_newproto (lua_State *L) {
-  Proto *f = luaM_new(L, Proto);
+  Proto *f = luaM_new(L, Proto, MEMPROTO);
   luaC_link(L, obj2gco(f), LUA_TPROTO);
   f->k = NULL;
   f->sizek = 0;
   f->p = NULL;
   f->sizep = 0;
   f->code = NULL;
+  f->icache = NULL;
   f->sizecode = 0;
   f->sizelineinfo = 0;
   f->sizeupvalues = 0;
@@ -131,28 +135,51 @@ Proto *luaF_newproto (lua_State *L) {
   f->lineinfo = NULL;
   f->sizelocvars = 0;
   f->locvars = NULL;
+  f->sizeinlines = 0;
+  f->inlines = NULL;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+#if defined(LUA_USE_JIT)
+  f->jit = NULL;
+  f->jitcount = 0;
+#endif
   return f;
 }
 
 
+/*
+** allocate the inline caches of a function whose code is complete;
+** all hints start at node 0 and are fixed by the first lookups
+*/
+void luaF_initcache (lua_State *L, Proto *f) {
+  int i;
+  f->icache = luaM_newvector(L, f->sizecode, int, MEMPROTO);
+  for (i=0; i<f->sizecode; i++) f->icache[i] = 0;
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode, Instruction);
-  luaM_freearray(L, f->p, f->sizep, Proto *);
-  luaM_freearray(L, f->k, f->sizek, TValue);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
-  luaM_freearray(L, f->locvars, f->sizelocvars, struct LocVar);
-  luaM_freearray(L, f->upvalues, f->sizeupvalues, TString *);
-  luaM_free(L, f);
+#if defined(LUA_USE_JIT)
+  if (f->jit) luaJ_free(L, f);
+#endif
+  luaM_freearray(L, f->code, f->sizecode, Instruction, MEMPROTO);
+  if (f->icache)  /* may be missing if the function was not completed */
+    luaM_freearray(L, f->icache, f->sizecode, int, MEMPROTO);
+  luaM_freearray(L, f->p, f->sizep, Proto *, MEMPROTO);
+  luaM_freearray(L, f->k, f->sizek, TValue, MEMPROTO);
+  luaM_freearray(L, f->lineinfo, f->sizelineinfo, int, MEMPROTO);
+  luaM_freearray(L, f->locvars, f->sizelocvars, struct LocVar, MEMPROTO);
+  luaM_freearray(L, f->inlines, f->sizeinlines, InlineCall, MEMPROTO);
+  luaM_freearray(L, f->upvalues, f->sizeupvalues, TString *, MEMPROTO);
+  luaM_free(L, f, MEMPROTO);
 }
 
 
 void luaF_freeclosure (lua_State *L, Closure *c) {
   int size = (c->c.isC) ? sizeCclosure(c->c.nupvalues) :
                           sizeLclosure(c->l.nupvalues);
-  luaM_freemem(L, c, size);
+  luaM_freemem(L, c, size, MEMCLOSURE);
 }
 
 
@@ -29,7 +29,7 @@
 #define GCFINALIZECOST	100
 
 
-#define maskmarks	cast_byte(~(bitmask(BLACKBIT)|WHITEBITS))
+#define maskmarks	cast_byte(~(bitmask(BLACKBIT)|WHITEBITS|bitmask(OLDBIT)))
 
 #define makewhite(g,x)	\
    ((x)->gch.marked = cast_byte(((x)->gch.marked & maskmarks) | luaC_white(g)))
@@ -37,7 +37,7 @@
 #define white2gray(x)	reset2bits((x)->gch.marked, WHITE0BIT, WHITE1BIT)
 #define black2gray(x)	resetbit((x)->gch.marked, BLACKBIT)
 
-#define stringmark(s)	reset2bits((s)->tsv.marked, WHITE0BIT, WHITE1BIT)
+#define stringmark(s)	((void)claimwhite(obj2gco(s)))
 
 
 #define isfinalized(u)		testbit((u)->marked, FINALIZEDBIT)
@@ -48,11 +48,90 @@
 #define VALUEWEAK       bitmask(VALUEWEAKBIT)
 
 
+#if defined(LUA_USE_PARALLELMARK)
+
+#include <pthread.h>
+#include <sched.h>
+
+#define MAXWORKERS	64
+
+typedef struct GCPool GCPool;
+
+typedef struct GCWorker {
+  GCObject *gray;  /* objects to traverse (other workers may steal them) */
+  GCObject *weak;  /* weak tables found by this worker */
+  GCObject *grayagain;  /* threads found by this worker */
+  char lock;  /* protects `gray' */
+  int id;
+  GCPool *pool;
+  pthread_t thread;
+  size_t marked;  /* objects traversed in the last full collection */
+  size_t bytes;  /* total size of those objects */
+  size_t steals;  /* how many of them were stolen from other workers */
+} GCWorker;
+
+struct GCPool {
+  global_State *g;
+  int n;  /* number of workers (worker 0 is the collector's own thread) */
+  int active;  /* is a parallel mark going on? */
+  int idle;  /* workers that found no work (for termination) */
+  int running;  /* threads still marking in the current round */
+  int quit;
+  unsigned long round;  /* number of parallel marks so far */
+  pthread_mutex_t mutex;
+  pthread_cond_t start;  /* signals a new round (or `quit') */
+  pthread_cond_t done;  /* signals the end of a round */
+  GCWorker w[MAXWORKERS];
+};
+
+static __thread GCWorker *worker = NULL;  /* marker running in this thread */
+
+#define lockgray(w) \
+	{ while (__atomic_test_and_set(&(w)->lock, __ATOMIC_ACQUIRE)) ; }
+#define unlockgray(w)	__atomic_clear(&(w)->lock, __ATOMIC_RELEASE)
+
+/* clear the white bits of `o'; true if they were set (`o' is ours) */
+#define claimwhite(o) testbits(__atomic_fetch_and(&(o)->gch.marked, \
+	cast_byte(~WHITEBITS), __ATOMIC_RELAXED), WHITEBITS)
+
+/* mark bits of objects being traversed may be read by other workers */
+#define testwhite(o) \
+	testbits(__atomic_load_n(&(o)->gch.marked, __ATOMIC_RELAXED), WHITEBITS)
+#define setmarks(o,m) \
+	((void)__atomic_fetch_or(&(o)->gch.marked, cast_byte(m), __ATOMIC_RELAXED))
+#define clearmarks(o,m) ((void)__atomic_fetch_and(&(o)->gch.marked, \
+	cast_byte(~(m)), __ATOMIC_RELAXED))
+
+/* link `o' into list `lst' (of the current worker, if any) */
+#define linkto(g,lst,o,l) { \
+	if (worker) { lockgray(worker); \
+	  (l) = worker->lst; worker->lst = (o); unlockgray(worker); } \
+	else { (l) = (g)->lst; (g)->lst = (o); } }
+
+#define inparallel()	(worker != NULL)
+
+#else
+
+#define claimwhite(o)	(white2gray(o), 1)
+#define testwhite(o)	iswhite(o)
+#define setmarks(o,m)	setbits((o)->gch.marked, m)
+#define clearmarks(o,m)	resetbits((o)->gch.marked, m)
+#define linkto(g,lst,o,l)	{ (l) = (g)->lst; (g)->lst = (o); }
+#define inparallel()	0
+
+#endif
+
+
+#if defined(LUA_USE_BGSWEEP)
+#include <pthread.h>
+#endif
+
+
 
 #define markvalue(g,o) { checkconsistency(o); \
-  if (iscollectable(o) && iswhite(gcvalue(o))) reallymarkobject(g,gcvalue(o)); }
+  if (iscollectable(o) && testwhite(gcvalue(o))) reallymarkobject(g,gcvalue(o)); }
 
-#define markobject(g,t) { if (iswhite(obj2gco(t))) \
+#define markobject(g,t) { if (testwhite(obj2gco(t))) \
 		reallymarkobject(g, obj2gco(t)); }
 
 
@@ -66,16 +145,38 @@ static void removeentry (Node *n) {
 }
 
 
+/*
+** ropes point only to strings and to the (newer) ropes that took over
+** their buffers, so a rope already claimed is marked at once, together
+** with the chain of ropes it reaches
+*/
+static void markrope (Rope *r) {
+  for (;;) {
+    setmarks(obj2gco(r), bitmask(BLACKBIT));  /* ropes are never gray */
+    if (r->flat) stringmark(r->flat);
+    r = r->owner;
+    if (r == NULL || !testwhite(obj2gco(r)) || !claimwhite(obj2gco(r)))
+      return;
+  }
+}
+
+
 static void reallymarkobject (global_State *g, GCObject *o) {
-  lua_assert(iswhite(o) && !isdead(g, o));
-  white2gray(o);
+  lua_assert((iswhite(o) || inparallel()) && !isdead(g, o));
+  if (!claimwhite(o))
+    return;  /* another worker got it first */
   switch (o->gch.tt) {
-    case LUA_TSTRING: {
+    case LUA_TSTRING:
+    case LUA_TLNGSTR: {
+      return;
+    }
+    case LUA_TROPE: {
+      markrope(gco2rp(o));
       return;
     }
     case LUA_TUSERDATA: {
       Table *mt = gco2u(o)->metatable;
-      gray2black(o);  /* udata are never gray */
+      setmarks(o, bitmask(BLACKBIT));  /* udata are never gray */
       if (mt) markobject(g, mt);
       markobject(g, gco2u(o)->env);
       return;
@@ -84,27 +185,23 @@ static void reallymarkobject (global_State *g, GCObject *o) {
       UpVal *uv = gco2uv(o);
       markvalue(g, uv->v);
       if (uv->v == &uv->u.value)  /* closed? */
-        gray2black(o);  /* open upvalues are never black */
+        setmarks(o, bitmask(BLACKBIT));  /* open upvalues are never black */
       return;
     }
     case LUA_TFUNCTION: {
-      gco2cl(o)->c.gclist = g->gray;
-      g->gray = o;
+      linkto(g, gray, o, gco2cl(o)->c.gclist);
       break;
     }
     case LUA_TTABLE: {
-      gco2h(o)->gclist = g->gray;
-      g->gray = o;
+      linkto(g, gray, o, gco2h(o)->gclist);
       break;
     }
     case LUA_TTHREAD: {
-      gco2th(o)->gclist = g->gray;
-      g->gray = o;
+      linkto(g, gray, o, gco2th(o)->gclist);
       break;
     }
     case LUA_TPROTO: {
-      gco2p(o)->gclist = g->gray;
-      g->gray = o;
+      linkto(g, gray, o, gco2p(o)->gclist);
       break;
     }
     default: lua_assert(0);
@@ -131,6 +228,8 @@ size_t luaC_separateudata (lua_State *L, int all) {
   GCObject **p = &g->mainthread->next;
   GCObject *curr;
   while ((curr = *p) != NULL) {
+    if (isold(curr) && !all)
+      break;  /* generational mode: all the following ones are old too */
     if (!(iswhite(curr) || all) || isfinalized(gco2u(curr)))
       p = &curr->gch.next;  /* don't bother with them */
     else if (fasttm(L, gco2u(curr)->metatable, TM_GC) == NULL) {
@@ -167,11 +266,11 @@ static int traversetable (global_State *g, Table *h) {
     weakkey = (strchr(svalue(mode), 'k') != NULL);
     weakvalue = (strchr(svalue(mode), 'v') != NULL);
     if (weakkey || weakvalue) {  /* is really weak? */
-      h->marked &= ~(KEYWEAK | VALUEWEAK);  /* clear bits */
-      h->marked |= cast_byte((weakkey << KEYWEAKBIT) |
-                             (weakvalue << VALUEWEAKBIT));
-      h->gclist = g->weak;  /* must be cleared after GC, ... */
-      g->weak = obj2gco(h);  /* ... so put in the appropriate list */
+      clearmarks(obj2gco(h), KEYWEAK | VALUEWEAK);  /* clear bits */
+      setmarks(obj2gco(h), (weakkey << KEYWEAKBIT) |
+                           (weakvalue << VALUEWEAKBIT));
+      /* must be cleared after GC, so put in the appropriate list */
+      linkto(g, weak, obj2gco(h), h->gclist);
     }
   }
   if (weakkey && weakvalue) return 1;
@@ -217,6 +316,8 @@ static void traverseproto (global_State *g, Proto *f) {
     if (f->locvars[i].varname)
       stringmark(f->locvars[i].varname);
   }
+  for (i=0; i<f->sizeinlines; i++)  /* mark inlined functions */
+    markobject(g, f->inlines[i].f);
 }
 
 
@@ -238,6 +339,12 @@ static void traverseclosure (global_State *g, Closure *cl) {
 }
 
 
+/*
+** stacks are never shrunk with LUA_USE_LOCK: the OS thread running a
+** coroutine may be reading them in a C function or in an API call that
+** does not take the lock, while another one collects
+*/
+#if !defined(LUA_USE_LOCK)
 static void checkstacksizes (lua_State *L, StkId max) {
   int ci_used = cast_int(L->ci - L->base_ci);  /* number of `ci' in use */
   int s_used = cast_int(max - L->stack);  /* part of stack in use */
@@ -251,6 +358,7 @@ static void checkstacksizes (lua_State *L, StkId max) {
     luaD_reallocstack(L, L->stacksize/2);  /* still big enough... */
   condhardstacktests(luaD_reallocstack(L, s_used));
 }
+#endif
 
 
 static void traversestack (global_State *g, lua_State *l) {
@@ -266,39 +374,49 @@ static void traversestack (global_State *g, lua_State *l) {
     markvalue(g, o);
   for (; o <= lim; o++)
     setnilvalue(o);
-  checkstacksizes(l, lim);
+#if !defined(LUA_USE_LOCK)
+  if (!inparallel())  /* stacks cannot move while other threads mark */
+    checkstacksizes(l, lim);
+#endif
+}
+
+
+/* field that links a gray object into its list */
+static GCObject **gclistof (GCObject *o) {
+  switch (o->gch.tt) {
+    case LUA_TTABLE: return &gco2h(o)->gclist;
+    case LUA_TFUNCTION: return &gco2cl(o)->c.gclist;
+    case LUA_TTHREAD: return &gco2th(o)->gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    default: lua_assert(0); return NULL;
+  }
 }
 
 
 /*
-** traverse one gray object, turning it to black.
-** Returns `quantity' traversed.
+** traverse one gray object (already removed from its list), turning
+** it to black. Returns `quantity' traversed.
 */
-static l_mem propagatemark (global_State *g) {
-  GCObject *o = g->gray;
+static l_mem traverseobject (global_State *g, GCObject *o) {
   lua_assert(isgray(o));
-  gray2black(o);
+  setmarks(o, bitmask(BLACKBIT));
   switch (o->gch.tt) {
     case LUA_TTABLE: {
       Table *h = gco2h(o);
-      g->gray = h->gclist;
       if (traversetable(g, h))  /* table is weak? */
-        black2gray(o);  /* keep it gray */
+        clearmarks(o, bitmask(BLACKBIT));  /* keep it gray */
       return sizeof(Table) + sizeof(TValue) * h->sizearray +
                              sizeof(Node) * sizenode(h);
     }
     case LUA_TFUNCTION: {
       Closure *cl = gco2cl(o);
-      g->gray = cl->c.gclist;
       traverseclosure(g, cl);
       return (cl->c.isC) ? sizeCclosure(cl->c.nupvalues) :
                            sizeLclosure(cl->l.nupvalues);
     }
     case LUA_TTHREAD: {
       lua_State *th = gco2th(o);
-      g->gray = th->gclist;
-      th->gclist = g->grayagain;
-      g->grayagain = o;
+      linkto(g, grayagain, o, th->gclist);
       black2gray(o);
       traversestack(g, th);
       return sizeof(lua_State) + sizeof(TValue) * th->stacksize +
@@ -306,13 +424,14 @@ static l_mem propagatemark (global_State *g) {
     }
     case LUA_TPROTO: {
       Proto *p = gco2p(o);
-      g->gray = p->gclist;
       traverseproto(g, p);
       return sizeof(Proto) + sizeof(Instruction) * p->sizecode +
+                             sizeof(int) * p->sizecode +
                              sizeof(Proto *) * p->sizep +
                              sizeof(TValue) * p->sizek + 
                              sizeof(int) * p->sizelineinfo +
                              sizeof(LocVar) * p->sizelocvars +
+                             sizeof(InlineCall) * p->sizeinlines +
                              sizeof(TString *) * p->sizeupvalues;
     }
     default: lua_assert(0); return 0;
@@ -320,8 +439,239 @@ static l_mem propagatemark (global_State *g) {
 }
 
 
+static l_mem propagatemark (global_State *g) {
+  GCObject *o = g->gray;
+  g->gray = *gclistof(o);
+  return traverseobject(g, o);
+}
+
+
+#if defined(LUA_USE_PARALLELMARK)
+
+/*
+** {======================================================
+** Parallel marker
+** =======================================================
+*/
+
+/*
+** Each worker keeps its own gray list, which other workers may steal
+** from when they run out of work; weak tables and threads found by a
+** worker go to its own `weak' and `grayagain' lists, which are moved
+** to the global ones at the end of the mark. Worker 0 runs in the
+** thread that called the collector; the others have their own threads.
+*/
+static void workerloop (GCWorker *w) {
+  GCPool *p = w->pool;
+  int n = p->n;
+  int i;
+  worker = w;
+  for (;;) {
+    GCObject *o;
+    lockgray(w);
+    o = w->gray;
+    if (o) w->gray = *gclistof(o);
+    unlockgray(w);
+    for (i = 1; o == NULL && i < n; i++) {  /* try to steal some work */
+      GCWorker *v = &p->w[(w->id + i) % n];
+      lockgray(v);
+      o = v->gray;
+      if (o) v->gray = *gclistof(o);
+      unlockgray(v);
+      if (o) w->steals++;
+    }
+    if (o) {
+      w->bytes += traverseobject(p->g, o);
+      w->marked++;
+    }
+    else {  /* no work anywhere; wait until all workers are idle */
+      int more = 0;
+      __atomic_add_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+      while (__atomic_load_n(&p->idle, __ATOMIC_SEQ_CST) < n) {
+        for (i = 0; i < n && !more; i++) {
+          GCWorker *v = &p->w[i];
+          lockgray(v);
+          more = (v->gray != NULL);
+          unlockgray(v);
+        }
+        if (more) break;
+        sched_yield();
+      }
+      if (!more) break;  /* everybody is idle: marking is over */
+      __atomic_sub_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+    }
+  }
+  worker = NULL;
+}
+
+
+static void *workermain (void *ud) {
+  GCWorker *w = cast(GCWorker *, ud);
+  GCPool *p = w->pool;
+  unsigned long round = 0;
+  pthread_mutex_lock(&p->mutex);
+  for (;;) {
+    while (p->round == round && !p->quit)
+      pthread_cond_wait(&p->start, &p->mutex);
+    if (p->quit) break;
+    round = p->round;
+    pthread_mutex_unlock(&p->mutex);
+    workerloop(w);
+    pthread_mutex_lock(&p->mutex);
+    if (--p->running == 0)
+      pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->mutex);
+  return NULL;
+}
+
+
+/* move all objects from list `from' (linked by `gclist') to list `*to' */
+static void movelist (GCObject *from, GCObject **to) {
+  while (from) {
+    GCObject *next = *gclistof(from);
+    *gclistof(from) = *to;
+    *to = from;
+    from = next;
+  }
+}
+
+
+/* propagate marks from all gray objects, using all workers */
+static size_t parallelmark (global_State *g) {
+  GCPool *p = g->gcpool;
+  lu_mem bytes = 0;
+  int i;
+  for (i = 0; i < p->n; i++)
+    bytes -= p->w[i].bytes;
+  p->w[0].gray = g->gray;
+  g->gray = NULL;
+  p->idle = 0;
+  pthread_mutex_lock(&p->mutex);
+  p->round++;
+  p->running = p->n - 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->mutex);
+  workerloop(&p->w[0]);
+  pthread_mutex_lock(&p->mutex);
+  while (p->running > 0)
+    pthread_cond_wait(&p->done, &p->mutex);
+  pthread_mutex_unlock(&p->mutex);
+  for (i = 0; i < p->n; i++) {
+    GCWorker *w = &p->w[i];
+    lua_assert(w->gray == NULL);
+    movelist(w->weak, &g->weak);
+    movelist(w->grayagain, &g->grayagain);
+    w->weak = w->grayagain = NULL;
+    bytes += w->bytes;
+  }
+  return cast(size_t, bytes);
+}
+
+
+/* turn parallel marking on (resetting statistics) or off */
+static void setparallel (global_State *g, int on) {
+  GCPool *p = g->gcpool;
+  if (p == NULL) return;
+  if (on) {
+    int i;
+    for (i = 0; i < p->n; i++)
+      p->w[i].marked = p->w[i].bytes = p->w[i].steals = 0;
+  }
+  p->active = on;
+}
+
+
+static void stopworkers (lua_State *L, GCPool *p) {
+  int i;
+  pthread_mutex_lock(&p->mutex);
+  p->quit = 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->mutex);
+  for (i = 1; i < p->n; i++)
+    pthread_join(p->w[i].thread, NULL);
+  pthread_cond_destroy(&p->done);
+  pthread_cond_destroy(&p->start);
+  pthread_mutex_destroy(&p->mutex);
+  luaM_free(L, p, MEMOTHER);
+}
+
+
+int luaC_setworkers (lua_State *L, int n) {
+  global_State *g = G(L);
+  GCPool *p = g->gcpool;
+  int old = (p) ? p->n : 1;
+  if (n < 0) return old;  /* just a query */
+  if (p) {
+    g->gcpool = NULL;
+    stopworkers(L, p);
+  }
+  if (n > MAXWORKERS) n = MAXWORKERS;
+  if (n > 1) {
+    int i;
+    p = luaM_new(L, GCPool, MEMOTHER);
+    p->g = g;
+    p->n = 1;
+    p->round = 0;
+    p->running = p->idle = p->quit = p->active = 0;
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+    for (i = 0; i < n; i++) {
+      GCWorker *w = &p->w[i];
+      w->gray = w->weak = w->grayagain = NULL;
+      w->lock = 0;
+      w->marked = w->bytes = w->steals = 0;
+      w->pool = p;
+      w->id = i;
+      if (i > 0 && pthread_create(&w->thread, NULL, workermain, w) != 0)
+        break;  /* use the workers we already have */
+      p->n = i + 1;
+    }
+    g->gcpool = p;
+  }
+  return old;
+}
+
+
+int luaC_getworker (lua_State *L, int i, size_t *marked, size_t *bytes,
+                    size_t *steals) {
+  GCPool *p = G(L)->gcpool;
+  if (p == NULL || i < 0 || i >= p->n) return 0;
+  *marked = p->w[i].marked;
+  *bytes = p->w[i].bytes;
+  *steals = p->w[i].steals;
+  return 1;
+}
+
+/* }====================================================== */
+
+#else
+
+#define setparallel(g,on)	((void)0)
+
+
+int luaC_setworkers (lua_State *L, int n) {
+  UNUSED(L); UNUSED(n);
+  return -1;  /* not available */
+}
+
+
+int luaC_getworker (lua_State *L, int i, size_t *marked, size_t *bytes,
+                    size_t *steals) {
+  UNUSED(L); UNUSED(i); UNUSED(marked); UNUSED(bytes); UNUSED(steals);
+  return 0;
+}
+
+#endif
+
+
 static size_t propagateall (global_State *g) {
   size_t m = 0;
+#if defined(LUA_USE_PARALLELMARK)
+  if (g->gcpool && g->gcpool->active)
+    return parallelmark(g);
+#endif
   while (g->gray) m += propagatemark(g);
   return m;
 }
@@ -330,14 +680,20 @@ static size_t propagateall (global_State *g) {
 /*
 ** The next function tells whether a key or value can be cleared from
 ** a weak table. Non-collectable objects are never removed from weak
-** tables. Strings behave as `values', so are never removed too. for
-** other objects: if really collected, cannot keep them; for userdata
-** being finalized, keep them in keys, but not in values
+** tables. Strings (and ropes) behave as `values', so are never removed
+** too. for other objects: if really collected, cannot keep them; for
+** userdata being finalized, keep them in keys, but not in values
 */
 static int iscleared (const TValue *o, int iskey) {
   if (!iscollectable(o)) return 0;
-  if (ttisstring(o)) {
-    stringmark(rawtsvalue(o));  /* strings are `values', so are never weak */
+  if (ttisstring(o)) {  /* strings are `values', so are never weak */
+    if (testwhite(gcvalue(o)))  /* (and frozen ones are never white) */
+      stringmark(rawtsvalue(o));
+    return 0;
+  }
+  if (ttisrope(o)) {
+    if (testwhite(gcvalue(o)) && claimwhite(gcvalue(o)))
+      markrope(rpvalue(o));
     return 0;
   }
   return iswhite(gcvalue(o)) ||
@@ -388,11 +744,21 @@ static void freeobj (lua_State *L, GCObject *o) {
     }
     case LUA_TSTRING: {
       G(L)->strt.nuse--;
-      luaM_freemem(L, o, sizestring(gco2ts(o)));
+      luaM_freemem(L, o, sizestring(gco2ts(o)), MEMSTRING);
+      break;
+    }
+    case LUA_TLNGSTR: {  /* not in the string table */
+      luaM_freemem(L, o, sizestring(gco2ts(o)), MEMSTRING);
+      break;
+    }
+    case LUA_TROPE: {
+      Rope *r = gco2rp(o);
+      luaM_freearray(L, r->buff, r->size, char, MEMSTRING);
+      luaM_free(L, r, MEMSTRING);
       break;
     }
     case LUA_TUSERDATA: {
-      luaM_freemem(L, o, sizeudata(gco2u(o)));
+      luaM_freemem(L, o, sizeudata(gco2u(o)), MEMUDATA);
       break;
     }
     default: lua_assert(0);
@@ -442,6 +808,308 @@ static void checkSizes (lua_State *L) {
 }
 
 
+#if defined(LUA_USE_BGSWEEP)
+
+/*
+** {======================================================
+** Background sweeper
+** =======================================================
+*/
+
+#define BATCHSIZE	256
+
+typedef struct FreeBatch {
+  global_State *g;
+  int n;
+  lu_mem freed;  /* bytes freed in the current sweep */
+#if defined(LUA_USE_MEMSTATS)
+  MemStats stats;  /* blocks freed in the current sweep */
+#endif
+  void *blocks[BATCHSIZE];
+  size_t sizes[BATCHSIZE];
+} FreeBatch;
+
+typedef struct GCSweeper {
+  FreeBatch batch;
+  lua_State L;  /* used by the sweeper to free objects */
+  GCObject *list;  /* objects to sweep (the part of `rootgc' before the
+                      main thread) */
+  GCObject **tail;  /* end of `list' after the sweep */
+  GCObject *udata;  /* userdata to sweep */
+  GCObject *threads;  /* live threads found (linked by `gclist') */
+  GCObject *dead;  /* dead threads, to be freed by the collector */
+  int busy;  /* is there a sweep going on? (collector's thread only) */
+  int strdone;  /* string table is already swept */
+  int done;  /* whole sweep is finished */
+  int quit;
+  unsigned long round;  /* number of sweeps so far */
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t start;  /* signals a new sweep (or `quit') */
+  pthread_cond_t finish;  /* signals `strdone' and `done' */
+} GCSweeper;
+
+
+/* batch of blocks being freed by the current thread (NULL if none) */
+__thread FreeBatch *luaC_freebatch = NULL;
+
+
+static void flushbatch (FreeBatch *b) {
+  if (b->n > 0) {
+    global_State *g = b->g;
+    (*g->freebatch)(g->ud, b->blocks, b->sizes, b->n);
+    b->n = 0;
+  }
+}
+
+
+void luaC_batchfree (lua_State *L, void *block, size_t size) {
+  FreeBatch *b = luaC_freebatch;
+  if (b->n == BATCHSIZE)
+    flushbatch(b);
+  b->blocks[b->n] = block;
+  b->sizes[b->n++] = size;
+  b->freed += size;
+#if defined(LUA_USE_MEMSTATS)
+  luaM_countmem(&b->stats, L->memkind, size, 0);
+#else
+  UNUSED(L);
+#endif
+}
+
+
+/*
+** sweep list `p' up to object `stop'. Threads are not swept here: their
+** open upvalues belong to the collector's thread, which sweeps them (and
+** frees the dead threads) when the sweep is over. All other objects are
+** freed into the sweeper's batch.
+*/
+static GCObject **bgsweeplist (GCSweeper *s, GCObject **p, GCObject *stop) {
+  global_State *g = s->batch.g;
+  int deadmask = otherwhite(g);
+  GCObject *curr;
+  while ((curr = *p) != stop) {
+    lu_byte marked = curr->gch.marked;
+    if ((marked ^ WHITEBITS) & deadmask) {  /* not dead? */
+      marked = cast_byte((marked & maskmarks) | luaC_white(g));
+      __atomic_store_n(&curr->gch.marked, marked, __ATOMIC_RELAXED);
+      if (curr->gch.tt == LUA_TTHREAD) {
+        gco2th(curr)->gclist = s->threads;
+        s->threads = curr;
+      }
+      p = &curr->gch.next;
+    }
+    else {
+      *p = curr->gch.next;
+      if (curr->gch.tt == LUA_TTHREAD) {
+        curr->gch.next = s->dead;
+        s->dead = curr;
+      }
+      else
+        freeobj(&s->L, curr);
+    }
+  }
+  return p;
+}
+
+
+static void setflag (GCSweeper *s, int *flag) {
+  pthread_mutex_lock(&s->mutex);
+  __atomic_store_n(flag, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&s->finish);
+  pthread_mutex_unlock(&s->mutex);
+}
+
+
+static void waitflag (GCSweeper *s, int *flag) {
+  if (!__atomic_load_n(flag, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&s->mutex);
+    while (!__atomic_load_n(flag, __ATOMIC_ACQUIRE))
+      pthread_cond_wait(&s->finish, &s->mutex);
+    pthread_mutex_unlock(&s->mutex);
+  }
+}
+
+
+static void *sweepermain (void *ud) {
+  GCSweeper *s = cast(GCSweeper *, ud);
+  global_State *g = s->batch.g;
+  unsigned long round = 0;
+  luaC_freebatch = &s->batch;
+  pthread_mutex_lock(&s->mutex);
+  for (;;) {
+    int i;
+    while (s->round == round && !s->quit)
+      pthread_cond_wait(&s->start, &s->mutex);
+    if (s->quit) break;
+    round = s->round;
+    pthread_mutex_unlock(&s->mutex);
+    for (i = 0; i < nstrchains(&g->strt); i++)
+      bgsweeplist(s, strchain(&g->strt, i), NULL);
+    setflag(s, &s->strdone);
+    s->tail = bgsweeplist(s, &s->list, obj2gco(g->mainthread));
+    bgsweeplist(s, &s->udata, NULL);
+    flushbatch(&s->batch);
+    setflag(s, &s->done);
+    pthread_mutex_lock(&s->mutex);
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return NULL;
+}
+
+
+#define usesweeper(g)	((g)->gcsweeper != NULL && (g)->gckind == KGC_NORMAL)
+#define sweepinbackground(g)	((g)->gcsweeper != NULL && (g)->gcsweeper->busy)
+
+
+/*
+** hand the sweep phase to the sweeper. The objects created until the
+** end of the sweep go to new (empty) lists, so the sweeper owns the old
+** ones and can change their links without locks.
+*/
+static void startsweep (lua_State *L) {
+  global_State *g = G(L);
+  GCSweeper *s = g->gcsweeper;
+  lua_assert(g->gcstate == GCSsweepstring && !s->busy);
+  s->list = g->rootgc;
+  g->rootgc = obj2gco(g->mainthread);
+  s->udata = g->mainthread->next;
+  g->mainthread->next = NULL;
+  s->threads = s->dead = NULL;
+  s->batch.freed = 0;
+#if defined(LUA_USE_MEMSTATS)
+  memset(&s->batch.stats, 0, sizeof(s->batch.stats));
+#endif
+  s->strdone = s->done = 0;
+  s->busy = 1;
+  pthread_mutex_lock(&s->mutex);
+  s->round++;
+  pthread_cond_signal(&s->start);
+  pthread_mutex_unlock(&s->mutex);
+  g->gcstate = GCSsweep;
+}
+
+
+/*
+** finish a background sweep, if it is over (or if `wait' is true):
+** link back the surviving objects and do the work left to this thread
+*/
+static int endsweep (lua_State *L, int wait) {
+  global_State *g = G(L);
+  GCSweeper *s = g->gcsweeper;
+  lu_mem old = g->totalbytes;
+  GCObject **p;
+  lua_assert(s->busy && g->gcstate == GCSsweep);
+  if (wait)
+    waitflag(s, &s->done);
+  else if (!__atomic_load_n(&s->done, __ATOMIC_ACQUIRE))
+    return 0;
+  s->busy = 0;
+  *s->tail = g->rootgc;  /* new objects go after the survivors */
+  g->rootgc = s->list;
+  for (p = &g->mainthread->next; *p != NULL; p = &(*p)->gch.next) ;
+  *p = s->udata;  /* old userdata go after the new ones */
+  g->totalbytes -= s->batch.freed;
+#if defined(LUA_USE_MEMSTATS)
+  luaM_addstats(&g->memstats, &s->batch.stats);
+#endif
+  while (s->dead) {
+    GCObject *o = s->dead;
+    s->dead = o->gch.next;
+    freeobj(L, o);
+  }
+  while (s->threads) {
+    lua_State *th = gco2th(s->threads);
+    s->threads = th->gclist;
+    sweepwholelist(L, &th->openupval);
+  }
+  sweepwholelist(L, &g->mainthread->openupval);
+  makewhite(g, obj2gco(g->mainthread));
+  lua_assert(old >= g->totalbytes);
+  g->estimate -= old - g->totalbytes;
+  checkSizes(L);
+  g->gcstate = GCSfinalize;
+  return 1;
+}
+
+
+void luaC_waitstrings (lua_State *L) {
+  GCSweeper *s = G(L)->gcsweeper;
+  if (s->busy)
+    waitflag(s, &s->strdone);
+}
+
+
+void luaC_finishsweep (lua_State *L) {
+  if (sweepinbackground(G(L)))
+    endsweep(L, 1);
+}
+
+
+int luaC_bgsweep (lua_State *L, int on) {
+  global_State *g = G(L);
+  GCSweeper *s = g->gcsweeper;
+  int old = (s != NULL);
+  if (on < 0 || on == old) return old;
+  if (s) {  /* turn it off */
+    luaC_finishsweep(L);
+    pthread_mutex_lock(&s->mutex);
+    s->quit = 1;
+    pthread_cond_signal(&s->start);
+    pthread_mutex_unlock(&s->mutex);
+    pthread_join(s->thread, NULL);
+    pthread_cond_destroy(&s->finish);
+    pthread_cond_destroy(&s->start);
+    pthread_mutex_destroy(&s->mutex);
+    g->gcsweeper = NULL;
+    luaM_free(L, s, MEMOTHER);
+  }
+  else {
+    if (g->freebatch == NULL) return -1;  /* cannot free from other threads */
+    s = luaM_new(L, GCSweeper, MEMOTHER);
+    s->batch.g = g;
+    s->batch.n = 0;
+    s->L.l_G = g;
+    s->busy = s->quit = 0;
+    s->round = 0;
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->start, NULL);
+    pthread_cond_init(&s->finish, NULL);
+    if (pthread_create(&s->thread, NULL, sweepermain, s) != 0) {
+      pthread_cond_destroy(&s->finish);
+      pthread_cond_destroy(&s->start);
+      pthread_mutex_destroy(&s->mutex);
+      luaM_free(L, s, MEMOTHER);
+      return -1;
+    }
+    g->gcsweeper = s;
+  }
+  return old;
+}
+
+/* }====================================================== */
+
+#else
+
+#define usesweeper(g)	0
+#define sweepinbackground(g)	0
+#define startsweep(L)	((void)0)
+#define endsweep(L,w)	1
+
+
+void luaC_finishsweep (lua_State *L) {
+  UNUSED(L);
+}
+
+
+int luaC_bgsweep (lua_State *L, int on) {
+  UNUSED(L); UNUSED(on);
+  return -1;  /* not available */
+}
+
+#endif
+
+
 static void GCTM (lua_State *L) {
   global_State *g = G(L);
   GCObject *o = g->tmudata->gch.next;  /* get first element */
@@ -485,8 +1153,8 @@ void luaC_freeall (lua_State *L) {
   int i;
   g->currentwhite = WHITEBITS | bitmask(SFIXEDBIT);  /* mask to collect all elements */
   sweepwholelist(L, &g->rootgc);
-  for (i = 0; i < g->strt.size; i++)  /* free all string lists */
-    sweepwholelist(L, &g->strt.hash[i]);
+  for (i = 0; i < nstrchains(&g->strt); i++)  /* free all string lists */
+    sweepwholelist(L, strchain(&g->strt, i));
 }
 
 
@@ -553,6 +1221,106 @@ static void atomic (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Generational mode
+** =======================================================
+*/
+
+/*
+** sweep the young part of a list, freeing dead objects and turning the
+** other ones old (their colors are kept, so they stay marked). New
+** objects are always linked at the head of their lists, so the sweep
+** can stop at the first old object.
+*/
+static void sweepgen (lua_State *L, GCObject **p) {
+  GCObject *curr;
+  global_State *g = G(L);
+  int deadmask = otherwhite(g);
+  while ((curr = *p) != NULL && !isold(curr)) {
+    if (curr->gch.tt == LUA_TTHREAD)  /* sweep open upvalues of each thread */
+      sweepgen(L, &gco2th(curr)->openupval);
+    if ((curr->gch.marked ^ WHITEBITS) & deadmask) {  /* not dead? */
+      l_setbit(curr->gch.marked, OLDBIT);
+      p = &curr->gch.next;
+    }
+    else {  /* must erase `curr' */
+      *p = curr->gch.next;
+      if (curr == g->rootgc)  /* is the first element of the list? */
+        g->rootgc = curr->gch.next;  /* adjust first */
+      freeobj(L, curr);
+    }
+  }
+}
+
+
+static void whitenlist (global_State *g, GCObject *o) {
+  for (; o != NULL; o = o->gch.next) {
+    if (o->gch.tt == LUA_TTHREAD)
+      whitenlist(g, gco2th(o)->openupval);
+    makewhite(g, o);
+  }
+}
+
+
+/* make all objects white and young again, and empty the gray lists */
+static void whitenall (global_State *g) {
+  int i;
+  whitenlist(g, g->rootgc);
+  for (i = 0; i < nstrchains(&g->strt); i++)
+    whitenlist(g, *strchain(&g->strt, i));
+  g->gray = NULL;
+  g->grayagain = NULL;
+  g->weak = NULL;
+}
+
+
+/*
+** Do a whole collection in generational mode. Old objects stay marked
+** between collections, so a minor collection only traverses the young
+** objects reachable from the roots and from `grayagain', which keeps
+** the old objects that may point to young ones: threads, weak tables
+** and the tables caught by `luaC_barrierback' (`luaC_barrierf' marks
+** its young objects right away). A major collection first makes every
+** object young again.
+*/
+static void gencollection (lua_State *L, int major) {
+  global_State *g = G(L);
+  int i;
+  lua_assert(g->gckind == KGC_GEN && g->gcstate == GCSpropagate);
+  if (major)
+    whitenall(g);
+  markobject(g, g->mainthread);
+  markvalue(g, gt(g->mainthread));
+  markvalue(g, registry(L));
+  markmt(g);
+  setparallel(g, major);
+  propagateall(g);
+  atomic(L);
+  setparallel(g, 0);
+  for (i = 0; i < nstrchains(&g->strt); i++)
+    sweepgen(L, strchain(&g->strt, i));
+  g->gcstate = GCSsweep;
+  sweepgen(L, &g->rootgc);
+  sweepgen(L, &g->mainthread->next);  /* userdata */
+  checkSizes(L);
+  while (g->weak) {  /* weak tables must be cleared after each collection */
+    GCObject *o = g->weak;
+    g->weak = gco2h(o)->gclist;
+    gco2h(o)->gclist = g->grayagain;
+    g->grayagain = o;
+  }
+  g->gcstate = GCSpropagate;
+  g->estimate = g->totalbytes;
+  if (major)
+    g->lastmajor = g->totalbytes;
+  g->GCthreshold = g->totalbytes + (g->totalbytes/100) * g->gcminor;
+  luaC_callGCTM(L);
+}
+
+/* }====================================================== */
+
+
 static l_mem singlestep (lua_State *L) {
   global_State *g = G(L);
   /*lua_checkmemory(L);*/
@@ -571,8 +1339,12 @@ static l_mem singlestep (lua_State *L) {
     }
     case GCSsweepstring: {
       lu_mem old = g->totalbytes;
-      sweepwholelist(L, &g->strt.hash[g->sweepstrgc++]);
-      if (g->sweepstrgc >= g->strt.size)  /* nothing more to sweep? */
+      if (usesweeper(g)) {  /* sweep in the background? */
+        startsweep(L);
+        return GCSWEEPCOST;
+      }
+      sweepwholelist(L, strchain(&g->strt, g->sweepstrgc));
+      if (++g->sweepstrgc >= nstrchains(&g->strt))  /* nothing more? */
         g->gcstate = GCSsweep;  /* end sweep-string phase */
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
@@ -580,13 +1352,15 @@ static l_mem singlestep (lua_State *L) {
     }
     case GCSsweep: {
       lu_mem old = g->totalbytes;
+      if (sweepinbackground(g))  /* only check whether it is over */
+        return endsweep(L, 0) ? GCSWEEPCOST : GCSWEEPMAX*GCSWEEPCOST;
       g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
+      lua_assert(old >= g->totalbytes);
+      g->estimate -= old - g->totalbytes;
       if (*g->sweepgc == NULL) {  /* nothing more to sweep? */
-        checkSizes(L);
+        checkSizes(L);  /* (may allocate a new string table) */
         g->gcstate = GCSfinalize;  /* end sweep phase */
       }
-      lua_assert(old >= g->totalbytes);
-      g->estimate -= old - g->totalbytes;
       return GCSWEEPMAX*GCSWEEPCOST;
     }
     case GCSfinalize: {
@@ -610,6 +1384,11 @@ static l_mem singlestep (lua_State *L) {
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
   l_mem lim = (GCSTEPSIZE/100) * g->gcstepmul;
+  if (g->gckind == KGC_GEN) {
+    /* do a major collection when memory grew `gcpause' since the last one */
+    gencollection(L, g->estimate > (g->lastmajor/100) * g->gcpause);
+    return;
+  }
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
   g->gcdept += g->totalbytes - g->GCthreshold;
@@ -634,6 +1413,10 @@ void luaC_step (lua_State *L) {
 
 void luaC_fullgc (lua_State *L) {
   global_State *g = G(L);
+  if (g->gckind == KGC_GEN) {
+    gencollection(L, 1);
+    return;
+  }
   if (g->gcstate <= GCSpropagate) {
     /* reset sweep marks to sweep all elements (returning them to white) */
     g->sweepstrgc = 0;
@@ -649,24 +1432,54 @@ void luaC_fullgc (lua_State *L) {
   while (g->gcstate != GCSfinalize) {
     lua_assert(g->gcstate == GCSsweepstring || g->gcstate == GCSsweep);
     singlestep(L);
+    luaC_finishsweep(L);  /* wait for the sweeper, if it is running */
   }
   markroot(L);
+  setparallel(g, 1);
+  propagateall(g);
+  atomic(L);
+  setparallel(g, 0);
   while (g->gcstate != GCSpause) {
     singlestep(L);
+    luaC_finishsweep(L);
   }
   setthreshold(g);
 }
 
 
+int luaC_changemode (lua_State *L, int kind) {
+  global_State *g = G(L);
+  int old = g->gckind;
+  if (kind == old) return old;
+  luaC_finishsweep(L);
+  if (kind == KGC_GEN) {
+    /* abandon the current cycle, if any, and start with a major collection */
+    g->gckind = KGC_GEN;
+    g->gcstate = GCSpropagate;
+    gencollection(L, 1);
+  }
+  else {
+    whitenall(g);  /* forget all ages and marks */
+    g->gckind = KGC_NORMAL;
+    g->gcstate = GCSpause;
+    g->gcdept = 0;
+    setthreshold(g);
+  }
+  return old;
+}
+
+
 void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
-  lua_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
+  /* (the sweeper may be whitening `o' and `v' while they are tested) */
+  lua_assert(sweepinbackground(g) ||
+             (isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o)));
   lua_assert(g->gcstate != GCSfinalize && g->gcstate != GCSpause);
   lua_assert(ttype(&o->gch) != LUA_TTABLE);
   /* must keep invariant? */
   if (g->gcstate == GCSpropagate)
     reallymarkobject(g, v);  /* restore invariant */
-  else  /* don't mind */
+  else if (!sweepinbackground(g))  /* don't mind */
     makewhite(g, o);  /* mark as white just to avoid other barriers */
 }
 
@@ -674,8 +1487,10 @@ void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v) {
 void luaC_barrierback (lua_State *L, Table *t) {
   global_State *g = G(L);
   GCObject *o = obj2gco(t);
-  lua_assert(isblack(o) && !isdead(g, o));
   lua_assert(g->gcstate != GCSfinalize && g->gcstate != GCSpause);
+  if (sweepinbackground(g))  /* `o' belongs to the sweeper */
+    return;  /* it will be white after the sweep anyway */
+  lua_assert(isblack(o) && !isdead(g, o));
   black2gray(o);  /* make table gray (again) */
   t->gclist = g->grayagain;
   g->grayagain = o;
@@ -696,6 +1511,7 @@ void luaC_linkupval (lua_State *L, UpVal *uv) {
   GCObject *o = obj2gco(uv);
   o->gch.next = g->rootgc;  /* link upvalue into `rootgc' list */
   g->rootgc = o;
+  resetbit(o->gch.marked, OLDBIT);  /* it is now in the young part of it */
   if (isgray(o)) { 
     if (g->gcstate == GCSpropagate) {
       gray2black(o);  /* closed upvalues need barrier */
@@ -21,6 +21,14 @@
 #define GCSfinalize	4
 
 
+/*
+** Kinds of collector: in generational mode the collector rests in
+** GCSpropagate between collections, and each collection is atomic
+*/
+#define KGC_NORMAL	0
+#define KGC_GEN		1
+
+
 /*
 ** some userful bit tricks
 */
@@ -48,6 +56,7 @@
 ** bit 4 - for tables: has weak values
 ** bit 5 - object is fixed (should not be collected)
 ** bit 6 - object is "super" fixed (only the main thread)
+** bit 7 - object is old (survived a generational collection)
 */
 
 
@@ -59,12 +68,35 @@
 #define VALUEWEAKBIT	4
 #define FIXEDBIT	5
 #define SFIXEDBIT	6
+#define OLDBIT		7
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
 
 
-#define iswhite(x)      test2bits((x)->gch.marked, WHITE0BIT, WHITE1BIT)
-#define isblack(x)      testbit((x)->gch.marked, BLACKBIT)
+#if defined(LUA_USE_BGSWEEP)
+/* the sweeper thread may be whitening the object being tested */
+#define gcmarks(x)	__atomic_load_n(&(x)->gch.marked, __ATOMIC_RELAXED)
+#else
+#define gcmarks(x)	((x)->gch.marked)
+#endif
+
+#define iswhite(x)      test2bits(gcmarks(x), WHITE0BIT, WHITE1BIT)
+#define isblack(x)      testbit(gcmarks(x), BLACKBIT)
 #define isgray(x)	(!isblack(x) && !iswhite(x))
+#define isold(x)	testbit((x)->gch.marked, OLDBIT)
+
+#if defined(LUA_USE_FROZEN)
+/*
+** objects of a frozen region (see lfrozen.c) are black, fixed and never
+** white, so the collector never marks, sweeps or writes them; besides
+** the main thread of each state, which is never frozen, they are the
+** only objects with SFIXEDBIT
+*/
+#define FROZENBITS	(bitmask(BLACKBIT) | bit2mask(FIXEDBIT, SFIXEDBIT))
+#define isfrozen(x)	(testbit(gcmarks(x), SFIXEDBIT) && \
+			 (x)->gch.tt != LUA_TTHREAD)
+#else
+#define isfrozen(x)	0
+#endif
 
 #define otherwhite(g)	(g->currentwhite ^ WHITEBITS)
 #define isdead(g,v)	((v)->gch.marked & otherwhite(g) & WHITEBITS)
@@ -77,6 +109,14 @@
 #define luaC_white(g)	cast(lu_byte, (g)->currentwhite & WHITEBITS)
 
 
+#if defined(LUA_USE_BGSWEEP)
+/* new strings must wait until the sweeper is done with the string table */
+#define luaC_checkstrings(L)	{ if (G(L)->gcsweeper) luaC_waitstrings(L); }
+#else
+#define luaC_checkstrings(L)	((void)0)
+#endif
+
+
 #define luaC_checkGC(L) { \
   condhardstacktests(luaD_reallocstack(L, L->stacksize - EXTRA_STACK - 1)); \
   if (G(L)->totalbytes >= G(L)->GCthreshold) \
@@ -101,10 +141,22 @@ LUAI_FUNC void luaC_callGCTM (lua_State *L);
 LUAI_FUNC void luaC_freeall (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_fullgc (lua_State *L);
+LUAI_FUNC int luaC_changemode (lua_State *L, int kind);
+LUAI_FUNC int luaC_setworkers (lua_State *L, int n);
+LUAI_FUNC int luaC_getworker (lua_State *L, int i, size_t *marked,
+                              size_t *bytes, size_t *steals);
+LUAI_FUNC int luaC_bgsweep (lua_State *L, int on);
+LUAI_FUNC void luaC_finishsweep (lua_State *L);
 LUAI_FUNC void luaC_link (lua_State *L, GCObject *o, lu_byte tt);
 LUAI_FUNC void luaC_linkupval (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback (lua_State *L, Table *t);
 
+#if defined(LUA_USE_BGSWEEP)
+LUAI_DATA __thread struct FreeBatch *luaC_freebatch;
+LUAI_FUNC void luaC_batchfree (lua_State *L, void *block, size_t size);
+LUAI_FUNC void luaC_waitstrings (lua_State *L);
+#endif
+
 
 #endif
@@ -23,6 +23,12 @@ static const luaL_Reg lualibs[] = {
   {LUA_STRLIBNAME, luaopen_string},
   {LUA_MATHLIBNAME, luaopen_math},
   {LUA_DBLIBNAME, luaopen_debug},
+#if defined(LUA_USE_CHANNEL)
+  {LUA_CHANLIBNAME, luaopen_channel},
+#endif
+#if defined(LUA_USE_SCHEDULER)
+  {LUA_SCHEDLIBNAME, luaopen_scheduler},
+#endif
   {NULL, NULL}
 };
 
@@ -0,0 +1,821 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler from Lua bytecode to x86-64 machine code
+** See Copyright Notice in lua.h
+*/
+
+
+#include <stddef.h>
+#include <string.h>
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#if defined(LUA_USE_JIT)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "lgc.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "lvm.h"
+
+
+#if !defined(LUA_NUMBER_DOUBLE)
+#error "the JIT compiler needs doubles as numbers (see LUA_NUMBER)"
+#endif
+
+
+/*
+** Each instruction of a compiled function becomes a piece of machine
+** code that works directly on the Lua stack, so the interpreter and the
+** native code can hand a running function over to each other at any
+** instruction (`luaJ_run' enters the code of a given instruction).
+** Moves, constants, upvalues, jumps and tests are done in line, and so
+** are integer `for' loops and the usual cases of arithmetic, comparisons
+** and indexing of array parts; everything else calls `luaV_jitop', which
+** runs one instruction as the interpreter does. Calls and returns go back
+** to `luaV_execute' (native code returns the address of the instruction),
+** so CallInfos, coroutines and call hooks work as always; backward jumps
+** also go back when there are line or count hooks (or, with LUA_USE_LOCK,
+** when another thread asks for the lock).
+**
+** While native code runs, rbx keeps `L', r12 keeps `base', r13 keeps the
+** closure and r14 keeps the bytecode (to compute `savedpc').
+*/
+
+
+struct JitCode {
+  unsigned char *mcode;  /* machine code (the entry is at offset 0) */
+  size_t size;  /* size of the mapping of `mcode' */
+  unsigned int *map;  /* offset in `mcode' of each instruction */
+};
+
+typedef const Instruction *(*JitEntry) (lua_State *L, LClosure *cl,
+                                        const unsigned char *code);
+
+
+/* size of a JitCode (with its map) for `n' instructions */
+#define jitcodesize(n)	(sizeof(struct JitCode) + (n)*sizeof(unsigned int))
+
+/* most bytes taken by the code of one instruction (and by the prologue) */
+#define MAXINSTRSIZE	512
+
+
+/* registers */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define RL	RBX
+#define RBASE	R12
+#define RCL	R13
+#define RCODE	R14
+
+/* conditions (-1 is an unconditional jump) */
+#define CC_O	0x0
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_A	0x7
+#define CC_L	0xc
+#define CC_LE	0xe
+#define CC_JMP	(-1)
+
+
+/* offset of register `r' from base and of the tag in a TValue */
+#define slot(r)		cast_int((r) * sizeof(TValue))
+#define TTOFS		cast_int(offsetof(TValue, tt))
+
+
+typedef struct JitState {
+  Proto *p;
+  struct JitCode *jc;
+  unsigned char *code;  /* where machine code is written */
+  size_t n;  /* bytes written so far */
+  size_t exit;  /* offset of the code that returns to the interpreter */
+  int pc;  /* instruction being compiled */
+} JitState;
+
+
+/* list of jumps to a place not yet known */
+typedef struct Label {
+  int n;
+  size_t at[8];  /* offset after each jump */
+} Label;
+
+
+
+/*
+** {======================================================
+** Encoding of instructions
+** =======================================================
+*/
+
+
+static void b1 (JitState *J, int b) {
+  J->code[J->n++] = cast(unsigned char, b);
+}
+
+
+static void b4 (JitState *J, unsigned int u) {
+  int i;
+  for (i = 0; i < 4; i++, u >>= 8)
+    b1(J, cast_int(u & 0xff));
+}
+
+
+static void b8 (JitState *J, size_t u) {
+  int i;
+  for (i = 0; i < 8; i++, u >>= 8)
+    b1(J, cast_int(u & 0xff));
+}
+
+
+static void rex (JitState *J, int w, int reg, int rm) {
+  int r = (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+  if (r) b1(J, 0x40 | r);
+}
+
+
+static void opcode (JitState *J, int op) {
+  if (op > 0xff) b1(J, op >> 8);
+  b1(J, op & 0xff);
+}
+
+
+/* instruction with a register and the memory operand [base+disp] */
+static void opm (JitState *J, int pfx, int w, int op, int reg, int base,
+                 int disp) {
+  if (pfx) b1(J, pfx);  /* mandatory prefix goes before REX */
+  rex(J, w, reg, base);
+  opcode(J, op);
+  b1(J, 0x80 | ((reg & 7) << 3) | (base & 7));  /* 32-bit displacement */
+  if ((base & 7) == RSP) b1(J, 0x24);  /* rsp and r12 need a SIB byte */
+  b4(J, cast(unsigned int, disp));
+}
+
+
+/* instruction with two register operands */
+static void opr (JitState *J, int w, int op, int reg, int rm) {
+  rex(J, w, reg, rm);
+  opcode(J, op);
+  b1(J, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+#define ld(J,r,b,d)	opm(J, 0, 1, 0x8b, r, b, d)	/* mov r, [b+d] */
+#define st(J,r,b,d)	opm(J, 0, 1, 0x89, r, b, d)	/* mov [b+d], r */
+#define ld32(J,r,b,d)	opm(J, 0, 0, 0x8b, r, b, d)	/* mov r32, [b+d] */
+#define mov(J,d,s)	opr(J, 1, 0x89, s, d)		/* mov d, s */
+#define cmp32i(J,r,x)	(opr(J, 0, 0x83, 7, r), b1(J, x))  /* cmp r32, x */
+#define test(J,r)	opr(J, 1, 0x85, r, r)		/* test r, r */
+
+
+static void movimm (JitState *J, int r, size_t u) {  /* mov r, imm64 */
+  rex(J, 1, 0, r);
+  b1(J, 0xb8 + (r & 7));
+  b8(J, u);
+}
+
+
+/* lea r, [address of instruction `pc'] */
+static void leapc (JitState *J, int r, int pc) {
+  opm(J, 0, 1, 0x8d, r, RCODE, pc * cast_int(sizeof(Instruction)));
+}
+
+
+/* set the tag of the TValue at [base+disp] */
+static void settt (JitState *J, int base, int disp, int tt) {
+  opm(J, 0, 0, 0xc7, 0, base, disp + TTOFS);
+  b4(J, cast(unsigned int, tt));
+}
+
+
+/* compare the tag of the TValue at [base+disp] with `tt' */
+static void cmptt (JitState *J, int base, int disp, int tt) {
+  opm(J, 0, 0, 0x81, 7, base, disp + TTOFS);
+  b4(J, cast(unsigned int, tt));
+}
+
+
+/* copy a TValue (through xmm0) */
+static void copy (JitState *J, int sbase, int sdisp, int dbase, int ddisp) {
+  opm(J, 0xf3, 0, 0x0f6f, 0, sbase, sdisp);  /* movdqu xmm0, [s] */
+  opm(J, 0xf3, 0, 0x0f7f, 0, dbase, ddisp);  /* movdqu [d], xmm0 */
+}
+
+
+/* jump (if `cc') to a place given later; returns the offset after it */
+static size_t jcc (JitState *J, int cc) {
+  if (cc == CC_JMP)
+    b1(J, 0xe9);
+  else {
+    b1(J, 0x0f);
+    b1(J, 0x80 | cc);
+  }
+  b4(J, 0);
+  return J->n;
+}
+
+
+static void patch (JitState *J, size_t at, size_t to) {
+  size_t n = J->n;
+  J->n = at - 4;
+  b4(J, cast(unsigned int, to - at));
+  J->n = n;
+}
+
+
+static void tolabel (JitState *J, Label *l, int cc) {
+  lua_assert(l->n < cast_int(sizeof(l->at)/sizeof(l->at[0])));
+  l->at[l->n++] = jcc(J, cc);
+}
+
+
+static void here (JitState *J, Label *l) {
+  int i;
+  for (i = 0; i < l->n; i++)
+    patch(J, l->at[i], J->n);
+  l->n = 0;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Code generation
+** =======================================================
+*/
+
+
+/* jump (if `cc') to the code of instruction `pc' */
+static void jumppc (JitState *J, int cc, int pc) {
+  patch(J, jcc(J, cc), J->jc->map[pc]);  /* map is known in second pass */
+}
+
+
+/* go back to the interpreter, which will run instruction `pc' */
+static void exitto (JitState *J, int pc) {
+  leapc(J, RAX, pc);
+  patch(J, jcc(J, CC_JMP), J->exit);
+}
+
+
+/*
+** go on at instruction `pc'; a backward jump checks for hooks first (and
+** for a thread asking for the lock, which the interpreter lets run)
+*/
+static void gotopc (JitState *J, int pc) {
+  if (pc <= J->pc) {
+    leapc(J, RAX, pc);
+    opm(J, 0, 0, 0xf6, 0, RL, cast_int(offsetof(lua_State, hookmask)));
+    b1(J, LUA_MASKLINE | LUA_MASKCOUNT);  /* test byte [hookmask], mask */
+    patch(J, jcc(J, CC_NE), J->exit);
+#if defined(LUA_USE_LOCK)
+    ld(J, RCX, RL, cast_int(offsetof(lua_State, l_G)));
+    opm(J, 0, 0, 0x83, 7, RCX, cast_int(offsetof(global_State, lockdrop)));
+    b1(J, 0);  /* cmp dword [rcx+lockdrop], 0 */
+    patch(J, jcc(J, CC_NE), J->exit);
+#endif
+  }
+  jumppc(J, CC_JMP, pc);
+}
+
+
+/* run the current instruction with `luaV_jitop' */
+static void callop (JitState *J) {
+  mov(J, RDI, RL);
+  leapc(J, RSI, J->pc);
+  movimm(J, RAX, cast(size_t, luaV_jitop));
+  b1(J, 0xff); b1(J, 0xd0);  /* call rax */
+  ld(J, RBASE, RL, cast_int(offsetof(lua_State, base)));  /* may change */
+}
+
+
+/* `callop' for a jump: go on at `next' or (if it jumped) at `target' */
+static void branchop (JitState *J, int next, int target) {
+  callop(J);
+  leapc(J, RCX, next);
+  opr(J, 1, 0x39, RCX, RAX);  /* cmp rax, rcx */
+  jumppc(J, CC_E, next);
+  gotopc(J, target);
+}
+
+
+/* point [*base+*disp] at RK operand `x' (loading constants into `r') */
+static void rkopnd (JitState *J, int x, int r, int *base, int *disp) {
+  if (ISK(x)) {
+    movimm(J, r, cast(size_t, &J->p->k[INDEXK(x)]));
+    *base = r;
+    *disp = 0;
+  }
+  else {
+    *base = RBASE;
+    *disp = slot(x);
+  }
+}
+
+
+/* jump to `f' if the value at [base+disp] is false (nil or false) */
+static void isfalse (JitState *J, int base, int disp, Label *f) {
+  Label t;
+  t.n = 0;
+  ld32(J, RCX, base, disp + TTOFS);
+  opr(J, 0, 0x85, RCX, RCX);  /* nil? */
+  tolabel(J, f, CC_E);
+  cmp32i(J, RCX, LUA_TBOOLEAN);
+  tolabel(J, &t, CC_NE);
+  opm(J, 0, 0, 0x81, 7, base, disp);  /* cmp dword [value], 0 */
+  b4(J, 0);
+  tolabel(J, f, CC_E);
+  here(J, &t);
+}
+
+
+static void arith (JitState *J, Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  int ra = slot(GETARG_A(i));
+  int bb, bd, cb, cd;
+  Label flt, slow, done;
+  flt.n = slow.n = done.n = 0;
+  rkopnd(J, GETARG_B(i), RSI, &bb, &bd);
+  rkopnd(J, GETARG_C(i), RDI, &cb, &cd);
+  if (op != OP_DIV) {  /* two integers? */
+    cmptt(J, bb, bd, LUA_TNUMINT);
+    tolabel(J, &flt, CC_NE);
+    cmptt(J, cb, cd, LUA_TNUMINT);
+    tolabel(J, &flt, CC_NE);
+    ld(J, RAX, bb, bd);
+    opm(J, 0, 1, (op == OP_ADD) ? 0x03 : (op == OP_SUB) ? 0x2b : 0x0faf,
+        RAX, cb, cd);
+    tolabel(J, &slow, CC_O);  /* overflow */
+    if (op == OP_MUL) {  /* a zero may have to be -0 */
+      test(J, RAX);
+      tolabel(J, &slow, CC_E);
+    }
+    movimm(J, RCX, cast(size_t, MAX_EXACTINT));  /* see `isexactint' */
+    opr(J, 1, 0x01, RAX, RCX);  /* add rcx, rax */
+    movimm(J, RDX, 2*cast(size_t, MAX_EXACTINT));
+    opr(J, 1, 0x39, RDX, RCX);  /* cmp rcx, rdx */
+    tolabel(J, &slow, CC_A);  /* beyond MAX_EXACTINT */
+    st(J, RAX, RBASE, ra);
+    settt(J, RBASE, ra, LUA_TNUMINT);
+    tolabel(J, &done, CC_JMP);
+    here(J, &flt);
+  }
+  cmptt(J, bb, bd, LUA_TNUMBER);  /* two floats? */
+  tolabel(J, &slow, CC_NE);
+  cmptt(J, cb, cd, LUA_TNUMBER);
+  tolabel(J, &slow, CC_NE);
+  opm(J, 0xf2, 0, 0x0f10, 0, bb, bd);  /* movsd xmm0, [b] */
+  opm(J, 0xf2, 0, (op == OP_ADD) ? 0x0f58 : (op == OP_SUB) ? 0x0f5c :
+                  (op == OP_MUL) ? 0x0f59 : 0x0f5e, 0, cb, cd);
+  opm(J, 0xf2, 0, 0x0f11, 0, RBASE, ra);  /* movsd [ra], xmm0 */
+  settt(J, RBASE, ra, LUA_TNUMBER);
+  tolabel(J, &done, CC_JMP);
+  here(J, &slow);
+  callop(J);
+  here(J, &done);
+}
+
+
+/*
+** OP_EQ, OP_LT and OP_LE, going on at `next' or (if the test says so)
+** jumping to `target'
+*/
+static void compare (JitState *J, Instruction i, int next, int target) {
+  OpCode op = GET_OPCODE(i);
+  int bb, bd, cb, cd;
+  Label yes, no, flt, slow;
+  yes.n = no.n = flt.n = slow.n = 0;
+  rkopnd(J, GETARG_B(i), RSI, &bb, &bd);
+  rkopnd(J, GETARG_C(i), RDI, &cb, &cd);
+  if (op == OP_EQ) {
+    Label word;
+    word.n = 0;
+    ld32(J, RAX, bb, bd + TTOFS);
+    opr(J, 0, 0x89, RAX, RCX);  /* mov ecx, eax */
+    opm(J, 0, 0, 0x33, RCX, cb, cd + TTOFS);  /* xor ecx, [tag of c] */
+    opr(J, 0, 0xf7, 0, RCX);  /* test ecx, TAGMASK */
+    b4(J, TAGMASK);
+    tolabel(J, &no, CC_NE);  /* different types */
+    opr(J, 0, 0x85, RCX, RCX);
+    tolabel(J, &slow, CC_NE);  /* different variants of a type */
+    cmp32i(J, RAX, LUA_TNIL);
+    tolabel(J, &yes, CC_E);
+    cmp32i(J, RAX, LUA_TNUMINT);
+    tolabel(J, &word, CC_E);
+    cmp32i(J, RAX, LUA_TSTRING);  /* short strings are interned */
+    tolabel(J, &word, CC_E);
+    cmp32i(J, RAX, LUA_TLIGHTUSERDATA);
+    tolabel(J, &word, CC_E);
+    cmp32i(J, RAX, LUA_TBOOLEAN);
+    tolabel(J, &slow, CC_NE);
+    ld32(J, RCX, bb, bd);
+    opm(J, 0, 0, 0x3b, RCX, cb, cd);  /* cmp ecx, [c] */
+    tolabel(J, &yes, CC_E);
+    tolabel(J, &no, CC_JMP);
+    here(J, &word);
+    ld(J, RCX, bb, bd);
+    opm(J, 0, 1, 0x3b, RCX, cb, cd);  /* cmp rcx, [c] */
+    tolabel(J, &yes, CC_E);
+    tolabel(J, &no, CC_JMP);
+  }
+  else {
+    cmptt(J, bb, bd, LUA_TNUMINT);  /* two integers? */
+    tolabel(J, &flt, CC_NE);
+    cmptt(J, cb, cd, LUA_TNUMINT);
+    tolabel(J, &flt, CC_NE);
+    ld(J, RAX, bb, bd);
+    opm(J, 0, 1, 0x3b, RAX, cb, cd);  /* cmp rax, [c] */
+    tolabel(J, &yes, (op == OP_LT) ? CC_L : CC_LE);
+    tolabel(J, &no, CC_JMP);
+    here(J, &flt);
+    cmptt(J, bb, bd, LUA_TNUMBER);  /* two floats? */
+    tolabel(J, &slow, CC_NE);
+    cmptt(J, cb, cd, LUA_TNUMBER);
+    tolabel(J, &slow, CC_NE);
+    opm(J, 0xf2, 0, 0x0f10, 0, cb, cd);  /* movsd xmm0, [c] */
+    opm(J, 0x66, 0, 0x0f2e, 0, bb, bd);  /* ucomisd xmm0, [b] */
+    /* `above' and `above or equal' are false for NaNs */
+    tolabel(J, &yes, (op == OP_LT) ? CC_A : CC_AE);
+    tolabel(J, &no, CC_JMP);
+  }
+  here(J, &slow);
+  branchop(J, next, target);
+  here(J, &yes);
+  if (GETARG_A(i)) gotopc(J, target); else jumppc(J, CC_JMP, next);
+  here(J, &no);
+  if (GETARG_A(i)) jumppc(J, CC_JMP, next); else gotopc(J, target);
+}
+
+
+/* OP_TEST and OP_TESTSET, going on at `next' or jumping to `target' */
+static void testop (JitState *J, Instruction i, int next, int target) {
+  int set = (GET_OPCODE(i) == OP_TESTSET);
+  int r = set ? GETARG_B(i) : GETARG_A(i);
+  Label f;
+  f.n = 0;
+  isfalse(J, RBASE, slot(r), &f);
+  if (GETARG_C(i)) {  /* jump if true */
+    if (set) copy(J, RBASE, slot(r), RBASE, slot(GETARG_A(i)));
+    gotopc(J, target);
+    here(J, &f);
+    jumppc(J, CC_JMP, next);
+  }
+  else {  /* jump if false */
+    jumppc(J, CC_JMP, next);
+    here(J, &f);
+    if (set) copy(J, RBASE, slot(r), RBASE, slot(GETARG_A(i)));
+    gotopc(J, target);
+  }
+}
+
+
+/* can constant `x' index an array part in line? */
+#define isKindex(J,x) \
+	(ttisint(&(J)->p->k[INDEXK(x)]) && \
+	 ivalue(&(J)->p->k[INDEXK(x)]) >= 1 && \
+	 ivalue(&(J)->p->k[INDEXK(x)]) <= MAX_INT)
+
+
+/*
+** point rcx at entry `key' (an RK operand) of the array part of the table
+** at [base+disp], going to `slow' if the key is not there or it is nil
+*/
+static void arrayslot (JitState *J, int base, int disp, int key,
+                       Label *slow) {
+  if (ISK(key))
+    movimm(J, RCX, cast(size_t, ivalue(&J->p->k[INDEXK(key)]) - 1));
+  else {
+    cmptt(J, RBASE, slot(key), LUA_TNUMINT);
+    tolabel(J, slow, CC_NE);
+    ld(J, RCX, RBASE, slot(key));
+    opr(J, 1, 0x83, 5, RCX);  /* sub rcx, 1 */
+    b1(J, 1);
+  }
+  ld(J, RAX, base, disp);
+  ld32(J, RDX, RAX, cast_int(offsetof(Table, sizearray)));
+  opr(J, 1, 0x39, RDX, RCX);  /* cmp rcx, rdx (unsigned: also if < 0) */
+  tolabel(J, slow, CC_AE);
+  opr(J, 1, 0xc1, 4, RCX);  /* shl rcx, 4 */
+  b1(J, 4);
+  opm(J, 0, 1, 0x03, RCX, RAX, cast_int(offsetof(Table, array)));
+  cmptt(J, RCX, 0, LUA_TNIL);
+  tolabel(J, slow, CC_E);
+}
+
+
+static void gettable (JitState *J, Instruction i) {
+  int c = GETARG_C(i);
+  Label slow, done;
+  slow.n = done.n = 0;
+  if (!ISK(c) || isKindex(J, c)) {
+    int rb = slot(GETARG_B(i));
+    cmptt(J, RBASE, rb, LUA_TTABLE);
+    tolabel(J, &slow, CC_NE);
+    arrayslot(J, RBASE, rb, c, &slow);
+    copy(J, RCX, 0, RBASE, slot(GETARG_A(i)));
+    tolabel(J, &done, CC_JMP);
+  }
+  here(J, &slow);
+  callop(J);
+  here(J, &done);
+}
+
+
+static void settable (JitState *J, Instruction i) {
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  Label slow, done;
+  slow.n = done.n = 0;
+  /* values that need no barrier only */
+  if ((!ISK(b) || isKindex(J, b)) &&
+      (!ISK(c) || !iscollectable(&J->p->k[INDEXK(c)]))) {
+    int ra = slot(GETARG_A(i));
+    int vb, vd;
+    cmptt(J, RBASE, ra, LUA_TTABLE);
+    tolabel(J, &slow, CC_NE);
+    if (!ISK(c)) {
+      ld32(J, RAX, RBASE, slot(c) + TTOFS);
+      opr(J, 0, 0x83, 4, RAX);  /* and eax, TAGMASK */
+      b1(J, TAGMASK);
+      cmp32i(J, RAX, LUA_TSTRING);  /* collectable? */
+      tolabel(J, &slow, CC_AE);
+    }
+#if defined(LUA_USE_FROZEN)
+    ld(J, RAX, RBASE, ra);
+    opm(J, 0, 0, 0xf6, 0, RAX, cast_int(offsetof(Table, marked)));
+    b1(J, bitmask(SFIXEDBIT));  /* test byte [rax+marked], SFIXEDBIT */
+    tolabel(J, &slow, CC_NE);  /* frozen: `luaV_settable' complains */
+#endif
+    arrayslot(J, RBASE, ra, b, &slow);
+    rkopnd(J, c, RSI, &vb, &vd);
+    copy(J, vb, vd, RCX, 0);
+    tolabel(J, &done, CC_JMP);
+  }
+  here(J, &slow);
+  callop(J);
+  here(J, &done);
+}
+
+
+static void forloop (JitState *J, Instruction i) {
+  int ra = slot(GETARG_A(i));
+  int target = J->pc + 1 + GETARG_sBx(i);
+  Label slow, done;
+  slow.n = done.n = 0;
+  cmptt(J, RBASE, ra, LUA_TNUMINT);  /* integer loop? (see `forprep') */
+  tolabel(J, &slow, CC_NE);
+  ld(J, RAX, RBASE, ra + slot(1));  /* iterations still to go */
+  test(J, RAX);
+  tolabel(J, &done, CC_E);
+  opr(J, 1, 0x83, 5, RAX);  /* sub rax, 1 */
+  b1(J, 1);
+  st(J, RAX, RBASE, ra + slot(1));
+  ld(J, RCX, RBASE, ra);
+  opm(J, 0, 1, 0x03, RCX, RBASE, ra + slot(2));  /* add rcx, step */
+  st(J, RCX, RBASE, ra);  /* internal index... */
+  st(J, RCX, RBASE, ra + slot(3));  /* ...and external index */
+  settt(J, RBASE, ra + slot(3), LUA_TNUMINT);
+  gotopc(J, target);
+  here(J, &slow);
+  branchop(J, J->pc + 1, target);
+  here(J, &done);
+}
+
+
+static void prologue (JitState *J) {
+  b1(J, 0x53);  /* push rbx */
+  b1(J, 0x41); b1(J, 0x54);  /* push r12 */
+  b1(J, 0x41); b1(J, 0x55);  /* push r13 */
+  b1(J, 0x41); b1(J, 0x56);  /* push r14 */
+  opr(J, 1, 0x83, 5, RSP);  /* sub rsp, 8 (to align the stack) */
+  b1(J, 8);
+  mov(J, RL, RDI);
+  mov(J, RCL, RSI);
+  ld(J, RBASE, RL, cast_int(offsetof(lua_State, base)));
+  movimm(J, RCODE, cast(size_t, J->p->code));
+  b1(J, 0xff); b1(J, 0xe2);  /* jmp rdx */
+  J->exit = J->n;  /* return rax to `luaJ_run' */
+  opr(J, 1, 0x83, 0, RSP);  /* add rsp, 8 */
+  b1(J, 8);
+  b1(J, 0x41); b1(J, 0x5e);  /* pop r14 */
+  b1(J, 0x41); b1(J, 0x5d);  /* pop r13 */
+  b1(J, 0x41); b1(J, 0x5c);  /* pop r12 */
+  b1(J, 0x5b);  /* pop rbx */
+  b1(J, 0xc3);  /* ret */
+}
+
+
+static void compile (JitState *J) {
+  Proto *p = J->p;
+  int skip = 0;  /* words after an instruction that are not instructions */
+  int pc;
+  J->n = 0;
+  prologue(J);
+  for (pc = 0; pc < p->sizecode; pc++) {
+    Instruction i = p->code[pc];
+    size_t start = J->n;
+    J->jc->map[pc] = cast(unsigned int, J->n);
+    J->pc = pc;
+    if (skip > 0) {
+      skip--;
+      continue;
+    }
+    switch (GET_OPCODE(i)) {
+      case OP_MOVE: {
+        copy(J, RBASE, slot(GETARG_B(i)), RBASE, slot(GETARG_A(i)));
+        break;
+      }
+      case OP_LOADK: {
+        movimm(J, RAX, cast(size_t, &p->k[GETARG_Bx(i)]));
+        copy(J, RAX, 0, RBASE, slot(GETARG_A(i)));
+        break;
+      }
+      case OP_LOADBOOL: {
+        opm(J, 0, 1, 0xc7, 0, RBASE, slot(GETARG_A(i)));  /* mov qword */
+        b4(J, cast(unsigned int, GETARG_B(i)));
+        settt(J, RBASE, slot(GETARG_A(i)), LUA_TBOOLEAN);
+        if (GETARG_C(i)) jumppc(J, CC_JMP, pc + 2);
+        break;
+      }
+      case OP_LOADNIL: {
+        int r;
+        for (r = GETARG_A(i); r <= GETARG_B(i); r++)
+          settt(J, RBASE, slot(r), LUA_TNIL);
+        break;
+      }
+      case OP_GETUPVAL: {
+        ld(J, RAX, RCL, cast_int(offsetof(LClosure, upvals) +
+                                 GETARG_B(i)*sizeof(UpVal *)));
+        ld(J, RAX, RAX, cast_int(offsetof(UpVal, v)));
+        copy(J, RAX, 0, RBASE, slot(GETARG_A(i)));
+        break;
+      }
+      case OP_GETTABLE: {
+        gettable(J, i);
+        break;
+      }
+      case OP_SETTABLE: {
+        settable(J, i);
+        break;
+      }
+      case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: {
+        arith(J, i);
+        break;
+      }
+      case OP_ADDK: {  /* as an OP_ADD */
+        arith(J, CREATE_ABC(OP_ADD, GETARG_A(i), GETARG_B(i), GETARG_C(i)));
+        break;
+      }
+      case OP_NOT: {
+        Label f, set;
+        f.n = set.n = 0;
+        isfalse(J, RBASE, slot(GETARG_B(i)), &f);
+        opr(J, 0, 0x31, RAX, RAX);  /* xor eax, eax */
+        tolabel(J, &set, CC_JMP);
+        here(J, &f);
+        b1(J, 0xb8);  /* mov eax, 1 */
+        b4(J, 1);
+        here(J, &set);
+        st(J, RAX, RBASE, slot(GETARG_A(i)));
+        settt(J, RBASE, slot(GETARG_A(i)), LUA_TBOOLEAN);
+        break;
+      }
+      case OP_JMP: {
+        gotopc(J, pc + 1 + GETARG_sBx(i));
+        break;
+      }
+      case OP_EQ: case OP_LT: case OP_LE: {  /* with the OP_JMP after it */
+        compare(J, i, pc + 2, pc + 2 + GETARG_sBx(p->code[pc + 1]));
+        break;
+      }
+      case OP_TEST: case OP_TESTSET: {  /* with the OP_JMP after it */
+        testop(J, i, pc + 2, pc + 2 + GETARG_sBx(p->code[pc + 1]));
+        break;
+      }
+      case OP_JMPEQ: case OP_JMPNE: {  /* as an OP_EQ and its OP_JMP */
+        compare(J, CREATE_ABC(OP_EQ, GET_OPCODE(i) == OP_JMPEQ,
+                              GETARG_A(i), GETARG_B(i)),
+                pc + 1, pc + 1 + GETARG_sC(i));
+        break;
+      }
+      case OP_JMPIF: case OP_JMPNOT: {  /* as an OP_TEST and its OP_JMP */
+        testop(J, CREATE_ABC(OP_TEST, GETARG_A(i), 0,
+                             GET_OPCODE(i) == OP_JMPIF),
+               pc + 1, pc + 1 + GETARG_sBx(i));
+        break;
+      }
+      case OP_CALL: case OP_TAILCALL: case OP_RETURN: {
+        exitto(J, pc);
+        break;
+      }
+      case OP_FORLOOP: {
+        forloop(J, i);
+        break;
+      }
+      case OP_FORPREP: {
+        callop(J);
+        jumppc(J, CC_JMP, pc + 1 + GETARG_sBx(i));
+        break;
+      }
+      case OP_TFORLOOP: {
+        branchop(J, pc + 2, pc + 2 + GETARG_sBx(p->code[pc + 1]));
+        break;
+      }
+      case OP_SETLIST: {
+        callop(J);
+        if (GETARG_C(i) == 0) skip = 1;  /* next word is the real C */
+        break;
+      }
+      case OP_CLOSURE: {
+        callop(J);
+        skip = p->p[GETARG_Bx(i)]->nups;  /* `luaV_jitop' runs these */
+        break;
+      }
+      default: {
+        callop(J);
+        break;
+      }
+    }
+    lua_assert(J->n - start <= MAXINSTRSIZE);
+    UNUSED(start);
+  }
+}
+
+/* }====================================================== */
+
+
+
+int luaJ_compile (lua_State *L, Proto *p) {
+  JitState J;
+  struct JitCode *jc;
+  size_t page = cast(size_t, sysconf(_SC_PAGESIZE));
+  size_t size, used;
+  void *m;
+  lua_assert(p->jit == NULL);
+  if (sizeof(TValue) != 16 || TTOFS != 8 || p->sizecode == 0 ||
+      p->sizecode > MAX_INT / MAXINSTRSIZE - 1) {  /* cannot compile it */
+    p->jitcount = -MAX_INT;
+    return 0;
+  }
+  size = (cast(size_t, p->sizecode + 1) * MAXINSTRSIZE + page - 1) &
+         ~(page - 1);
+  jc = cast(struct JitCode *,
+            luaM_malloc(L, jitcodesize(p->sizecode), MEMPROTO));
+  m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (m == MAP_FAILED) {
+    luaM_freemem(L, jc, jitcodesize(p->sizecode), MEMPROTO);
+    p->jitcount = -MAX_INT;  /* do not try again */
+    return 0;
+  }
+  jc->map = cast(unsigned int *, jc + 1);
+  memset(jc->map, 0, p->sizecode * sizeof(unsigned int));
+  J.p = p;
+  J.jc = jc;
+  J.code = cast(unsigned char *, m);
+  compile(&J);  /* first pass finds where each instruction goes */
+  compile(&J);  /* second pass knows where all jumps go */
+  used = (J.n + page - 1) & ~(page - 1);
+  if (used < size)
+    munmap(J.code + used, size - used);
+  if (mprotect(m, used, PROT_READ | PROT_EXEC) != 0) {  /* not allowed? */
+    munmap(m, used);
+    luaM_freemem(L, jc, jitcodesize(p->sizecode), MEMPROTO);
+    p->jitcount = -MAX_INT;
+    return 0;
+  }
+  jc->mcode = J.code;
+  jc->size = used;
+  p->jit = jc;
+  return 1;
+}
+
+
+const Instruction *luaJ_run (lua_State *L, LClosure *cl,
+                             const Instruction *pc) {
+  struct JitCode *jc = cl->p->jit;
+  JitEntry f = cast(JitEntry, cast(void *, jc->mcode));
+  lua_assert(cl->p->code <= pc && pc < cl->p->code + cl->p->sizecode);
+  return (*f)(L, cl, jc->mcode + jc->map[pc - cl->p->code]);
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  struct JitCode *jc = p->jit;
+  munmap(jc->mcode, jc->size);
+  luaM_freemem(L, jc, jitcodesize(p->sizecode), MEMPROTO);
+  p->jit = NULL;
+}
+
+#endif
@@ -0,0 +1,33 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler from Lua bytecode to x86-64 machine code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+#if defined(LUA_USE_JIT)
+
+/*
+** counts a call or a backward jump in `p' (compiling it when it gets hot)
+** and tells whether it can run as native code
+*/
+#define luaJ_hot(L,p) \
+	(G(L)->jithot > 0 && ((p)->jit != NULL || \
+	 (++(p)->jitcount >= G(L)->jithot && luaJ_compile(L, p))))
+
+
+LUAI_FUNC int luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC const Instruction *luaJ_run (lua_State *L, LClosure *cl,
+                                       const Instruction *pc);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+
+#endif
+
+#endif
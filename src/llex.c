@@ -32,6 +32,9 @@
 
 #define currIsNewline(ls)	(ls->current == '\n' || ls->current == '\r')
 
+/* `extra' marks reserved words only in short strings */
+#define isreserved(ts)	((ts)->tsv.tt == LUA_TSTRING && (ts)->tsv.extra > 0)
+
 
 /* ORDER RESERVED */
 const char *const luaX_tokens [] = {
@@ -67,7 +70,8 @@ void luaX_init (lua_State *L) {
     TString *ts = luaS_new(L, luaX_tokens[i]);
     luaS_fix(ts);  /* reserved words are never collected */
     lua_assert(strlen(luaX_tokens[i])+1 <= TOKEN_LEN);
-    ts->tsv.reserved = cast_byte(i+1);  /* reserved word */
+    lua_assert(ts->tsv.tt == LUA_TSTRING);
+    ts->tsv.extra = cast_byte(i+1);  /* reserved word */
   }
 }
 
@@ -114,6 +118,11 @@ void luaX_syntaxerror (LexState *ls, const char *msg) {
 }
 
 
+/*
+** creates a new string and anchors it in the function's table. Long
+** strings are not interned, so when the table already has an equal
+** string it is that (anchored) one that is returned.
+*/
 TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
   lua_State *L = ls->L;
   TString *ts = luaS_newlstr(L, str, l);
@@ -122,6 +131,8 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     setbvalue(o, 1);  /* make sure `str' will not be collected */
     luaC_checkGC(L);
   }
+  else
+    ts = rawtsvalue(keyfromval(o));  /* re-use the anchored string */
   return ts;
 }
 
@@ -427,8 +438,8 @@ static int llex (LexState *ls, SemInfo *seminfo) {
           } while (isalnum(ls->current) || ls->current == '_');
           ts = luaX_newstring(ls, luaZ_buffer(ls->buff),
                                   luaZ_bufflen(ls->buff));
-          if (ts->tsv.reserved > 0)  /* reserved word? */
-            return ts->tsv.reserved - 1 + FIRST_RESERVED;
+          if (isreserved(ts))  /* reserved word? */
+            return ts->tsv.extra - 1 + FIRST_RESERVED;
           else {
             seminfo->ts = ts;
             return TK_NAME;
@@ -21,6 +21,8 @@ typedef LUAI_UMEM lu_mem;
 
 typedef LUAI_MEM l_mem;
 
+typedef LUAI_UINTEGER lu_integer;
+
 
 
 /* chars used as small naturals (so that `char' is reserved for characters) */
@@ -34,6 +36,23 @@ typedef unsigned char lu_byte;
 
 #define MAX_INT (INT_MAX-2)  /* maximum value of an int (-2 for safety) */
 
+/* limits of lua_Integer */
+#define MAX_INTEGER	((lua_Integer)((~(lu_integer)0) >> 1))
+#define MIN_INTEGER	(-MAX_INTEGER-1)
+
+/*
+** largest integer that a lua_Number (a double) and a lua_Integer both
+** hold exactly: 2^53-1 when lua_Integer has 64 bits. Only integers up
+** to it (in absolute value) are kept as integers, so that they always
+** behave exactly as the floating-point numbers they stand for
+*/
+#define INTEGERBITS	(sizeof(lua_Integer)*CHAR_BIT)
+#define MAX_EXACTINT \
+	(MAX_INTEGER >> (INTEGERBITS > 54 ? INTEGERBITS - 54 : 0))
+#define isexactint(i) \
+	(cast(lu_integer, i) + cast(lu_integer, MAX_EXACTINT) <= \
+	 2*cast(lu_integer, MAX_EXACTINT))
+
 /*
 ** conversion of pointer to integer
 ** this is for hashing only; there is no problem if the integer
@@ -6,14 +6,21 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #define lmem_c
 #define LUA_CORE
 
 #include "lua.h"
 
+#if defined(LUA_USE_STACKMAP)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "ldebug.h"
 #include "ldo.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -44,7 +51,7 @@
 
 
 void *luaM_growaux_ (lua_State *L, void *block, int *size, size_t size_elems,
-                     int limit, const char *errormsg) {
+                     int limit, const char *errormsg, int kind) {
   void *newblock;
   int newsize;
   if (*size >= limit/2) {  /* cannot double it? */
@@ -57,7 +64,7 @@ void *luaM_growaux_ (lua_State *L, void *block, int *size, size_t size_elems,
     if (newsize < MINSIZEARRAY)
       newsize = MINSIZEARRAY;  /* minimum size */
   }
-  newblock = luaM_reallocv(L, block, *size, newsize, size_elems);
+  newblock = luaM_reallocv(L, block, *size, newsize, size_elems, kind);
   *size = newsize;  /* update only when everything else is OK */
   return newblock;
 }
@@ -70,17 +77,281 @@ void *luaM_toobig (lua_State *L) {
 
 
 
+
+/*
+** {======================================================
+** Allocation statistics and heap profiler
+** =======================================================
+*/
+
+#if defined(LUA_USE_MEMSTATS)
+
+#define MAXSITES	256
+
+
+typedef struct MemSite {
+  char source[LUA_IDSIZE];
+  int line;
+  int kind;
+  lu_mem count;  /* samples taken at this site */
+  lu_mem bytes;  /* bytes requested by those samples */
+} MemSite;
+
+
+typedef struct MemProfile {
+  int period;  /* bytes between samples */
+  l_mem left;  /* bytes until next sample */
+  int nsites;
+  lu_mem lost;  /* samples that did not fit in `sites' */
+  MemSite sites[MAXSITES];
+} MemProfile;
+
+
+static const char *const kindnames[MEMKINDS] = {
+  "other", "string", "table", "node", "closure", "proto", "userdata", "thread"
+};
+
+
+const char *luaM_kindname (int kind) {
+  return (0 <= kind && kind < MEMKINDS) ? kindnames[kind] : NULL;
+}
+
+
+void luaM_countmem (MemStats *s, int kind, size_t osize, size_t nsize) {
+  if (osize == 0 && nsize == 0) return;
+  if (osize == 0) {
+    s->count[kind]++;
+    s->allocs[kind]++;
+  }
+  else if (nsize == 0)
+    s->count[kind]--;
+  s->bytes[kind] += nsize - osize;  /* modular arithmetic */
+  if (nsize > osize)
+    s->total[kind] += nsize - osize;
+}
+
+
+void luaM_addstats (MemStats *to, MemStats *from) {
+  int i;
+  for (i = 0; i < MEMKINDS; i++) {
+    to->count[i] += from->count[i];
+    to->bytes[i] += from->bytes[i];
+    to->allocs[i] += from->allocs[i];
+    to->total[i] += from->total[i];
+  }
+}
+
+
+static void sample (lua_State *L, MemProfile *p, size_t size) {
+  char source[LUA_IDSIZE];
+  int line, i;
+  luaG_where(L, source, &line);
+  for (i = 0; i < p->nsites; i++) {
+    MemSite *s = &p->sites[i];
+    if (s->line == line && s->kind == L->memkind &&
+        strcmp(s->source, source) == 0)
+      break;
+  }
+  if (i == p->nsites) {  /* new site? */
+    if (p->nsites == MAXSITES) {
+      p->lost++;
+      return;
+    }
+    p->nsites++;
+    strcpy(p->sites[i].source, source);
+    p->sites[i].line = line;
+    p->sites[i].kind = L->memkind;
+    p->sites[i].count = p->sites[i].bytes = 0;
+  }
+  p->sites[i].count++;
+  p->sites[i].bytes += size;
+}
+
+
+/*
+** starts (`period' > 0) or stops (`period' == 0) the profiler; returns
+** the previous period (0 if it was not running). A new period keeps the
+** samples taken so far.
+*/
+int luaM_profile (lua_State *L, int period) {
+  global_State *g = G(L);
+  MemProfile *p = g->memprof;
+  int old = (p != NULL) ? p->period : 0;
+  if (period <= 0) {
+    if (p != NULL) {
+      g->memprof = NULL;
+      luaM_free(L, p, MEMOTHER);
+    }
+  }
+  else {
+    if (p == NULL) {
+      p = luaM_new(L, MemProfile, MEMOTHER);
+      p->nsites = 0;
+      p->lost = 0;
+      g->memprof = p;
+    }
+    p->period = period;
+    p->left = period;
+  }
+  return old;
+}
+
+
+const char *luaM_getsample (lua_State *L, int i, int *line, int *kind,
+                            size_t *count, size_t *bytes) {
+  MemProfile *p = G(L)->memprof;
+  MemSite *s;
+  if (p == NULL || i < 0 || i >= p->nsites) return NULL;
+  s = &p->sites[i];
+  *line = s->line;
+  *kind = s->kind;
+  *count = cast(size_t, s->count);
+  *bytes = cast(size_t, s->bytes);
+  return s->source;
+}
+
+#endif
+
+/* }====================================================== */
+
+
+
 /*
 ** generic allocation routine.
 */
 void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
+#if defined(LUA_USE_BGSWEEP)
+  if (luaC_freebatch != NULL && nsize == 0) {  /* in the sweeper thread? */
+    if (block != NULL)
+      luaC_batchfree(L, block, osize);
+    return NULL;
+  }
+#endif
+#if defined(LUA_USE_MEMSTATS)
+  if (g->memprof != NULL && nsize > osize) {
+    MemProfile *p = g->memprof;
+    p->left -= cast(l_mem, nsize - osize);
+    if (p->left <= 0) {
+      p->left += p->period;
+      if (p->left <= 0) p->left = p->period;  /* block much larger */
+      sample(L, p, nsize - osize);
+    }
+  }
+#endif
   block = (*g->frealloc)(g->ud, block, osize, nsize);
   if (block == NULL && nsize > 0)
     luaD_throw(L, LUA_ERRMEM);
   lua_assert((nsize == 0) == (block == NULL));
   g->totalbytes = (g->totalbytes - osize) + nsize;
+#if defined(LUA_USE_MEMSTATS)
+  luaM_countmem(&g->memstats, L->memkind, osize, nsize);
+#endif
   return block;
 }
 
+
+#if defined(LUA_USE_STACKMAP)
+/*
+** {======================================================
+** Reserved address space (see `luaD_reallocstack')
+** =======================================================
+*/
+
+static size_t pageround (size_t size) {
+  size_t page = cast(size_t, sysconf(_SC_PAGESIZE));
+  return (size + page - 1) & ~(page - 1);
+}
+
+
+/* let the system take pages back, but only when it needs them */
+static void freepages (char *b, size_t size) {
+#if defined(MADV_FREE)
+  madvise(b, size, MADV_FREE);
+#else
+  madvise(b, size, MADV_DONTNEED);
+#endif
+}
+
+
+/*
+** reserve `size' bytes of address space (a released one if possible,
+** as its pages are probably still there); returns NULL if there is no
+** room
+*/
+void *luaM_reserve (lua_State *L, size_t size) {
+  global_State *g = G(L);
+  void *m;
+  int i;
+  size = pageround(size);
+  for (i = 0; i < g->nmaps; i++) {
+    if (g->mapsizes[i] == size) {
+      m = g->maps[i];
+      g->nmaps--;
+      g->maps[i] = g->maps[g->nmaps];
+      g->mapsizes[i] = g->mapsizes[g->nmaps];
+      return m;
+    }
+  }
+  m = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE,
+           -1, 0);
+  return (m == MAP_FAILED) ? NULL : m;
+}
+
+
+/*
+** make the first `nsize' bytes of reserved `block' usable instead of its
+** first `osize' ones; returns 0 if the system has no memory for a larger
+** part. Pages no longer used stay usable until the system takes them.
+*/
+int luaM_commit (lua_State *L, void *block, size_t osize, size_t nsize,
+                 int kind) {
+  global_State *g = G(L);
+  char *b = cast(char *, block);
+  size_t o = pageround(osize);
+  size_t n = pageround(nsize);
+  if (n > o) {
+    if (mprotect(b + o, n - o, PROT_READ | PROT_WRITE) != 0)
+      return 0;
+  }
+  else if (n < o)
+    freepages(b + n, o - n);
+  g->totalbytes = (g->totalbytes - osize) + nsize;
+#if defined(LUA_USE_MEMSTATS)
+  luaM_countmem(&g->memstats, kind, osize, nsize);
+#else
+  UNUSED(kind);
+#endif
+  return 1;
+}
+
+
+/*
+** give back `block' (`reserve' bytes, the first `size' of them in use),
+** keeping it for the next reservation of that size if there is room
+*/
+void luaM_release (lua_State *L, void *block, size_t size, size_t reserve,
+                   int kind) {
+  global_State *g = G(L);
+  luaM_commit(L, block, size, 0, kind);
+  reserve = pageround(reserve);
+  if (g->nmaps < MAXMAPS) {
+    g->maps[g->nmaps] = block;
+    g->mapsizes[g->nmaps++] = reserve;
+  }
+  else
+    munmap(block, reserve);
+}
+
+
+void luaM_freemaps (lua_State *L) {
+  global_State *g = G(L);
+  while (g->nmaps > 0) {
+    g->nmaps--;
+    munmap(g->maps[g->nmaps], g->mapsizes[g->nmaps]);
+  }
+}
+
+/* }====================================================== */
+#endif
@@ -16,26 +16,57 @@
 #define MEMERRMSG	"not enough memory"
 
 
-#define luaM_reallocv(L,b,on,n,e) \
+/*
+** kinds of memory blocks, for the allocation statistics (every macro
+** below gets the kind `k' of the block it handles)
+*/
+#define MEMOTHER	0
+#define MEMSTRING	1
+#define MEMTABLE	2	/* tables and their array parts */
+#define MEMNODE		3	/* hash parts of tables */
+#define MEMCLOSURE	4	/* closures and upvalues */
+#define MEMPROTO	5	/* prototypes and all their arrays */
+#define MEMUDATA	6
+#define MEMTHREAD	7	/* threads, their stacks and CallInfos */
+#define MEMKINDS	8
+
+typedef struct MemStats {
+  lu_mem count[MEMKINDS];  /* live blocks */
+  lu_mem bytes[MEMKINDS];  /* bytes in live blocks */
+  lu_mem allocs[MEMKINDS];  /* blocks ever allocated */
+  lu_mem total[MEMKINDS];  /* bytes ever allocated (including growth) */
+} MemStats;
+
+
+#if defined(LUA_USE_MEMSTATS)
+#define luaM_setkind(L,k)	((L)->memkind = cast_byte(k))
+#else
+#define luaM_setkind(L,k)	((void)0)
+#endif
+
+#define luaM_realloc(L,b,os,ns,k)  (luaM_setkind(L,k), luaM_realloc_(L,b,os,ns))
+
+#define luaM_reallocv(L,b,on,n,e,k) \
 	((cast(size_t, (n)+1) <= MAX_SIZET/(e)) ?  /* +1 to avoid warnings */ \
-		luaM_realloc_(L, (b), (on)*(e), (n)*(e)) : \
+		luaM_realloc(L, (b), (on)*(e), (n)*(e), k) : \
 		luaM_toobig(L))
 
-#define luaM_freemem(L, b, s)	luaM_realloc_(L, (b), (s), 0)
-#define luaM_free(L, b)		luaM_realloc_(L, (b), sizeof(*(b)), 0)
-#define luaM_freearray(L, b, n, t)   luaM_reallocv(L, (b), n, 0, sizeof(t))
+#define luaM_freemem(L, b, s, k)	luaM_realloc(L, (b), (s), 0, k)
+#define luaM_free(L, b, k)	luaM_realloc(L, (b), sizeof(*(b)), 0, k)
+#define luaM_freearray(L, b, n, t, k) \
+		luaM_reallocv(L, (b), n, 0, sizeof(t), k)
 
-#define luaM_malloc(L,t)	luaM_realloc_(L, NULL, 0, (t))
-#define luaM_new(L,t)		cast(t *, luaM_malloc(L, sizeof(t)))
-#define luaM_newvector(L,n,t) \
-		cast(t *, luaM_reallocv(L, NULL, 0, n, sizeof(t)))
+#define luaM_malloc(L,t,k)	luaM_realloc(L, NULL, 0, (t), k)
+#define luaM_new(L,t,k)		cast(t *, luaM_malloc(L, sizeof(t), k))
+#define luaM_newvector(L,n,t,k) \
+		cast(t *, luaM_reallocv(L, NULL, 0, n, sizeof(t), k))
 
-#define luaM_growvector(L,v,nelems,size,t,limit,e) \
+#define luaM_growvector(L,v,nelems,size,t,limit,e,k) \
           if ((nelems)+1 > (size)) \
-            ((v)=cast(t *, luaM_growaux_(L,v,&(size),sizeof(t),limit,e)))
+            ((v)=cast(t *, luaM_growaux_(L,v,&(size),sizeof(t),limit,e,k)))
 
-#define luaM_reallocvector(L, v,oldn,n,t) \
-   ((v)=cast(t *, luaM_reallocv(L, v, oldn, n, sizeof(t))))
+#define luaM_reallocvector(L, v,oldn,n,t,k) \
+   ((v)=cast(t *, luaM_reallocv(L, v, oldn, n, sizeof(t), k)))
 
 
 LUAI_FUNC void *luaM_realloc_ (lua_State *L, void *block, size_t oldsize,
@@ -43,7 +74,26 @@ LUAI_FUNC void *luaM_realloc_ (lua_State *L, void *block, size_t oldsize,
 LUAI_FUNC void *luaM_toobig (lua_State *L);
 LUAI_FUNC void *luaM_growaux_ (lua_State *L, void *block, int *size,
                                size_t size_elem, int limit,
-                               const char *errormsg);
+                               const char *errormsg, int kind);
+#if defined(LUA_USE_STACKMAP)
+LUAI_FUNC void *luaM_reserve (lua_State *L, size_t size);
+LUAI_FUNC int luaM_commit (lua_State *L, void *block, size_t osize,
+                           size_t nsize, int kind);
+LUAI_FUNC void luaM_release (lua_State *L, void *block, size_t size,
+                             size_t reserve, int kind);
+LUAI_FUNC void luaM_freemaps (lua_State *L);
+#endif
+
+#if defined(LUA_USE_MEMSTATS)
+LUAI_FUNC void luaM_countmem (MemStats *s, int kind, size_t osize,
+                                                     size_t nsize);
+LUAI_FUNC void luaM_addstats (MemStats *to, MemStats *from);
+LUAI_FUNC int luaM_profile (lua_State *L, int period);
+LUAI_FUNC const char *luaM_getsample (lua_State *L, int i, int *line,
+                                      int *kind, size_t *count,
+                                      size_t *bytes);
+LUAI_FUNC const char *luaM_kindname (int kind);
+#endif
 
 #endif
 
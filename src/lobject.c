@@ -75,11 +75,13 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
     case LUA_TNIL:
       return 1;
     case LUA_TNUMBER:
-      return luai_numeq(nvalue(t1), nvalue(t2));
+      return numequal(t1, t2);
     case LUA_TBOOLEAN:
       return bvalue(t1) == bvalue(t2);  /* boolean true must be 1 !! */
     case LUA_TLIGHTUSERDATA:
       return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING:
+      return luaS_eqstr(t1, t2);
     default:
       lua_assert(iscollectable(t1));
       return gcvalue(t1) == gcvalue(t2);
@@ -87,6 +89,25 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
 }
 
 
+/*
+** sets `obj' to the number `n', using the integer variant when `n' is
+** an integer no larger than MAX_EXACTINT (-0 is not)
+*/
+void luaO_setnum (TValue *obj, lua_Number n) {
+  if (luai_numle(-cast_num(MAX_EXACTINT), n) &&
+      luai_numle(n, cast_num(MAX_EXACTINT))) {
+    lua_Integer i;
+    lua_number2integer(i, n);
+    if (luai_numeq(cast_num(i), n) &&
+        (i != 0 || !luai_numlt(luai_numdiv(1, n), 0))) {
+      setivalue(obj, i);
+      return;
+    }
+  }
+  setnvalue(obj, n);
+}
+
+
 int luaO_str2d (const char *s, lua_Number *result) {
   char *endptr;
   *result = lua_str2number(s, &endptr);
@@ -163,7 +184,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
     fmt = e+2;
   }
   pushstr(L, fmt);
-  luaV_concat(L, n+1, cast_int(L->top - L->base) - 1);
+  luaV_concat(L, n+1, cast_int(L->top - L->base) - 1, 0);
   L->top -= n;
   return svalue(L->top - 1);
 }
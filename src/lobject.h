@@ -30,6 +30,24 @@
 #define LUA_TDEADKEY	(LAST_TAG+3)
 
 
+/*
+** Numbers have two internal variants, distinguished by a bit in their tag:
+** integral values that fit in a lua_Integer may be kept as such (so that
+** the VM can do integer arithmetic and index tables without conversions);
+** all others are kept as lua_Number. Both variants have type LUA_TNUMBER
+** and compare equal when they denote the same value.
+** Strings have two variants: strings longer than LUAI_MAXSHORTLEN are
+** not interned (and are hashed only when used as keys), and a `rope' is
+** the result of a long concatenation, whose characters are copied into a
+** string only when needed.
+*/
+#define VARBIT		0x10
+#define TAGMASK		(VARBIT-1)
+#define LUA_TNUMINT	(LUA_TNUMBER | VARBIT)
+#define LUA_TROPE	(LUA_TSTRING | VARBIT)
+#define LUA_TLNGSTR	(LUA_TSTRING | (VARBIT<<1))
+
+
 /*
 ** Union of all collectable objects
 */
@@ -60,6 +78,7 @@ typedef union {
   GCObject *gc;
   void *p;
   lua_Number n;
+  lua_Integer i;
   int b;
 } Value;
 
@@ -75,24 +94,35 @@ typedef struct lua_TValue {
 } TValue;
 
 
-/* Macros to test type */
-#define ttisnil(o)	(ttype(o) == LUA_TNIL)
+/* Macros to test type (only numbers and strings have variants, so the
+   others can check the raw tag) */
+#define ttisnil(o)	(rttype(o) == LUA_TNIL)
 #define ttisnumber(o)	(ttype(o) == LUA_TNUMBER)
-#define ttisstring(o)	(ttype(o) == LUA_TSTRING)
-#define ttistable(o)	(ttype(o) == LUA_TTABLE)
-#define ttisfunction(o)	(ttype(o) == LUA_TFUNCTION)
-#define ttisboolean(o)	(ttype(o) == LUA_TBOOLEAN)
-#define ttisuserdata(o)	(ttype(o) == LUA_TUSERDATA)
-#define ttisthread(o)	(ttype(o) == LUA_TTHREAD)
-#define ttislightuserdata(o)	(ttype(o) == LUA_TLIGHTUSERDATA)
+#define ttisint(o)	(rttype(o) == LUA_TNUMINT)
+#define ttisfloat(o)	(rttype(o) == LUA_TNUMBER)
+#define ttisstring(o)	((rttype(o) & ~(VARBIT<<1)) == LUA_TSTRING)
+#define ttisshrstring(o)	(rttype(o) == LUA_TSTRING)
+#define ttislngstring(o)	(rttype(o) == LUA_TLNGSTR)
+#define ttisrope(o)	(rttype(o) == LUA_TROPE)
+#define ttistable(o)	(rttype(o) == LUA_TTABLE)
+#define ttisfunction(o)	(rttype(o) == LUA_TFUNCTION)
+#define ttisboolean(o)	(rttype(o) == LUA_TBOOLEAN)
+#define ttisuserdata(o)	(rttype(o) == LUA_TUSERDATA)
+#define ttisthread(o)	(rttype(o) == LUA_TTHREAD)
+#define ttislightuserdata(o)	(rttype(o) == LUA_TLIGHTUSERDATA)
 
 /* Macros to access values */
-#define ttype(o)	((o)->tt)
+#define rttype(o)	((o)->tt)
+#define ttype(o)	(rttype(o) & TAGMASK)
 #define gcvalue(o)	check_exp(iscollectable(o), (o)->value.gc)
 #define pvalue(o)	check_exp(ttislightuserdata(o), (o)->value.p)
-#define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
+#define nvalue(o)	check_exp(ttisnumber(o), \
+	ttisint(o) ? cast_num((o)->value.i) : (o)->value.n)
+#define ivalue(o)	check_exp(ttisint(o), (o)->value.i)
+#define fltvalue(o)	check_exp(ttisfloat(o), (o)->value.n)
 #define rawtsvalue(o)	check_exp(ttisstring(o), &(o)->value.gc->ts)
 #define tsvalue(o)	(&rawtsvalue(o)->tsv)
+#define rpvalue(o)	check_exp(ttisrope(o), &(o)->value.gc->rp)
 #define rawuvalue(o)	check_exp(ttisuserdata(o), &(o)->value.gc->u)
 #define uvalue(o)	(&rawuvalue(o)->uv)
 #define clvalue(o)	check_exp(ttisfunction(o), &(o)->value.gc->cl)
@@ -100,17 +130,22 @@ typedef struct lua_TValue {
 #define bvalue(o)	check_exp(ttisboolean(o), (o)->value.b)
 #define thvalue(o)	check_exp(ttisthread(o), &(o)->value.gc->th)
 
+/* equality of two numbers (exact when both are integers) */
+#define numequal(t1,t2) \
+	((ttisint(t1) && ttisint(t2)) ? ivalue(t1) == ivalue(t2) : \
+	 luai_numeq(nvalue(t1), nvalue(t2)))
+
 #define l_isfalse(o)	(ttisnil(o) || (ttisboolean(o) && bvalue(o) == 0))
 
 /*
 ** for internal debug only
 */
 #define checkconsistency(obj) \
-  lua_assert(!iscollectable(obj) || (ttype(obj) == (obj)->value.gc->gch.tt))
+  lua_assert(!iscollectable(obj) || (rttype(obj) == (obj)->value.gc->gch.tt))
 
 #define checkliveness(g,obj) \
   lua_assert(!iscollectable(obj) || \
-  ((ttype(obj) == (obj)->value.gc->gch.tt) && !isdead(g, (obj)->value.gc)))
+  ((rttype(obj) == (obj)->value.gc->gch.tt) && !isdead(g, (obj)->value.gc)))
 
 
 /* Macros to set values */
@@ -119,6 +154,9 @@ typedef struct lua_TValue {
 #define setnvalue(obj,x) \
   { TValue *i_o=(obj); i_o->value.n=(x); i_o->tt=LUA_TNUMBER; }
 
+#define setivalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.i=(x); i_o->tt=LUA_TNUMINT; }
+
 #define setpvalue(obj,x) \
   { TValue *i_o=(obj); i_o->value.p=(x); i_o->tt=LUA_TLIGHTUSERDATA; }
 
@@ -126,8 +164,13 @@ typedef struct lua_TValue {
   { TValue *i_o=(obj); i_o->value.b=(x); i_o->tt=LUA_TBOOLEAN; }
 
 #define setsvalue(L,obj,x) \
+  { TValue *i_o=(obj); TString *x_=(x); \
+    i_o->value.gc=cast(GCObject *, x_); i_o->tt=x_->tsv.tt; \
+    checkliveness(G(L),i_o); }
+
+#define setrpvalue(L,obj,x) \
   { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TSTRING; \
+    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TROPE; \
     checkliveness(G(L),i_o); }
 
 #define setuvalue(L,obj,x) \
@@ -183,7 +226,7 @@ typedef struct lua_TValue {
 #define setobj2n	setobj
 #define setsvalue2n	setsvalue
 
-#define setttype(obj, tt) (ttype(obj) = (tt))
+#define setttype(obj, t) ((obj)->tt = (t))
 
 
 #define iscollectable(o)	(ttype(o) >= LUA_TSTRING)
@@ -200,7 +243,7 @@ typedef union TString {
   L_Umaxalign dummy;  /* ensures maximum alignment for strings */
   struct {
     CommonHeader;
-    lu_byte reserved;
+    lu_byte extra;  /* reserved words for short strings; "has hash" for longs */
     unsigned int hash;
     size_t len;
   } tsv;
@@ -211,6 +254,22 @@ typedef union TString {
 #define svalue(o)       getstr(rawtsvalue(o))
 
 
+/*
+** Ropes: the rope that owns a buffer may give it to a new rope made by
+** appending to it (the characters it sees never change), and then points
+** to that rope. Other ropes reach their characters through `owner', up
+** to a rope that owns a buffer or has been flattened.
+*/
+typedef struct Rope {
+  CommonHeader;
+  size_t len;
+  size_t size;  /* size of `buff' */
+  char *buff;  /* characters (NULL if not the owner) */
+  struct Rope *owner;  /* rope that took `buff' (or owns it) */
+  union TString *flat;  /* interned string (NULL if not computed yet) */
+} Rope;
+
+
 
 typedef union Udata {
   L_Umaxalign dummy;  /* ensures maximum alignment for `local' udata */
@@ -232,10 +291,12 @@ typedef struct Proto {
   CommonHeader;
   TValue *k;  /* constants used by the function */
   Instruction *code;
+  int *icache;  /* inline caches for `code' (one node hint per instruction) */
   struct Proto **p;  /* functions defined inside the function */
   int *lineinfo;  /* map from opcodes to source lines */
   struct LocVar *locvars;  /* information about local variables */
   TString **upvalues;  /* upvalue names */
+  struct InlineCall *inlines;  /* calls replaced by the code called */
   TString  *source;
   int sizeupvalues;
   int sizek;  /* size of `k' */
@@ -243,9 +304,14 @@ typedef struct Proto {
   int sizelineinfo;
   int sizep;  /* size of `p' */
   int sizelocvars;
+  int sizeinlines;
   int linedefined;
   int lastlinedefined;
   GCObject *gclist;
+#if defined(LUA_USE_JIT)
+  struct JitCode *jit;  /* native code (NULL if not compiled) */
+  int jitcount;  /* calls and backward jumps so far (see `luaJ_hot') */
+#endif
   lu_byte nups;  /* number of upvalues */
   lu_byte numparams;
   lu_byte is_vararg;
@@ -266,6 +332,21 @@ typedef struct LocVar {
 } LocVar;
 
 
+/*
+** a call that the compiler replaced by the code of the function called
+** (see `luaK_inline'), kept so that the call still shows when debugging
+*/
+typedef struct InlineCall {
+  struct Proto *f;  /* function called */
+  int startpc;  /* first instruction of its code */
+  int endpc;    /* first instruction after its code */
+  int bodypc;   /* where the code of the function itself starts */
+  int base;     /* register where its frame starts */
+  int line;     /* line of the call */
+  int name;     /* register with the function, or -1-(upvalue with it) */
+} InlineCall;
+
+
 
 /*
 ** Upvalues
@@ -323,7 +404,9 @@ typedef union Closure {
 typedef union TKey {
   struct {
     TValuefields;
+#if !defined(LUA_USE_SWISSTABLE)
     struct Node *next;  /* for chaining */
+#endif
   } nk;
   TValue tvk;
 } TKey;
@@ -342,7 +425,11 @@ typedef struct Table {
   struct Table *metatable;
   TValue *array;  /* array part */
   Node *node;
+#if defined(LUA_USE_SWISSTABLE)
+  int nfree;  /* nodes that can still be used before a rehash */
+#else
   Node *lastfree;  /* any free position is before this position */
+#endif
   GCObject *gclist;
   int sizearray;  /* size of `array' array */
 } Table;
@@ -371,6 +458,7 @@ LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_rawequalObj (const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaO_str2d (const char *s, lua_Number *result);
+LUAI_FUNC void luaO_setnum (TValue *obj, lua_Number n);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
 LUAI_FUNC const char *luaO_pushfstring (lua_State *L, const char *fmt, ...);
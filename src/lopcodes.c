@@ -52,6 +52,12 @@ const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSE",
   "CLOSURE",
   "VARARG",
+  "JMPIF",
+  "JMPNOT",
+  "JMPEQ",
+  "JMPNE",
+  "GETGFIELD",
+  "ADDK",
   NULL
 };
 
@@ -98,5 +104,11 @@ const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, OpArgN, OpArgN, iABC)		/* OP_CLOSE */
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
+ ,opmode(0, 1, OpArgR, OpArgN, iAsBx)		/* OP_JMPIF */
+ ,opmode(0, 1, OpArgR, OpArgN, iAsBx)		/* OP_JMPNOT */
+ ,opmode(0, 0, OpArgK, OpArgU, iABC)		/* OP_JMPEQ */
+ ,opmode(0, 0, OpArgK, OpArgU, iABC)		/* OP_JMPNE */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_GETGFIELD */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_ADDK */
 };
 
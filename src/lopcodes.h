@@ -19,6 +19,7 @@
 	`C' : 9 bits
 	`Bx' : 18 bits (`B' and `C' together)
 	`sBx' : signed Bx
+	`sC' : signed C
 
   A signed argument is represented in excess K; that is, the number
   value is the unsigned value minus K. K is exactly the maximum value
@@ -65,6 +66,7 @@ enum OpMode {iABC, iABx, iAsBx};  /* basic instruction format */
 #define MAXARG_A        ((1<<SIZE_A)-1)
 #define MAXARG_B        ((1<<SIZE_B)-1)
 #define MAXARG_C        ((1<<SIZE_C)-1)
+#define MAXARG_sC       (MAXARG_C>>1)          /* `sC' is signed */
 
 
 /* creates a mask with `n' 1 bits at position `p' */
@@ -100,6 +102,9 @@ enum OpMode {iABC, iABx, iAsBx};  /* basic instruction format */
 #define GETARG_sBx(i)	(GETARG_Bx(i)-MAXARG_sBx)
 #define SETARG_sBx(i,b)	SETARG_Bx((i),cast(unsigned int, (b)+MAXARG_sBx))
 
+#define GETARG_sC(i)	(GETARG_C(i)-MAXARG_sC)
+#define SETARG_sC(i,b)	SETARG_C((i),cast(unsigned int, (b)+MAXARG_sC))
+
 
 #define CREATE_ABC(o,a,b,c)	((cast(Instruction, o)<<POS_OP) \
 			| (cast(Instruction, a)<<POS_A) \
@@ -204,11 +209,19 @@ OP_SETLIST,/*	A B C	R(A)[(C-1)*FPF+i] := R(A+i), 1 <= i <= B	*/
 OP_CLOSE,/*	A 	close all variables in the stack up to (>=) R(A)*/
 OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx], R(A), ... ,R(A+n))	*/
 
-OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+
+/* superinstructions, made only by `luaK_optimize' (see note) */
+OP_JMPIF,/*	A sBx	if R(A) then pc+=sBx				*/
+OP_JMPNOT,/*	A sBx	if not R(A) then pc+=sBx			*/
+OP_JMPEQ,/*	A B sC	if R(A) == RK(B) then pc+=sC			*/
+OP_JMPNE,/*	A B sC	if R(A) ~= RK(B) then pc+=sC			*/
+OP_GETGFIELD,/*	A B C	R(A) := Gbl[RK(B)][RK(C)]			*/
+OP_ADDK/*	A B C	R(A) := R(B) + RK(C)				*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_VARARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_ADDK) + 1)
 
 
 
@@ -230,6 +243,11 @@ OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
       (true or false).
 
   (*) All `skips' (pc++) assume that next instruction is a jump
+
+  (*) The code generator never emits the superinstructions; the
+      optimizer makes them from pairs of instructions (OP_TEST or OP_EQ
+      and its OP_JMP, OP_GETGLOBAL and OP_GETTABLE) or, for OP_ADDK,
+      from an OP_ADD of a number. Their RK operands are always constants.
 ===========================================================================*/
 
 
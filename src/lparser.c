@@ -33,6 +33,10 @@
 
 #define luaY_checklimit(fs,v,l,m)	if ((v)>(l)) errorlimit(fs,l,m)
 
+/* names are interned only when short; each function anchors its own
+   copy of a long one */
+#define eqname(a,b)	((a) == (b) || luaS_eqlngstr(a, b))
+
 
 /*
 ** nodes for block list (list of active blocks)
@@ -145,7 +149,7 @@ static int registerlocalvar (LexState *ls, TString *varname) {
   Proto *f = fs->f;
   int oldsize = f->sizelocvars;
   luaM_growvector(ls->L, f->locvars, fs->nlocvars, f->sizelocvars,
-                  LocVar, SHRT_MAX, "too many local variables");
+                  LocVar, SHRT_MAX, "too many local variables", MEMPROTO);
   while (oldsize < f->sizelocvars) f->locvars[oldsize++].varname = NULL;
   f->locvars[fs->nlocvars].varname = varname;
   luaC_objbarrier(ls->L, f, varname);
@@ -186,14 +190,14 @@ static int indexupvalue (FuncState *fs, TString *name, expdesc *v) {
   int oldsize = f->sizeupvalues;
   for (i=0; i<f->nups; i++) {
     if (fs->upvalues[i].k == v->k && fs->upvalues[i].info == v->u.s.info) {
-      lua_assert(f->upvalues[i] == name);
+      lua_assert(eqname(f->upvalues[i], name));
       return i;
     }
   }
   /* new one */
   luaY_checklimit(fs, f->nups + 1, LUAI_MAXUPVALUES, "upvalues");
   luaM_growvector(fs->L, f->upvalues, f->nups, f->sizeupvalues,
-                  TString *, MAX_INT, "");
+                  TString *, MAX_INT, "", MEMPROTO);
   while (oldsize < f->sizeupvalues) f->upvalues[oldsize++] = NULL;
   f->upvalues[f->nups] = name;
   luaC_objbarrier(fs->L, f, name);
@@ -207,7 +211,7 @@ static int indexupvalue (FuncState *fs, TString *name, expdesc *v) {
 static int searchvar (FuncState *fs, TString *n) {
   int i;
   for (i=fs->nactvar-1; i >= 0; i--) {
-    if (n == getlocvar(fs, i).varname)
+    if (eqname(n, getlocvar(fs, i).varname))
       return i;
   }
   return -1;  /* not found */
@@ -313,7 +317,7 @@ static void pushclosure (LexState *ls, FuncState *func, expdesc *v) {
   int oldsize = f->sizep;
   int i;
   luaM_growvector(ls->L, f->p, fs->np, f->sizep, Proto *,
-                  MAXARG_Bx, "constant table overflow");
+                  MAXARG_Bx, "constant table overflow", MEMPROTO);
   while (oldsize < f->sizep) f->p[oldsize++] = NULL;
   f->p[fs->np++] = func->f;
   luaC_objbarrier(ls->L, f, func->f);
@@ -359,17 +363,21 @@ static void close_func (LexState *ls) {
   Proto *f = fs->f;
   removevars(ls, 0);
   luaK_ret(fs, 0, 0);  /* final return */
-  luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
+  luaK_optimize(fs);
+  luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction, MEMPROTO);
   f->sizecode = fs->pc;
-  luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
+  luaF_initcache(L, f);
+  luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int, MEMPROTO);
   f->sizelineinfo = fs->pc;
-  luaM_reallocvector(L, f->k, f->sizek, fs->nk, TValue);
+  luaM_reallocvector(L, f->k, f->sizek, fs->nk, TValue, MEMPROTO);
   f->sizek = fs->nk;
-  luaM_reallocvector(L, f->p, f->sizep, fs->np, Proto *);
+  luaM_reallocvector(L, f->p, f->sizep, fs->np, Proto *, MEMPROTO);
   f->sizep = fs->np;
-  luaM_reallocvector(L, f->locvars, f->sizelocvars, fs->nlocvars, LocVar);
+  luaM_reallocvector(L, f->locvars, f->sizelocvars, fs->nlocvars, LocVar,
+                     MEMPROTO);
   f->sizelocvars = fs->nlocvars;
-  luaM_reallocvector(L, f->upvalues, f->sizeupvalues, f->nups, TString *);
+  luaM_reallocvector(L, f->upvalues, f->sizeupvalues, f->nups, TString *,
+                     MEMPROTO);
   f->sizeupvalues = f->nups;
   lua_assert(luaG_checkcode(f));
   lua_assert(fs->bl == NULL);
@@ -394,6 +402,12 @@ Proto *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff, const char *name) {
   lua_assert(funcstate.prev == NULL);
   lua_assert(funcstate.f->nups == 0);
   lua_assert(lexstate.fs == NULL);
+#if defined(LUA_USE_INLINE)
+  setptvalue2s(L, L->top, funcstate.f);  /* anchor it while inlining */
+  incr_top(L);
+  luaK_inline(L, funcstate.f);
+  L->top--;
+#endif
   return funcstate.f;
 }
 
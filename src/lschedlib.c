@@ -0,0 +1,543 @@
+/*
+** $Id: lschedlib.c $
+** Scheduler of tasks on a pool of threads
+** See Copyright Notice in lua.h
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define lschedlib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+
+#if defined(LUA_USE_SCHEDULER)
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+** A task is a state of its own, with the standard libraries, whose
+** function runs in a coroutine. Tasks run on a pool of worker threads,
+** started by the first `spawn'. Each worker has a queue of tasks ready
+** to run: it runs the first task of its own queue, and when that is
+** empty it steals half of the queue of another worker. A task that
+** yields goes to the end of the queue of its worker. A task that sleeps
+** goes to a timer wheel, with a slot for each millisecond of a turn of
+** WHEELSIZE milliseconds, and the first worker that sees its time come
+** moves it to its own queue. Workers with nothing to do wait until
+** there are tasks in some queue (or, while tasks sleep, for a tick).
+*/
+
+
+#define TASKKEY		"scheduler.task"	/* task of a state (registry) */
+#define COKEY		"scheduler.co"	/* coroutine of a task (registry) */
+
+#define WHEELSIZE	256
+#define MAXWORKERS	256
+
+
+typedef struct Task {
+  lua_State *L;  /* state of the task */
+  lua_State *co;  /* coroutine that runs its function */
+  int nargs;  /* for the next resume */
+  long wakeup;  /* when it must wake (ms), if it sleeps; 0 otherwise */
+  struct Task *next;  /* in a queue or in a slot of the wheel */
+} Task;
+
+
+typedef struct Worker {
+  pthread_t thread;
+  pthread_mutex_t lock;  /* for its queue */
+  Task *first, *last;  /* queue of tasks ready to run */
+  int n;  /* tasks in the queue */
+  unsigned int rand;  /* to choose where to steal */
+} Worker;
+
+
+static struct Scheduler {
+  pthread_mutex_t lock;  /* for the start and the conditions */
+  pthread_cond_t wake;  /* idle workers wait here for tasks */
+  pthread_cond_t done;  /* `wait' waits here for the last task */
+  int nworkers;  /* 0 until the first `spawn' */
+  int wanted;  /* workers to start (0 for one per processor) */
+  Worker *workers;
+  unsigned int next;  /* worker for the next task spawned from outside */
+  int idle;  /* workers waiting for tasks */
+  int queued;  /* tasks in all queues */
+  long live;  /* tasks not finished */
+  long failed;  /* tasks that raised errors (since the last `wait') */
+  pthread_mutex_t wheellock;
+  Task *wheel[WHEELSIZE];  /* sleeping tasks, by millisecond */
+  long wheeltime;  /* last millisecond whose tasks woke */
+  int sleeping;  /* tasks in the wheel */
+} sched = {
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+  PTHREAD_COND_INITIALIZER, 0, 0, NULL, 0, 0, 0, 0, 0,
+  PTHREAD_MUTEX_INITIALIZER, {NULL}, 0, 0
+};
+
+
+static __thread Worker *current = NULL;  /* worker of this thread */
+
+
+/* milliseconds from some fixed time */
+static long now (void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (long)t.tv_sec*1000 + t.tv_nsec/1000000;
+}
+
+
+
+/*
+** {======================================================
+** Queues of ready tasks
+** =======================================================
+*/
+
+static void push (Worker *w, Task *t) {
+  t->next = NULL;
+  pthread_mutex_lock(&w->lock);
+  if (w->last != NULL) w->last->next = t;
+  else w->first = t;
+  w->last = t;
+  __atomic_add_fetch(&w->n, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&w->lock);
+  __atomic_add_fetch(&sched.queued, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&sched.idle, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&sched.lock);
+    pthread_cond_signal(&sched.wake);
+    pthread_mutex_unlock(&sched.lock);
+  }
+}
+
+
+static Task *pop (Worker *w) {
+  Task *t;
+  if (__atomic_load_n(&w->n, __ATOMIC_RELAXED) == 0) return NULL;
+  pthread_mutex_lock(&w->lock);
+  t = w->first;
+  if (t != NULL) {
+    w->first = t->next;
+    if (w->first == NULL) w->last = NULL;
+    __atomic_sub_fetch(&w->n, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&w->lock);
+  if (t != NULL)
+    __atomic_sub_fetch(&sched.queued, 1, __ATOMIC_SEQ_CST);
+  return t;
+}
+
+
+/*
+** takes the first half of the queue of some other worker: returns its
+** first task and puts the others in the queue of `w'
+*/
+static Task *steal (Worker *w) {
+  int i, n = sched.nworkers;
+  w->rand = w->rand*1103515245 + 12345;
+  for (i = 0; i < n; i++) {
+    Worker *v = &sched.workers[(w->rand + i) % n];
+    Task *first, *t;
+    int k, j;
+    if (v == w || __atomic_load_n(&v->n, __ATOMIC_RELAXED) == 0) continue;
+    pthread_mutex_lock(&v->lock);
+    k = (v->n + 1)/2;
+    first = t = v->first;
+    for (j = 1; j < k; j++) t = t->next;
+    if (k > 0) {
+      v->first = t->next;
+      if (v->first == NULL) v->last = NULL;
+      __atomic_sub_fetch(&v->n, k, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&v->lock);
+    if (k == 0) continue;  /* it was empty already */
+    t->next = NULL;
+    if (k > 1) {  /* keep the others */
+      pthread_mutex_lock(&w->lock);
+      if (w->last != NULL) w->last->next = first->next;
+      else w->first = first->next;
+      w->last = t;
+      __atomic_add_fetch(&w->n, k - 1, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&w->lock);
+    }
+    __atomic_sub_fetch(&sched.queued, 1, __ATOMIC_SEQ_CST);
+    return first;
+  }
+  return NULL;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Timer wheel
+** =======================================================
+*/
+
+static void addtimer (Task *t) {
+  pthread_mutex_lock(&sched.wheellock);
+  if (t->wakeup <= sched.wheeltime)  /* its time went by already? */
+    t->wakeup = sched.wheeltime + 1;
+  t->next = sched.wheel[t->wakeup % WHEELSIZE];
+  sched.wheel[t->wakeup % WHEELSIZE] = t;
+  __atomic_add_fetch(&sched.sleeping, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&sched.wheellock);
+}
+
+
+/* moves the tasks whose time came to the queue of `w' */
+static void expire (Worker *w) {
+  Task *ready = NULL;
+  long time, ms;
+  if (__atomic_load_n(&sched.sleeping, __ATOMIC_RELAXED) == 0 ||
+      pthread_mutex_trylock(&sched.wheellock) != 0)
+    return;  /* nobody sleeps, or another worker is doing it */
+  time = now();
+  ms = sched.wheeltime + 1;
+  if (time - ms >= WHEELSIZE)  /* more than a turn went by? */
+    ms = time - WHEELSIZE + 1;  /* visit each slot once */
+  for (; ms <= time; ms++) {
+    Task **p = &sched.wheel[ms % WHEELSIZE];
+    while (*p != NULL) {
+      Task *t = *p;
+      if (t->wakeup <= time) {  /* its time came? */
+        *p = t->next;
+        t->next = ready;
+        ready = t;
+        __atomic_sub_fetch(&sched.sleeping, 1, __ATOMIC_RELAXED);
+      }
+      else p = &t->next;  /* it sleeps for more turns */
+    }
+  }
+  if (time > sched.wheeltime) sched.wheeltime = time;
+  pthread_mutex_unlock(&sched.wheellock);
+  while (ready != NULL) {
+    Task *t = ready;
+    ready = t->next;
+    t->wakeup = 0;
+    push(w, t);
+  }
+}
+
+/* }====================================================== */
+
+
+
+static void finish (Task *t, int status) {
+  if (status != 0) {
+    const char *msg = lua_tostring(t->co, -1);
+    if (msg == NULL) msg = "(error object is not a string)";
+    fprintf(stderr, "task: %s\n", msg);
+    fflush(stderr);
+    __atomic_add_fetch(&sched.failed, 1, __ATOMIC_RELAXED);
+  }
+  lua_close(t->L);
+  free(t);
+  if (__atomic_sub_fetch(&sched.live, 1, __ATOMIC_ACQ_REL) == 0) {
+    pthread_mutex_lock(&sched.lock);
+    pthread_cond_broadcast(&sched.done);
+    pthread_mutex_unlock(&sched.lock);
+  }
+}
+
+
+static void run (Worker *w, Task *t) {
+  int status = lua_resume(t->co, t->nargs);
+  t->nargs = 0;
+  if (status != LUA_YIELD)
+    finish(t, status);
+  else {
+    lua_settop(t->co, 0);  /* values yielded go nowhere */
+    if (t->wakeup != 0)
+      addtimer(t);
+    else
+      push(w, t);
+  }
+}
+
+
+/* waits until there are tasks to run, or for a tick if some task sleeps */
+static void waittasks (void) {
+  pthread_mutex_lock(&sched.lock);
+  __atomic_add_fetch(&sched.idle, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&sched.queued, __ATOMIC_SEQ_CST) == 0) {
+    if (__atomic_load_n(&sched.sleeping, __ATOMIC_RELAXED) > 0) {
+      struct timespec t;
+      clock_gettime(CLOCK_REALTIME, &t);
+      t.tv_nsec += 1000000;
+      if (t.tv_nsec >= 1000000000L) {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&sched.wake, &sched.lock, &t);
+    }
+    else
+      pthread_cond_wait(&sched.wake, &sched.lock);
+  }
+  __atomic_sub_fetch(&sched.idle, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&sched.lock);
+}
+
+
+static void *workermain (void *ud) {
+  Worker *w = (Worker *)ud;
+  current = w;
+  for (;;) {
+    Task *t;
+    expire(w);
+    if ((t = pop(w)) != NULL || (t = steal(w)) != NULL)
+      run(w, t);
+    else
+      waittasks();
+  }
+  return NULL;
+}
+
+
+static void startworkers (lua_State *L) {
+  int i, n;
+  Worker *ws;
+  pthread_mutex_lock(&sched.lock);
+  if (sched.nworkers > 0) {  /* another thread started them? */
+    pthread_mutex_unlock(&sched.lock);
+    return;
+  }
+  n = (sched.wanted > 0) ? sched.wanted : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1) n = 1;
+  else if (n > MAXWORKERS) n = MAXWORKERS;
+  ws = (Worker *)malloc(n*sizeof(Worker));
+  if (ws == NULL) {
+    pthread_mutex_unlock(&sched.lock);
+    luaL_error(L, "not enough memory");
+  }
+  for (i = 0; i < n; i++) {
+    pthread_mutex_init(&ws[i].lock, NULL);
+    ws[i].first = ws[i].last = NULL;
+    ws[i].n = 0;
+    ws[i].rand = i;
+  }
+  sched.workers = ws;
+  sched.wheeltime = now();
+  __atomic_store_n(&sched.nworkers, n, __ATOMIC_RELEASE);
+  for (i = 0; i < n; i++) {
+    if (pthread_create(&ws[i].thread, NULL, workermain, &ws[i]) != 0) {
+      if (i == 0) {  /* no worker at all? (others steal from dead ones) */
+        pthread_mutex_unlock(&sched.lock);
+        luaL_error(L, "cannot create worker threads");
+      }
+      break;
+    }
+    pthread_detach(ws[i].thread);
+  }
+  pthread_mutex_unlock(&sched.lock);
+}
+
+
+/* task running in `L', or NULL if it is not the coroutine of a task */
+static Task *totask (lua_State *L) {
+  Task *t;
+  lua_getfield(L, LUA_REGISTRYINDEX, TASKKEY);
+  t = (Task *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return (t != NULL && t->co == L) ? t : NULL;
+}
+
+
+typedef struct Spawn {
+  lua_State *L;  /* state that spawns */
+  Task *t;
+  const char *code;  /* chunk of the function, source or binary */
+  size_t len;
+  int nargs;  /* arguments, after the function in `L' */
+} Spawn;
+
+
+static int dumpwriter (lua_State *L, const void *b, size_t size, void *B) {
+  (void)L;
+  luaL_addlstring((luaL_Buffer *)B, (const char *)b, size);
+  return 0;
+}
+
+
+/* builds a task in its new state (which `lua_cpcall' protects) */
+static int opentask (lua_State *T) {
+  Spawn *s = (Spawn *)lua_touserdata(T, 1);
+  int i;
+  luaL_openlibs(T);
+  lua_pushlightuserdata(T, s->t);
+  lua_setfield(T, LUA_REGISTRYINDEX, TASKKEY);
+  if (luaL_loadbuffer(T, s->code, s->len, s->code) != 0)
+    lua_error(T);
+  luaL_checkstack(T, s->nargs + 1, "too many arguments");
+  for (i = 2; i <= s->nargs + 1; i++) {
+    switch (lua_type(s->L, i)) {
+      case LUA_TBOOLEAN: lua_pushboolean(T, lua_toboolean(s->L, i)); break;
+      case LUA_TNUMBER: lua_pushnumber(T, lua_tonumber(s->L, i)); break;
+      case LUA_TSTRING: {
+        size_t l;
+        const char *str = lua_tolstring(s->L, i, &l);
+        lua_pushlstring(T, str, l);
+        break;
+      }
+      default: lua_pushnil(T); break;
+    }
+  }
+  s->t->co = lua_newthread(T);
+  lua_pushvalue(T, -1);
+  lua_setfield(T, LUA_REGISTRYINDEX, COKEY);  /* keep it */
+  lua_pop(T, 1);
+  if (!lua_checkstack(s->t->co, s->nargs + 1))
+    luaL_error(T, "too many arguments");
+  lua_xmove(T, s->t->co, s->nargs + 1);  /* function and arguments */
+  return 0;
+}
+
+
+static int sc_spawn (lua_State *L) {
+  Spawn s;
+  lua_State *T;
+  int i, status;
+  s.nargs = lua_gettop(L) - 1;
+  if (lua_type(L, 1) != LUA_TSTRING) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    if (lua_iscfunction(L, 1))
+      luaL_argerror(L, 1, "cannot spawn a C function");
+    if (lua_getupvalue(L, 1, 1) != NULL)
+      luaL_argerror(L, 1, "cannot spawn a function with upvalues");
+  }
+  for (i = 2; i <= s.nargs + 1; i++) {
+    int tp = lua_type(L, i);
+    if (tp != LUA_TNIL && tp != LUA_TBOOLEAN && tp != LUA_TNUMBER &&
+        tp != LUA_TSTRING)
+      luaL_error(L, "cannot pass a %s value to a task", luaL_typename(L, i));
+  }
+  if (lua_type(L, 1) == LUA_TSTRING)
+    s.code = lua_tolstring(L, 1, &s.len);
+  else {  /* dump the function, as `string.dump' does */
+    luaL_Buffer b;
+    lua_pushvalue(L, 1);
+    luaL_buffinit(L, &b);
+    if (lua_dump(L, dumpwriter, &b) != 0)
+      luaL_error(L, "unable to dump given function");
+    luaL_pushresult(&b);
+    s.code = lua_tolstring(L, -1, &s.len);
+  }
+  if (__atomic_load_n(&sched.nworkers, __ATOMIC_ACQUIRE) == 0)
+    startworkers(L);
+  s.L = L;
+  s.t = (Task *)malloc(sizeof(Task));
+  if (s.t == NULL || (T = luaL_newstate()) == NULL) {
+    free(s.t);
+    return luaL_error(L, "not enough memory");
+  }
+  s.t->L = T;
+  s.t->nargs = s.nargs;
+  s.t->wakeup = 0;
+  status = lua_cpcall(T, opentask, &s);
+  if (status != 0) {
+    lua_pushstring(L, lua_tostring(T, -1));
+    lua_close(T);
+    free(s.t);
+    return lua_error(L);
+  }
+  __atomic_add_fetch(&sched.live, 1, __ATOMIC_ACQ_REL);
+  if (current != NULL)  /* spawned by a task? */
+    push(current, s.t);  /* others steal it if they have nothing to do */
+  else
+    push(&sched.workers[__atomic_fetch_add(&sched.next, 1, __ATOMIC_RELAXED)
+                        % sched.nworkers], s.t);
+  return 0;
+}
+
+
+static int sc_sleep (lua_State *L) {
+  lua_Number secs = luaL_checknumber(L, 1);
+  Task *t = totask(L);
+  if (t != NULL) {  /* let the worker run other tasks meanwhile */
+    long ms = (secs > 0) ? (long)(secs*1000 + 0.5) : 0;
+    t->wakeup = now() + ms;
+    return lua_yield(L, 0);
+  }
+  else if (secs > 0) {  /* outside a task: sleep for real */
+    struct timespec ts;
+    ts.tv_sec = (time_t)secs;
+    ts.tv_nsec = (long)((secs - ts.tv_sec)*1e9);
+    nanosleep(&ts, NULL);
+  }
+  return 0;
+}
+
+
+static int sc_yield (lua_State *L) {
+  if (totask(L) != NULL)
+    return lua_yield(L, 0);
+  return 0;  /* outside a task, there is nothing else to run */
+}
+
+
+/* waits until all tasks finish; returns how many of them failed */
+static int sc_wait (lua_State *L) {
+  long failed;
+  if (current != NULL)
+    return luaL_error(L, "cannot wait inside a task");
+  pthread_mutex_lock(&sched.lock);
+  while (__atomic_load_n(&sched.live, __ATOMIC_ACQUIRE) > 0)
+    pthread_cond_wait(&sched.done, &sched.lock);
+  failed = __atomic_exchange_n(&sched.failed, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&sched.lock);
+  lua_pushinteger(L, failed);
+  return 1;
+}
+
+
+/* number of workers; it may be set until they start */
+static int sc_workers (lua_State *L) {
+  int n = luaL_optint(L, 1, 0);
+  int started;
+  luaL_argcheck(L, 0 <= n && n <= MAXWORKERS, 1, "invalid number of workers");
+  pthread_mutex_lock(&sched.lock);
+  started = sched.nworkers;
+  if (n > 0 && !started) sched.wanted = n;
+  n = started ? sched.nworkers : sched.wanted;
+  pthread_mutex_unlock(&sched.lock);
+  if (lua_gettop(L) > 0 && started)
+    return luaL_error(L, "workers have started already");
+  lua_pushinteger(L, (n > 0) ? n : sysconf(_SC_NPROCESSORS_ONLN));
+  return 1;
+}
+
+
+static const luaL_Reg schedlib[] = {
+  {"sleep", sc_sleep},
+  {"spawn", sc_spawn},
+  {"wait", sc_wait},
+  {"workers", sc_workers},
+  {"yield", sc_yield},
+  {NULL, NULL}
+};
+
+
+LUALIB_API int luaopen_scheduler (lua_State *L) {
+  luaL_register(L, LUA_SCHEDLIBNAME, schedlib);
+  return 1;
+}
+
+#else
+
+LUALIB_API int luaopen_scheduler (lua_State *L) {
+  return luaL_error(L, "no scheduler: build Lua with LUA_USE_SCHEDULER");
+}
+
+#endif
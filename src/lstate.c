@@ -6,6 +6,11 @@
 
 
 #include <stddef.h>
+#include <string.h>
+
+#if defined(LUA_USE_LOCK)
+#include <time.h>
+#endif
 
 #define lstate_c
 #define LUA_CORE
@@ -29,6 +34,16 @@
 #define tostate(l)   (cast(lua_State *, cast(lu_byte *, l) + LUAI_EXTRASPACE))
 
 
+/*
+** a source of randomness for the seed of string hashes; the seed also
+** mixes in a few addresses, which vary from run to run with ASLR
+*/
+#if !defined(luai_makeseed)
+#include <time.h>
+#define luai_makeseed()		cast(unsigned int, time(NULL))
+#endif
+
+
 /*
 ** Main thread combines a thread state and the global state
 */
@@ -41,12 +56,13 @@ typedef struct LG {
 
 static void stack_init (lua_State *L1, lua_State *L) {
   /* initialize CallInfo array */
-  L1->base_ci = luaM_newvector(L, BASIC_CI_SIZE, CallInfo);
+  L1->base_ci = luaM_newvector(L, BASIC_CI_SIZE, CallInfo, MEMTHREAD);
   L1->ci = L1->base_ci;
   L1->size_ci = BASIC_CI_SIZE;
   L1->end_ci = L1->base_ci + L1->size_ci - 1;
   /* initialize stack array */
-  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, TValue);
+  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, TValue,
+                             MEMTHREAD);
   L1->stacksize = BASIC_STACK_SIZE + EXTRA_STACK;
   L1->top = L1->stack;
   L1->stack_last = L1->stack+(L1->stacksize - EXTRA_STACK)-1;
@@ -59,8 +75,20 @@ static void stack_init (lua_State *L1, lua_State *L) {
 
 
 static void freestack (lua_State *L, lua_State *L1) {
-  luaM_freearray(L, L1->base_ci, L1->size_ci, CallInfo);
-  luaM_freearray(L, L1->stack, L1->stacksize, TValue);
+#if defined(LUA_USE_STACKMAP)
+  if (L1->stackmap & MAPCI)
+    luaM_release(L, L1->base_ci, L1->size_ci * sizeof(CallInfo), CIRESERVE,
+                 MEMTHREAD);
+  else
+#endif
+  luaM_freearray(L, L1->base_ci, L1->size_ci, CallInfo, MEMTHREAD);
+#if defined(LUA_USE_STACKMAP)
+  if (L1->stackmap & MAPSTACK)
+    luaM_release(L, L1->stack, L1->stacksize * sizeof(TValue), STACKRESERVE,
+                 MEMTHREAD);
+  else
+#endif
+  luaM_freearray(L, L1->stack, L1->stacksize, TValue, MEMTHREAD);
 }
 
 
@@ -98,26 +126,46 @@ static void preinit_state (lua_State *L, global_State *g) {
   L->base_ci = L->ci = NULL;
   L->savedpc = NULL;
   L->errfunc = 0;
+#if defined(LUA_USE_MEMSTATS)
+  L->memkind = MEMOTHER;
+#endif
+#if defined(LUA_USE_STACKMAP)
+  L->stackmap = 0;
+#endif
   setnilvalue(gt(L));
 }
 
 
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  luaC_setworkers(L, 0);  /* stop marking threads */
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeall(L);  /* collect all objects */
+#if defined(LUA_USE_MEMSTATS)
+  luaM_profile(L, 0);  /* free the profiler */
+#endif
   lua_assert(g->rootgc == obj2gco(L));
   lua_assert(g->strt.nuse == 0);
-  luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *);
+  luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *, MEMOTHER);
+  luaM_freearray(L, G(L)->strt.oldhash, G(L)->strt.oldsize, TString *,
+                 MEMOTHER);
   luaZ_freebuffer(L, &g->buff);
   freestack(L, L);
+#if defined(LUA_USE_STACKMAP)
+  luaM_freemaps(L);
+#endif
+#if defined(LUA_USE_LOCK)
+  pthread_cond_destroy(&g->lockpassed);
+  pthread_cond_destroy(&g->lockfree);
+  pthread_mutex_destroy(&g->lockmutex);
+#endif
   lua_assert(g->totalbytes == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), state_size(LG), 0);
 }
 
 
 lua_State *luaE_newthread (lua_State *L) {
-  lua_State *L1 = tostate(luaM_malloc(L, state_size(lua_State)));
+  lua_State *L1 = tostate(luaM_malloc(L, state_size(lua_State), MEMTHREAD));
   luaC_link(L, obj2gco(L1), LUA_TTHREAD);
   preinit_state(L1, G(L));
   stack_init(L1, L);  /* init stack */
@@ -136,10 +184,51 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L1);
   freestack(L, L1);
-  luaM_freemem(L, fromstate(L1), state_size(lua_State));
+  luaM_freemem(L, fromstate(L1), state_size(lua_State), MEMTHREAD);
+}
+
+
+#define addbuff(b,p,e) \
+  { size_t t = cast(size_t, e); \
+    memcpy((b) + (p), &t, sizeof(t)); (p) += sizeof(t); }
+
+static unsigned int makeseed (lua_State *L) {
+  char buff[4 * sizeof(size_t)];
+  unsigned int h = luai_makeseed();
+  int p = 0;
+  addbuff(buff, p, L);  /* heap variable */
+  addbuff(buff, p, &h);  /* local variable */
+  addbuff(buff, p, luaO_nilobject);  /* global variable */
+  addbuff(buff, p, &lua_newstate);  /* public function */
+  lua_assert(p == sizeof(buff));
+  return luaS_hash(buff, p, h);
 }
 
 
+#if defined(LUA_USE_FROZEN)
+
+/*
+** strings of frozen regions (see lfrozen.c) keep hashes that all states
+** must agree with, so all states use the seed that the first one made
+*/
+static unsigned int processseed = 0;  /* no state yet */
+
+static unsigned int sharedseed (lua_State *L) {
+  unsigned int seed = __atomic_load_n(&processseed, __ATOMIC_ACQUIRE);
+  if (seed == 0) {  /* first state? (or first ones, in several threads) */
+    unsigned int mine = makeseed(L) | 1;
+    if (__atomic_compare_exchange_n(&processseed, &seed, mine, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      seed = mine;  /* else `seed' is the one another thread made */
+  }
+  return seed;
+}
+
+#else
+#define sharedseed(L)	makeseed(L)
+#endif
+
+
 LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   int i;
   lua_State *L;
@@ -163,10 +252,14 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->strt.size = 0;
   g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->strt.oldhash = NULL;
+  g->strt.oldsize = g->strt.migrated = 0;
+  g->seed = sharedseed(L);
   setnilvalue(registry(L));
   luaZ_initbuffer(L, &g->buff);
   g->panic = NULL;
   g->gcstate = GCSpause;
+  g->gckind = KGC_NORMAL;
   g->rootgc = obj2gco(L);
   g->sweepstrgc = 0;
   g->sweepgc = &g->rootgc;
@@ -178,6 +271,28 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
   g->gcdept = 0;
+  g->gcminor = LUAI_GCMINOR;
+#if defined(LUA_USE_JIT)
+  g->jithot = LUAI_JITHOT;
+#endif
+  g->lastmajor = 0;
+  g->gcpool = NULL;
+  g->gcsweeper = NULL;
+  g->freebatch = NULL;
+#if defined(LUA_USE_MEMSTATS)
+  memset(&g->memstats, 0, sizeof(g->memstats));
+  g->memprof = NULL;
+#endif
+#if defined(LUA_USE_STACKMAP)
+  g->nmaps = 0;
+#endif
+#if defined(LUA_USE_LOCK)
+  pthread_mutex_init(&g->lockmutex, NULL);
+  pthread_cond_init(&g->lockfree, NULL);
+  pthread_cond_init(&g->lockpassed, NULL);
+  g->lockswitches = 0;
+  g->lockheld = g->lockwaiting = g->lockdrop = 0;
+#endif
   for (i=0; i<NUM_TAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != 0) {
     /* memory allocation error: free partial state */
@@ -199,6 +314,7 @@ static void callallgcTM (lua_State *L, void *ud) {
 LUA_API void lua_close (lua_State *L) {
   L = G(L)->mainthread;  /* only the main thread can be closed */
   lua_lock(L);
+  luaC_bgsweep(L, 0);  /* finish sweeping and stop the sweeper thread */
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_separateudata(L, 1);  /* separate udata that have GC metamethods */
   L->errfunc = 0;  /* no error function during GC metamethods */
@@ -212,3 +328,77 @@ LUA_API void lua_close (lua_State *L) {
   close_state(L);
 }
 
+
+#if defined(LUA_USE_LOCK)
+/*
+** {======================================================
+** Lock shared by the threads of a state (see `lua_lock')
+** =======================================================
+*/
+
+/*
+** A thread that finds the lock held waits for it in slices of
+** LUAI_LOCKSLICE milliseconds; when a whole slice goes by with no
+** thread getting it, it sets `lockdrop'. Then the thread that has the
+** lock gives it up at its next backward jump or call to a C function
+** (or at once, if it is in a C function already) and waits until some
+** other thread takes it, as otherwise it would usually take it back at
+** once. Threads that run short C functions thus keep the lock without
+** switching on every call, and no thread waits much more than a slice.
+*/
+
+static void addtime (struct timespec *t, long ms) {
+  t->tv_sec += ms / 1000;
+  t->tv_nsec += (ms % 1000) * 1000000L;
+  if (t->tv_nsec >= 1000000000L) {
+    t->tv_sec++;
+    t->tv_nsec -= 1000000000L;
+  }
+}
+
+
+void luaE_lock (lua_State *L) {
+  global_State *g = G(L);
+  pthread_mutex_lock(&g->lockmutex);
+  if (g->lockheld) {  /* must wait? */
+    unsigned long seen = g->lockswitches;
+    g->lockwaiting++;
+    do {
+      struct timespec t;
+      clock_gettime(CLOCK_REALTIME, &t);
+      addtime(&t, LUAI_LOCKSLICE);
+      if (pthread_cond_timedwait(&g->lockfree, &g->lockmutex, &t) != 0 &&
+          g->lockheld) {  /* slice went by? */
+        if (g->lockswitches == seen)  /* no other thread got the lock? */
+          __atomic_store_n(&g->lockdrop, 1, __ATOMIC_RELAXED);
+        seen = g->lockswitches;
+      }
+    } while (g->lockheld);
+    g->lockwaiting--;
+  }
+  g->lockheld = 1;
+  g->lockswitches++;
+  if (g->lockdrop) {  /* some thread was waiting for this? */
+    __atomic_store_n(&g->lockdrop, 0, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&g->lockpassed);
+  }
+  pthread_mutex_unlock(&g->lockmutex);
+}
+
+
+void luaE_unlock (lua_State *L) {
+  global_State *g = G(L);
+  pthread_mutex_lock(&g->lockmutex);
+  lua_assert(g->lockheld);
+  g->lockheld = 0;
+  if (g->lockdrop) {  /* a waiting thread asked for the lock? */
+    unsigned long n = g->lockswitches;
+    pthread_cond_signal(&g->lockfree);
+    while (g->lockswitches == n && g->lockwaiting > 0)  /* let it go first */
+      pthread_cond_wait(&g->lockpassed, &g->lockmutex);
+  }
+  pthread_mutex_unlock(&g->lockmutex);
+}
+
+/* }====================================================== */
+#endif
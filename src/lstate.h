@@ -9,6 +9,10 @@
 
 #include "lua.h"
 
+#if defined(LUA_USE_LOCK)
+#include <pthread.h>
+#endif
+
 #include "lobject.h"
 #include "ltm.h"
 #include "lzio.h"
@@ -39,8 +43,16 @@ typedef struct stringtable {
   GCObject **hash;
   lu_int32 nuse;  /* number of elements */
   int size;
+  GCObject **oldhash;  /* chains not yet moved by a resize (or NULL) */
+  int oldsize;
+  int migrated;  /* number of chains of `oldhash' already moved */
 } stringtable;
 
+/* all chains of a string table, old ones first */
+#define nstrchains(tb)	((tb)->oldsize + (tb)->size)
+#define strchain(tb,i)	((i) < (tb)->oldsize ? &(tb)->oldhash[i] : \
+                                                &(tb)->hash[(i) - (tb)->oldsize])
+
 
 /*
 ** informations about a call
@@ -62,15 +74,21 @@ typedef struct CallInfo {
 #define isLua(ci)	(ttisfunction((ci)->func) && f_isLua(ci))
 
 
+/* released address spaces kept for new stacks (see `luaM_release') */
+#define MAXMAPS		8
+
+
 /*
 ** `global state', shared by all threads of this state
 */
 typedef struct global_State {
   stringtable strt;  /* hash table for strings */
+  unsigned int seed;  /* randomized seed for string hashes */
   lua_Alloc frealloc;  /* function to reallocate memory */
   void *ud;         /* auxiliary data to `frealloc' */
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
+  lu_byte gckind;  /* kind of collector: incremental or generational */
   int sweepstrgc;  /* position of sweep in `strt' */
   GCObject *rootgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* position of sweep in `rootgc' */
@@ -85,6 +103,32 @@ typedef struct global_State {
   lu_mem gcdept;  /* how much GC is `behind schedule' */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC `granularity' */
+  int gcminor;  /* size of the young generation (generational mode) */
+#if defined(LUA_USE_JIT)
+  int jithot;  /* calls and loops before compiling a function (0: never) */
+#endif
+  lu_mem lastmajor;  /* memory in use after the last major collection */
+  struct GCPool *gcpool;  /* threads for parallel marking (NULL if none) */
+  struct GCSweeper *gcsweeper;  /* background sweeper (NULL if none) */
+  lua_FreeBatch freebatch;  /* to free blocks from the sweeper's thread */
+#if defined(LUA_USE_MEMSTATS)
+  MemStats memstats;  /* allocation statistics per kind of block */
+  struct MemProfile *memprof;  /* heap profiler (NULL if not running) */
+#endif
+#if defined(LUA_USE_LOCK)
+  pthread_mutex_t lockmutex;  /* guards the lock fields below */
+  pthread_cond_t lockfree;  /* signals that the lock is free */
+  pthread_cond_t lockpassed;  /* signals that another thread got it */
+  unsigned long lockswitches;  /* number of times some thread got it */
+  int lockheld;  /* does some thread have the lock? */
+  int lockwaiting;  /* number of threads waiting for it */
+  int lockdrop;  /* has a waiting thread asked to have it? */
+#endif
+#if defined(LUA_USE_STACKMAP)
+  void *maps[MAXMAPS];  /* released address spaces, kept for reuse */
+  size_t mapsizes[MAXMAPS];
+  int nmaps;
+#endif
   lua_CFunction panic;  /* to be called in unprotected errors */
   TValue l_registry;
   struct lua_State *mainthread;
@@ -115,6 +159,12 @@ struct lua_State {
   unsigned short baseCcalls;  /* nested C calls when resuming coroutine */
   lu_byte hookmask;
   lu_byte allowhook;
+#if defined(LUA_USE_MEMSTATS)
+  lu_byte memkind;  /* kind of the block being (re)allocated */
+#endif
+#if defined(LUA_USE_STACKMAP)
+  lu_byte stackmap;  /* vectors in reserved address space (see `ldo.h') */
+#endif
   int basehookcount;
   int hookcount;
   lua_Hook hook;
@@ -136,6 +186,7 @@ struct lua_State {
 union GCObject {
   GCheader gch;
   union TString ts;
+  struct Rope rp;
   union Udata u;
   union Closure cl;
   struct Table h;
@@ -146,8 +197,11 @@ union GCObject {
 
 
 /* macros to convert a GCObject into a specific value */
-#define rawgco2ts(o)	check_exp((o)->gch.tt == LUA_TSTRING, &((o)->ts))
+#define rawgco2ts(o)	\
+	check_exp((o)->gch.tt == LUA_TSTRING || (o)->gch.tt == LUA_TLNGSTR, \
+	          &((o)->ts))
 #define gco2ts(o)	(&rawgco2ts(o)->tsv)
+#define gco2rp(o)	check_exp((o)->gch.tt == LUA_TROPE, &((o)->rp))
 #define rawgco2u(o)	check_exp((o)->gch.tt == LUA_TUSERDATA, &((o)->u))
 #define gco2u(o)	(&rawgco2u(o)->uv)
 #define gco2cl(o)	check_exp((o)->gch.tt == LUA_TFUNCTION, &((o)->cl))
@@ -165,5 +219,15 @@ union GCObject {
 LUAI_FUNC lua_State *luaE_newthread (lua_State *L);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
 
+#if defined(LUA_USE_LOCK)
+LUAI_FUNC void luaE_lock (lua_State *L);
+LUAI_FUNC void luaE_unlock (lua_State *L);
+
+/* let a thread that asked for the lock have it (see `luai_threadyield') */
+#define luaE_yield(L) \
+	{ if (__atomic_load_n(&G(L)->lockdrop, __ATOMIC_RELAXED)) \
+	    { luaE_unlock(L); luaE_lock(L); } }
+#endif
+
 #endif
 
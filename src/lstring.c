@@ -19,49 +19,234 @@
 
 
 
-void luaS_resize (lua_State *L, int newsize) {
-  GCObject **newhash;
-  stringtable *tb;
-  int i;
-  if (G(L)->gcstate == GCSsweepstring)
-    return;  /* cannot resize during GC traverse */
-  newhash = luaM_newvector(L, newsize, GCObject *);
-  tb = &G(L)->strt;
-  for (i=0; i<newsize; i++) newhash[i] = NULL;
-  /* rehash */
-  for (i=0; i<tb->size; i++) {
-    GCObject *p = tb->hash[i];
+/*
+** {======================================================
+** Hash function
+** =======================================================
+*/
+
+/*
+** Strings are hashed 4 bytes at a time, in the way of xxHash32. Longer
+** strings are first consumed in blocks of 32 bytes by 8 independent
+** lanes (with SSE2, 4 lanes per register). All characters count, and
+** the `seed' of each state changes which strings collide, so that keys
+** cannot be crafted to fill a chain of the string table or of a table.
+*/
+
+#define PRIME1	0x9E3779B1U
+#define PRIME2	0x85EBCA77U
+#define PRIME3	0xC2B2AE3DU
+#define PRIME4	0x27D4EB2FU
+#define PRIME5	0x165667B1U
+
+#define NLANES		8
+#define BLOCKSIZE	(4*NLANES)
+
+#define rotl(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+/* little-endian word at `p' (a single load in most compilers) */
+#define getword(p) \
+	(cast(lu_int32, cast(unsigned char, (p)[0])) | \
+	 cast(lu_int32, cast(unsigned char, (p)[1])) << 8 | \
+	 cast(lu_int32, cast(unsigned char, (p)[2])) << 16 | \
+	 cast(lu_int32, cast(unsigned char, (p)[3])) << 24)
+
+#define hround(v,w)	(rotl((v) + (w)*PRIME2, 13) * PRIME1)
+
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#define mullo(a,b)	_mm_mullo_epi32(a, b)
+#else
+/* low 32 bits of the products of the 4 lanes of `a' and `b' */
+static __m128i mullo (__m128i a, __m128i b) {
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#endif
+
+static __m128i vround (__m128i v, __m128i w) {
+  v = _mm_add_epi32(v, mullo(w, _mm_set1_epi32(cast(int, PRIME2))));
+  v = _mm_or_si128(_mm_slli_epi32(v, 13), _mm_srli_epi32(v, 19));
+  return mullo(v, _mm_set1_epi32(cast(int, PRIME1)));
+}
+
+/* run all blocks of `str' through the lanes `v' */
+static void hashblocks (const char *str, size_t nblocks, lu_int32 *v) {
+  __m128i a = _mm_loadu_si128(cast(const __m128i *, v));
+  __m128i b = _mm_loadu_si128(cast(const __m128i *, v + 4));
+  for (; nblocks > 0; nblocks--, str += BLOCKSIZE) {
+    a = vround(a, _mm_loadu_si128(cast(const __m128i *, str)));
+    b = vround(b, _mm_loadu_si128(cast(const __m128i *, str + 16)));
+  }
+  _mm_storeu_si128(cast(__m128i *, v), a);
+  _mm_storeu_si128(cast(__m128i *, v + 4), b);
+}
+
+#else
+
+static void hashblocks (const char *str, size_t nblocks, lu_int32 *v) {
+  lu_int32 v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+  lu_int32 v4 = v[4], v5 = v[5], v6 = v[6], v7 = v[7];
+  for (; nblocks > 0; nblocks--, str += BLOCKSIZE) {
+    v0 = hround(v0, getword(str));
+    v1 = hround(v1, getword(str + 4));
+    v2 = hround(v2, getword(str + 8));
+    v3 = hround(v3, getword(str + 12));
+    v4 = hround(v4, getword(str + 16));
+    v5 = hround(v5, getword(str + 20));
+    v6 = hround(v6, getword(str + 24));
+    v7 = hround(v7, getword(str + 28));
+  }
+  v[0] = v0; v[1] = v1; v[2] = v2; v[3] = v3;
+  v[4] = v4; v[5] = v5; v[6] = v6; v[7] = v7;
+}
+
+#endif
+
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  const char *end = str + l;
+  lu_int32 h;
+  if (l >= BLOCKSIZE) {
+    lu_int32 v[NLANES];
+    size_t nblocks = l / BLOCKSIZE;
+    int i;
+    for (i = 0; i < NLANES; i++)
+      v[i] = seed + cast(lu_int32, i + 1) * PRIME1;
+    hashblocks(str, nblocks, v);
+    str += nblocks * BLOCKSIZE;
+    h = 0;
+    for (i = 0; i < NLANES; i++)
+      h += rotl(v[i], 4*i + 1);
+  }
+  else
+    h = seed + PRIME5;
+  h += cast(lu_int32, l);
+  for (; end - str >= 4; str += 4) {
+    h += getword(str) * PRIME3;
+    h = rotl(h, 17) * PRIME4;
+  }
+  for (; str < end; str++) {
+    h += cast(unsigned char, *str) * PRIME5;
+    h = rotl(h, 11) * PRIME1;
+  }
+  h ^= h >> 15;  /* final mix, so that all bits of `h' depend on all bytes */
+  h *= PRIME2;
+  h ^= h >> 13;
+  h *= PRIME3;
+  h ^= h >> 16;
+  return cast(unsigned int, h);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** A resize does not rehash the whole table at once, which would stop
+** the program for a long time when there are millions of strings. It
+** keeps the old array of chains in `oldhash', and each later lookup
+** moves STRMIGRATE of its chains to the new array. Until all of them
+** are moved, lookups search both arrays. Chains are not moved while the
+** collector sweeps them, nor is a new resize started.
+*/
+#define STRMIGRATE	2
+
+
+static void migrate (lua_State *L, int n) {
+  stringtable *tb = &G(L)->strt;
+  for (; n > 0 && tb->migrated < tb->oldsize; n--) {
+    GCObject *p = tb->oldhash[tb->migrated];
+    tb->oldhash[tb->migrated++] = NULL;
     while (p) {  /* for each node in the list */
       GCObject *next = p->gch.next;  /* save next */
-      unsigned int h = gco2ts(p)->hash;
-      int h1 = lmod(h, newsize);  /* new position */
-      lua_assert(cast_int(h%newsize) == lmod(h, newsize));
-      p->gch.next = newhash[h1];  /* chain it */
-      newhash[h1] = p;
+      int h1 = lmod(gco2ts(p)->hash, tb->size);  /* new position */
+      p->gch.next = tb->hash[h1];  /* chain it */
+      tb->hash[h1] = p;
       p = next;
     }
   }
-  luaM_freearray(L, tb->hash, tb->size, TString *);
-  tb->size = newsize;
+  if (tb->migrated == tb->oldsize) {  /* all chains moved? */
+    luaM_freearray(L, tb->oldhash, tb->oldsize, GCObject *, MEMOTHER);
+    tb->oldhash = NULL;
+    tb->oldsize = tb->migrated = 0;
+  }
+}
+
+
+void luaS_resize (lua_State *L, int newsize) {
+  GCObject **newhash;
+  stringtable *tb = &G(L)->strt;
+  int i;
+  if (G(L)->gcstate == GCSsweepstring || tb->oldhash != NULL)
+    return;  /* cannot resize during GC traverse or a migration */
+  newhash = luaM_newvector(L, newsize, GCObject *, MEMOTHER);
+  for (i=0; i<newsize; i++) newhash[i] = NULL;
+  tb->oldhash = tb->hash;
+  tb->oldsize = tb->size;
+  tb->migrated = 0;
   tb->hash = newhash;
+  tb->size = newsize;
+  migrate(L, 0);  /* frees an empty old array at once */
 }
 
 
-static TString *newlstr (lua_State *L, const char *str, size_t l,
-                                       unsigned int h) {
+/*
+** statistic `what' (LUA_STRSIZE etc.) of the string table; chains still
+** to be migrated count too, in the size as well, so that all statistics
+** cover the same chains
+*/
+int luaS_stats (lua_State *L, int what) {
+  stringtable *tb = &G(L)->strt;
+  int i, longest = 0, empty = 0;
+  luaC_checkstrings(L);  /* the sweeper may be changing the chains */
+  switch (what) {
+    case LUA_STRSIZE: return nstrchains(tb) - tb->migrated;
+    case LUA_STRUSE: return cast_int(tb->nuse);
+    case LUA_STRPENDING: return tb->oldsize - tb->migrated;
+    case LUA_STRLONGEST: case LUA_STREMPTY: break;
+    default: return -1;
+  }
+  for (i = tb->migrated; i < nstrchains(tb); i++) {
+    int n = 0;
+    GCObject *o;
+    for (o = *strchain(tb, i); o != NULL; o = o->gch.next) n++;
+    if (n == 0) empty++;
+    else if (n > longest) longest = n;
+  }
+  return (what == LUA_STRLONGEST) ? longest : empty;
+}
+
+
+static TString *createstrobj (lua_State *L, const char *str, size_t l,
+                               unsigned int h) {
   TString *ts;
-  stringtable *tb;
   if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
     luaM_toobig(L);
-  ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char)+sizeof(TString)));
+  ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char)+sizeof(TString),
+                                   MEMSTRING));
   ts->tsv.len = l;
   ts->tsv.hash = h;
-  ts->tsv.marked = luaC_white(G(L));
-  ts->tsv.tt = LUA_TSTRING;
-  ts->tsv.reserved = 0;
+  ts->tsv.extra = 0;
   memcpy(ts+1, str, l*sizeof(char));
   ((char *)(ts+1))[l] = '\0';  /* ending 0 */
-  tb = &G(L)->strt;
+  return ts;
+}
+
+
+static TString *newshrstr (lua_State *L, const char *str, size_t l,
+                                         unsigned int h) {
+  TString *ts = createstrobj(L, str, l, h);
+  stringtable *tb = &G(L)->strt;
+  ts->tsv.marked = luaC_white(G(L));
+  ts->tsv.tt = LUA_TSTRING;
   h = lmod(h, tb->size);
   ts->tsv.next = tb->hash[h];  /* chain new entry */
   tb->hash[h] = obj2gco(ts);
@@ -72,16 +257,9 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
 }
 
 
-TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
-  GCObject *o;
-  unsigned int h = cast(unsigned int, l);  /* seed */
-  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
-  size_t l1;
-  for (l1=l; l1>=step; l1-=step)  /* compute hash */
-    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
-  for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
-       o != NULL;
-       o = o->gch.next) {
+static TString *findchain (lua_State *L, GCObject *o, const char *str,
+                           size_t l) {
+  for (; o != NULL; o = o->gch.next) {
     TString *ts = rawgco2ts(o);
     if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0)) {
       /* string may be dead */
@@ -89,7 +267,85 @@ TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
       return ts;
     }
   }
-  return newlstr(L, str, l, h);  /* not found */
+  return NULL;
+}
+
+
+static TString *internshrstr (lua_State *L, const char *str, size_t l) {
+  stringtable *tb = &G(L)->strt;
+  unsigned int h = luaS_hash(str, l, G(L)->seed);
+  TString *ts;
+  luaC_checkstrings(L);
+  if (tb->oldhash != NULL && G(L)->gcstate != GCSsweepstring)
+    migrate(L, STRMIGRATE);  /* in the middle of a resize */
+  if (tb->oldhash != NULL) {
+    int h1 = lmod(h, tb->oldsize);
+    if (h1 >= tb->migrated &&  /* is its old chain still there? */
+        (ts = findchain(L, tb->oldhash[h1], str, l)) != NULL)
+      return ts;
+  }
+  ts = findchain(L, tb->hash[lmod(h, tb->size)], str, l);
+  if (ts != NULL)
+    return ts;
+  return newshrstr(L, str, l, h);  /* not found */
+}
+
+
+/*
+** short strings are interned; long strings are created anew each time,
+** and their hashes are computed only when needed (see `luaS_hashlongstr')
+*/
+TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
+  if (l <= LUAI_MAXSHORTLEN)
+    return internshrstr(L, str, l);
+  else {
+    TString *ts = createstrobj(L, str, l, G(L)->seed);
+    luaC_link(L, obj2gco(ts), LUA_TLNGSTR);
+    return ts;
+  }
+}
+
+
+/*
+** makes a long string of `ts', a block of the allocator of the state
+** with its length and characters already in place (see
+** `lua_newstrblock')
+*/
+TString *luaS_adopt (lua_State *L, TString *ts) {
+  global_State *g = G(L);
+  size_t size = sizestring(&ts->tsv);
+  lua_assert(ts->tsv.len > LUAI_MAXSHORTLEN);
+  ts->tsv.hash = g->seed;
+  ts->tsv.extra = 0;
+  g->totalbytes += size;
+#if defined(LUA_USE_MEMSTATS)
+  luaM_countmem(&g->memstats, MEMSTRING, 0, size);
+#endif
+  luaC_link(L, obj2gco(ts), LUA_TLNGSTR);
+  return ts;
+}
+
+
+/*
+** hash of a long string, computed when it is first used as a key (until
+** then, `hash' keeps the seed of the state)
+*/
+unsigned int luaS_hashlongstr (TString *ts) {
+  lua_assert(ts->tsv.tt == LUA_TLNGSTR);
+  if (ts->tsv.extra == 0) {  /* no hash yet? */
+    ts->tsv.hash = luaS_hash(getstr(ts), ts->tsv.len, ts->tsv.hash);
+    ts->tsv.extra = 1;
+  }
+  return ts->tsv.hash;
+}
+
+
+int luaS_eqlngstr (TString *a, TString *b) {
+  size_t len = a->tsv.len;
+  return (a == b) ||  /* same instance or... */
+    (a->tsv.tt == LUA_TLNGSTR && b->tsv.tt == LUA_TLNGSTR &&
+     len == b->tsv.len &&  /* long strings with equal contents */
+     memcmp(getstr(a), getstr(b), len) == 0);
 }
 
 
@@ -97,7 +353,7 @@ Udata *luaS_newudata (lua_State *L, size_t s, Table *e) {
   Udata *u;
   if (s > MAX_SIZET - sizeof(Udata))
     luaM_toobig(L);
-  u = cast(Udata *, luaM_malloc(L, s + sizeof(Udata)));
+  u = cast(Udata *, luaM_malloc(L, s + sizeof(Udata), MEMUDATA));
   u->uv.marked = luaC_white(G(L));  /* is not finalized */
   u->uv.tt = LUA_TUSERDATA;
   u->uv.len = s;
@@ -109,3 +365,86 @@ Udata *luaS_newudata (lua_State *L, size_t s, Table *e) {
   return u;
 }
 
+
+
+
+/*
+** {======================================================
+** Ropes
+** =======================================================
+*/
+
+/*
+** creates a rope with the characters of string or rope `o' and room for
+** `size' characters. If `o' owns its buffer, the new rope takes it over
+** (so that appending to a rope again and again costs no copies)
+*/
+Rope *luaS_newrope (lua_State *L, const TValue *o, size_t size) {
+  Rope *r = luaM_new(L, Rope, MEMSTRING);
+  r->len = r->size = 0;
+  r->buff = NULL;
+  r->owner = NULL;
+  r->flat = NULL;
+  luaC_link(L, obj2gco(r), LUA_TROPE);
+  if (ttisrope(o) && rpvalue(o)->buff != NULL) {
+    Rope *p = rpvalue(o);
+    if (size > p->size) {  /* grow the buffer, leaving room for more */
+      size_t newsize = (size <= MAX_SIZET/2) ? 2*size : size;
+      luaM_reallocvector(L, p->buff, p->size, newsize, char, MEMSTRING);
+      p->size = newsize;
+    }
+    r->buff = p->buff;
+    r->size = p->size;
+    p->buff = NULL;
+    p->size = 0;
+    if (p->flat == NULL) {  /* `p' still needs the buffer? */
+      p->owner = r;
+      luaC_objbarrier(L, p, r);
+    }
+  }
+  else {
+    r->buff = luaM_newvector(L, size, char, MEMSTRING);
+    r->size = size;
+    memcpy(r->buff, luaS_data(o), luaS_len(o));
+  }
+  r->len = luaS_len(o);
+  return r;
+}
+
+
+/*
+** the characters of a rope: its own, or those of the first rope along
+** its owners that has them, buffer or interned string (a newer rope
+** starts with the same characters, and a flattened one needs no owner)
+*/
+const char *luaS_ropedata (Rope *r) {
+  for (;;) {
+    if (r->flat != NULL)
+      return getstr(r->flat);
+    else if (r->buff != NULL)
+      return r->buff;
+    r = r->owner;
+  }
+}
+
+
+/* interns the characters of a rope (once) */
+TString *luaS_flatten (lua_State *L, Rope *r) {
+  if (r->flat == NULL) {
+    r->flat = luaS_newlstr(L, luaS_ropedata(r), r->len);
+    luaC_objbarrier(L, r, r->flat);
+    r->owner = NULL;  /* does not need other buffers anymore */
+  }
+  return r->flat;
+}
+
+
+/* }====================================================== */
+
+
+/* compares the characters of two strings or ropes (not both short) */
+int luaS_eqchars (const TValue *o1, const TValue *o2) {
+  size_t l = luaS_len(o1);
+  return (gcvalue(o1) == gcvalue(o2) ||
+          (l == luaS_len(o2) && memcmp(luaS_data(o1), luaS_data(o2), l) == 0));
+}
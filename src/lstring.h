@@ -23,9 +23,32 @@
 
 #define luaS_fix(s)	l_setbit((s)->tsv.marked, FIXEDBIT)
 
+/* length and characters of a string or rope value */
+#define luaS_len(o)	(ttisrope(o) ? rpvalue(o)->len : tsvalue(o)->len)
+#define luaS_data(o)	(ttisrope(o) ? luaS_ropedata(rpvalue(o)) : svalue(o))
+
+/* short strings are interned; other strings and ropes compare contents */
+#define luaS_eqstr(o1,o2) \
+	((ttisshrstring(o1) && ttisshrstring(o2)) ? \
+	 rawtsvalue(o1) == rawtsvalue(o2) : luaS_eqchars(o1, o2))
+
+/* hash of a string, computed on demand for long strings */
+#define luaS_strhash(s) \
+	((s)->tsv.tt == LUA_TSTRING ? (s)->tsv.hash : luaS_hashlongstr(s))
+
+LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l,
+                                  unsigned int seed);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC int luaS_stats (lua_State *L, int what);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
+LUAI_FUNC TString *luaS_adopt (lua_State *L, TString *ts);
+LUAI_FUNC unsigned int luaS_hashlongstr (TString *ts);
+LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
+LUAI_FUNC Rope *luaS_newrope (lua_State *L, const TValue *o, size_t size);
+LUAI_FUNC const char *luaS_ropedata (Rope *r);
+LUAI_FUNC TString *luaS_flatten (lua_State *L, Rope *r);
+LUAI_FUNC int luaS_eqchars (const TValue *o1, const TValue *o2);
 
 
 #endif
@@ -16,6 +16,8 @@
 ** in its main position (i.e. the `original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** With LUA_USE_SWISSTABLE the hash part uses open addressing instead
+** (see below).
 */
 
 #include <math.h>
@@ -32,6 +34,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lstring.h"
 #include "ltable.h"
 
 
@@ -47,9 +50,43 @@
 #define MAXASIZE	(1 << MAXBITS)
 
 
+/*
+** number of ints inside a lua_Number
+*/
+#define numints		cast_int(sizeof(lua_Number)/sizeof(int))
+
+
+static void rehash (lua_State *L, Table *t, const TValue *ek);
+
+
+/*
+** is node `n' the node of short string `key'? Strings of frozen regions
+** (see lfrozen.c) are long strings whatever their lengths, so a long
+** key may have the same characters as a short string
+*/
+#if defined(LUA_USE_FROZEN)
+#define isshrkey(n,key) \
+	(ttisstring(gkey(n)) && (rawtsvalue(gkey(n)) == (key) || \
+	 (ttislngstring(gkey(n)) && eqfrozenkey(rawtsvalue(gkey(n)), key))))
+#define eqfrozenkey(ts,key)	((ts)->tsv.len == (key)->tsv.len && \
+	memcmp(getstr(ts), getstr(key), (key)->tsv.len) == 0)
+#else
+#define isshrkey(n,key)	(ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == (key))
+#endif
+
+
+#if !defined(LUA_USE_SWISSTABLE)
+
+/*
+** {=============================================================
+** Hash part: chained scatter table
+** ==============================================================
+*/
+
 #define hashpow2(t,n)      (gnode(t, lmod((n), sizenode(t))))
   
-#define hashstr(t,str)  hashpow2(t, (str)->tsv.hash)
+#define hashstr(t,str)  hashpow2(t, luaS_strhash(str))
+#define hashshrstr(t,str)  hashpow2(t, (str)->tsv.hash)
 #define hashboolean(t,p)        hashpow2(t, p)
 
 
@@ -63,14 +100,14 @@
 #define hashpointer(t,p)	hashmod(t, IntPoint(p))
 
 
-/*
-** number of ints inside a lua_Number
-*/
-#define numints		cast_int(sizeof(lua_Number)/sizeof(int))
-
+#define dummynode		(&dummynode_)
+#define isdummy(t)		((t)->node == dummynode)
 
+/* number of keys the hash part holds before a rehash */
+#define nodecapacity(t)		(isdummy(t) ? 0 : sizenode(t))
 
-#define dummynode		(&dummynode_)
+/* bytes of a hash part of size 2^lsize */
+#define nodebytes(lsize)	(twoto(lsize)*sizeof(Node))
 
 static const Node dummynode_ = {
   {{NULL}, LUA_TNIL},  /* value */
@@ -113,12 +150,560 @@ static Node *mainposition (const Table *t, const TValue *key) {
 }
 
 
+/*
+** returns the index of node holding `key' in the hash part, or -1
+*/
+static int nodeindex (const Table *t, const TValue *key) {
+  Node *n = mainposition(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    /* key may be dead already, but it is ok to use it in `next' */
+    if (luaO_rawequalObj(key2tval(n), key) ||
+          (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) &&
+           gcvalue(gkey(n)) == gcvalue(key)))
+      return cast_int(n - gnode(t, 0));
+    else n = gnext(n);
+  } while (n);
+  return -1;
+}
+
+
+static void setnodevector (lua_State *L, Table *t, int size) {
+  int lsize;
+  if (size == 0) {  /* no elements to hash part? */
+    t->node = cast(Node *, dummynode);  /* use common `dummynode' */
+    lsize = 0;
+  }
+  else {
+    int i;
+    lsize = ceillog2(size);
+    if (lsize > MAXBITS)
+      luaG_runerror(L, "table overflow");
+    size = twoto(lsize);
+    t->node = luaM_newvector(L, size, Node, MEMNODE);
+    for (i=0; i<size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = NULL;
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+  }
+  t->lsizenode = cast_byte(lsize);
+  t->lastfree = gnode(t, size);  /* all positions are free */
+}
+
+
+static void freenodevector (lua_State *L, Node *node, int lsize) {
+  if (node != dummynode)
+    luaM_freearray(L, node, twoto(lsize), Node, MEMNODE);
+}
+
+
+static void clearnodevector (Table *t) {
+  if (!isdummy(t)) {
+    int i;
+    int size = sizenode(t);
+    for (i = 0; i < size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = NULL;
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* all positions are free again */
+  }
+}
+
+
+static Node *getfreepos (Table *t) {
+  while (t->lastfree-- > t->node) {
+    if (ttisnil(gkey(t->lastfree)))
+      return t->lastfree;
+  }
+  return NULL;  /* could not find a free place */
+}
+
+
+
+/*
+** inserts a new key into a hash table; first, check whether key's main 
+** position is free. If not, check whether colliding node is in its main 
+** position or not: if it is not, move colliding node to an empty place and 
+** put new key in its main position; otherwise (colliding node is in its main 
+** position), new key goes to an empty position. 
+*/
+static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
+  Node *mp = mainposition(t, key);
+  if (!ttisnil(gval(mp)) || mp == dummynode) {
+    Node *othern;
+    Node *n = getfreepos(t);  /* get a free place */
+    if (n == NULL) {  /* cannot find a free place? */
+      rehash(L, t, key);  /* grow table */
+      return luaH_set(L, t, key);  /* re-insert key into grown table */
+    }
+    lua_assert(n != dummynode);
+    othern = mainposition(t, key2tval(mp));
+    if (othern != mp) {  /* is colliding node out of its main position? */
+      /* yes; move colliding node into free position */
+      while (gnext(othern) != mp) othern = gnext(othern);  /* find previous */
+      gnext(othern) = n;  /* redo the chain with `n' in place of `mp' */
+      *n = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
+      gnext(mp) = NULL;  /* now `mp' is free */
+      setnilvalue(gval(mp));
+    }
+    else {  /* colliding node is in its own main position */
+      /* new node will go into free position */
+      gnext(n) = gnext(mp);  /* chain new position */
+      gnext(mp) = n;
+      mp = n;
+    }
+  }
+  gkey(mp)->value = key->value; gkey(mp)->tt = key->tt;
+  luaC_barriert(L, t, key);
+  lua_assert(ttisnil(gval(mp)));
+  return gval(mp);
+}
+
+
+/*
+** search function for integers
+*/
+const TValue *luaH_getnum (Table *t, int key) {
+  /* (1 <= key && key <= t->sizearray) */
+  if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
+    return &t->array[key-1];
+  else {
+    lua_Number nk = cast_num(key);
+    Node *n = hashnum(t, nk);
+    do {  /* check whether `key' is somewhere in the chain */
+      if (ttisint(gkey(n)) ? ivalue(gkey(n)) == key :
+          ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
+        return gval(n);  /* that's it */
+      else n = gnext(n);
+    } while (n);
+    return luaO_nilobject;
+  }
+}
+
+
+/*
+** search function for short (interned) strings
+*/
+const TValue *luaH_getstr (Table *t, TString *key) {
+  Node *n = hashshrstr(t, key);
+  lua_assert(key->tsv.tt == LUA_TSTRING);
+  do {  /* check whether `key' is somewhere in the chain */
+    if (isshrkey(n, key))
+      return gval(n);  /* that's it */
+    else n = gnext(n);
+  } while (n);
+  return luaO_nilobject;
+}
+
+
+/*
+** search function for short strings with an inline cache: first try the node
+** at `*hint' and, on a miss, do a normal search and leave in `*hint'
+** the node where the key was found. As the guard checks the key itself,
+** a stale hint (after a rehash or a removal) is just a miss.
+*/
+const TValue *luaH_getstrhint (Table *t, TString *key, int *hint) {
+  Node *n;
+  if (*hint < sizenode(t)) {
+    n = gnode(t, *hint);
+    if (isshrkey(n, key))
+      return gval(n);
+  }
+  n = hashshrstr(t, key);
+  do {
+    if (isshrkey(n, key)) {
+      *hint = cast_int(n - t->node);
+      return gval(n);
+    }
+    else n = gnext(n);
+  } while (n);
+  return luaO_nilobject;
+}
+
+
+/*
+** search function for any other key
+*/
+static const TValue *getgeneric (Table *t, const TValue *key) {
+  Node *n = mainposition(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    if (luaO_rawequalObj(key2tval(n), key))
+      return gval(n);  /* that's it */
+    else n = gnext(n);
+  } while (n);
+  return luaO_nilobject;
+}
+
+/* }============================================================= */
+
+#else
+
+/*
+** {=============================================================
+** Hash part: open addressing
+** ==============================================================
+*/
+
+/*
+** `node' is followed by one control byte per node: EMPTY for a free
+** node, or 7 bits of the hash of the node's key. The nodes are split in
+** groups, and a search compares all the control bytes of a group at
+** once (with SSE2 when the compiler has it), looking only at the keys
+** whose bytes match. Groups are probed in triangular order; a group
+** with an EMPTY byte ends the search. As in the chained table, a key
+** stays in its node when its value becomes nil, so there is no need
+** for tombstones: the next rehash removes it. To keep misses short, a
+** rehash happens when the hash part is 7/8 full.
+*/
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define GROUPSIZE	16
+#else
+#define GROUPSIZE	8
+#endif
+
+#define EMPTY		0x80
+#define SENTINEL	0xFE	/* control bytes after a small hash part */
+
+#define EMPTY4		EMPTY, EMPTY, EMPTY, EMPTY
+#if GROUPSIZE == 16
+#define EMPTYGROUP	{EMPTY4, EMPTY4, EMPTY4, EMPTY4}
+#else
+#define EMPTYGROUP	{EMPTY4, EMPTY4}
+#endif
+
+/* hash parts smaller than a group still have a whole group of bytes */
+#define sizectrl(lsize)	(twoto(lsize) > GROUPSIZE ? twoto(lsize) : GROUPSIZE)
+#define getctrl(t)	(cast(lu_byte *, (t)->node + sizenode(t)))
+#define ngroups(t)	(sizenode(t) > GROUPSIZE ? sizenode(t)/GROUPSIZE : 1)
+
+#define ctrlhash(h)	cast_int(((h) >> 25) & 0x7f)
+
+/* number of keys that a hash part of size `s' holds before a rehash */
+#define maxload(s)	((s) < 8 ? (s) : (s) - (s)/8)
+
+#define dummynode		(&dummy_.node)
+#define isdummy(t)		((t)->node == dummynode)
+
+#define nodecapacity(t)		(isdummy(t) ? 0 : maxload(sizenode(t)))
+
+#define nodebytes(lsize)	(twoto(lsize)*sizeof(Node) + sizectrl(lsize))
+
+/* an empty hash part, shared by all tables without one */
+static const struct {
+  Node node;
+  lu_byte ctrl[GROUPSIZE];  /* must follow `node' */
+} dummy_ = {
+  {{{NULL}, LUA_TNIL}, {{{NULL}, LUA_TNIL}}},
+  EMPTYGROUP
+};
+
+
+/*
+** bit mask of the bytes equal to `b' in the group at `ctrl'
+*/
+#if defined(__SSE2__)
+
+static unsigned int matchbyte (const lu_byte *ctrl, int b) {
+  __m128i group = _mm_loadu_si128(cast(const __m128i *, ctrl));
+  __m128i bytes = _mm_set1_epi8(cast(char, b));
+  return cast(unsigned int, _mm_movemask_epi8(_mm_cmpeq_epi8(group, bytes)));
+}
+
+#else
+
+static unsigned int matchbyte (const lu_byte *ctrl, int b) {
+  unsigned int m = 0;
+  int i;
+  for (i = 0; i < GROUPSIZE; i++) {
+    if (ctrl[i] == b) m |= 1u << i;
+  }
+  return m;
+}
+
+#endif
+
+
+#if defined(__GNUC__)
+#define firstbit(m)	__builtin_ctz(m)
+#else
+static int firstbit (unsigned int m) {
+  int i = 0;
+  while ((m & 1) == 0) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+
+/* iterate over the groups where a key with hash `h' may be */
+#define forgroups(t,h,g,i,mask) \
+  for (mask = ngroups(t) - 1, g = cast_int((h) & mask), i = 0; \
+       i <= mask; g = (g + ++i) & mask)
+
+/* iterate over the nodes of group `g' whose control byte is `b' */
+#define formatches(ctrl,g,b,m) \
+  for (m = matchbyte((ctrl) + (g)*GROUPSIZE, b); m != 0; m &= m - 1)
+
+#define matchnode(t,g,m)	gnode(t, (g)*GROUPSIZE + firstbit(m))
+
+#define hasempty(ctrl,g)	(matchbyte((ctrl) + (g)*GROUPSIZE, EMPTY) != 0)
+
+
+/*
+** the main positions of the chained table are taken modulo the table
+** size; here the control bytes use the high bits of the hash and the
+** probe its low bits, so the hash must spread its bits both ways
+*/
+static unsigned int mixhash (unsigned int h) {
+  h *= 0x9e3779b1u;
+  return h ^ (h >> 16);
+}
+
+
+/*
+** hash for lua_Numbers
+*/
+static unsigned int hashnum (lua_Number n) {
+  unsigned int a[numints];
+  int i;
+  if (luai_numeq(n, 0))  /* avoid problems with -0 */
+    return mixhash(0);
+  memcpy(a, &n, sizeof(a));
+  for (i = 1; i < numints; i++) a[0] += a[i];
+  return mixhash(a[0]);
+}
+
+
+static unsigned int hashkey (const TValue *key) {
+  switch (ttype(key)) {
+    case LUA_TNUMBER:
+      return hashnum(nvalue(key));
+    case LUA_TSTRING:
+      return mixhash(luaS_strhash(rawtsvalue(key)));
+    case LUA_TBOOLEAN:
+      return mixhash(bvalue(key));
+    case LUA_TLIGHTUSERDATA:
+      return mixhash(IntPoint(pvalue(key)));
+    default:
+      return mixhash(IntPoint(gcvalue(key)));
+  }
+}
+
+
+/*
+** returns the index of node holding `key' in the hash part, or -1
+*/
+static int nodeindex (const Table *t, const TValue *key) {
+  unsigned int h = hashkey(key);
+  const lu_byte *ctrl = getctrl(t);
+  unsigned int m;
+  int g, i, mask;
+  forgroups(t, h, g, i, mask) {
+    formatches(ctrl, g, ctrlhash(h), m) {
+      Node *n = matchnode(t, g, m);
+      /* key may be dead already, but it is ok to use it in `next' */
+      if (luaO_rawequalObj(key2tval(n), key) ||
+            (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) &&
+             gcvalue(gkey(n)) == gcvalue(key)))
+        return cast_int(n - gnode(t, 0));
+    }
+    if (hasempty(ctrl, g)) break;
+  }
+  return -1;
+}
+
+
+static void setnodevector (lua_State *L, Table *t, int size) {
+  if (size == 0) {  /* no elements to hash part? */
+    t->node = cast(Node *, dummynode);  /* use common `dummynode' */
+    t->lsizenode = 0;
+    t->nfree = 0;
+  }
+  else {
+    int i;
+    int lsize = ceillog2(size);
+    if (size > maxload(twoto(lsize)))  /* too full? */
+      lsize++;
+    if (lsize > MAXBITS)
+      luaG_runerror(L, "table overflow");
+    size = twoto(lsize);
+    t->node = cast(Node *, luaM_malloc(L, size*sizeof(Node) + sizectrl(lsize),
+                                       MEMNODE));
+    for (i=0; i<size; i++) {
+      Node *n = gnode(t, i);
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lsizenode = cast_byte(lsize);
+    memset(getctrl(t), EMPTY, size);
+    if (size < GROUPSIZE)  /* pad the group */
+      memset(getctrl(t) + size, SENTINEL, GROUPSIZE - size);
+    t->nfree = maxload(size);
+  }
+}
+
+
+static void freenodevector (lua_State *L, Node *node, int lsize) {
+  if (node != dummynode)
+    luaM_freemem(L, node, twoto(lsize)*sizeof(Node) + sizectrl(lsize),
+                 MEMNODE);
+}
+
+
+static void clearnodevector (Table *t) {
+  if (!isdummy(t)) {
+    int i;
+    int size = sizenode(t);
+    lu_byte *ctrl = getctrl(t);
+    for (i = 0; i < size; i++) {
+      Node *n = gnode(t, i);
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+      ctrl[i] = EMPTY;
+    }
+    t->nfree = maxload(size);
+  }
+}
+
+
+/*
+** inserts a new key into the first EMPTY node of its probe sequence
+** (the one where a search for it will stop)
+*/
+static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
+  if (t->nfree > 0) {
+    unsigned int h = hashkey(key);
+    lu_byte *ctrl = getctrl(t);
+    unsigned int m;
+    int g, i, mask;
+    forgroups(t, h, g, i, mask) {
+      formatches(ctrl, g, EMPTY, m) {
+        Node *n = matchnode(t, g, m);
+        ctrl[n - gnode(t, 0)] = cast_byte(ctrlhash(h));
+        t->nfree--;
+        gkey(n)->value = key->value; gkey(n)->tt = key->tt;
+        luaC_barriert(L, t, key);
+        lua_assert(ttisnil(gval(n)));
+        return gval(n);
+      }
+    }
+  }
+  rehash(L, t, key);  /* grow table */
+  return luaH_set(L, t, key);  /* re-insert key into grown table */
+}
+
+
+/*
+** search function for integers
+*/
+const TValue *luaH_getnum (Table *t, int key) {
+  /* (1 <= key && key <= t->sizearray) */
+  if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
+    return &t->array[key-1];
+  else {
+    lua_Number nk = cast_num(key);
+    unsigned int h = hashnum(nk);
+    const lu_byte *ctrl = getctrl(t);
+    unsigned int m;
+    int g, i, mask;
+    forgroups(t, h, g, i, mask) {
+      formatches(ctrl, g, ctrlhash(h), m) {
+        Node *n = matchnode(t, g, m);
+        if (ttisint(gkey(n)) ? ivalue(gkey(n)) == key :
+            ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
+          return gval(n);  /* that's it */
+      }
+      if (hasempty(ctrl, g)) break;
+    }
+    return luaO_nilobject;
+  }
+}
+
+
+/*
+** search function for short (interned) strings
+*/
+static Node *getstrnode (Table *t, TString *key) {
+  unsigned int h = mixhash(key->tsv.hash);
+  const lu_byte *ctrl = getctrl(t);
+  unsigned int m;
+  int g, i, mask;
+  forgroups(t, h, g, i, mask) {
+    formatches(ctrl, g, ctrlhash(h), m) {
+      Node *n = matchnode(t, g, m);
+      if (isshrkey(n, key))
+        return n;  /* that's it */
+    }
+    if (hasempty(ctrl, g)) break;
+  }
+  return NULL;
+}
+
+
+const TValue *luaH_getstr (Table *t, TString *key) {
+  Node *n = getstrnode(t, key);
+  return (n != NULL) ? gval(n) : luaO_nilobject;
+}
+
+
+/*
+** search function for strings with an inline cache (see the chained
+** version above)
+*/
+const TValue *luaH_getstrhint (Table *t, TString *key, int *hint) {
+  Node *n;
+  if (*hint < sizenode(t)) {
+    n = gnode(t, *hint);
+    if (isshrkey(n, key))
+      return gval(n);
+  }
+  n = getstrnode(t, key);
+  if (n == NULL) return luaO_nilobject;
+  *hint = cast_int(n - t->node);
+  return gval(n);
+}
+
+
+/*
+** search function for any other key
+*/
+static const TValue *getgeneric (Table *t, const TValue *key) {
+  unsigned int h = hashkey(key);
+  const lu_byte *ctrl = getctrl(t);
+  unsigned int m;
+  int g, i, mask;
+  forgroups(t, h, g, i, mask) {
+    formatches(ctrl, g, ctrlhash(h), m) {
+      Node *n = matchnode(t, g, m);
+      if (luaO_rawequalObj(key2tval(n), key))
+        return gval(n);  /* that's it */
+    }
+    if (hasempty(ctrl, g)) break;
+  }
+  return luaO_nilobject;
+}
+
+/* }============================================================= */
+
+#endif
+
+
 /*
 ** returns the index for `key' if `key' is an appropriate key to live in
 ** the array part of the table, -1 otherwise.
 */
 static int arrayindex (const TValue *key) {
-  if (ttisnumber(key)) {
+  if (ttisint(key)) {
+    lua_Integer i = ivalue(key);
+    int k = cast_int(i);
+    if (cast(lua_Integer, k) == i)
+      return k;
+  }
+  else if (ttisnumber(key)) {
     lua_Number n = nvalue(key);
     int k;
     lua_number2int(k, n);
@@ -141,20 +726,11 @@ static int findindex (lua_State *L, Table *t, StkId key) {
   if (0 < i && i <= t->sizearray)  /* is `key' inside array part? */
     return i-1;  /* yes; that's the index (corrected to C) */
   else {
-    Node *n = mainposition(t, key);
-    do {  /* check whether `key' is somewhere in the chain */
-      /* key may be dead already, but it is ok to use it in `next' */
-      if (luaO_rawequalObj(key2tval(n), key) ||
-            (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) &&
-             gcvalue(gkey(n)) == gcvalue(key))) {
-        i = cast_int(n - gnode(t, 0));  /* key index in hash table */
-        /* hash elements are numbered after array ones */
-        return i + t->sizearray;
-      }
-      else n = gnext(n);
-    } while (n);
-    luaG_runerror(L, "invalid key to " LUA_QL("next"));  /* key not found */
-    return 0;  /* to avoid warnings */
+    i = nodeindex(t, key);  /* key index in hash table */
+    if (i < 0)
+      luaG_runerror(L, "invalid key to " LUA_QL("next"));  /* not found */
+    /* hash elements are numbered after array ones */
+    return i + t->sizearray;
   }
 }
 
@@ -163,7 +739,7 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
   int i = findindex(L, t, key);  /* find original element */
   for (i++; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setnvalue(key, cast_num(i+1));
+      setivalue(key, i+1);
       setobj2s(L, key+1, &t->array[i]);
       return 1;
     }
@@ -262,38 +838,13 @@ static int numusehash (const Table *t, int *nums, int *pnasize) {
 
 static void setarrayvector (lua_State *L, Table *t, int size) {
   int i;
-  luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
+  luaM_reallocvector(L, t->array, t->sizearray, size, TValue, MEMTABLE);
   for (i=t->sizearray; i<size; i++)
      setnilvalue(&t->array[i]);
   t->sizearray = size;
 }
 
 
-static void setnodevector (lua_State *L, Table *t, int size) {
-  int lsize;
-  if (size == 0) {  /* no elements to hash part? */
-    t->node = cast(Node *, dummynode);  /* use common `dummynode' */
-    lsize = 0;
-  }
-  else {
-    int i;
-    lsize = ceillog2(size);
-    if (lsize > MAXBITS)
-      luaG_runerror(L, "table overflow");
-    size = twoto(lsize);
-    t->node = luaM_newvector(L, size, Node);
-    for (i=0; i<size; i++) {
-      Node *n = gnode(t, i);
-      gnext(n) = NULL;
-      setnilvalue(gkey(n));
-      setnilvalue(gval(n));
-    }
-  }
-  t->lsizenode = cast_byte(lsize);
-  t->lastfree = gnode(t, size);  /* all positions are free */
-}
-
-
 static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
   int i;
   int oldasize = t->sizearray;
@@ -311,7 +862,7 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
         setobjt2t(L, luaH_setnum(L, t, i+1), &t->array[i]);
     }
     /* shrink array */
-    luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
+    luaM_reallocvector(L, t->array, oldasize, nasize, TValue, MEMTABLE);
   }
   /* re-insert elements from hash part */
   for (i = twoto(oldhsize) - 1; i >= 0; i--) {
@@ -319,14 +870,12 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
     if (!ttisnil(gval(old)))
       setobjt2t(L, luaH_set(L, t, key2tval(old)), gval(old));
   }
-  if (nold != dummynode)
-    luaM_freearray(L, nold, twoto(oldhsize), Node);  /* free old array */
+  freenodevector(L, nold, oldhsize);  /* free old hash part */
 }
 
 
 void luaH_resizearray (lua_State *L, Table *t, int nasize) {
-  int nsize = (t->node == dummynode) ? 0 : sizenode(t);
-  resize(L, t, nasize, nsize);
+  resize(L, t, nasize, nodecapacity(t));
 }
 
 
@@ -356,7 +905,7 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
 
 
 Table *luaH_new (lua_State *L, int narray, int nhash) {
-  Table *t = luaM_new(L, Table);
+  Table *t = luaM_new(L, Table, MEMTABLE);
   luaC_link(L, obj2gco(t), LUA_TTABLE);
   t->metatable = NULL;
   t->flags = cast_byte(~0);
@@ -371,96 +920,89 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
 }
 
 
-void luaH_free (lua_State *L, Table *t) {
-  if (t->node != dummynode)
-    luaM_freearray(L, t->node, sizenode(t), Node);
-  luaM_freearray(L, t->array, t->sizearray, TValue);
-  luaM_free(L, t);
+/*
+** remove all entries from `t', keeping its array and hash parts
+** (removing references needs no barrier)
+*/
+void luaH_clear (Table *t) {
+  int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  clearnodevector(t);
+  t->flags = 0;  /* it may be a metatable */
 }
 
 
-static Node *getfreepos (Table *t) {
-  while (t->lastfree-- > t->node) {
-    if (ttisnil(gkey(t->lastfree)))
-      return t->lastfree;
-  }
-  return NULL;  /* could not find a free place */
+void luaH_free (lua_State *L, Table *t) {
+  freenodevector(L, t->node, t->lsizenode);
+  luaM_freearray(L, t->array, t->sizearray, TValue, MEMTABLE);
+  luaM_free(L, t, MEMTABLE);
 }
 
 
+#if defined(LUA_USE_FROZEN)
 
 /*
-** inserts a new key into a hash table; first, check whether key's main 
-** position is free. If not, check whether colliding node is in its main 
-** position or not: if it is not, move colliding node to an empty place and 
-** put new key in its main position; otherwise (colliding node is in its main 
-** position), new key goes to an empty position. 
+** {=============================================================
+** Frozen tables (see lfrozen.c)
+** ==============================================================
 */
-static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
-  Node *mp = mainposition(t, key);
-  if (!ttisnil(gval(mp)) || mp == dummynode) {
-    Node *othern;
-    Node *n = getfreepos(t);  /* get a free place */
-    if (n == NULL) {  /* cannot find a free place? */
-      rehash(L, t, key);  /* grow table */
-      return luaH_set(L, t, key);  /* re-insert key into grown table */
-    }
-    lua_assert(n != dummynode);
-    othern = mainposition(t, key2tval(mp));
-    if (othern != mp) {  /* is colliding node out of its main position? */
-      /* yes; move colliding node into free position */
-      while (gnext(othern) != mp) othern = gnext(othern);  /* find previous */
-      gnext(othern) = n;  /* redo the chain with `n' in place of `mp' */
-      *n = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
-      gnext(mp) = NULL;  /* now `mp' is free */
-      setnilvalue(gval(mp));
-    }
-    else {  /* colliding node is in its own main position */
-      /* new node will go into free position */
-      gnext(n) = gnext(mp);  /* chain new position */
-      gnext(mp) = n;
-      mp = n;
-    }
-  }
-  gkey(mp)->value = key->value; gkey(mp)->tt = key->tt;
-  luaC_barriert(L, t, key);
-  lua_assert(ttisnil(gval(mp)));
-  return gval(mp);
+
+void luaH_frozenerror (lua_State *L) {
+  luaG_runerror(L, "attempt to modify a frozen table");
+}
+
+
+/* bytes taken by the array and hash parts of `t' */
+size_t luaH_partsize (const Table *t) {
+  size_t size = t->sizearray * sizeof(TValue);
+  if (!isdummy(t))
+    size += nodebytes(t->lsizenode);
+  return size;
 }
 
 
 /*
-** search function for integers
+** gives the frozen table `ft' a copy of the parts of `t', laid out in
+** `mem' (with `luaH_partsize(t)' bytes). Keys stay where they are, as
+** their hashes do not depend on the table. Frozen tables never get new
+** keys, so they have no free nodes.
 */
-const TValue *luaH_getnum (Table *t, int key) {
-  /* (1 <= key && key <= t->sizearray) */
-  if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
-    return &t->array[key-1];
+void luaH_copyparts (const Table *t, Table *ft, void *mem) {
+  size_t asize = t->sizearray * sizeof(TValue);
+  ft->sizearray = t->sizearray;
+  ft->array = NULL;
+  if (asize > 0) {
+    ft->array = cast(TValue *, mem);
+    memcpy(ft->array, t->array, asize);
+  }
+  ft->lsizenode = t->lsizenode;
+  if (isdummy(t))
+    ft->node = cast(Node *, dummynode);
   else {
-    lua_Number nk = cast_num(key);
-    Node *n = hashnum(t, nk);
-    do {  /* check whether `key' is somewhere in the chain */
-      if (ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
-        return gval(n);  /* that's it */
-      else n = gnext(n);
-    } while (n);
-    return luaO_nilobject;
+    ft->node = cast(Node *, cast(char *, mem) + asize);
+    memcpy(ft->node, t->node, nodebytes(t->lsizenode));
+#if !defined(LUA_USE_SWISSTABLE)
+    {
+      int i;
+      for (i = 0; i < sizenode(ft); i++) {  /* chains go through the copy */
+        Node *n = gnode(ft, i);
+        if (gnext(n) != NULL)
+          gnext(n) = gnode(ft, gnext(n) - t->node);
+      }
+    }
+#endif
   }
+#if defined(LUA_USE_SWISSTABLE)
+  ft->nfree = 0;
+#else
+  ft->lastfree = ft->node;
+#endif
 }
 
+/* }============================================================= */
 
-/*
-** search function for strings
-*/
-const TValue *luaH_getstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
-  do {  /* check whether `key' is somewhere in the chain */
-    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
-      return gval(n);  /* that's it */
-    else n = gnext(n);
-  } while (n);
-  return luaO_nilobject;
-}
+#endif
 
 
 /*
@@ -469,30 +1011,36 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 const TValue *luaH_get (Table *t, const TValue *key) {
   switch (ttype(key)) {
     case LUA_TNIL: return luaO_nilobject;
-    case LUA_TSTRING: return luaH_getstr(t, rawtsvalue(key));
+    case LUA_TSTRING: {
+      if (ttisshrstring(key))  /* interned? */
+        return luaH_getstr(t, rawtsvalue(key));  /* use specialized version */
+      else return getgeneric(t, key);
+    }
     case LUA_TNUMBER: {
       int k;
-      lua_Number n = nvalue(key);
-      lua_number2int(k, n);
-      if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
-        return luaH_getnum(t, k);  /* use specialized version */
+      if (ttisint(key)) {
+        lua_Integer i = ivalue(key);
+        k = cast_int(i);
+        if (cast(lua_Integer, k) == i)  /* index fits in an int? */
+          return luaH_getnum(t, k);  /* use specialized version */
+      }
+      else {
+        lua_Number n = nvalue(key);
+        lua_number2int(k, n);
+        if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
+          return luaH_getnum(t, k);  /* use specialized version */
+      }
       /* else go through */
     }
-    default: {
-      Node *n = mainposition(t, key);
-      do {  /* check whether `key' is somewhere in the chain */
-        if (luaO_rawequalObj(key2tval(n), key))
-          return gval(n);  /* that's it */
-        else n = gnext(n);
-      } while (n);
-      return luaO_nilobject;
-    }
+    default: return getgeneric(t, key);
   }
 }
 
 
 TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
-  const TValue *p = luaH_get(t, key);
+  const TValue *p;
+  luaH_checkfrozen(L, t);
+  p = luaH_get(t, key);
   t->flags = 0;
   if (p != luaO_nilobject)
     return cast(TValue *, p);
@@ -506,26 +1054,29 @@ TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
 
 
 TValue *luaH_setnum (lua_State *L, Table *t, int key) {
-  const TValue *p = luaH_getnum(t, key);
+  const TValue *p;
+  luaH_checkfrozen(L, t);
+  p = luaH_getnum(t, key);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
     TValue k;
-    setnvalue(&k, cast_num(key));
+    setivalue(&k, key);
     return newkey(L, t, &k);
   }
 }
 
 
 TValue *luaH_setstr (lua_State *L, Table *t, TString *key) {
-  const TValue *p = luaH_getstr(t, key);
+  const TValue *p;
+  TValue k;
+  luaH_checkfrozen(L, t);
+  setsvalue(L, &k, key);
+  p = luaH_get(t, &k);  /* `key' may be a long string */
   if (p != luaO_nilobject)
     return cast(TValue *, p);
-  else {
-    TValue k;
-    setsvalue(L, &k, key);
+  else
     return newkey(L, t, &k);
-  }
 }
 
 
@@ -570,7 +1121,7 @@ int luaH_getn (Table *t) {
     return i;
   }
   /* else must find a boundary in hash part */
-  else if (t->node == dummynode)  /* hash part is empty? */
+  else if (isdummy(t))  /* hash part is empty? */
     return j;  /* that is easy... */
   else return unbound_search(t, j);
 }
@@ -579,9 +1130,15 @@ int luaH_getn (Table *t) {
 
 #if defined(LUA_DEBUG)
 
+#if defined(LUA_USE_SWISSTABLE)
+Node *luaH_mainposition (const Table *t, const TValue *key) {
+  return gnode(t, cast_int(hashkey(key) & (ngroups(t) - 1))*GROUPSIZE);
+}
+#else
 Node *luaH_mainposition (const Table *t, const TValue *key) {
   return mainposition(t, key);
 }
+#endif
 
 int luaH_isdummy (Node *n) { return n == dummynode; }
 
@@ -17,19 +17,36 @@
 
 #define key2tval(n)	(&(n)->i_key.tvk)
 
+/* key of the node holding value `v' */
+#define keyfromval(v) \
+	(key2tval(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
+
 
 LUAI_FUNC const TValue *luaH_getnum (Table *t, int key);
 LUAI_FUNC TValue *luaH_setnum (lua_State *L, Table *t, int key);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getstrhint (Table *t, TString *key, int *hint);
 LUAI_FUNC TValue *luaH_setstr (lua_State *L, Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
 LUAI_FUNC Table *luaH_new (lua_State *L, int narray, int lnhash);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, int nasize);
+LUAI_FUNC void luaH_clear (Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_getn (Table *t);
 
+#if defined(LUA_USE_FROZEN)
+/* frozen tables (see lfrozen.c) never change */
+#define luaH_checkfrozen(L,t) \
+	{ if (isfrozen(obj2gco(t))) luaH_frozenerror(L); }
+LUAI_FUNC void luaH_frozenerror (lua_State *L);
+LUAI_FUNC size_t luaH_partsize (const Table *t);
+LUAI_FUNC void luaH_copyparts (const Table *t, Table *ft, void *mem);
+#else
+#define luaH_checkfrozen(L,t)	((void)0)
+#endif
+
 
 #if defined(LUA_DEBUG)
 LUAI_FUNC Node *luaH_mainposition (const Table *t, const TValue *key);
@@ -266,12 +266,39 @@ static int sort (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Pre-sizing and reuse
+** =======================================================
+*/
+
+static int tnew (lua_State *L) {
+  int narr = luaL_optint(L, 1, 0);
+  int nrec = luaL_optint(L, 2, 0);
+  luaL_argcheck(L, narr >= 0, 1, "size cannot be negative");
+  luaL_argcheck(L, nrec >= 0, 2, "size cannot be negative");
+  lua_createtable(L, narr, nrec);
+  return 1;
+}
+
+
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg tab_funcs[] = {
+  {"clear", tclear},
   {"concat", tconcat},
   {"foreach", foreach},
   {"foreachi", foreachi},
   {"getn", getn},
   {"maxn", maxn},
+  {"new", tnew},
   {"insert", tinsert},
   {"remove", tremove},
   {"setn", setn},
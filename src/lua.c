@@ -47,6 +47,7 @@ static void print_usage (void) {
   "  -l name  require library " LUA_QL("name") "\n"
   "  -i       enter interactive mode after executing " LUA_QL("script") "\n"
   "  -v       show version information\n"
+  "  -p       use the pool allocator\n"
   "  --       stop handling options\n"
   "  -        execute stdin and stop handling options\n"
   ,
@@ -258,7 +259,7 @@ static int handle_script (lua_State *L, char **argv, int n) {
 #define notail(x)	{if ((x)[2] != '\0') return -1;}
 
 
-static int collectargs (char **argv, int *pi, int *pv, int *pe) {
+static int collectargs (char **argv, int *pi, int *pv, int *pe, int *pp) {
   int i;
   for (i = 1; argv[i] != NULL; i++) {
     if (argv[i][0] != '-')  /* not an option? */
@@ -276,6 +277,10 @@ static int collectargs (char **argv, int *pi, int *pv, int *pe) {
         notail(argv[i]);
         *pv = 1;
         break;
+      case 'p':
+        notail(argv[i]);
+        *pp = 1;
+        break;
       case 'e':
         *pe = 1;  /* go through */
       case 'l':
@@ -341,7 +346,7 @@ static int pmain (lua_State *L) {
   struct Smain *s = (struct Smain *)lua_touserdata(L, 1);
   char **argv = s->argv;
   int script;
-  int has_i = 0, has_v = 0, has_e = 0;
+  int has_i = 0, has_v = 0, has_e = 0, has_p = 0;
   globalL = L;
   if (argv[0] && argv[0][0]) progname = argv[0];
   lua_gc(L, LUA_GCSTOP, 0);  /* stop collector during initialization */
@@ -349,7 +354,7 @@ static int pmain (lua_State *L) {
   lua_gc(L, LUA_GCRESTART, 0);
   s->status = handle_luainit(L);
   if (s->status != 0) return 0;
-  script = collectargs(argv, &has_i, &has_v, &has_e);
+  script = collectargs(argv, &has_i, &has_v, &has_e, &has_p);
   if (script < 0) {  /* invalid args? */
     print_usage();
     s->status = 1;
@@ -377,7 +382,10 @@ static int pmain (lua_State *L) {
 int main (int argc, char **argv) {
   int status;
   struct Smain s;
-  lua_State *L = lua_open();  /* create state */
+  int has_p = 0, dummy;
+  lua_State *L;
+  collectargs(argv, &dummy, &dummy, &dummy, &has_p);
+  L = (has_p) ? luaL_newpoolstate() : lua_open();  /* create state */
   if (L == NULL) {
     l_message(argv[0], "cannot create state: not enough memory");
     return EXIT_FAILURE;
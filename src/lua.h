@@ -65,6 +65,12 @@ typedef int (*lua_Writer) (lua_State *L, const void* p, size_t sz, void* ud);
 */
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
+/*
+** prototype for functions that free `n' blocks at once; unlike a
+** lua_Alloc, they may be called from a thread other than Lua's own
+*/
+typedef void (*lua_FreeBatch) (void *ud, void **blocks, size_t *sizes, int n);
+
 
 /*
 ** basic types
@@ -110,6 +116,25 @@ typedef LUA_INTEGER lua_Integer;
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
 LUA_API void       (lua_close) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
+LUA_API lua_State *(lua_clonestate) (lua_State *L, lua_Alloc f, void *ud);
+
+
+/*
+** frozen regions: read-only tables that all states share
+*/
+typedef struct lua_Frozen lua_Frozen;
+
+LUA_API lua_Frozen *(lua_freeze) (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void        (lua_pushfrozen) (lua_State *L, lua_Frozen *fz);
+LUA_API void        (lua_freefrozen) (lua_Frozen *fz);
+
+/*
+** string blocks: long strings made outside any state, which a state
+** with the same allocator may take over
+*/
+LUA_API char *(lua_newstrblock) (lua_Alloc f, void *ud, size_t len);
+LUA_API void  (lua_pushstrblock) (lua_State *L, char *s);
+LUA_API void  (lua_freestrblock) (lua_Alloc f, void *ud, char *s);
 
 LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
 
@@ -193,6 +218,7 @@ LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, int n);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API int   (lua_setfenv) (lua_State *L, int idx);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
 
 
 /*
@@ -226,8 +252,30 @@ LUA_API int  (lua_status) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCGEN		8
+#define LUA_GCINC		9
+#define LUA_GCSETWORKERS	10
+#define LUA_GCBGSWEEP		11
+#define LUA_GCPROFILE		12
+#define LUA_GCSTRINGS		13
+#define LUA_GCJIT		14
+
+/* statistics of the string table given by LUA_GCSTRINGS */
+#define LUA_STRSIZE		0	/* number of chains */
+#define LUA_STRUSE		1	/* number of strings */
+#define LUA_STRLONGEST		2	/* length of the longest chain */
+#define LUA_STREMPTY		3	/* number of empty chains */
+#define LUA_STRPENDING		4	/* chains left to move by a resize */
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
+LUA_API int (lua_gcworker) (lua_State *L, int n, size_t *marked,
+                            size_t *bytes, size_t *steals);
+LUA_API const char *(lua_memstats) (lua_State *L, int kind, size_t *count,
+                                    size_t *bytes, size_t *allocs,
+                                    size_t *total);
+LUA_API const char *(lua_memsample) (lua_State *L, int n, int *line,
+                                     const char **kind, size_t *count,
+                                     size_t *bytes);
 
 
 /*
@@ -242,6 +290,7 @@ LUA_API void  (lua_concat) (lua_State *L, int n);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void (lua_setfreebatch) (lua_State *L, lua_FreeBatch f);
 
 
 
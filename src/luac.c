@@ -128,9 +128,9 @@ static const Proto* combine(lua_State* L, int n)
   f->source=luaS_newliteral(L,"=(" PROGNAME ")");
   f->maxstacksize=1;
   pc=2*n+1;
-  f->code=luaM_newvector(L,pc,Instruction);
+  f->code=luaM_newvector(L,pc,Instruction,MEMPROTO);
   f->sizecode=pc;
-  f->p=luaM_newvector(L,n,Proto*);
+  f->p=luaM_newvector(L,n,Proto*,MEMPROTO);
   f->sizep=n;
   pc=0;
   for (i=0; i<n; i++)
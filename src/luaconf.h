@@ -142,6 +142,13 @@
 */
 #define LUA_INTEGER	ptrdiff_t
 
+/*
+@@ LUAI_UINTEGER is the unsigned counterpart of LUA_INTEGER.
+** CHANGE it together with LUA_INTEGER. The VM uses it to do wrap-around
+** arithmetic (and to detect overflows) over integer-valued numbers.
+*/
+#define LUAI_UINTEGER	size_t
+
 
 /*
 @@ LUA_API is a mark for all core API functions.
@@ -313,6 +320,94 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 
 
+/*
+@@ LUAI_GCMINOR defines the default size of the young generation, as a
+@* percentage of the memory in use after the previous collection, for
+@* the generational mode of the garbage collector.
+** CHANGE it if you want minor collections to run more or less often.
+** In generational mode, LUAI_GCPAUSE gives how much the memory in use
+** may grow after a full (major) collection before the next one.
+*/
+#define LUAI_GCMINOR	20  /* young objects use up to 20% of the heap */
+
+
+/*
+@@ LUA_USE_PARALLELMARK lets full collections mark objects with a pool of
+@* threads, set with lua_gc(L, LUA_GCSETWORKERS, n).
+** CHANGE it (define it) if your system has POSIX threads and your
+** compiler has the GNU '__atomic' builtins and '__thread'. You must
+** also link with -lpthread.
+*/
+/* #define LUA_USE_PARALLELMARK */
+
+
+/*
+@@ LUA_USE_BGSWEEP lets the incremental collector sweep in a thread of
+@* its own, turned on with lua_gc(L, LUA_GCBGSWEEP, 1).
+** CHANGE it (define it) if your system has POSIX threads and your
+** compiler has the GNU '__atomic' builtins and '__thread'. You must
+** also link with -lpthread. The state also needs a lua_FreeBatch
+** function (luaL_newstate sets one).
+*/
+/* #define LUA_USE_BGSWEEP */
+
+
+/*
+@@ LUA_USE_MEMSTATS keeps allocation statistics for each kind of block
+@* (strings, tables, closures, etc.) and a sampling heap profiler, both
+@* read with collectgarbage("stats") and lua_memstats/lua_memsample.
+** CHANGE it (define it) to see where the memory goes. Without it the
+** statistics cost nothing: the kinds of blocks are compiled away.
+*/
+/* #define LUA_USE_MEMSTATS */
+
+
+/*
+@@ LUA_USE_SWISSTABLE gives tables a hash part with open addressing,
+@* probing groups of control bytes (16 at a time with SSE2), instead of
+@* the default chained scatter table.
+** CHANGE it (define it) if your programs look up many keys that are
+** not in the tables (misses are much cheaper) or use large tables.
+*/
+/* #define LUA_USE_SWISSTABLE */
+
+
+/*
+@@ LUA_USE_FROZEN lets lua_freeze copy a graph of tables, strings and
+@* numbers into a frozen region, read-only and outside any collector,
+@* that any state (in any thread) can use with lua_pushfrozen.
+** CHANGE it (define it) if many states read the same big tables, such
+** as configurations. Your compiler must have the GNU '__atomic'
+** builtins. All states then hash strings with the same seed (made
+** once per process), and tables check that they are not frozen before
+** any change.
+*/
+/* #define LUA_USE_FROZEN */
+
+
+/*
+@@ LUA_USE_CHANNEL adds the `channel' library, whose channels carry
+@* messages (nils, booleans, numbers, strings and tables of them) from
+@* one state to another, in the same thread or in another one.
+** CHANGE it (define it) if you run independent states in several
+** threads and they must talk. Your compiler must have the GNU '__atomic'
+** builtins.
+*/
+/* #define LUA_USE_CHANNEL */
+
+
+/*
+@@ LUA_USE_SCHEDULER adds the `scheduler' library, which runs tasks (each
+@* one a state of its own) on a pool of threads, with `spawn', `sleep'
+@* and `yield'.
+** CHANGE it (define it) if your system has POSIX threads and your
+** compiler has the GNU '__atomic' builtins, and you want many
+** independent jobs to use all processors. You must also link with
+** -lpthread.
+*/
+/* #define LUA_USE_SCHEDULER */
+
+
 
 /*
 @@ LUA_COMPAT_GETN controls compatibility with old getn behavior.
@@ -482,6 +577,122 @@
 #define LUAI_MAXUPVALUES	60
 
 
+/*
+@@ LUAI_MAXSHORTLEN is the maximum length of an interned string.
+** CHANGE it if you want more or fewer strings interned. Longer strings
+** are neither hashed nor interned when created: they are compared by
+** contents and hashed only when first used as a table key, so reading
+** or building big strings does not pay for the string table.
+*/
+#define LUAI_MAXSHORTLEN	40
+
+
+/*
+@@ LUAI_MINROPE is the length from which a concatenation to a string
+@* gives a rope, whose characters are interned only when needed.
+** CHANGE it if you want more or fewer ropes. Appending to a rope takes
+** constant time (amortized), so loops like 's = s .. x' run in linear
+** time; but a rope costs an extra copy when it is used as a key, ordered
+** or passed to C. Concatenations by the API (lua_concat) never give ropes.
+*/
+#define LUAI_MINROPE	64
+
+
+/*
+@@ LUA_USE_JUMPTABLE makes the interpreter dispatch opcodes through a
+@* table of label addresses instead of a 'switch'.
+** CHANGE it (undefine it) if your compiler does not support the GNU
+** "labels as values" extension or if you want the portable 'switch'.
+*/
+#if defined(__GNUC__) && !defined(LUA_ANSI)
+#define LUA_USE_JUMPTABLE
+#endif
+
+
+/*
+@@ LUA_USE_JIT compiles hot Lua functions to x86-64 machine code.
+@@ LUAI_JITHOT is the default number of calls and backward jumps after
+@* which a function is compiled (set it with lua_gc(L, LUA_GCJIT, n)).
+** CHANGE it (define it) if you run on x86-64 with a GNU compiler and
+** 'mmap'; it is ignored on other machines. Native code gives calls,
+** returns and hooks back to the interpreter, so debugging is as usual.
+*/
+/* #define LUA_USE_JIT */
+#if defined(LUA_USE_JIT) && \
+    !(defined(__GNUC__) && defined(__x86_64__) && !defined(_WIN32))
+#undef LUA_USE_JIT
+#endif
+#define LUAI_JITHOT	100
+
+
+/*
+@@ LUA_USE_PROPAGATE makes the compiler propagate constants through the
+@* code of each function and remove the code that can never run.
+** CHANGE it if your programs test constant locals (such as debugging
+** switches) in hot code. Hooks and debuggers do not see the code that is
+** removed: a line left with no code gets no line events, so breakpoints
+** set on it never hit.
+*/
+/* #define LUA_USE_PROPAGATE */
+
+
+/*
+@@ LUA_USE_INLINE makes the compiler inline calls to small local functions.
+@@ LUAI_MAXINLINE is the size (in instructions) of the largest function
+@* that is inlined.
+@@ LUAI_INLINEBUDGET is how many instructions inlining may add to a chunk.
+** CHANGE them if your programs call small helpers in tight loops. Only
+** functions that call nothing, use no globals or varargs and change no
+** upvalues are inlined, and only where the compiler knows which function
+** a local or an upvalue holds. Tracebacks and the debug library still
+** show inlined calls, but hooks do not see them and precompiled chunks
+** lose them.
+*/
+/* #define LUA_USE_INLINE */
+#define LUAI_MAXINLINE		24
+#define LUAI_INLINEBUDGET	4000
+
+
+/*
+@@ LUA_USE_STACKMAP keeps big Lua stacks and CallInfo arrays in address
+@* space reserved for them, where they grow and shrink in place, so that
+@* their frames never move.
+@@ LUAI_STACKMAPMIN is the size (in bytes) at which a stack or a
+@* CallInfo array moves (once) to its reserved address space.
+@@ LUAI_MAXSTACKMAP is the number of slots reserved for each such stack.
+** CHANGE it (define it) if your system has 'mmap' and deep recursions
+** in long-lived coroutines spend time moving stacks (new stacks pay for
+** fresh pages, so many short-lived deep coroutines may run slower). A
+** stack larger than LUAI_MAXSTACKMAP goes back to the heap. Reserved
+** memory does not come from the lua_Alloc function, but the collector
+** counts it as usual.
+*/
+/* #define LUA_USE_STACKMAP */
+#define LUAI_STACKMAPMIN	131072
+#define LUAI_MAXSTACKMAP	1000000
+
+
+/*
+@@ LUA_USE_LOCK lets several OS threads share a state, each one running
+@* its own coroutines, with a lock that lua_lock and lua_unlock take.
+** CHANGE it (define it) if your system has POSIX threads and your
+** compiler has the GNU '__atomic' builtins, and you want threads to
+** share one heap instead of copying it into a state each. You must
+** also link with -lpthread. Only one thread at a time runs Lua code:
+** the lock is free while a thread runs C functions, and a thread that
+** runs loops or calls passes it on when another thread has waited for
+** it for LUAI_LOCKSLICE milliseconds. The collector then never shrinks
+** stacks, as API calls read them without the lock.
+*/
+/* #define LUA_USE_LOCK */
+#if defined(LUA_USE_LOCK)
+#define lua_lock(L)		luaE_lock(L)
+#define lua_unlock(L)		luaE_unlock(L)
+#define luai_threadyield(L)	luaE_yield(L)
+#define LUAI_LOCKSLICE		5
+#endif
+
+
 /*
 @@ LUAL_BUFFERSIZE is the buffer size used by the lauxlib buffer system.
 */
@@ -39,6 +39,12 @@ LUALIB_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUALIB_API int (luaopen_package) (lua_State *L);
 
+#define LUA_CHANLIBNAME	"channel"
+LUALIB_API int (luaopen_channel) (lua_State *L);
+
+#define LUA_SCHEDLIBNAME	"scheduler"
+LUALIB_API int (luaopen_scheduler) (lua_State *L);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L); 
@@ -90,9 +90,10 @@ static TString* LoadString(LoadState* S)
 static void LoadCode(LoadState* S, Proto* f)
 {
  int n=LoadInt(S);
- f->code=luaM_newvector(S->L,n,Instruction);
+ f->code=luaM_newvector(S->L,n,Instruction,MEMPROTO);
  f->sizecode=n;
  LoadVector(S,f->code,n,sizeof(Instruction));
+ luaF_initcache(S->L,f);
 }
 
 static Proto* LoadFunction(LoadState* S, TString* p);
@@ -101,7 +102,7 @@ static void LoadConstants(LoadState* S, Proto* f)
 {
  int i,n;
  n=LoadInt(S);
- f->k=luaM_newvector(S->L,n,TValue);
+ f->k=luaM_newvector(S->L,n,TValue,MEMPROTO);
  f->sizek=n;
  for (i=0; i<n; i++) setnilvalue(&f->k[i]);
  for (i=0; i<n; i++)
@@ -117,7 +118,7 @@ static void LoadConstants(LoadState* S, Proto* f)
    	setbvalue(o,LoadChar(S)!=0);
 	break;
    case LUA_TNUMBER:
-	setnvalue(o,LoadNumber(S));
+	luaO_setnum(o,LoadNumber(S));
 	break;
    case LUA_TSTRING:
 	setsvalue2n(S->L,o,LoadString(S));
@@ -128,7 +129,7 @@ static void LoadConstants(LoadState* S, Proto* f)
   }
  }
  n=LoadInt(S);
- f->p=luaM_newvector(S->L,n,Proto*);
+ f->p=luaM_newvector(S->L,n,Proto*,MEMPROTO);
  f->sizep=n;
  for (i=0; i<n; i++) f->p[i]=NULL;
  for (i=0; i<n; i++) f->p[i]=LoadFunction(S,f->source);
@@ -138,11 +139,11 @@ static void LoadDebug(LoadState* S, Proto* f)
 {
  int i,n;
  n=LoadInt(S);
- f->lineinfo=luaM_newvector(S->L,n,int);
+ f->lineinfo=luaM_newvector(S->L,n,int,MEMPROTO);
  f->sizelineinfo=n;
  LoadVector(S,f->lineinfo,n,sizeof(int));
  n=LoadInt(S);
- f->locvars=luaM_newvector(S->L,n,LocVar);
+ f->locvars=luaM_newvector(S->L,n,LocVar,MEMPROTO);
  f->sizelocvars=n;
  for (i=0; i<n; i++) f->locvars[i].varname=NULL;
  for (i=0; i<n; i++)
@@ -152,7 +153,7 @@ static void LoadDebug(LoadState* S, Proto* f)
   f->locvars[i].endpc=LoadInt(S);
  }
  n=LoadInt(S);
- f->upvalues=luaM_newvector(S->L,n,TString*);
+ f->upvalues=luaM_newvector(S->L,n,TString*,MEMPROTO);
  f->sizeupvalues=n;
  for (i=0; i<n; i++) f->upvalues[i]=NULL;
  for (i=0; i<n; i++) f->upvalues[i]=LoadString(S);
@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -32,10 +33,16 @@
 #define MAXTAGLOOP	100
 
 
-const TValue *luaV_tonumber (const TValue *obj, TValue *n) {
+/* interned string of a string value (flattening ropes) */
+#define flatstr(L,o) \
+	(ttisrope(o) ? luaS_flatten(L, rpvalue(o)) : rawtsvalue(o))
+
+
+const TValue *luaV_tonumber (lua_State *L, const TValue *obj, TValue *n) {
   lua_Number num;
   if (ttisnumber(obj)) return obj;
-  if (ttisstring(obj) && luaO_str2d(svalue(obj), &num)) {
+  if (ttype(obj) == LUA_TSTRING &&
+      luaO_str2d(getstr(flatstr(L, obj)), &num)) {
     setnvalue(n, num);
     return n;
   }
@@ -45,7 +52,11 @@ const TValue *luaV_tonumber (const TValue *obj, TValue *n) {
 
 
 int luaV_tostring (lua_State *L, StkId obj) {
-  if (!ttisnumber(obj))
+  if (ttisrope(obj)) {
+    setsvalue2s(L, obj, luaS_flatten(L, rpvalue(obj)));
+    return 1;
+  }
+  else if (!ttisnumber(obj))
     return 0;
   else {
     char s[LUAI_MAXNUMBER2STR];
@@ -107,6 +118,7 @@ static void callTM (lua_State *L, const TValue *f, const TValue *p1,
 
 void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
   int loop;
+  flatkey(L, key);
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;
     if (ttistable(t)) {  /* `t' is a table? */
@@ -131,9 +143,43 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
 }
 
 
+/*
+** `luaV_gettable' for a constant string key: each primitive get goes
+** through the inline cache `hint' of the current instruction. For method
+** calls the hint ends up pointing into the table that has the method,
+** usually the `__index' of the object's metatable.
+*/
+static void gettablestr (lua_State *L, const TValue *t, TValue *key,
+                         StkId val, int *hint) {
+  int loop;
+  for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    const TValue *tm;
+    if (ttistable(t)) {  /* `t' is a table? */
+      Table *h = hvalue(t);
+      const TValue *res = luaH_getstrhint(h, rawtsvalue(key), hint);
+      if (!ttisnil(res) ||  /* result is no nil? */
+          (tm = fasttm(L, h->metatable, TM_INDEX)) == NULL) { /* or no TM? */
+        setobj2s(L, val, res);
+        return;
+      }
+      /* else will try the tag method */
+    }
+    else if (ttisnil(tm = luaT_gettmbyobj(L, t, TM_INDEX)))
+      luaG_typeerror(L, t, "index");
+    if (ttisfunction(tm)) {
+      callTMres(L, val, tm, t, key);
+      return;
+    }
+    t = tm;  /* else repeat with `tm' */
+  }
+  luaG_runerror(L, "loop in gettable");
+}
+
+
 void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
   int loop;
   TValue temp;
+  flatkey(L, key);
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;
     if (ttistable(t)) {  /* `t' is a table? */
@@ -227,9 +273,10 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
-    return luai_numlt(nvalue(l), nvalue(r));
-  else if (ttisstring(l))
-    return l_strcmp(rawtsvalue(l), rawtsvalue(r)) < 0;
+    return (ttisint(l) && ttisint(r)) ? ivalue(l) < ivalue(r)
+                                      : luai_numlt(nvalue(l), nvalue(r));
+  else if (ttype(l) == LUA_TSTRING)
+    return l_strcmp(flatstr(L, l), flatstr(L, r)) < 0;
   else if ((res = call_orderTM(L, l, r, TM_LT)) != -1)
     return res;
   return luaG_ordererror(L, l, r);
@@ -241,9 +288,10 @@ static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
-    return luai_numle(nvalue(l), nvalue(r));
-  else if (ttisstring(l))
-    return l_strcmp(rawtsvalue(l), rawtsvalue(r)) <= 0;
+    return (ttisint(l) && ttisint(r)) ? ivalue(l) <= ivalue(r)
+                                      : luai_numle(nvalue(l), nvalue(r));
+  else if (ttype(l) == LUA_TSTRING)
+    return l_strcmp(flatstr(L, l), flatstr(L, r)) <= 0;
   else if ((res = call_orderTM(L, l, r, TM_LE)) != -1)  /* first try `le' */
     return res;
   else if ((res = call_orderTM(L, r, l, TM_LT)) != -1)  /* else try `lt' */
@@ -257,9 +305,10 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
   lua_assert(ttype(t1) == ttype(t2));
   switch (ttype(t1)) {
     case LUA_TNIL: return 1;
-    case LUA_TNUMBER: return luai_numeq(nvalue(t1), nvalue(t2));
+    case LUA_TNUMBER: return numequal(t1, t2);
     case LUA_TBOOLEAN: return bvalue(t1) == bvalue(t2);  /* true must be 1 !! */
     case LUA_TLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING: return luaS_eqstr(t1, t2);
     case LUA_TUSERDATA: {
       if (uvalue(t1) == uvalue(t2)) return 1;
       tm = get_compTM(L, uvalue(t1)->metatable, uvalue(t2)->metatable,
@@ -279,34 +328,56 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
 }
 
 
-void luaV_concat (lua_State *L, int total, int last) {
+/* like `tostring', but keeps ropes as they are */
+#define tostrorrope(L,o)	(ttisrope(o) || tostring(L, o))
+
+
+/*
+** concatenates `total' values ending at register `last'. When `rope' is
+** true, a concatenation whose first value is a rope or a long string
+** gives a rope, so that appending to a string in a loop takes linear
+** time: the characters are interned only when the result is used as a
+** key, compared or converted (see `luaS_flatten').
+*/
+void luaV_concat (lua_State *L, int total, int last, int rope) {
   do {
     StkId top = L->base + last + 1;
     int n = 2;  /* number of elements handled in this pass (at least 2) */
-    if (!(ttisstring(top-2) || ttisnumber(top-2)) || !tostring(L, top-1)) {
+    if (!(ttype(top-2) == LUA_TSTRING || ttisnumber(top-2)) ||
+        !tostrorrope(L, top-1)) {
       if (!call_binTM(L, top-2, top-1, top-2, TM_CONCAT))
         luaG_concaterror(L, top-2, top-1);
-    } else if (tsvalue(top-1)->len == 0)  /* second op is empty? */
-      (void)tostring(L, top - 2);  /* result is first op (as string) */
+    } else if (luaS_len(top-1) == 0)  /* second op is empty? */
+      (void)tostrorrope(L, top - 2);  /* result is first op (as string) */
     else {
       /* at least two string values; get as many as possible */
-      size_t tl = tsvalue(top-1)->len;
-      char *buffer;
+      size_t tl = luaS_len(top-1);
       int i;
       /* collect total length */
-      for (n = 1; n < total && tostring(L, top-n-1); n++) {
-        size_t l = tsvalue(top-n-1)->len;
+      for (n = 1; n < total && tostrorrope(L, top-n-1); n++) {
+        size_t l = luaS_len(top-n-1);
         if (l >= MAX_SIZET - tl) luaG_runerror(L, "string length overflow");
         tl += l;
       }
-      buffer = luaZ_openspace(L, &G(L)->buff, tl);
-      tl = 0;
-      for (i=n; i>0; i--) {  /* concat all strings */
-        size_t l = tsvalue(top-i)->len;
-        memcpy(buffer+tl, svalue(top-i), l);
-        tl += l;
+      if (rope && (ttisrope(top-n) || tsvalue(top-n)->len >= LUAI_MINROPE)) {
+        Rope *r = luaS_newrope(L, top-n, tl);
+        for (i=n-1; i>0; i--) {  /* append the other strings */
+          size_t l = luaS_len(top-i);
+          memcpy(r->buff+r->len, luaS_data(top-i), l);
+          r->len += l;
+        }
+        setrpvalue(L, top-n, r);
+      }
+      else {
+        char *buffer = luaZ_openspace(L, &G(L)->buff, tl);
+        tl = 0;
+        for (i=n; i>0; i--) {  /* concat all strings */
+          size_t l = luaS_len(top-i);
+          memcpy(buffer+tl, luaS_data(top-i), l);
+          tl += l;
+        }
+        setsvalue2s(L, top-n, luaS_newlstr(L, buffer, tl));
       }
-      setsvalue2s(L, top-n, luaS_newlstr(L, buffer, tl));
     }
     total -= n-1;  /* got `n' strings to create 1 new */
     last -= n-1;
@@ -318,8 +389,8 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
                    const TValue *rc, TMS op) {
   TValue tempb, tempc;
   const TValue *b, *c;
-  if ((b = luaV_tonumber(rb, &tempb)) != NULL &&
-      (c = luaV_tonumber(rc, &tempc)) != NULL) {
+  if ((b = luaV_tonumber(L, rb, &tempb)) != NULL &&
+      (c = luaV_tonumber(L, rc, &tempc)) != NULL) {
     lua_Number nb = nvalue(b), nc = nvalue(c);
     switch (op) {
       case TM_ADD: setnvalue(ra, luai_numadd(nb, nc)); break;
@@ -338,11 +409,110 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 
 
 
+/*
+** Integer arithmetic for the VM fast paths. Each operation stores its
+** result in `*r' and returns 0 when the result cannot be an integer
+** (it overflows, is beyond MAX_EXACTINT or is -0); the caller then falls
+** back to floating-point arithmetic, which gives the same results.
+*/
+
+#define iadd(a,b,r) \
+	(*(r) = cast(lua_Integer, cast(lu_integer, a) + cast(lu_integer, b)), \
+	 ((*(r) ^ (a)) & (*(r) ^ (b))) >= 0 && isexactint(*(r)))
+
+#define isub(a,b,r) \
+	(*(r) = cast(lua_Integer, cast(lu_integer, a) - cast(lu_integer, b)), \
+	 (((a) ^ (b)) & ((a) ^ *(r))) >= 0 && isexactint(*(r)))
+
+/* operands in [-HALFINT, HALFINT) cannot overflow a multiplication */
+#define HALFINT		(cast(lu_integer, 1) << (sizeof(lua_Integer)*CHAR_BIT/2 - 1))
+#define ishalfint(a)	(cast(lu_integer, a) + HALFINT < 2*HALFINT)
+
+
+static int imul (lua_Integer a, lua_Integer b, lua_Integer *r) {
+  if ((a == 0 || b == 0) && (a < 0 || b < 0))
+    return 0;  /* result is -0 */
+  else if (ishalfint(a) && ishalfint(b))
+    *r = a * b;
+  else {
+    int neg = (a < 0) != (b < 0);
+    lu_integer ua = (a < 0) ? 0 - cast(lu_integer, a) : cast(lu_integer, a);
+    lu_integer ub = (b < 0) ? 0 - cast(lu_integer, b) : cast(lu_integer, b);
+    lu_integer max = cast(lu_integer, MAX_INTEGER) + neg;
+    if (ub != 0 && ua > max / ub)
+      return 0;  /* overflow */
+    *r = cast(lua_Integer, neg ? 0 - ua * ub : ua * ub);
+  }
+  return isexactint(*r);
+}
+
+
+static int imod (lua_Integer a, lua_Integer b, lua_Integer *r) {
+  if (b == 0)
+    return 0;  /* let floating point produce a NaN */
+  else if (b == -1)
+    *r = 0;  /* avoid overflow with MIN_INTEGER % -1 */
+  else if ((a ^ b) < 0 &&
+           !isexactint(cast(lua_Integer, cast(lu_integer, a) -
+                                         cast(lu_integer, b))))
+    return 0;  /* floating point would round `floor(a/b)*b' */
+  else {
+    lua_Integer m = a % b;
+    if (m != 0 && (m ^ b) < 0)  /* C division truncated the quotient? */
+      m += b;  /* correct result for floor division */
+    *r = m;
+  }
+  return 1;
+}
+
+
+/*
+** Prepares a numeric `for' over integers: if the initial value and the
+** step are integers (and the step is not zero), the loop runs with
+** integer arithmetic and its limit slot keeps the number of iterations
+** still to go. Returns 0 if the loop must run with floating point.
+*/
+static int forprep (StkId ra) {
+  lua_Integer init, limit, step;
+  lu_integer count;
+  if (!ttisint(ra) || !ttisint(ra+2) || (step = ivalue(ra+2)) == 0)
+    return 0;
+  init = ivalue(ra);
+  if (ttisint(ra+1))
+    limit = ivalue(ra+1);
+  else {  /* convert a float limit to the last integer it allows */
+    lua_Number l = nvalue(ra+1);
+    if (luai_numisnan(l)) return 0;
+    l = (step > 0) ? floor(l) : ceil(l);
+    if (!(luai_numle(-cast_num(MAX_EXACTINT), l) &&
+          luai_numle(l, cast_num(MAX_EXACTINT))))
+      return 0;  /* indices could go beyond MAX_EXACTINT */
+    lua_number2integer(limit, l);
+  }
+  if (step > 0 ? init > limit : init < limit)
+    count = 0;  /* loop will not run */
+  else {
+    if (step > 0)
+      count = (cast(lu_integer, limit) - cast(lu_integer, init)) /
+              cast(lu_integer, step);
+    else
+      count = (cast(lu_integer, init) - cast(lu_integer, limit)) /
+              (0 - cast(lu_integer, step));
+    if (count < ~cast(lu_integer, 0)) count++;  /* count first iteration */
+  }
+  setivalue(ra, cast(lua_Integer, cast(lu_integer, init) -
+                                  cast(lu_integer, step)));
+  setivalue(ra+1, cast(lua_Integer, count));
+  return 1;
+}
+
+
+
 /*
 ** some macros for common tasks in `luaV_execute'
 */
 
-#define runtime_check(L, c)	{ if (!(c)) break; }
+#define runtime_check(L, c)	{ if (!(c)) vmbreak; }
 
 #define RA(i)	(base+GETARG_A(i))
 /* to be used after possible stack reallocation */
@@ -353,14 +523,152 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 #define RKC(i)	check_exp(getCMode(GET_OPCODE(i)) == OpArgK, \
 	ISK(GETARG_C(i)) ? k+INDEXK(GETARG_C(i)) : base+GETARG_C(i))
 #define KBx(i)	check_exp(getBMode(GET_OPCODE(i)) == OpArgK, k+GETARG_Bx(i))
+#define KC(i)	check_exp(ISK(GETARG_C(i)), k+INDEXK(GETARG_C(i)))
 
 
+/* inline cache of the current instruction */
+#define ICACHE(pc)	(&cl->p->icache[pcRel(pc, cl->p)])
+
+/* is RK operand `x' a constant short string? */
+#define isKstr(x)	(ISK(x) && ttisshrstring(k+INDEXK(x)))
+
+
+#if defined(LUA_USE_LOCK)
+/* other threads get the lock only in `luaV_execute' (see `vmyield') */
+#define dojump(L,pc,i)	((pc) += (i))
+#else
 #define dojump(L,pc,i)	{(pc) += (i); luai_threadyield(L);}
+#endif
 
 
 #define Protect(x)	{ L->savedpc = pc; {x;}; base = L->base; }
 
 
+#if defined(LUA_USE_MEMSTATS)
+/* the heap profiler needs the current line of unprotected allocations */
+#define savepc(L)	((L)->savedpc = pc)
+#else
+#define savepc(L)	((void)0)
+#endif
+
+
+/*
+** can OP_CALL enter the function in `f' without `luaD_precall'?  Only a
+** Lua function with a fixed number of parameters, with no call hook and
+** with room for its frame in the stack and for a new CallInfo (the
+** checks `luaD_precall' makes one at a time, all up front here)
+*/
+#define fastcall(L,f) \
+  (ttisfunction(f) && !clvalue(f)->c.isC && !clvalue(f)->l.p->is_vararg && \
+   !((L)->hookmask & LUA_MASKCALL) && (L)->ci != (L)->end_ci && \
+   (L)->stack_last - (f) > clvalue(f)->l.p->maxstacksize)
+
+/* start the frame of Lua function `p' at `b' (the rest of a call) */
+#define enterframe(L,ci,p,b) { \
+  StkId st_ = (b) + (p)->numparams; \
+  if (L->top < st_) st_ = L->top;  /* missing arguments */ \
+  L->base = (ci)->base = (b); \
+  (ci)->top = (b) + (p)->maxstacksize; \
+  for (; st_ < (ci)->top; st_++) \
+    setnilvalue(st_); \
+  L->top = (ci)->top; \
+  L->savedpc = (p)->code; \
+}
+
+
+#if defined(LUA_USE_LOCK)
+/*
+** let a thread asking for the lock run, at calls, returns and backward
+** jumps; it may move the stack, so only where nothing but `base' points
+** into it
+*/
+#define vmyield()	{ L->savedpc = pc; luai_threadyield(L); base = L->base; }
+#else
+#define vmyield()	((void)0)
+#endif
+
+
+#if defined(LUA_USE_JIT)
+/*
+** go on in native code (see `ljit.c') after a call, a return or a
+** backward jump, each of which counts towards compiling the function;
+** native code comes back here for calls, returns and hooks (and at
+** backward jumps, for threads waiting for the lock)
+*/
+#define jitenter() { \
+  if (!(L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))) { \
+    L->savedpc = pc;  /* (not while tracing: see `traceexec') */ \
+    if (luaJ_hot(L, cl->p)) { \
+      pc = luaJ_run(L, cl, pc); \
+      base = L->base; \
+      vmyield(); \
+    } \
+  } \
+}
+#else
+#define jitenter()	((void)0)
+#endif
+
+
+#if defined(LUA_USE_JIT) || defined(LUA_USE_LOCK)
+/* after an instruction that may have jumped backward (see `dojump') */
+#define endloop()	{ if (loop) { loop = 0; vmyield(); jitenter(); } }
+#else
+#define endloop()	((void)0)
+#endif
+
+
+/*
+** fetch the next instruction into `i' (running hooks if needed) and
+** point `ra' at its register A
+*/
+#define vmfetch()	{ \
+  i = *pc++; \
+  if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+      (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) { \
+    traceexec(L, pc); \
+    if (L->status == LUA_YIELD) {  /* did hook yield? */ \
+      L->savedpc = pc - 1; \
+      return; \
+    } \
+    base = L->base; \
+  } \
+  /* warning!! several calls may realloc the stack and invalidate `ra' */ \
+  ra = RA(i); \
+  lua_assert(base == L->base && L->base == L->ci->base); \
+  lua_assert(base <= L->top && L->top <= L->stack + L->stacksize); \
+  lua_assert(L->top == L->ci->top || luaG_checkopenop(i)); \
+}
+
+/*
+** opcode dispatch; with LUA_USE_JUMPTABLE these are redefined in
+** `ljumptab.h' so that each opcode jumps straight to the next one
+*/
+#define vmdispatch(o)	switch(o)
+#define vmcase(l)	case l:
+#define vmbreak		continue
+
+
+#define arith_opi(iop,op,tm) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        lua_Integer ir; \
+        if (ttisfloat(rb) && ttisfloat(rc)) { \
+          lua_Number nb = fltvalue(rb), nc = fltvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        } \
+        else if (ttisint(rb) && ttisint(rc) && iop(ivalue(rb), ivalue(rc), &ir)) { \
+          setivalue(ra, ir); \
+        } \
+        else if (ttisnumber(rb) && ttisnumber(rc)) { \
+          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        } \
+        else \
+          Protect(Arith(L, ra, rb, rc, tm)); \
+      }
+
+
 #define arith_op(op,tm) { \
         TValue *rb = RKB(i); \
         TValue *rc = RKC(i); \
@@ -373,153 +681,512 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
       }
 
 
+/* `arith_opi' for a register and a constant that is a number */
+#define arith_opk(iop,op,tm) { \
+        TValue *rb = RB(i); \
+        TValue *rc = KC(i); \
+        lua_Integer ir; \
+        if (ttisint(rb) && ttisint(rc) && \
+            iop(ivalue(rb), ivalue(rc), &ir)) { \
+          setivalue(ra, ir); \
+        } \
+        else if (ttisnumber(rb)) { \
+          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        } \
+        else \
+          Protect(Arith(L, ra, rb, rc, tm)); \
+      }
+
+
+/* OP_GETGFIELD: the global goes through R(A), to be named in errors */
+#define getgfield() { \
+        TValue g; \
+        sethvalue(L, &g, cl->env); \
+        Protect(luaV_gettable(L, &g, RKB(i), ra)); \
+        ra = RA(i);  /* previous call may change the stack */ \
+        Protect(gettablestr(L, ra, RKC(i), ra, ICACHE(pc))); \
+      }
+
+
+
+#if defined(LUA_USE_JIT)
+
+/*
+** Runs the instruction at `pc' for the native code of a function (see
+** `ljit.c') and returns the address of the next instruction to run. Only
+** the opcodes that native code does not do in line come here; calls and
+** returns go back to `luaV_execute' instead.
+*/
+const Instruction *luaV_jitop (lua_State *L, const Instruction *pc) {
+  LClosure *cl = &clvalue(L->ci->func)->l;
+  StkId base = L->base;
+  TValue *k = cl->p->k;
+  Instruction i = *pc++;
+  StkId ra = RA(i);
+  switch (GET_OPCODE(i)) {
+    case OP_GETGLOBAL: {
+      TValue g;
+      TValue *rb = KBx(i);
+      sethvalue(L, &g, cl->env);
+      lua_assert(ttisstring(rb));
+      if (ttisshrstring(rb)) {
+        Protect(gettablestr(L, &g, rb, ra, ICACHE(pc)));
+      }
+      else {
+        Protect(luaV_gettable(L, &g, rb, ra));
+      }
+      break;
+    }
+    case OP_GETTABLE: {
+      if (isKstr(GETARG_C(i))) {
+        Protect(gettablestr(L, RB(i), RKC(i), ra, ICACHE(pc)));
+      }
+      else {
+        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
+      }
+      break;
+    }
+    case OP_SETGLOBAL: {
+      TValue g;
+      sethvalue(L, &g, cl->env);
+      lua_assert(ttisstring(KBx(i)));
+      Protect(luaV_settable(L, &g, KBx(i), ra));
+      break;
+    }
+    case OP_SETUPVAL: {
+      UpVal *uv = cl->upvals[GETARG_B(i)];
+      setobj(L, uv->v, ra);
+      luaC_barrier(L, uv, ra);
+      break;
+    }
+    case OP_SETTABLE: {
+      Protect(luaV_settable(L, ra, RKB(i), RKC(i)));
+      break;
+    }
+    case OP_NEWTABLE: {
+      int b = GETARG_B(i);
+      int c = GETARG_C(i);
+      savepc(L);
+      sethvalue(L, ra, luaH_new(L, luaO_fb2int(b), luaO_fb2int(c)));
+      Protect(luaC_checkGC(L));
+      break;
+    }
+    case OP_SELF: {
+      StkId rb = RB(i);
+      setobjs2s(L, ra+1, rb);
+      if (isKstr(GETARG_C(i))) {
+        Protect(gettablestr(L, rb, RKC(i), ra, ICACHE(pc)));
+      }
+      else {
+        Protect(luaV_gettable(L, rb, RKC(i), ra));
+      }
+      break;
+    }
+    case OP_ADD: arith_opi(iadd, luai_numadd, TM_ADD); break;
+    case OP_SUB: arith_opi(isub, luai_numsub, TM_SUB); break;
+    case OP_MUL: arith_opi(imul, luai_nummul, TM_MUL); break;
+    case OP_DIV: arith_op(luai_numdiv, TM_DIV); break;
+    case OP_MOD: arith_opi(imod, luai_nummod, TM_MOD); break;
+    case OP_POW: arith_op(luai_numpow, TM_POW); break;
+    case OP_UNM: {
+      TValue *rb = RB(i);
+      if (ttisint(rb) && ivalue(rb) != 0 && ivalue(rb) != MIN_INTEGER) {
+        setivalue(ra, -ivalue(rb));
+      }
+      else if (ttisnumber(rb)) {
+        lua_Number nb = nvalue(rb);
+        setnvalue(ra, luai_numunm(nb));
+      }
+      else {
+        Protect(Arith(L, ra, rb, rb, TM_UNM));
+      }
+      break;
+    }
+    case OP_LEN: {
+      const TValue *rb = RB(i);
+      switch (ttype(rb)) {
+        case LUA_TTABLE: {
+          setivalue(ra, luaH_getn(hvalue(rb)));
+          break;
+        }
+        case LUA_TSTRING: {
+          setivalue(ra, cast(lua_Integer, luaS_len(rb)));
+          break;
+        }
+        default: {  /* try metamethod */
+          Protect(
+            if (!call_binTM(L, rb, luaO_nilobject, ra, TM_LEN))
+              luaG_typeerror(L, rb, "get length of");
+          )
+        }
+      }
+      break;
+    }
+    case OP_CONCAT: {
+      int b = GETARG_B(i);
+      int c = GETARG_C(i);
+      Protect(luaV_concat(L, c-b+1, c, 1); luaC_checkGC(L));
+      setobjs2s(L, RA(i), base+b);
+      break;
+    }
+    case OP_EQ: {
+      TValue *rb = RKB(i);
+      TValue *rc = RKC(i);
+      Protect(
+        if (equalobj(L, rb, rc) == GETARG_A(i))
+          dojump(L, pc, GETARG_sBx(*pc));
+      )
+      pc++;
+      break;
+    }
+    case OP_LT: {
+      Protect(
+        if (luaV_lessthan(L, RKB(i), RKC(i)) == GETARG_A(i))
+          dojump(L, pc, GETARG_sBx(*pc));
+      )
+      pc++;
+      break;
+    }
+    case OP_LE: {
+      Protect(
+        if (lessequal(L, RKB(i), RKC(i)) == GETARG_A(i))
+          dojump(L, pc, GETARG_sBx(*pc));
+      )
+      pc++;
+      break;
+    }
+    case OP_JMPEQ: {
+      Protect(
+        if (equalobj(L, ra, RKB(i)))
+          dojump(L, pc, GETARG_sC(i));
+      )
+      break;
+    }
+    case OP_JMPNE: {
+      Protect(
+        if (!equalobj(L, ra, RKB(i)))
+          dojump(L, pc, GETARG_sC(i));
+      )
+      break;
+    }
+    case OP_GETGFIELD: getgfield(); break;
+    case OP_ADDK: arith_opk(iadd, luai_numadd, TM_ADD); break;
+    case OP_FORLOOP: {  /* native code does the integer loops */
+      lua_Number step = fltvalue(ra+2);
+      lua_Number idx = luai_numadd(fltvalue(ra), step);
+      lua_Number limit = fltvalue(ra+1);
+      if (luai_numlt(0, step) ? luai_numle(idx, limit)
+                              : luai_numle(limit, idx)) {
+        dojump(L, pc, GETARG_sBx(i));  /* jump back */
+        setnvalue(ra, idx);  /* update internal index... */
+        setnvalue(ra+3, idx);  /* ...and external index */
+      }
+      break;
+    }
+    case OP_FORPREP: {
+      const TValue *init = ra;
+      const TValue *plimit = ra+1;
+      const TValue *pstep = ra+2;
+      L->savedpc = pc;  /* next steps may throw errors */
+      if (!tonumber(L, init, ra))
+        luaG_runerror(L, LUA_QL("for") " initial value must be a number");
+      else if (!tonumber(L, plimit, ra+1))
+        luaG_runerror(L, LUA_QL("for") " limit must be a number");
+      else if (!tonumber(L, pstep, ra+2))
+        luaG_runerror(L, LUA_QL("for") " step must be a number");
+      if (!forprep(ra)) {  /* not an integer loop? */
+        setnvalue(ra+1, nvalue(plimit));
+        setnvalue(ra+2, nvalue(pstep));
+        setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
+      }
+      dojump(L, pc, GETARG_sBx(i));
+      break;
+    }
+    case OP_TFORLOOP: {
+      StkId cb = ra + 3;  /* call base */
+      setobjs2s(L, cb+2, ra+2);
+      setobjs2s(L, cb+1, ra+1);
+      setobjs2s(L, cb, ra);
+      L->top = cb+3;  /* func. + 2 args (state and index) */
+      Protect(luaD_call(L, cb, GETARG_C(i)));
+      L->top = L->ci->top;
+      cb = RA(i) + 3;  /* previous call may change the stack */
+      if (!ttisnil(cb)) {  /* continue loop? */
+        setobjs2s(L, cb-1, cb);  /* save control variable */
+        dojump(L, pc, GETARG_sBx(*pc));  /* jump back */
+      }
+      pc++;
+      break;
+    }
+    case OP_SETLIST: {
+      int n = GETARG_B(i);
+      int c = GETARG_C(i);
+      int last;
+      Table *h;
+      if (n == 0) {
+        n = cast_int(L->top - ra) - 1;
+        L->top = L->ci->top;
+      }
+      if (c == 0) c = cast_int(*pc++);
+      if (!ttistable(ra)) break;  /* runtime check */
+      h = hvalue(ra);
+      last = ((c-1)*LFIELDS_PER_FLUSH) + n;
+      savepc(L);
+      if (last > h->sizearray)  /* needs more space? */
+        luaH_resizearray(L, h, last);  /* pre-alloc it at once */
+      for (; n > 0; n--) {
+        TValue *val = ra+n;
+        setobj2t(L, luaH_setnum(L, h, last--), val);
+        luaC_barriert(L, h, val);
+      }
+      break;
+    }
+    case OP_CLOSE: {
+      luaF_close(L, ra);
+      break;
+    }
+    case OP_CLOSURE: {
+      Proto *p;
+      Closure *ncl;
+      int nup, j;
+      p = cl->p->p[GETARG_Bx(i)];
+      nup = p->nups;
+      savepc(L);
+      ncl = luaF_newLclosure(L, nup, cl->env);
+      ncl->l.p = p;
+      for (j=0; j<nup; j++, pc++) {
+        if (GET_OPCODE(*pc) == OP_GETUPVAL)
+          ncl->l.upvals[j] = cl->upvals[GETARG_B(*pc)];
+        else {
+          lua_assert(GET_OPCODE(*pc) == OP_MOVE);
+          ncl->l.upvals[j] = luaF_findupval(L, base + GETARG_B(*pc));
+        }
+      }
+      setclvalue(L, ra, ncl);
+      Protect(luaC_checkGC(L));
+      break;
+    }
+    case OP_VARARG: {
+      int b = GETARG_B(i) - 1;
+      int j;
+      CallInfo *ci = L->ci;
+      int n = cast_int(ci->base - ci->func) - cl->p->numparams - 1;
+      if (b == LUA_MULTRET) {
+        Protect(luaD_checkstack(L, n));
+        ra = RA(i);  /* previous call may change the stack */
+        b = n;
+        L->top = ra + n;
+      }
+      for (j = 0; j < b; j++) {
+        if (j < n) {
+          setobjs2s(L, ra + j, ci->base - n + j);
+        }
+        else {
+          setnilvalue(ra + j);
+        }
+      }
+      break;
+    }
+    default: lua_assert(0);
+  }
+  return pc;
+}
+
+
+#endif
+
+
+#if defined(LUA_USE_JIT) || defined(LUA_USE_LOCK)
+/* in `luaV_execute', a backward jump goes on in `endloop' */
+#undef dojump
+#define dojump(L,pc,i)	{int off = (i); (pc) += off; if (off < 0) loop = 1;}
+#endif
+
+
 
 void luaV_execute (lua_State *L, int nexeccalls) {
   LClosure *cl;
   StkId base;
   TValue *k;
   const Instruction *pc;
+  Instruction i;
+  StkId ra;
+#if defined(LUA_USE_JIT) || defined(LUA_USE_LOCK)
+  int loop = 0;  /* set by backward jumps */
+#endif
+#if defined(LUA_USE_JUMPTABLE)
+#include "ljumptab.h"
+#endif
  reentry:  /* entry point */
   lua_assert(isLua(L->ci));
   pc = L->savedpc;
   cl = &clvalue(L->ci->func)->l;
   base = L->base;
   k = cl->p->k;
+  vmyield();  /* (so that recursion without loops lets other threads run) */
+  jitenter();
   /* main loop of interpreter */
   for (;;) {
-    const Instruction i = *pc++;
-    StkId ra;
-    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
-        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
-      traceexec(L, pc);
-      if (L->status == LUA_YIELD) {  /* did hook yield? */
-        L->savedpc = pc - 1;
-        return;
-      }
-      base = L->base;
-    }
-    /* warning!! several calls may realloc the stack and invalidate `ra' */
-    ra = RA(i);
-    lua_assert(base == L->base && L->base == L->ci->base);
-    lua_assert(base <= L->top && L->top <= L->stack + L->stacksize);
-    lua_assert(L->top == L->ci->top || luaG_checkopenop(i));
-    switch (GET_OPCODE(i)) {
-      case OP_MOVE: {
+    vmfetch();
+    vmdispatch (GET_OPCODE(i)) {
+      vmcase(OP_MOVE) {
         setobjs2s(L, ra, RB(i));
-        continue;
+        vmbreak;
       }
-      case OP_LOADK: {
+      vmcase(OP_LOADK) {
         setobj2s(L, ra, KBx(i));
-        continue;
+        vmbreak;
       }
-      case OP_LOADBOOL: {
+      vmcase(OP_LOADBOOL) {
         setbvalue(ra, GETARG_B(i));
         if (GETARG_C(i)) pc++;  /* skip next instruction (if C) */
-        continue;
+        vmbreak;
       }
-      case OP_LOADNIL: {
+      vmcase(OP_LOADNIL) {
         TValue *rb = RB(i);
         do {
           setnilvalue(rb--);
         } while (rb >= ra);
-        continue;
+        vmbreak;
       }
-      case OP_GETUPVAL: {
+      vmcase(OP_GETUPVAL) {
         int b = GETARG_B(i);
         setobj2s(L, ra, cl->upvals[b]->v);
-        continue;
+        vmbreak;
       }
-      case OP_GETGLOBAL: {
+      vmcase(OP_GETGLOBAL) {
         TValue g;
         TValue *rb = KBx(i);
         sethvalue(L, &g, cl->env);
         lua_assert(ttisstring(rb));
-        Protect(luaV_gettable(L, &g, rb, ra));
-        continue;
+        if (ttisshrstring(rb)) {
+          Protect(gettablestr(L, &g, rb, ra, ICACHE(pc)));
+        }
+        else {
+          Protect(luaV_gettable(L, &g, rb, ra));
+        }
+        vmbreak;
       }
-      case OP_GETTABLE: {
-        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
-        continue;
+      vmcase(OP_GETTABLE) {
+        TValue *rb = RB(i);
+        TValue *rc = RKC(i);
+        if (ttistable(rb) && ttisint(rc)) {  /* try array part directly */
+          Table *h = hvalue(rb);
+          lu_integer n = cast(lu_integer, ivalue(rc)) - 1;
+          if (n < cast(lu_integer, h->sizearray) && !ttisnil(&h->array[n])) {
+            setobj2s(L, ra, &h->array[n]);
+            vmbreak;
+          }
+        }
+        if (isKstr(GETARG_C(i))) {
+          Protect(gettablestr(L, rb, rc, ra, ICACHE(pc)));
+        }
+        else {
+          Protect(luaV_gettable(L, rb, rc, ra));
+        }
+        vmbreak;
       }
-      case OP_SETGLOBAL: {
+      vmcase(OP_SETGLOBAL) {
         TValue g;
         sethvalue(L, &g, cl->env);
         lua_assert(ttisstring(KBx(i)));
         Protect(luaV_settable(L, &g, KBx(i), ra));
-        continue;
+        vmbreak;
       }
-      case OP_SETUPVAL: {
+      vmcase(OP_SETUPVAL) {
         UpVal *uv = cl->upvals[GETARG_B(i)];
         setobj(L, uv->v, ra);
         luaC_barrier(L, uv, ra);
-        continue;
+        vmbreak;
       }
-      case OP_SETTABLE: {
-        Protect(luaV_settable(L, ra, RKB(i), RKC(i)));
-        continue;
+      vmcase(OP_SETTABLE) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttistable(ra) && ttisint(rb)) {  /* try array part directly */
+          Table *h = hvalue(ra);
+          lu_integer n = cast(lu_integer, ivalue(rb)) - 1;
+          if (n < cast(lu_integer, h->sizearray) && !ttisnil(&h->array[n]) &&
+              !isfrozen(obj2gco(h))) {
+            setobj2t(L, &h->array[n], rc);
+            luaC_barriert(L, h, rc);
+            vmbreak;
+          }
+        }
+        Protect(luaV_settable(L, ra, rb, rc));
+        vmbreak;
       }
-      case OP_NEWTABLE: {
+      vmcase(OP_NEWTABLE) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
+        savepc(L);
         sethvalue(L, ra, luaH_new(L, luaO_fb2int(b), luaO_fb2int(c)));
         Protect(luaC_checkGC(L));
-        continue;
+        vmbreak;
       }
-      case OP_SELF: {
+      vmcase(OP_SELF) {
         StkId rb = RB(i);
         setobjs2s(L, ra+1, rb);
-        Protect(luaV_gettable(L, rb, RKC(i), ra));
-        continue;
+        if (isKstr(GETARG_C(i))) {
+          Protect(gettablestr(L, rb, RKC(i), ra, ICACHE(pc)));
+        }
+        else {
+          Protect(luaV_gettable(L, rb, RKC(i), ra));
+        }
+        vmbreak;
       }
-      case OP_ADD: {
-        arith_op(luai_numadd, TM_ADD);
-        continue;
+      vmcase(OP_ADD) {
+        arith_opi(iadd, luai_numadd, TM_ADD);
+        vmbreak;
       }
-      case OP_SUB: {
-        arith_op(luai_numsub, TM_SUB);
-        continue;
+      vmcase(OP_SUB) {
+        arith_opi(isub, luai_numsub, TM_SUB);
+        vmbreak;
       }
-      case OP_MUL: {
-        arith_op(luai_nummul, TM_MUL);
-        continue;
+      vmcase(OP_MUL) {
+        arith_opi(imul, luai_nummul, TM_MUL);
+        vmbreak;
       }
-      case OP_DIV: {
+      vmcase(OP_DIV) {
         arith_op(luai_numdiv, TM_DIV);
-        continue;
+        vmbreak;
       }
-      case OP_MOD: {
-        arith_op(luai_nummod, TM_MOD);
-        continue;
+      vmcase(OP_MOD) {
+        arith_opi(imod, luai_nummod, TM_MOD);
+        vmbreak;
       }
-      case OP_POW: {
+      vmcase(OP_POW) {
         arith_op(luai_numpow, TM_POW);
-        continue;
+        vmbreak;
       }
-      case OP_UNM: {
+      vmcase(OP_UNM) {
         TValue *rb = RB(i);
-        if (ttisnumber(rb)) {
+        if (ttisint(rb) && ivalue(rb) != 0 && ivalue(rb) != MIN_INTEGER) {
+          setivalue(ra, -ivalue(rb));
+        }
+        else if (ttisnumber(rb)) {
           lua_Number nb = nvalue(rb);
           setnvalue(ra, luai_numunm(nb));
         }
         else {
           Protect(Arith(L, ra, rb, rb, TM_UNM));
         }
-        continue;
+        vmbreak;
       }
-      case OP_NOT: {
+      vmcase(OP_NOT) {
         int res = l_isfalse(RB(i));  /* next assignment may change this value */
         setbvalue(ra, res);
-        continue;
+        vmbreak;
       }
-      case OP_LEN: {
+      vmcase(OP_LEN) {
         const TValue *rb = RB(i);
         switch (ttype(rb)) {
           case LUA_TTABLE: {
-            setnvalue(ra, cast_num(luaH_getn(hvalue(rb))));
+            setivalue(ra, luaH_getn(hvalue(rb)));
             break;
           }
           case LUA_TSTRING: {
-            setnvalue(ra, cast_num(tsvalue(rb)->len));
+            setivalue(ra, cast(lua_Integer, luaS_len(rb)));
             break;
           }
           default: {  /* try metamethod */
@@ -529,20 +1196,21 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             )
           }
         }
-        continue;
+        vmbreak;
       }
-      case OP_CONCAT: {
+      vmcase(OP_CONCAT) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
-        Protect(luaV_concat(L, c-b+1, c); luaC_checkGC(L));
+        Protect(luaV_concat(L, c-b+1, c, 1); luaC_checkGC(L));
         setobjs2s(L, RA(i), base+b);
-        continue;
+        vmbreak;
       }
-      case OP_JMP: {
+      vmcase(OP_JMP) {
         dojump(L, pc, GETARG_sBx(i));
-        continue;
+        endloop();
+        vmbreak;
       }
-      case OP_EQ: {
+      vmcase(OP_EQ) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         Protect(
@@ -550,44 +1218,73 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
-        continue;
+        endloop();
+        vmbreak;
       }
-      case OP_LT: {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) == GETARG_A(i))
+      vmcase(OP_LT) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisint(rb) && ttisint(rc)) {
+          if ((ivalue(rb) < ivalue(rc)) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
+          if (luaV_lessthan(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
-        continue;
+        endloop();
+        vmbreak;
       }
-      case OP_LE: {
-        Protect(
-          if (lessequal(L, RKB(i), RKC(i)) == GETARG_A(i))
+      vmcase(OP_LE) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisint(rb) && ttisint(rc)) {
+          if ((ivalue(rb) <= ivalue(rc)) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
+          if (lessequal(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
-        continue;
+        endloop();
+        vmbreak;
       }
-      case OP_TEST: {
+      vmcase(OP_TEST) {
         if (l_isfalse(ra) != GETARG_C(i))
           dojump(L, pc, GETARG_sBx(*pc));
         pc++;
-        continue;
+        endloop();
+        vmbreak;
       }
-      case OP_TESTSET: {
+      vmcase(OP_TESTSET) {
         TValue *rb = RB(i);
         if (l_isfalse(rb) != GETARG_C(i)) {
           setobjs2s(L, ra, rb);
           dojump(L, pc, GETARG_sBx(*pc));
         }
         pc++;
-        continue;
+        endloop();
+        vmbreak;
       }
-      case OP_CALL: {
+      vmcase(OP_CALL) {
         int b = GETARG_B(i);
         int nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         L->savedpc = pc;
+        if (fastcall(L, ra)) {  /* Lua function with fixed parameters? */
+          Proto *p = clvalue(ra)->l.p;
+          CallInfo *ci;
+          L->ci->savedpc = pc;
+          ci = ++L->ci;  /* `enter' new function */
+          ci->func = ra;
+          ci->tailcalls = 0;
+          ci->nresults = nresults;
+          enterframe(L, ci, p, ra+1);
+          nexeccalls++;
+          goto reentry;
+        }
         switch (luaD_precall(L, ra, nresults)) {
           case PCRLUA: {
             nexeccalls++;
@@ -597,18 +1294,33 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             /* it was a C function (`precall' called it); adjust results */
             if (nresults >= 0) L->top = L->ci->top;
             base = L->base;
-            continue;
+            jitenter();
+            vmbreak;
           }
           default: {
             return;  /* yield */
           }
         }
       }
-      case OP_TAILCALL: {
+      vmcase(OP_TAILCALL) {
         int b = GETARG_B(i);
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         L->savedpc = pc;
         lua_assert(GETARG_C(i) - 1 == LUA_MULTRET);
+        if (fastcall(L, ra)) {  /* put new frame in place of this one */
+          Proto *p = clvalue(ra)->l.p;
+          CallInfo *ci = L->ci;
+          StkId func = ci->func;
+          int aux;
+          if (L->openupval) luaF_close(L, base);
+          for (aux = 0; ra+aux < L->top; aux++)  /* move function down */
+            setobjs2s(L, func+aux, ra+aux);
+          L->top = func+aux;
+          enterframe(L, ci, p, func+1);
+          ci->savedpc = L->savedpc;
+          ci->tailcalls++;  /* one more call lost */
+          goto reentry;
+        }
         switch (luaD_precall(L, ra, LUA_MULTRET)) {
           case PCRLUA: {
             /* tail call: put new frame in place of previous one */
@@ -629,19 +1341,34 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           }
           case PCRC: {  /* it was a C function (`precall' called it) */
             base = L->base;
-            continue;
+            jitenter();
+            vmbreak;
           }
           default: {
             return;  /* yield */
           }
         }
       }
-      case OP_RETURN: {
+      vmcase(OP_RETURN) {
         int b = GETARG_B(i);
         if (b != 0) L->top = ra+b-1;
         if (L->openupval) luaF_close(L, base);
         L->savedpc = pc;
-        b = luaD_poscall(L, ra);
+        if (L->hookmask & LUA_MASKRET)
+          b = luaD_poscall(L, ra);
+        else {  /* `luaD_poscall' without the hook */
+          CallInfo *ci = L->ci--;
+          StkId res = ci->func;  /* final position of 1st result */
+          int n;
+          L->base = (ci - 1)->base;
+          L->savedpc = (ci - 1)->savedpc;
+          for (n = ci->nresults; n != 0 && ra < L->top; n--)
+            setobjs2s(L, res++, ra++);
+          while (n-- > 0)
+            setnilvalue(res++);
+          L->top = res;
+          b = (ci->nresults != LUA_MULTRET);
+        }
         if (--nexeccalls == 0)  /* was previous function running `here'? */
           return;  /* no: return */
         else {  /* yes: continue its execution */
@@ -651,34 +1378,52 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           goto reentry;
         }
       }
-      case OP_FORLOOP: {
-        lua_Number step = nvalue(ra+2);
-        lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
-        lua_Number limit = nvalue(ra+1);
-        if (luai_numlt(0, step) ? luai_numle(idx, limit)
-                                : luai_numle(limit, idx)) {
-          dojump(L, pc, GETARG_sBx(i));  /* jump back */
-          setnvalue(ra, idx);  /* update internal index... */
-          setnvalue(ra+3, idx);  /* ...and external index */
+      vmcase(OP_FORLOOP) {
+        if (ttisint(ra)) {  /* integer loop? (see `forprep') */
+          lu_integer count = cast(lu_integer, ivalue(ra+1));
+          if (count > 0) {
+            lua_Integer idx = cast(lua_Integer, cast(lu_integer, ivalue(ra)) +
+                                                cast(lu_integer, ivalue(ra+2)));
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setivalue(ra+1, cast(lua_Integer, count - 1));
+            setivalue(ra, idx);  /* update internal index... */
+            setivalue(ra+3, idx);  /* ...and external index */
+          }
         }
-        continue;
+        else {
+          lua_Number step = fltvalue(ra+2);
+          lua_Number idx = luai_numadd(fltvalue(ra), step); /* increment index */
+          lua_Number limit = fltvalue(ra+1);
+          if (luai_numlt(0, step) ? luai_numle(idx, limit)
+                                  : luai_numle(limit, idx)) {
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setnvalue(ra, idx);  /* update internal index... */
+            setnvalue(ra+3, idx);  /* ...and external index */
+          }
+        }
+        endloop();
+        vmbreak;
       }
-      case OP_FORPREP: {
+      vmcase(OP_FORPREP) {
         const TValue *init = ra;
         const TValue *plimit = ra+1;
         const TValue *pstep = ra+2;
         L->savedpc = pc;  /* next steps may throw errors */
-        if (!tonumber(init, ra))
+        if (!tonumber(L, init, ra))
           luaG_runerror(L, LUA_QL("for") " initial value must be a number");
-        else if (!tonumber(plimit, ra+1))
+        else if (!tonumber(L, plimit, ra+1))
           luaG_runerror(L, LUA_QL("for") " limit must be a number");
-        else if (!tonumber(pstep, ra+2))
+        else if (!tonumber(L, pstep, ra+2))
           luaG_runerror(L, LUA_QL("for") " step must be a number");
-        setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
+        if (!forprep(ra)) {  /* not an integer loop? */
+          setnvalue(ra+1, nvalue(plimit));
+          setnvalue(ra+2, nvalue(pstep));
+          setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
+        }
         dojump(L, pc, GETARG_sBx(i));
-        continue;
+        vmbreak;
       }
-      case OP_TFORLOOP: {
+      vmcase(OP_TFORLOOP) {
         StkId cb = ra + 3;  /* call base */
         setobjs2s(L, cb+2, ra+2);
         setobjs2s(L, cb+1, ra+1);
@@ -692,9 +1437,10 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           dojump(L, pc, GETARG_sBx(*pc));  /* jump back */
         }
         pc++;
-        continue;
+        endloop();
+        vmbreak;
       }
-      case OP_SETLIST: {
+      vmcase(OP_SETLIST) {
         int n = GETARG_B(i);
         int c = GETARG_C(i);
         int last;
@@ -707,6 +1453,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         runtime_check(L, ttistable(ra));
         h = hvalue(ra);
         last = ((c-1)*LFIELDS_PER_FLUSH) + n;
+        savepc(L);
         if (last > h->sizearray)  /* needs more space? */
           luaH_resizearray(L, h, last);  /* pre-alloc it at once */
         for (; n > 0; n--) {
@@ -714,18 +1461,19 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           setobj2t(L, luaH_setnum(L, h, last--), val);
           luaC_barriert(L, h, val);
         }
-        continue;
+        vmbreak;
       }
-      case OP_CLOSE: {
+      vmcase(OP_CLOSE) {
         luaF_close(L, ra);
-        continue;
+        vmbreak;
       }
-      case OP_CLOSURE: {
+      vmcase(OP_CLOSURE) {
         Proto *p;
         Closure *ncl;
         int nup, j;
         p = cl->p->p[GETARG_Bx(i)];
         nup = p->nups;
+        savepc(L);
         ncl = luaF_newLclosure(L, nup, cl->env);
         ncl->l.p = p;
         for (j=0; j<nup; j++, pc++) {
@@ -738,9 +1486,9 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         }
         setclvalue(L, ra, ncl);
         Protect(luaC_checkGC(L));
-        continue;
+        vmbreak;
       }
-      case OP_VARARG: {
+      vmcase(OP_VARARG) {
         int b = GETARG_B(i) - 1;
         int j;
         CallInfo *ci = L->ci;
@@ -759,7 +1507,43 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             setnilvalue(ra + j);
           }
         }
-        continue;
+        vmbreak;
+      }
+      vmcase(OP_JMPIF) {
+        if (!l_isfalse(ra))
+          dojump(L, pc, GETARG_sBx(i));
+        endloop();
+        vmbreak;
+      }
+      vmcase(OP_JMPNOT) {
+        if (l_isfalse(ra))
+          dojump(L, pc, GETARG_sBx(i));
+        endloop();
+        vmbreak;
+      }
+      vmcase(OP_JMPEQ) {
+        Protect(
+          if (equalobj(L, ra, RKB(i)))
+            dojump(L, pc, GETARG_sC(i));
+        )
+        endloop();
+        vmbreak;
+      }
+      vmcase(OP_JMPNE) {
+        Protect(
+          if (!equalobj(L, ra, RKB(i)))
+            dojump(L, pc, GETARG_sC(i));
+        )
+        endloop();
+        vmbreak;
+      }
+      vmcase(OP_GETGFIELD) {
+        getgfield();
+        vmbreak;
+      }
+      vmcase(OP_ADDK) {
+        arith_opk(iadd, luai_numadd, TM_ADD);
+        vmbreak;
       }
     }
   }
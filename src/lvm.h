@@ -10,13 +10,18 @@
 
 #include "ldo.h"
 #include "lobject.h"
+#include "lstring.h"
 #include "ltm.h"
 
 
-#define tostring(L,o) ((ttype(o) == LUA_TSTRING) || (luaV_tostring(L, o)))
+#define tostring(L,o) (ttisstring(o) || (luaV_tostring(L, o)))
 
-#define tonumber(o,n)	(ttype(o) == LUA_TNUMBER || \
-                         (((o) = luaV_tonumber(o,n)) != NULL))
+#define tonumber(L,o,n)	(ttype(o) == LUA_TNUMBER || \
+                         (((o) = luaV_tonumber(L,o,n)) != NULL))
+
+/* ropes must be flattened before being used as keys */
+#define flatkey(L,k) \
+	{ if (ttisrope(k)) setsvalue(L, k, luaS_flatten(L, rpvalue(k))); }
 
 #define equalobj(L,o1,o2) \
 	(ttype(o1) == ttype(o2) && luaV_equalval(L, o1, o2))
@@ -24,13 +29,18 @@
 
 LUAI_FUNC int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r);
 LUAI_FUNC int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2);
-LUAI_FUNC const TValue *luaV_tonumber (const TValue *obj, TValue *n);
+LUAI_FUNC const TValue *luaV_tonumber (lua_State *L, const TValue *obj,
+                                       TValue *n);
 LUAI_FUNC int luaV_tostring (lua_State *L, StkId obj);
 LUAI_FUNC void luaV_gettable (lua_State *L, const TValue *t, TValue *key,
                                             StkId val);
 LUAI_FUNC void luaV_settable (lua_State *L, const TValue *t, TValue *key,
                                             StkId val);
 LUAI_FUNC void luaV_execute (lua_State *L, int nexeccalls);
-LUAI_FUNC void luaV_concat (lua_State *L, int total, int last);
+LUAI_FUNC void luaV_concat (lua_State *L, int total, int last, int rope);
+#if defined(LUA_USE_JIT)
+LUAI_FUNC const Instruction *luaV_jitop (lua_State *L,
+                                         const Instruction *pc);
+#endif
 
 #endif
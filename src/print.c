@@ -93,7 +93,8 @@ static void PrintCode(const Proto* f)
    case iABC:
     printf("%d",a);
     if (getBMode(o)!=OpArgN) printf(" %d",ISK(b) ? (-1-INDEXK(b)) : b);
-    if (getCMode(o)!=OpArgN) printf(" %d",ISK(c) ? (-1-INDEXK(c)) : c);
+    if (o==OP_JMPEQ || o==OP_JMPNE) printf(" %d",GETARG_sC(i));
+    else if (getCMode(o)!=OpArgN) printf(" %d",ISK(c) ? (-1-INDEXK(c)) : c);
     break;
    case iABx:
     if (getBMode(o)==OpArgK) printf("%d %d",a,-1-bx); else printf("%d %d",a,bx);
@@ -119,8 +120,12 @@ static void PrintCode(const Proto* f)
    case OP_SELF:
     if (ISK(c)) { printf("\t; "); PrintConstant(f,INDEXK(c)); }
     break;
+   case OP_GETGFIELD:
+    printf("\t; %s ",svalue(&f->k[INDEXK(b)])); PrintConstant(f,INDEXK(c));
+    break;
    case OP_SETTABLE:
    case OP_ADD:
+   case OP_ADDK:
    case OP_SUB:
    case OP_MUL:
    case OP_DIV:
@@ -137,10 +142,17 @@ static void PrintCode(const Proto* f)
     }
     break;
    case OP_JMP:
+   case OP_JMPIF:
+   case OP_JMPNOT:
    case OP_FORLOOP:
    case OP_FORPREP:
     printf("\t; to %d",sbx+pc+2);
     break;
+   case OP_JMPEQ:
+   case OP_JMPNE:
+    printf("\t; "); PrintConstant(f,INDEXK(b));
+    printf(" to %d",GETARG_sC(i)+pc+2);
+    break;
    case OP_CLOSURE:
     printf("\t; %p",VOID(f->p[bx]));
     break;
@@ -158,6 +170,32 @@ static void PrintCode(const Proto* f)
 #define SS(x)	(x==1)?"":"s"
 #define S(x)	x,SS(x)
 
+/* instructions saved by the optimizer: each pair became one */
+static int Saved(const Proto* f)
+{
+ int pc,n=0;
+ for (pc=0; pc<f->sizecode; pc++)
+ {
+  Instruction i=f->code[pc];
+  switch (GET_OPCODE(i))
+  {
+   case OP_JMPIF:
+   case OP_JMPNOT:
+   case OP_JMPEQ:
+   case OP_JMPNE:
+   case OP_GETGFIELD:
+    n++;
+    break;
+   case OP_SETLIST:
+    if (GETARG_C(i)==0) pc++;
+    break;
+   default:
+    break;
+  }
+ }
+ return n;
+}
+
 static void PrintHeader(const Proto* f)
 {
  const char* s=getstr(f->source);
@@ -167,10 +205,10 @@ static void PrintHeader(const Proto* f)
   s="(bstring)";
  else
   s="(string)";
- printf("\n%s <%s:%d,%d> (%d instruction%s, %d bytes at %p)\n",
+ printf("\n%s <%s:%d,%d> (%d instruction%s, %d saved, %d bytes at %p)\n",
  	(f->linedefined==0)?"main":"function",s,
 	f->linedefined,f->lastlinedefined,
-	S(f->sizecode),f->sizecode*Sizeof(Instruction),VOID(f));
+	S(f->sizecode),Saved(f),f->sizecode*Sizeof(Instruction),VOID(f));
  printf("%d%s param%s, %d slot%s, %d upvalue%s, ",
 	f->numparams,f->is_vararg?"+":"",SS(f->numparams),
 	S(f->maxstacksize),S(f->nups));
@@ -0,0 +1,29 @@
+-- time other test programs, discarding their output
+-- typical usage: lua bench.lua 100 fibfor.lua sieve.lua
+
+local rounds=1
+local progs={}
+for i=1,table.getn(arg) do
+  if tonumber(arg[i]) then rounds=tonumber(arg[i]) else progs[#progs+1]=arg[i] end
+end
+
+local function quiet() end
+local print,write=print,io.write
+
+for _,name in ipairs(progs) do
+  local f=assert(loadfile(name))
+  collectgarbage()
+  _G.print,io.write=quiet,quiet
+  local c=os.clock()
+  local ok,err=pcall(function ()
+    for r=1,rounds do
+      -- each run gets fresh globals and an empty command line
+      setfenv(f,setmetatable({arg={[0]=name}},{__index=_G}))
+      f()
+    end
+  end)
+  local t=os.clock()-c
+  _G.print,io.write=print,write
+  if not ok then error(name..": "..tostring(err),0) end
+  print(string.format("%-12s %4d rounds %9.3f s",name,rounds,t))
+end
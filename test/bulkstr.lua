@@ -0,0 +1,49 @@
+-- time creating, reading and keying big strings
+-- typical usage: lua bulkstr.lua 2000	(number of 64K bodies)
+
+local n=tonumber(arg and arg[1]) or 2000
+local size=65536
+
+local function time(name,f)
+  collectgarbage()
+  local start=os.clock()
+  f()
+  print(string.format("%-14s %.3f s",name,os.clock()-start))
+end
+
+local t={}
+for i=1,size/16 do t[i]=string.format("line %08d\r\n",i) end
+local chunk=table.concat(t)
+
+-- each body is a new string with distinct contents
+time("create",function()
+  for i=1,n do local s=chunk..i end
+end)
+
+time("sub",function()
+  local m=#chunk
+  for i=1,n do local s=chunk:sub(i%size+1,m) end
+end)
+
+local name=os.tmpname()
+local f=assert(io.open(name,"wb"))
+f:write(chunk) f:close()
+time("io.read *a",function()
+  for i=1,n do
+    local f=assert(io.open(name,"rb"))
+    f:seek("set",i%size)
+    local s=f:read("*a")
+    f:close()
+  end
+end)
+os.remove(name)
+
+-- only these pay for hashing (once per string)
+time("as key",function()
+  local t={}
+  for i=1,n/10 do
+    local s=chunk..i
+    t[s]=i
+    assert(t[s]==i)
+  end
+end)
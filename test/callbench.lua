@@ -0,0 +1,33 @@
+-- time the overhead of calls and returns between Lua functions
+-- typical usage: lua callbench.lua 10000000	(calls per test)
+
+local n=tonumber(arg and arg[1]) or 10000000
+
+local function f0() end
+local function f1(a) return a end
+local function f3(a,b,c) return c end
+local function fv(...) return ... end
+local function down(i) if i>0 then return down(i-1) end return i end
+
+local obj={}
+function obj:get() return self end
+
+local function time(name,f)
+  collectgarbage()
+  local start=os.clock()
+  f()
+  print(string.format("%-10s %6.1f ns/call",name,1e9*(os.clock()-start)/n))
+end
+
+-- calls through a table, so that no compiler inlines them
+local t={f0=f0,f1=f1,f3=f3,fv=fv}
+
+time("empty",function() local f=t.f0 for i=1,n do f() end end)
+time("1 arg",function() local f=t.f1 for i=1,n do f(i) end end)
+time("3 args",function() local f=t.f3 for i=1,n do f(i,i,i) end end)
+time("missing",function() local f=t.f3 for i=1,n do f(i) end end)
+time("extra",function() local f=t.f1 for i=1,n do f(i,i,i) end end)
+time("vararg",function() local f=t.fv for i=1,n do f(i) end end)
+time("method",function() for i=1,n do obj:get() end end)
+time("tail call",function() down(n) end)
+time("C function",function() local f=rawlen or type for i=1,n do f(i) end end)
@@ -0,0 +1,34 @@
+-- compare building a string with s=s..x (ropes) and with table.concat
+-- typical usage: lua concat.lua 100000	(pieces per string)
+
+local n=tonumber(arg and arg[1]) or 100000
+local rounds=5
+
+local function time(name,f)
+  collectgarbage()
+  local start=os.clock()
+  local s
+  for r=1,rounds do s=f() end
+  print(string.format("%-14s %.3f s  (%d bytes)",name,os.clock()-start,#s))
+  return s
+end
+
+local a=time("s=s..x",function()
+  local s=""
+  for i=1,n do s=s..i.."," end
+  return s
+end)
+local b=time("table.concat",function()
+  local t={}
+  for i=1,n do t[#t+1]=i.."," end
+  return table.concat(t)
+end)
+local c=time("s=s..x as key",function()	-- flattened every 100 appends
+  local s,t="",{}
+  for i=1,n do
+    s=s..i..","
+    if i%100==0 then t[s]=true t[s]=nil end
+  end
+  return s
+end)
+assert(a==b and b==c)
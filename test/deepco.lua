@@ -0,0 +1,26 @@
+-- time deep recursion in new coroutines and in one that keeps growing
+-- typical usage: lua deepco.lua 300 10000	(rounds, depth)
+
+local n=tonumber(arg and arg[1]) or 300
+local depth=tonumber(arg and arg[2]) or 10000
+
+local function deep(d) if d==0 then return 0 end return 1+deep(d-1) end
+
+local function time(name,round)
+  local worst,start=0,os.clock()
+  for i=1,n do
+    local t=os.clock()
+    round()
+    t=os.clock()-t
+    if t>worst then worst=t end
+  end
+  print(string.format("%-8s %8.1f us/round  worst %8.1f us",
+        name,1e6*(os.clock()-start)/n,1e6*worst))
+end
+
+-- each round grows the stacks of a new coroutine
+time("new",function() coroutine.wrap(deep)(depth) end)
+
+-- the same coroutine grows again after each collection shrinks it
+local co=coroutine.wrap(function() while true do deep(depth) coroutine.yield() end end)
+time("regrow",function() co() collectgarbage() end)
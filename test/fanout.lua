@@ -0,0 +1,25 @@
+-- fan out requests to tasks on a pool of threads, with the scheduler library
+-- typical usage: lua fanout.lua 2000 4	(2000 requests on 4 workers)
+--                lua fanout.lua 2000 1	(same, on one worker)
+
+local n=tonumber(arg and arg[1]) or 2000
+if arg and arg[2] then scheduler.workers(tonumber(arg[2])) end
+
+local function handle(id)
+  local function fib(k) if k<2 then return k end return fib(k-1)+fib(k-2) end
+  for step=1,3 do
+    scheduler.sleep(0.002)		-- waiting for a backend
+    local parts={}
+    for i=1,200 do parts[i]=string.format("%d:%d",id,i*step) end
+    assert(#table.concat(parts,",")>0 and fib(18)==2584)
+    scheduler.yield()
+  end
+end
+
+local start=os.time()
+local clock=os.clock()
+for id=1,n do scheduler.spawn(handle,id) end
+local failed=scheduler.wait()
+local cpu=os.clock()-clock
+print(string.format("%d requests on %d workers: %d failed, %.2f s of CPU",
+      n,scheduler.workers(),failed,cpu))
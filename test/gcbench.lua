@@ -0,0 +1,38 @@
+-- compare the incremental and generational modes of the collector
+-- a large heap of long-lived tables plus a stream of short-lived garbage
+-- typical usage: lua gcbench.lua 20	(20 MB of long-lived data)
+
+local mb=tonumber(arg and arg[1]) or 20
+local requests=200000
+
+local function run(mode)
+  collectgarbage("incremental")
+  collectgarbage()
+  -- long-lived "config and cache" tables
+  local cache={}
+  while collectgarbage("count")<mb*1024 do
+    local n=#cache+1
+    cache[n]={id=n,name="item"..n,tags={"a","b","c"}}
+  end
+  collectgarbage()
+  collectgarbage(mode)
+  local clock=os.clock
+  local maxpause,start=0,clock()
+  for i=1,requests do
+    local c=clock()
+    -- a "request": some temporary tables and strings
+    local req={path="/item/"..i,args={i,i+1,i+2}}
+    local item=cache[i%#cache+1]
+    local reply=table.concat({req.path,item.name,#req.args},":")
+    if i%100==0 then cache[i%#cache+1]={id=i,name=reply,tags={}} end
+    c=clock()-c
+    if c>maxpause then maxpause=c end
+  end
+  local total=clock()-start
+  print(string.format("%-13s %6.3f s total %8.3f ms max pause %8.0f KB",
+        mode,total,maxpause*1000,collectgarbage("count")))
+end
+
+run("incremental")
+run("generational")
+collectgarbage("incremental")
@@ -10,4 +10,8 @@ while 1 do
   if op=="S" then op="*" else op="" end
   io.write(g,"\t",l,op,"\n")
  end
+ local ok,_,l,g=string.find(s,"%[%-?(%d*)%]%s*GETGFIELD.-;%s+(%S+)")
+ if ok then
+  io.write(g,"\t",l,"\n")
+ end
 end
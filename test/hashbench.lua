@@ -0,0 +1,49 @@
+-- time hits and misses in the hash part of tables from 8 to 1M keys
+-- typical usage: lua hashbench.lua 4	(4 million lookups per test)
+
+local lookups=(tonumber(arg and arg[1]) or 4)*1000000
+math.randomseed(42)
+
+local function keys(n,f)
+  local k={}
+  for i=1,n do k[i]=f(i) end
+  return k
+end
+
+-- look keys up in random order, not in the order they were inserted
+local function shuffle(k)
+  for i=#k,2,-1 do
+    local j=math.random(i)
+    k[i],k[j]=k[j],k[i]
+  end
+  return k
+end
+
+local function bench(n,hit,miss)
+  local t={}
+  for i=1,n do t[hit[i]]=i end
+  shuffle(hit)
+  shuffle(miss)
+  local function run(k)
+    local m=#k
+    local start=os.clock()
+    local j=1
+    for i=1,lookups do
+      local v=t[k[j]]
+      j=j+1
+      if j>m then j=1 end
+    end
+    return os.clock()-start
+  end
+  return run(hit),run(miss)
+end
+
+print(string.format("%8s %12s %12s %12s %12s","keys","string hit","string miss",
+      "number hit","number miss"))
+for _,n in ipairs{8,64,512,4096,32768,262144,1048576} do
+  local sh,sm=bench(n,keys(n,function(i) return "k"..i end),
+                     keys(n,function(i) return "x"..i end))
+  local nh,nm=bench(n,keys(n,function(i) return i+0.5 end),
+                     keys(n,function(i) return -i-0.5 end))
+  print(string.format("%8d %12.3f %12.3f %12.3f %12.3f",n,sh,sm,nh,nm))
+end
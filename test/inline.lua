@@ -0,0 +1,33 @@
+-- time calls to a small local function, which the compiler may inline
+-- typical usage: lua inline.lua 10000000	(calls per test)
+
+local n=tonumber(arg and arg[1]) or 10000000
+
+local function clamp(x,lo,hi)
+  if x<lo then return lo end
+  if x>hi then return hi end
+  return x
+end
+
+local lib={clamp=clamp}		-- calls through a table are never inlined
+
+local function time(name,f)
+  local start=os.clock()
+  local s=f()
+  print(string.format("%-8s %6.1f ns/call  (sum %d)",name,1e9*(os.clock()-start)/n,s))
+end
+
+time("local",function()
+  local s=0
+  for i=1,n do s=s+clamp(i%100,10,90) end
+  return s
+end)
+
+time("table",function()
+  local s=0
+  for i=1,n do s=s+lib.clamp(i%100,10,90) end
+  return s
+end)
+
+-- an error in an inlined function still shows its call
+print(select(2,xpcall(function() local x=clamp(nil,1,2) return x end,debug.traceback)))
@@ -0,0 +1,46 @@
+-- run other test programs interpreted and compiled and compare their output
+-- typical usage: lua jittest.lua bisect.lua cf.lua life.lua sieve.lua sort.lua
+
+local ok,hot=pcall(collectgarbage,"jit")
+if not ok or hot<0 then error("this Lua has no compiler",0) end
+
+local print,write=print,io.write
+
+-- run a program with the given threshold and return everything it printed
+local function run(name,jit)
+  local f=assert(loadfile(name))
+  local out={}
+  _G.print=function (...)
+    for i=1,select("#",...) do
+      if i>1 then out[#out+1]="\t" end
+      out[#out+1]=tostring((select(i,...)))
+    end
+    out[#out+1]="\n"
+  end
+  io.write=function (...)
+    for i=1,select("#",...) do out[#out+1]=tostring((select(i,...))) end
+  end
+  collectgarbage("jit",jit)
+  setfenv(f,setmetatable({arg={[0]=name}},{__index=_G}))
+  local ok,err=pcall(f)
+  collectgarbage("jit",hot)
+  _G.print,io.write=print,write
+  if not ok then out[#out+1]="error: "..tostring(err) end
+  return table.concat(out)
+end
+
+local failed=0
+for i=1,table.getn(arg) do
+  local name=arg[i]
+  local a=run(name,0)
+  local result
+  if a~=run(name,0) then
+    result="varies"			-- timings, addresses: cannot compare
+  elseif a==run(name,1) then		-- compile everything on first entry
+    result="ok"
+  else
+    result="DIFFERS" failed=failed+1
+  end
+  print(string.format("%-12s %s",name,result))
+end
+if failed>0 then error(failed.." program(s) differ",0) end
@@ -0,0 +1,37 @@
+-- report memory use per kind of block and the top allocation sites
+-- needs a Lua built with LUA_USE_MEMSTATS
+-- typical usage: lua memprof.lua 4096	(sample every 4096 bytes)
+
+local period=tonumber(arg and arg[1]) or 4096
+if collectgarbage("stats")==nil then
+  print("no memory statistics: build Lua with LUA_USE_MEMSTATS")
+  return
+end
+collectgarbage("profile",period)
+
+-- some work to profile
+local words={}
+for i=1,20000 do
+  words[i]={n=i, s="word"..i}
+end
+local function counter(n) return function() n=n+1 return n end end
+local counters={}
+for i=1,5000 do counters[i]=counter(i) end
+
+local st=collectgarbage("stats")
+collectgarbage("profile",0)
+print(string.format("%-10s %8s %10s %8s %10s","kind","count","bytes",
+      "allocs","total"))
+for _,k in ipairs{"string","table","node","closure","proto","userdata",
+                  "thread","other"} do
+  local s=st[k]
+  print(string.format("%-10s %8d %10d %8d %10d",k,s.count,s.bytes,
+        s.allocs,s.total))
+end
+table.sort(st.samples,function(a,b) return a.bytes>b.bytes end)
+print("\ntop allocation sites (sampled every "..period.." bytes)")
+for i=1,math.min(10,#st.samples) do
+  local s=st.samples[i]
+  print(string.format("%s:%d\t%s\t%d samples\t%d bytes",
+        s.source,s.line,s.kind,s.count,s.bytes))
+end
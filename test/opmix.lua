@@ -0,0 +1,95 @@
+-- time the opcode mix of fib.lua, life.lua and sort.lua in a tight loop
+-- typical usage: lua opmix.lua 5		(best of 5 runs of each kernel)
+
+local runs=tonumber(arg and arg[1]) or 3
+
+-- calls, returns, comparisons and arithmetic, as in fib.lua
+local function fib(n)
+  if n<2 then return n end
+  return fib(n-1)+fib(n-2)
+end
+
+-- table reads and writes with computed indices, as in life.lua
+local function life(w,h,gens)
+  local a,b={},{}
+  for y=1,h do
+    a[y],b[y]={},{}
+    for x=1,w do a[y][x]=0 b[y][x]=0 end
+  end
+  a[2][3],a[3][4],a[4][2],a[4][3],a[4][4]=1,1,1,1,1	-- glider
+  for g=1,gens do
+    for y=1,h do
+      local ym,yp=a[(y+h-2)%h+1],a[y%h+1]
+      local row,out=a[y],b[y]
+      for x=1,w do
+        local xm,xp=(x+w-2)%w+1,x%w+1
+        local n=ym[xm]+ym[x]+ym[xp]+row[xm]+row[xp]+yp[xm]+yp[x]+yp[xp]
+        if n==3 or (n==2 and row[x]==1) then out[x]=1 else out[x]=0 end
+      end
+    end
+    a,b=b,a
+  end
+  return a
+end
+
+-- loops, swaps and closure calls, as in sort.lua
+local function qsort(x,l,u,f)
+  if l<u then
+    local m=math.floor((l+u)/2)
+    x[l],x[m]=x[m],x[l]
+    local t=x[l]
+    m=l
+    local i=l+1
+    while i<=u do
+      if f(x[i],t) then
+        m=m+1
+        x[m],x[i]=x[i],x[m]
+      end
+      i=i+1
+    end
+    x[l],x[m]=x[m],x[l]
+    qsort(x,l,m-1,f)
+    qsort(x,m+1,u,f)
+  end
+end
+
+local function selectionsort(x,n,f)
+  local i=1
+  while i<=n do
+    local m,j=i,i+1
+    while j<=n do
+      if f(x[j],x[m]) then m=j end
+      j=j+1
+    end
+    x[i],x[m]=x[m],x[i]
+    i=i+1
+  end
+end
+
+local function sort(n)
+  local x={}
+  local s=42
+  for i=1,n do s=(s*16807)%2147483647 x[i]=s end
+  for k=1,20 do
+    qsort(x,1,n,function (a,b) return a<b end)
+    qsort(x,1,n,function (a,b) return a>b end)
+  end
+  selectionsort(x,n,function (a,b) return a<b end)
+  return x
+end
+
+local function time(name,f,...)
+  local best
+  for r=1,runs do
+    collectgarbage()
+    local c=os.clock()
+    f(...)
+    c=os.clock()-c
+    if not best or c<best then best=c end
+  end
+  print(string.format("%-8s %8.3f s",name,best))
+  return best
+end
+
+local total=time("fib",fib,30)+time("life",life,64,64,200)+time("sort",sort,2000)
+print(string.format("%-8s %8.3f s","total",total))
@@ -0,0 +1,22 @@
+-- create and discard millions of small tables, to compare allocators
+-- typical usage: lua poolbench.lua 5	(5 million tables)
+--                lua -p poolbench.lua 5	(same, with the pool allocator)
+
+local n=(tonumber(arg and arg[1]) or 5)*1000000
+local keep={}
+local start=os.clock()
+for i=1,n do
+  local t={i,i+1}
+  local u={x=i,y=t}
+  if i%1000==0 then keep[(i/1000)%100+1]=u end
+end
+print(string.format("%d tables in %.2f s, %.0f KB in use",
+      2*n,os.clock()-start,collectgarbage("count")))
+local st=debug.poolstats()
+if st then
+  print(string.format("pool: %d allocs, %d frees, %d reallocs, %d pages",
+        st.allocs,st.frees,st.reallocs,st.pages))
+  print(string.format("small blocks: %d bytes in use, %d slack, %d idle",
+        st.inuse,st.slack,st.idle))
+  print(string.format("large blocks: %d using %d bytes",st.large,st.largebytes))
+end
@@ -0,0 +1,31 @@
+-- check that ropes (long concatenations) keep their characters
+-- when the ropes made from them are appended to and flattened
+
+local p=string.rep("a",70).."b"
+
+-- a rope that gave its buffer to one that was then keyed and appended to
+local r=p.."x"
+local t={} t[r]=1
+local r2=r.."y"
+assert(p==string.rep("a",70).."b" and r==p.."x" and r2==p.."xy")
+assert(#p==71 and #r==72 and #r2==73)
+
+-- a long chain, flattened here and there, with the collector running
+local s=p
+local all={}
+for i=1,200 do
+  s=s..i..","
+  all[i]=s
+  if i%7==0 then t[s]=i end
+  if i%50==0 then collectgarbage() end
+end
+collectgarbage()
+local want=p
+for i=1,200 do
+  want=want..i..","
+  assert(all[i]==want,i)
+  assert(#all[i]==#want,i)
+  if i%7==0 then assert(t[want]==i,i) end
+end
+
+print("OK")
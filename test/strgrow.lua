@@ -0,0 +1,17 @@
+-- worst pause while the string table grows to millions of strings
+-- typical usage: lua strgrow.lua 4	(4 million strings)
+
+local n=(tonumber(arg and arg[1]) or 4)*1000000
+local batch=1000
+local keep=table.new and table.new(n,0) or {}	-- (no rehash of `keep')
+collectgarbage("stop")	-- leave out the pauses of the collector
+local start=os.clock()
+local worst,at=0,0
+for i=1,n,batch do
+  local t=os.clock()
+  for j=i,i+batch-1 do keep[j]="s"..j end
+  t=os.clock()-t
+  if t>worst then worst,at=t,i end
+end
+print(string.format("%d strings in %.2f s, worst %d strings in %.1f ms (at %d)",
+      n,os.clock()-start,batch,1000*worst,at))
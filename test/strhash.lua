@@ -0,0 +1,39 @@
+-- time interning strings and show the chains of the string table
+-- typical usage: lua strhash.lua 200000	(strings per set)
+
+local n=tonumber(arg and arg[1]) or 200000
+
+-- chain statistics (none if this Lua has no collectgarbage"strings")
+local function chains()
+  local ok,st=pcall(collectgarbage,"strings")
+  if not ok then return "" end
+  return string.format("%7d chains, longest %3d, %4.1f%% empty",
+         st.size,st.longest,100*st.empty/st.size)
+end
+
+local function set(name,n,f)
+  local keep={}
+  collectgarbage()
+  local start=os.clock()
+  for i=1,n do keep[i]=f(i) end
+  local t=os.clock()-start
+  print(string.format("%-10s %8.1f ns/string  %s",name,1e9*t/n,chains()))
+end
+
+local pad=string.rep("x",40)
+
+-- short keys, as in most programs
+set("counter",n,function(i) return "key"..i end)
+
+-- same length, differing only in a few characters (headers, paths, ids)
+set("similar",n,function(i)
+  return (string.format("%08d",i)..pad):sub(1,40)
+end)
+
+-- differing only at every other character counted from the end: the
+-- characters that a sampling hash skips for strings of 32 to 63 bytes
+-- (fewer of them, as with such a hash they all go to a single chain)
+set("skipped",n/10,function(i)
+  local s=string.format("%020d",i):gsub(".","%0-")
+  return s:sub(1,40)
+end)
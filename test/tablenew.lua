@@ -0,0 +1,23 @@
+-- compare growing tables with pre-sized and reused ones
+-- typical usage: lua tablenew.lua 100000	(keys per table)
+
+local n=tonumber(arg and arg[1]) or 100000
+local rounds=10
+
+local function fill(t)
+  for i=1,n do t[i]=i end
+  for i=1,n do t["k"..i]=i end
+  return t
+end
+
+local function time(name,f)
+  collectgarbage()
+  local start=os.clock()
+  for r=1,rounds do f() end
+  print(string.format("%-12s %.2f s",name,os.clock()-start))
+end
+
+time("grow",function() fill({}) end)
+time("table.new",function() fill(table.new(n,n)) end)
+local t=table.new(n,n)
+time("table.clear",function() fill(t) table.clear(t) end)